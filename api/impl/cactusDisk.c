@@ -350,6 +350,7 @@ char *cactusDisk_getString(CactusDisk *cactusDisk, Name name, int64_t start, int
     //First try getting it from the cache
     char *string = cactusDisk_getStringFromCache(cactusDisk, name, start, length, strand);
     if (string == NULL) { //If not in the cache, add it to the cache and then get it from the cache.
+        cactusDisk->stringCacheMisses++;
         stList *list = stList_construct3(0, (void (*)(void *)) substring_destruct);
         stList_append(list, substring_construct(name, start, length));
         cacheSubstringsFromDB(cactusDisk, list);
@@ -906,6 +907,10 @@ void cactusDisk_clearStringCache(CactusDisk *cactusDisk) {
     stCache_clear(cactusDisk->stringCache);
 }
 
+int64_t cactusDisk_getStringCacheMissNumber(CactusDisk *cactusDisk) {
+    return cactusDisk->stringCacheMisses;
+}
+
 void cactusDisk_clearCache(CactusDisk *cactusDisk) {
     stCache_clear(cactusDisk->cache);
 }
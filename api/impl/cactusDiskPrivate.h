@@ -20,6 +20,7 @@ struct _cactusDisk {
     EventTree *eventTree;
     Name uniqueNumber;
     Name maxUniqueNumber;
+    int64_t stringCacheMisses;
 };
 
 ////////////////////////////////////////////////
@@ -126,6 +126,10 @@ Name end_getName(End *end) {
     return end->endContents->name;
 }
 
+int64_t end_getIndex(End *end) {
+    return end->endContents->index;
+}
+
 bool end_getOrientation(End *end) {
     return end->orientation;
 }
@@ -377,6 +381,10 @@ void end_setFlower(End *end, Flower *flower) {
     flower_addEnd(flower, end);
 }
 
+void end_setIndex(End *end, int64_t index) {
+    end->endContents->index = index;
+}
+
 /*
  * Serialisation functions.
  */
@@ -14,6 +14,7 @@ typedef struct _endContents {
 	bool isStub;
 	bool isAttached;
 	Name name;
+	int64_t index;
 	Block *attachedBlock;
 	stSortedSet *caps;
 	Group *group;
@@ -92,5 +93,10 @@ int end_hashEqualsKey(const void *o, const void *o2);
  */
 void end_setFlower(End *end, Flower *flower);
 
+/*
+ * Sets the index of the end in its flower, see end_getIndex.
+ */
+void end_setIndex(End *end, int64_t index);
+
 
 #endif
@@ -67,6 +67,7 @@ static Flower *flower_construct3(Name name, CactusDisk *cactusDisk) {
     flower->cactusDisk = cactusDisk;
     flower->faceIndex = 0;
     flower->chainIndex = 0;
+    flower->endIndex = 0;
 
     flower->builtBlocks = 0;
     flower->builtFaces = 0;
@@ -242,6 +243,10 @@ int64_t flower_getEndNumber(Flower *flower) {
     return stSortedSet_size(flower->ends);
 }
 
+int64_t flower_getEndIndexBound(Flower *flower) {
+    return flower->endIndex;
+}
+
 int64_t flower_getBlockEndNumber(Flower *flower) {
     return flower_getBlockNumber(flower) * 2;
 }
@@ -822,6 +827,7 @@ void flower_addEnd(Flower *flower, End *end) {
     end = end_getPositiveOrientation(end);
     assert(stSortedSet_search(flower->ends, end) == NULL);
     stSortedSet_insert(flower->ends, end);
+    end_setIndex(end, flower->endIndex++);
 }
 
 void flower_removeEnd(Flower *flower, End *end) {
@@ -23,6 +23,7 @@ struct _flower {
     CactusDisk *cactusDisk;
     int64_t faceIndex;
     int64_t chainIndex;
+    int64_t endIndex;
     bool builtBlocks;
     bool builtTrees;
     bool builtFaces;
@@ -91,6 +91,12 @@ void cactusDisk_preCacheSegmentStrings(CactusDisk *cactusDisk, stList *flowers);
  */
 void cactusDisk_clearStringCache(CactusDisk *cactusDisk);
 
+/*
+ * The number of strings got by cactusDisk_getString that were not in the string cache, and so
+ * were got from the database.
+ */
+int64_t cactusDisk_getStringCacheMissNumber(CactusDisk *cactusDisk);
+
 /*
  * Clears all cached DB responses (but not cached sequences).
  */
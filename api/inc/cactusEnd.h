@@ -41,6 +41,14 @@ End *end_copyConstruct(End *end, Flower *newFlower);
  */
 Name end_getName(End *end);
 
+/*
+ * Gets the index of the end in its flower, a small non-negative integer assigned when the end is
+ * added to the flower (when it is constructed or loaded) and less than flower_getEndIndexBound.
+ * Indices are not reused, so arrays indexed by them have gaps for removed ends. The index is not
+ * serialised, so is only stable while the flower is in memory.
+ */
+int64_t end_getIndex(End *end);
+
 /*
  * Returns a non zero if the end is oriented positively.
  * The orientation is arbitrary (it is not explicitly with respect to anything else), but is consistent.
@@ -138,6 +138,11 @@ End *flower_getEnd(Flower *flower, Name name);
  */
 int64_t flower_getEndNumber(Flower *flower);
 
+/*
+ * Returns one more than the largest index given to an end of the flower, see end_getIndex.
+ */
+int64_t flower_getEndIndexBound(Flower *flower);
+
 /*
  * Sugar for flower_getBlockNumber(flower)*2
  */
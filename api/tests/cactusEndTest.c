@@ -55,6 +55,26 @@ void testEnd_getName(CuTest* testCase) {
     cactusEndTestTeardown(testCase);
 }
 
+void testEnd_getIndex(CuTest* testCase) {
+    cactusEndTestSetup(testCase);
+    CuAssertIntEquals(testCase, end_getIndex(end), end_getIndex(end_getReverse(end)));
+    CuAssertTrue(testCase, end_getIndex(end) >= 0);
+    CuAssertTrue(testCase, end_getIndex(end) < flower_getEndIndexBound(flower));
+    //The indices of the ends of a flower are distinct.
+    int64_t indexBound = flower_getEndIndexBound(flower);
+    End *end2 = end_construct(0, flower);
+    CuAssertIntEquals(testCase, indexBound, end_getIndex(end2));
+    CuAssertIntEquals(testCase, indexBound + 1, flower_getEndIndexBound(flower));
+    //Ends added to another flower get an index in that flower.
+    Flower *flower2 = flower_construct(cactusDisk);
+    sequence_construct(metaSequence, flower2);
+    CuAssertIntEquals(testCase, 0, flower_getEndIndexBound(flower2));
+    End *end3 = end_copyConstruct(end, flower2);
+    CuAssertIntEquals(testCase, 0, end_getIndex(end3));
+    CuAssertIntEquals(testCase, 1, flower_getEndIndexBound(flower2));
+    cactusEndTestTeardown(testCase);
+}
+
 void testEnd_getOrientation(CuTest* testCase) {
     cactusEndTestSetup(testCase);
     CuAssertTrue(testCase, end_getOrientation(end));
@@ -341,6 +361,7 @@ CuSuite* cactusEndTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, testEnd_copyConstruct);
     SUITE_ADD_TEST(suite, testEnd_getName);
+    SUITE_ADD_TEST(suite, testEnd_getIndex);
     SUITE_ADD_TEST(suite, testEnd_getOrientation);
     SUITE_ADD_TEST(suite, testEnd_getReverse);
     SUITE_ADD_TEST(suite, testEnd_getSide);
@@ -15,6 +15,8 @@
 #include "endAligner.h"
 #include "flowerAligner.h"
 #include "rescue.h"
+#include "barProfile.h"
+#include "endAlignmentCheckpoint.h"
 #include "commonC.h"
 #include "stCaf.h"
 #include "stPinchGraphs.h"
@@ -60,16 +62,26 @@ void usage() {
     fprintf(stderr,
             "-F --useProgressiveMerging : Use progressive merging instead of poset merging for constructing multiple sequence alignments.\n");
 
+    fprintf(stderr, "-S --checkpointEndAlignments : With --endAlignmentsToPrecomputeOutputFile, keep an index of the completed end alignments in [fileName].index, so that a restarted run with the same arguments resumes after the last completed end.\n");
+
     fprintf(stderr, "-G --calculateWhichEndsToComputeSeparately : Decide which end alignments to compute separately.\n");
 
     fprintf(stderr, "-I --largeEndSize : The size of sequences in an end at which point to compute it separately.\n");
 
+    fprintf(stderr, "-O --largeEndTime : If given, compute separately the ends whose alignments are estimated to take at least this many seconds, instead of using --largeEndSize. The estimates use an uncalibrated model of the alignment time, see cactus_barBenchmark --calibrateEndAlignmentTime.\n");
+
+    fprintf(stderr, "-P --endAlignmentJobTime : With --calculateWhichEndsToComputeSeparately, group the ends to compute separately into jobs estimated to take about this many seconds each. A fourth and fifth column give the estimated time of each end alignment and its job.\n");
+
     fprintf(stderr, "-J --ingroupCoverageFile : Binary coverage file containing ingroup regions that are covered by outgroups. These regions will be 'rescued' into single-degree blocks if they haven't been aligned to anything after the bar phase finished.\n");
 
     fprintf(stderr, "-K --minimumSizeToRescue : Unaligned but covered segments must be at least this size to be rescued.\n");
 
     fprintf(stderr, "-M --minimumCoverageToRescue : Unaligned segments must have at least this proportion of their bases covered by an outgroup to be rescued.\n");
 
+    fprintf(stderr, "-R --memoryBudget [bytes] : Align ends predicted to take more memory than this with tighter anchoring or fewer spanning trees, so they fit in it.\n");
+
+    fprintf(stderr, "-Q --profileFile [fileName] : Write a profile of the time and peak memory taken by each end alignment, and by the pruning, annealing and melting of each flower, to this file, as JSON if its name ends in .json, otherwise as CSV.\n");
+
     fprintf(stderr, "-h --help : Print this help screen\n");
 }
 
@@ -104,8 +116,13 @@ int main(int argc, char *argv[]) {
     int64_t k;
     stList *listOfEndAlignmentFiles = NULL;
     char *endAlignmentsToPrecomputeOutputFile = NULL;
+    bool checkpointEndAlignments = 0;
     bool calculateWhichEndsToComputeSeparately = 0;
     int64_t largeEndSize = 1000000;
+    double largeEndTime = -1.0;
+    double endAlignmentJobTime = -1.0;
+    BarProfile *profile = NULL;
+    double memoryBudget = -1.0;
     int64_t chainLengthForBigFlower = 1000000;
     int64_t longChain = 2;
     char *ingroupCoverageFilePath = NULL;
@@ -136,6 +153,11 @@ int main(int argc, char *argv[]) {
                         "endAlignmentsToPrecomputeOutputFile", required_argument, 0, 'E' }, { "useProgressiveMerging",
                         no_argument, 0, 'F' }, { "calculateWhichEndsToComputeSeparately", no_argument, 0, 'G' }, { "largeEndSize",
                         required_argument, 0, 'I' },
+                        { "largeEndTime", required_argument, 0, 'O' },
+                        { "endAlignmentJobTime", required_argument, 0, 'P' },
+                        { "profileFile", required_argument, 0, 'Q' },
+                        { "memoryBudget", required_argument, 0, 'R' },
+                        { "checkpointEndAlignments", no_argument, 0, 'S' },
                         {"ingroupCoverageFile", required_argument, 0, 'J'},
                         {"minimumSizeToRescue", required_argument, 0, 'K'},
                         {"minimumCoverageToRescue", required_argument, 0, 'M'},
@@ -144,7 +166,7 @@ int main(int argc, char *argv[]) {
 
         int option_index = 0;
 
-        int key = getopt_long(argc, argv, "a:b:hi:j:kl:o:p:q:r:t:u:wy:A:B:D:E:FGI:J:K:L:M:N:", long_options, &option_index);
+        int key = getopt_long(argc, argv, "a:b:hi:j:kl:o:p:q:r:t:u:wy:A:B:D:E:FGI:J:K:L:M:N:O:P:Q:R:S", long_options, &option_index);
 
         if (key == -1) {
             break;
@@ -238,6 +260,9 @@ int main(int argc, char *argv[]) {
             case 'E':
                 endAlignmentsToPrecomputeOutputFile = stString_copy(optarg);
                 break;
+            case 'S':
+                checkpointEndAlignments = 1;
+                break;
             case 'F':
                 useProgressiveMerging = 1;
                 break;
@@ -265,6 +290,27 @@ int main(int argc, char *argv[]) {
                     st_errAbort("Error parsing minimumNumberOfSpecies parameter");
                 }
                 break;
+            case 'O':
+                i = sscanf(optarg, "%lf", &largeEndTime);
+                if (i != 1 || largeEndTime < 0.0) {
+                    st_errAbort("Error parsing largeEndTime parameter");
+                }
+                break;
+            case 'P':
+                i = sscanf(optarg, "%lf", &endAlignmentJobTime);
+                if (i != 1 || endAlignmentJobTime <= 0.0) {
+                    st_errAbort("Error parsing endAlignmentJobTime parameter");
+                }
+                break;
+            case 'Q':
+                profile = barProfile_construct(optarg);
+                break;
+            case 'R':
+                i = sscanf(optarg, "%lf", &memoryBudget);
+                if (i != 1 || memoryBudget <= 0.0) {
+                    st_errAbort("Error parsing memoryBudget parameter");
+                }
+                break;
             default:
                 usage();
                 return 1;
@@ -293,12 +339,36 @@ int main(int argc, char *argv[]) {
         if (stList_length(flowers) != 1) {
             st_errAbort("We are breaking up a flower's end alignments for precomputation but we have %" PRIi64 " flowers.\n", stList_length(flowers));
         }
-        stSortedSet *endsToAlignSeparately = getEndsToAlignSeparately(stList_get(flowers, 0), maximumLength, largeEndSize);
+        stSortedSet *endsToAlignSeparately = largeEndTime >= 0.0 ?
+                getEndsToAlignSeparatelyByTime(stList_get(flowers, 0), maximumLength, spanningTrees, pairwiseAlignmentBandingParameters, largeEndTime) :
+                getEndsToAlignSeparately(stList_get(flowers, 0), maximumLength, largeEndSize);
         assert(stSortedSet_size(endsToAlignSeparately) != 1);
         stSortedSetIterator *it = stSortedSet_getIterator(endsToAlignSeparately);
         End *end;
-        while ((end = stSortedSet_getNext(it)) != NULL) {
-            fprintf(stdout, "%s\t%" PRIi64 "\t%" PRIi64 "\n", cactusMisc_nameToStringStatic(end_getName(end)), end_getInstanceNumber(end), getTotalAdjacencyLength(end));
+        if (endAlignmentJobTime > 0.0) {
+            //Balance the ends between jobs by their estimated alignment times.
+            int64_t endNumber = stSortedSet_size(endsToAlignSeparately);
+            double *endAlignmentTimes = st_malloc(sizeof(double) * (endNumber + 1));
+            for (int64_t j = 0; (end = stSortedSet_getNext(it)) != NULL; j++) {
+                endAlignmentTimes[j] = estimateEndAlignmentTime(end, spanningTrees, maximumLength, pairwiseAlignmentBandingParameters);
+            }
+            int64_t groupNumber;
+            int64_t *groups = groupEndAlignmentJobs(endAlignmentTimes, endNumber, endAlignmentJobTime, &groupNumber);
+            st_logInfo("Grouped %" PRIi64 " ends to align separately into %" PRIi64 " jobs\n", endNumber, groupNumber);
+            stSortedSet_destructIterator(it);
+            it = stSortedSet_getIterator(endsToAlignSeparately);
+            for (int64_t j = 0; (end = stSortedSet_getNext(it)) != NULL; j++) {
+                fprintf(stdout, "%s\t%" PRIi64 "\t%" PRIi64 "\t%f\t%" PRIi64 "\n", cactusMisc_nameToStringStatic(end_getName(end)), end_getInstanceNumber(end), getTotalAdjacencyLength(end), endAlignmentTimes[j], groups[j]);
+            }
+            free(endAlignmentTimes);
+            free(groups);
+        } else {
+            while ((end = stSortedSet_getNext(it)) != NULL) {
+                fprintf(stdout, "%s\t%" PRIi64 "\t%" PRIi64 "\n", cactusMisc_nameToStringStatic(end_getName(end)), end_getInstanceNumber(end), getTotalAdjacencyLength(end));
+            }
+        }
+        if (profile != NULL) {
+            barProfile_destruct(profile);
         }
         return 0; //avoid cleanup costs
         stSortedSet_destructIterator(it);
@@ -309,21 +379,74 @@ int main(int argc, char *argv[]) {
          */
         stList *names = flowerWriter_parseNames(stdin);
         Flower *flower = cactusDisk_getFlower(cactusDisk, *((Name *)stList_get(names, 0)));
-        FILE *fileHandle = fopen(endAlignmentsToPrecomputeOutputFile, "w");
-        if (fileHandle == NULL) {
-            st_errnoAbort("Opening end alignment file %s failed", endAlignmentsToPrecomputeOutputFile);
+        FILE *fileHandle = NULL;
+        EndAlignmentCheckpoint *checkpoint = NULL;
+        int64_t firstEnd = 1;
+        if (checkpointEndAlignments) {
+            //The arguments identify the run, the ends are checked against the names.
+            stList *arguments = stList_construct();
+            for (int64_t i = 0; i < argc; i++) {
+                stList_append(arguments, argv[i]);
+            }
+            char *header = stString_join2(" ", arguments);
+            stList_destruct(arguments);
+            stList *endNames = stList_construct();
+            for (int64_t i = 1; i < stList_length(names); i++) {
+                stList_append(endNames, stList_get(names, i));
+            }
+            checkpoint = endAlignmentCheckpoint_construct(endAlignmentsToPrecomputeOutputFile, header, endNames);
+            firstEnd += endAlignmentCheckpoint_getCompletedEndNumber(checkpoint);
+            free(header);
+        } else {
+            fileHandle = fopen(endAlignmentsToPrecomputeOutputFile, "w");
+            if (fileHandle == NULL) {
+                st_errnoAbort("Opening end alignment file %s failed", endAlignmentsToPrecomputeOutputFile);
+            }
         }
-        for(int64_t i=1; i<stList_length(names); i++) {
+        //Read the adjacency sequences of the ends in one ordered pass, so those shared by two ends are read once.
+        AdjacencySequenceCache *adjacencySequenceCache = adjacencySequenceCache_construct(maximumLength);
+        stList *caps = stList_construct();
+        for(int64_t i=firstEnd; i<stList_length(names); i++) {
             End *end = flower_getEnd(flower, *((Name *)stList_get(names, i)));
             if (end == NULL) {
                 st_errAbort("The end %" PRIi64 " was not found in the flower\n", *((Name *)stList_get(names, i)));
             }
-            stSortedSet *endAlignment = makeEndAlignment(sM, end, spanningTrees, maximumLength, useProgressiveMerging,
-                            matchGamma, pairwiseAlignmentBandingParameters);
-            writeEndAlignmentToDisk(end, endAlignment, fileHandle);
-            stSortedSet_destruct(endAlignment);
+            Cap *cap;
+            End_InstanceIterator *capIt = end_getInstanceIterator(end);
+            while ((cap = end_getNext(capIt)) != NULL) {
+                stList_append(caps, cap);
+            }
+            end_destructInstanceIterator(capIt);
+        }
+        adjacencySequenceCache_prefetch(adjacencySequenceCache, caps);
+        stList_destruct(caps);
+        for(int64_t i=firstEnd; i<stList_length(names); i++) {
+            End *end = flower_getEnd(flower, *((Name *)stList_get(names, i)));
+            int64_t endSpanningTrees = spanningTrees;
+            PairwiseAlignmentParameters endParameters = *pairwiseAlignmentBandingParameters;
+            if (memoryBudget > 0) {
+                fitEndAlignmentToMemoryBudget(end, maximumLength, memoryBudget, &endSpanningTrees, &endParameters);
+            }
+            EndAlignment *endAlignment = makeCompactEndAlignment(sM, end, endSpanningTrees, maximumLength, useProgressiveMerging,
+                            matchGamma, &endParameters, adjacencySequenceCache, profile);
+            if (checkpoint != NULL) {
+                endAlignmentCheckpoint_add(checkpoint, end, endAlignment);
+            } else {
+                writeCompactEndAlignmentToDisk(end, endAlignment, fileHandle);
+            }
+            endAlignment_destruct(endAlignment);
+        }
+        if (checkpoint != NULL) {
+            endAlignmentCheckpoint_destruct(checkpoint);
+        } else {
+            fclose(fileHandle);
+        }
+        st_logInfo("Read %" PRIi64 " bases in %" PRIi64 " strings for %" PRIi64 " adjacency sequences\n",
+                adjacencySequenceCache->basesRead, adjacencySequenceCache->sequencesRead,
+                adjacencySequenceCache->adjacencySequencesGot);
+        if (profile != NULL) {
+            barProfile_destruct(profile);
         }
-        fclose(fileHandle);
         return 0; //avoid cleanup costs
         stList_destruct(names);
         st_logInfo("Finished precomputing end alignments\n");
@@ -372,20 +495,32 @@ int main(int argc, char *argv[]) {
             st_logInfo("Processing a flower\n");
 
             stSortedSet *alignedPairs = makeFlowerAlignment3(sM, flower, listOfEndAlignmentFiles, spanningTrees, maximumLength,
-                    useProgressiveMerging, matchGamma, pairwiseAlignmentBandingParameters, pruneOutStubAlignments);
+                    useProgressiveMerging, matchGamma, pairwiseAlignmentBandingParameters, pruneOutStubAlignments, memoryBudget, profile);
             st_logInfo("Created the alignment: %" PRIi64 " pairs\n", stSortedSet_size(alignedPairs));
             stPinchIterator *pinchIterator = stPinchIterator_constructFromAlignedPairs(alignedPairs, getNextAlignedPairAlignment);
 
             /*
              * Run the cactus caf functions to build cactus.
              */
+            double startTime = profile != NULL ? barProfile_getTime() : 0.0;
+            int64_t startPeakRss = profile != NULL ? barProfile_getPeakRss() : 0;
             stPinchThreadSet *threadSet = stCaf_setup(flower);
             stCaf_anneal(threadSet, pinchIterator, NULL);
             if (minimumDegree < 2) {
                 stCaf_makeDegreeOneBlocks(threadSet);
             }
+            if (profile != NULL) {
+                barProfile_addStage(profile, flower, "anneal", barProfile_getTime() - startTime,
+                        barProfile_getPeakRss() - startPeakRss);
+                startTime = barProfile_getTime();
+                startPeakRss = barProfile_getPeakRss();
+            }
             if (minimumIngroupDegree > 0 || minimumOutgroupDegree > 0 || minimumDegree > 1) {
                 stCaf_melt(flower, threadSet, blockFilterFn, 0, 0, 0, INT64_MAX);
+                if (profile != NULL) {
+                    barProfile_addStage(profile, flower, "melt", barProfile_getTime() - startTime,
+                            barProfile_getPeakRss() - startPeakRss);
+                }
             }
 
             if (ingroupCoverageFilePath != NULL) {
@@ -426,6 +561,9 @@ int main(int argc, char *argv[]) {
          * Write and close the cactusdisk.
          */
         cactusDisk_write(cactusDisk);
+        if (profile != NULL) {
+            barProfile_destruct(profile);
+        }
         return 0; //Exit without clean up is quicker, enable cleanup when doing memory leak detection.
         if (bedRegions != NULL) {
             // Clean up our mapping.
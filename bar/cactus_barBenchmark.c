@@ -0,0 +1,591 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+/*
+ * Benchmarks the bar routines against their reference implementations on
+ * synthetic inputs, checking that they give identical results, measures
+ * the throughput of makeEndAlignment on simulated ends, and calibrates the
+ * model used to estimate end alignment times.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+#include <getopt.h>
+
+#include "cactus.h"
+#include "sonLib.h"
+#include "stPinchGraphs.h"
+#include "rescue.h"
+#include "endAligner.h"
+#include "barProfile.h"
+#include "pairwiseAligner.h"
+#include "multipleAligner.h"
+
+static double getTime(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1.0e9;
+}
+
+/*
+ * Makes threads named 1 to threadNumber, each split into segmentNumber
+ * unaligned segments of random length.
+ */
+static stPinchThreadSet *makeRandomThreads(int64_t threadNumber, int64_t segmentNumber) {
+    stPinchThreadSet *threadSet = stPinchThreadSet_construct();
+    for (int64_t i = 0; i < threadNumber; i++) {
+        int64_t *segmentLengths = st_malloc(sizeof(int64_t) * segmentNumber);
+        int64_t length = 0;
+        for (int64_t j = 0; j < segmentNumber; j++) {
+            segmentLengths[j] = st_randomInt(1, 20);
+            length += segmentLengths[j];
+        }
+        stPinchThread *thread = stPinchThreadSet_addThread(threadSet, i + 1, 0, length);
+        int64_t position = 0;
+        for (int64_t j = 0; j + 1 < segmentNumber; j++) {
+            position += segmentLengths[j];
+            stPinchThread_split(thread, position - 1);
+        }
+        free(segmentLengths);
+    }
+    return threadSet;
+}
+
+/*
+ * Makes a sorted, little-endian bed array, as mapped from a coverage file,
+ * of up to regionNumber disjoint regions of random length along each of the
+ * threads made by makeRandomThreads.
+ */
+static bedRegion *makeRandomBedRegions(stPinchThreadSet *threadSet, int64_t threadNumber, int64_t regionNumber,
+        size_t *numBeds) {
+    bedRegion *beds = st_malloc(sizeof(bedRegion) * (threadNumber * regionNumber + 1));
+    *numBeds = 0;
+    for (int64_t i = 0; i < threadNumber; i++) {
+        stPinchThread *thread = stPinchThreadSet_getThread(threadSet, i + 1);
+        int64_t threadEnd = stPinchThread_getStart(thread) + stPinchThread_getLength(thread);
+        // Space the regions out so they cover about half the thread.
+        int64_t averageLength = stPinchThread_getLength(thread) / (2 * regionNumber) + 1;
+        int64_t position = stPinchThread_getStart(thread);
+        for (int64_t j = 0; j < regionNumber && position < threadEnd; j++) {
+            int64_t start = position + st_randomInt(0, 2 * averageLength);
+            int64_t stop = start + st_randomInt(1, 2 * averageLength);
+            if (stop > threadEnd) {
+                break;
+            }
+            bedRegion *region = beds + (*numBeds)++;
+            region->name = st_nativeInt64ToLittleEndian(stPinchThread_getName(thread));
+            region->start = st_nativeInt64ToLittleEndian(start);
+            region->stop = st_nativeInt64ToLittleEndian(stop);
+            position = stop;
+        }
+    }
+    return beds;
+}
+
+/*
+ * Runs the rescue function on every thread, recording which segments were
+ * rescued in the given array, then removes the blocks made.
+ */
+static double timeRescue(stPinchThreadSet *threadSet, bedRegion *beds, size_t numBeds, double coveredBasesThreshold,
+        void (*rescueFn)(stPinchThread *, bedRegion *, size_t, Name, int64_t, double), bool *rescued) {
+    double startTime = getTime();
+    stPinchThreadSetIt threadIt = stPinchThreadSet_getIt(threadSet);
+    stPinchThread *thread;
+    while ((thread = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
+        rescueFn(thread, beds, numBeds, stPinchThread_getName(thread), 1, coveredBasesThreshold);
+    }
+    double time = getTime() - startTime;
+
+    int64_t i = 0;
+    threadIt = stPinchThreadSet_getIt(threadSet);
+    while ((thread = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
+        for (stPinchSegment *segment = stPinchThread_getFirst(thread); segment != NULL;
+                segment = stPinchSegment_get3Prime(segment)) {
+            rescued[i++] = stPinchSegment_getBlock(segment) != NULL;
+            if (stPinchSegment_getBlock(segment) != NULL) {
+                stPinchBlock_destruct(stPinchSegment_getBlock(segment));
+            }
+        }
+    }
+    return time;
+}
+
+/*
+ * Times rescueCoveredRegions against rescueCoveredRegions_binarySearch.
+ * Returns non-zero if they rescue different segments.
+ */
+static int benchmarkRescue(int64_t threadNumber, int64_t segmentNumber, int64_t regionNumber,
+        double coveredBasesThreshold, int64_t repeats) {
+    stPinchThreadSet *threadSet = makeRandomThreads(threadNumber, segmentNumber);
+    size_t numBeds;
+    bedRegion *beds = makeRandomBedRegions(threadSet, threadNumber, regionNumber, &numBeds);
+    bool *sweepRescued = st_malloc(sizeof(bool) * (threadNumber * segmentNumber + 1));
+    bool *binarySearchRescued = st_malloc(sizeof(bool) * (threadNumber * segmentNumber + 1));
+    int64_t rescuedNumber = 0;
+    double sweepTime = 0.0, binarySearchTime = 0.0;
+    bool identical = 1;
+    for (int64_t r = 0; r < repeats; r++) {
+        binarySearchTime += timeRescue(threadSet, beds, numBeds, coveredBasesThreshold,
+                rescueCoveredRegions_binarySearch, binarySearchRescued);
+        sweepTime += timeRescue(threadSet, beds, numBeds, coveredBasesThreshold, rescueCoveredRegions, sweepRescued);
+        rescuedNumber = 0;
+        for (int64_t i = 0; i < threadNumber * segmentNumber; i++) {
+            identical = identical && sweepRescued[i] == binarySearchRescued[i];
+            rescuedNumber += sweepRescued[i];
+        }
+    }
+
+    fprintf(stdout, "rescueCoveredRegions: %" PRIi64 " threads, %" PRIi64 " segments, %zu regions, %" PRIi64
+            " segments rescued: binary search %lf s, sweep %lf s, speedup %.2lfx, results %s\n", threadNumber,
+            threadNumber * segmentNumber, numBeds, rescuedNumber, binarySearchTime / repeats, sweepTime / repeats,
+            sweepTime > 0.0 ? binarySearchTime / sweepTime : 0.0, identical ? "identical" : "DIFFERENT");
+
+    free(sweepRescued);
+    free(binarySearchRescued);
+    free(beds);
+    stPinchThreadSet_destruct(threadSet);
+    return !identical;
+}
+
+/*
+ * Makes sequences of random lengths about the given length, each a mutated
+ * copy of a random root sequence, as the adjacencies of an end are.
+ */
+static stList *makeRandomSeqFrags(int64_t sequenceNumber, int64_t sequenceLength) {
+    static const char bases[] = "ACGT";
+    char *root = st_malloc(2 * sequenceLength + 1);
+    for (int64_t i = 0; i < 2 * sequenceLength; i++) {
+        root[i] = bases[st_randomInt(0, 4)];
+    }
+    stList *seqFrags = stList_construct3(0, (void (*)(void *)) seqFrag_destruct);
+    for (int64_t i = 0; i < sequenceNumber; i++) {
+        int64_t length = st_randomInt(sequenceLength / 2, 2 * sequenceLength + 1);
+        char *seq = st_malloc(length + 1);
+        for (int64_t j = 0; j < length; j++) {
+            seq[j] = st_random() < 0.1 ? bases[st_randomInt(0, 4)] : root[j];
+        }
+        seq[length] = '\0';
+        stList_append(seqFrags, seqFrag_construct(seq, 0, st_randomInt(0, 4)));
+        free(seq);
+    }
+    free(root);
+    return seqFrags;
+}
+
+/*
+ * Solves the 3x3 system a.x = b by Gaussian elimination, returning zero if it is singular.
+ */
+static int solve3(double a[3][3], double b[3], double x[3]) {
+    for (int64_t i = 0; i < 3; i++) {
+        int64_t pivot = i;
+        for (int64_t j = i + 1; j < 3; j++) {
+            if (fabs(a[j][i]) > fabs(a[pivot][i])) {
+                pivot = j;
+            }
+        }
+        if (a[pivot][i] == 0.0) {
+            return 0;
+        }
+        for (int64_t k = 0; k < 3; k++) {
+            double t = a[i][k];
+            a[i][k] = a[pivot][k];
+            a[pivot][k] = t;
+        }
+        double t = b[i];
+        b[i] = b[pivot];
+        b[pivot] = t;
+        for (int64_t j = i + 1; j < 3; j++) {
+            double f = a[j][i] / a[i][i];
+            for (int64_t k = i; k < 3; k++) {
+                a[j][k] -= f * a[i][k];
+            }
+            b[j] -= f * b[i];
+        }
+    }
+    for (int64_t i = 2; i >= 0; i--) {
+        x[i] = b[i];
+        for (int64_t k = i + 1; k < 3; k++) {
+            x[i] -= a[i][k] * x[k];
+        }
+        x[i] /= a[i][i];
+    }
+    return 1;
+}
+
+/*
+ * Times makeAlignment on ends of a range of shapes, from a few long
+ * sequences to many short ones, and fits the coefficients of the
+ * AlignmentTimeModel used by estimateAlignmentTime to the times by least
+ * squares on the relative errors, so the short ends count as much as the
+ * long ones.
+ */
+static int calibrateEndAlignmentTime(int64_t spanningTrees, int64_t repeats) {
+    static const int64_t sequenceNumbers[] = { 2, 4, 8, 16, 32, 64 };
+    static const int64_t sequenceLengths[] = { 100, 1000, 5000 };
+    const int64_t shapeNumber = 18; //Every pair of sequence number and length.
+    const AlignmentTimeModel unitModels[3] = { { 1.0, 0.0, 0.0 }, { 0.0, 1.0, 0.0 }, { 0.0, 0.0, 1.0 } };
+    StateMachine *sM = stateMachine5_construct(fiveState);
+    PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+    double features[18][3], times[18];
+    int64_t shapeSequenceNumbers[18], shapeSequenceLengths[18];
+
+    for (int64_t shape = 0; shape < shapeNumber; shape++) {
+        int64_t sequenceNumber = sequenceNumbers[shape / 3], sequenceLength = sequenceLengths[shape % 3];
+        stList *seqFrags = makeRandomSeqFrags(sequenceNumber, sequenceLength);
+        int64_t *lengths = st_malloc(sizeof(int64_t) * sequenceNumber);
+        for (int64_t i = 0; i < sequenceNumber; i++) {
+            lengths[i] = ((SeqFrag *) stList_get(seqFrags, i))->length;
+        }
+        for (int64_t i = 0; i < 3; i++) {
+            features[shape][i] = estimateAlignmentTime(lengths, sequenceNumber, spanningTrees, p, &unitModels[i]);
+        }
+        double time = 0.0;
+        for (int64_t r = 0; r < repeats; r++) {
+            double startTime = getTime();
+            MultipleAlignment *mA = makeAlignment(sM, seqFrags, spanningTrees, 100000000, 1, 0.0, p);
+            time += getTime() - startTime;
+            multipleAlignment_destruct(mA);
+        }
+        times[shape] = time / repeats;
+        shapeSequenceNumbers[shape] = sequenceNumber;
+        shapeSequenceLengths[shape] = sequenceLength;
+        free(lengths);
+        stList_destruct(seqFrags);
+    }
+
+    double a[3][3] = { { 0.0 } }, b[3] = { 0.0 }, x[3];
+    for (int64_t shape = 0; shape < shapeNumber; shape++) {
+        double weight = 1.0 / (times[shape] * times[shape] + 1.0e-12);
+        for (int64_t i = 0; i < 3; i++) {
+            for (int64_t j = 0; j < 3; j++) {
+                a[i][j] += weight * features[shape][i] * features[shape][j];
+            }
+            b[i] += weight * features[shape][i] * times[shape];
+        }
+    }
+    if (!solve3(a, b, x)) {
+        fprintf(stderr, "The end alignment times could not be fitted\n");
+        return 1;
+    }
+    AlignmentTimeModel model = { x[0], x[1], x[2] };
+    fprintf(stdout, "estimateAlignmentTime: spanning trees %" PRIi64 ", fitted model { %.3e, %.3e, %.3e }, "
+            "default model { %.3e, %.3e, %.3e }\n", spanningTrees, model.secondsPerAlignment, model.secondsPerCell,
+            model.secondsPerAlignedBase, defaultAlignmentTimeModel.secondsPerAlignment,
+            defaultAlignmentTimeModel.secondsPerCell, defaultAlignmentTimeModel.secondsPerAlignedBase);
+    for (int64_t shape = 0; shape < shapeNumber; shape++) {
+        double fitted = 0.0, byDefault = 0.0;
+        for (int64_t i = 0; i < 3; i++) {
+            fitted += features[shape][i] * x[i];
+        }
+        byDefault = features[shape][0] * defaultAlignmentTimeModel.secondsPerAlignment
+                + features[shape][1] * defaultAlignmentTimeModel.secondsPerCell
+                + features[shape][2] * defaultAlignmentTimeModel.secondsPerAlignedBase;
+        fprintf(stdout, "%" PRIi64 " sequences of about %" PRIi64 " bases: measured %lf s, fitted %lf s, default %lf s\n",
+                shapeSequenceNumbers[shape], shapeSequenceLengths[shape], times[shape], fitted, byDefault);
+    }
+
+    pairwiseAlignmentBandingParameters_destruct(p);
+    stateMachine_destruct(sM);
+    return 0;
+}
+
+/*
+ * Makes a copy of the sequence with substitutions at the given rate, and
+ * short insertions and deletions at a tenth of it.
+ */
+static char *mutateSequence(const char *sequence, double divergence) {
+    static const char bases[] = "ACGT";
+    int64_t length = strlen(sequence);
+    char *mutated = st_malloc(2 * length + 1);
+    int64_t j = 0;
+    for (int64_t i = 0; i < length; i++) {
+        double r = st_random();
+        if (r < divergence / 20) { //Deletion
+            i += st_randomInt(0, 5);
+        } else if (r < divergence / 10) { //Insertion before the base
+            for (int64_t k = st_randomInt(1, 6); k > 0 && j < 2 * length - 1; k--) {
+                mutated[j++] = bases[st_randomInt(0, 4)];
+            }
+            mutated[j++] = sequence[i];
+        } else if (r < divergence / 10 + divergence) {
+            mutated[j++] = bases[st_randomInt(0, 4)];
+        } else {
+            mutated[j++] = sequence[i];
+        }
+        if (j >= 2 * length) {
+            break;
+        }
+    }
+    mutated[j] = '\0';
+    return mutated;
+}
+
+/*
+ * Makes a flower with an end whose caps each begin a sequence, a mutated
+ * copy of a common random sequence of the given length, joining it to one
+ * of a few other ends, as the adjacencies of an end in a real flower are.
+ */
+static End *makeRandomEnd(CactusDisk *cactusDisk, int64_t degree, int64_t sequenceLength, double divergence) {
+    static const char bases[] = "ACGT";
+    Flower *flower = flower_construct(cactusDisk);
+    EventTree *eventTree = eventTree_construct2(cactusDisk);
+    Event *leafEvent = event_construct3("LEAF", 0.1, eventTree_getRootEvent(eventTree), eventTree);
+    char *root = st_malloc(sequenceLength + 1);
+    for (int64_t i = 0; i < sequenceLength; i++) {
+        root[i] = bases[st_randomInt(0, 4)];
+    }
+    root[sequenceLength] = '\0';
+    End *end = end_construct2(0, 1, flower);
+    End *otherEnds[4];
+    for (int64_t i = 0; i < 4; i++) {
+        otherEnds[i] = end_construct2(1, 1, flower);
+    }
+    for (int64_t i = 0; i < degree; i++) {
+        char *string = mutateSequence(root, divergence);
+        int64_t length = strlen(string);
+        char *header = stString_print(">seq%" PRIi64, i);
+        MetaSequence *metaSequence = metaSequence_construct(1, length, string, header, event_getName(leafEvent),
+                cactusDisk);
+        Sequence *sequence = sequence_construct(metaSequence, flower);
+        Cap *cap = cap_construct2(end, 0, 1, sequence);
+        Cap *adjacentCap = cap_construct2(otherEnds[st_randomInt(0, 4)], length + 1, 1, sequence);
+        cap_makeAdjacent(cap, adjacentCap);
+        free(header);
+        free(string);
+    }
+    free(root);
+    return end;
+}
+
+/*
+ * Parses a comma separated list of numbers.
+ */
+static stList *parseNumbers(const char *string) {
+    stList *numbers = stList_construct3(0, free);
+    stList *tokens = stString_splitByString(string, ",");
+    for (int64_t i = 0; i < stList_length(tokens); i++) {
+        double *number = st_malloc(sizeof(double));
+        if (sscanf(stList_get(tokens, i), "%lf", number) != 1) {
+            st_errAbort("Could not parse the number %s in %s", (char *) stList_get(tokens, i), string);
+        }
+        stList_append(numbers, number);
+    }
+    stList_destruct(tokens);
+    return numbers;
+}
+
+/*
+ * Times makeEndAlignment on simulated ends of every combination of the
+ * given degrees, sequence lengths and divergences, skipping those
+ * estimated to take more than maxEstimatedTime seconds.
+ */
+static int benchmarkEndAlignment(stList *degrees, stList *sequenceLengths, stList *divergences, int64_t spanningTrees,
+        int64_t maximumLength, bool useProgressiveMerging, float gapGamma, PairwiseAlignmentParameters *p,
+        double maxEstimatedTime, int64_t repeats) {
+    StateMachine *sM = stateMachine5_construct(fiveState);
+    for (int64_t i = 0; i < stList_length(degrees); i++) {
+        for (int64_t j = 0; j < stList_length(sequenceLengths); j++) {
+            for (int64_t k = 0; k < stList_length(divergences); k++) {
+                int64_t degree = *(double *) stList_get(degrees, i);
+                int64_t sequenceLength = *(double *) stList_get(sequenceLengths, j);
+                double divergence = *(double *) stList_get(divergences, k);
+                int64_t *lengths = st_malloc(sizeof(int64_t) * (degree + 1));
+                for (int64_t l = 0; l < degree; l++) {
+                    lengths[l] = sequenceLength < maximumLength ? sequenceLength : maximumLength;
+                }
+                double estimatedTime = estimateAlignmentTime(lengths, degree, spanningTrees, p,
+                        &defaultAlignmentTimeModel);
+                free(lengths);
+                if (estimatedTime > maxEstimatedTime) {
+                    fprintf(stdout, "makeEndAlignment: degree %" PRIi64 ", length %" PRIi64 ", divergence %.3lf: "
+                            "skipped, estimated %lf s\n", degree, sequenceLength, divergence, estimatedTime);
+                    continue;
+                }
+                double time = 0.0;
+                int64_t peakRssDelta = 0, alignedPairNumber = 0;
+                for (int64_t r = 0; r < repeats; r++) {
+                    CactusDisk *cactusDisk = testCommon_getTemporaryCactusDisk("cactus_barBenchmark");
+                    End *end = makeRandomEnd(cactusDisk, degree, sequenceLength, divergence);
+                    int64_t startPeakRss = barProfile_getPeakRss();
+                    double startTime = getTime();
+                    stSortedSet *alignedPairs = makeEndAlignment(sM, end, spanningTrees, maximumLength,
+                            useProgressiveMerging, gapGamma, p);
+                    time += getTime() - startTime;
+                    if (barProfile_getPeakRss() - startPeakRss > peakRssDelta) {
+                        peakRssDelta = barProfile_getPeakRss() - startPeakRss;
+                    }
+                    alignedPairNumber += stSortedSet_size(alignedPairs) / 2;
+                    stSortedSet_destruct(alignedPairs);
+                    testCommon_deleteTemporaryCactusDisk("cactus_barBenchmark", cactusDisk);
+                }
+                fprintf(stdout, "makeEndAlignment: degree %" PRIi64 ", length %" PRIi64 ", divergence %.3lf: "
+                        "%lf s, estimated %lf s, peak RSS increase %" PRIi64 " bytes, %.1lf aligned pairs\n", degree,
+                        sequenceLength, divergence, time / repeats, estimatedTime, peakRssDelta,
+                        ((double) alignedPairNumber) / repeats);
+            }
+        }
+    }
+    stateMachine_destruct(sM);
+    return 0;
+}
+
+static void usage(void) {
+    fprintf(stderr, "cactus_barBenchmark [options]\n");
+    fprintf(stderr, "-a --threads : Number of threads in the rescue benchmark (default 4)\n");
+    fprintf(stderr, "-b --segments : Number of segments in each thread (default 1000000)\n");
+    fprintf(stderr, "-c --regions : Number of covered regions along each thread (default 1000000)\n");
+    fprintf(stderr, "-d --repeats : Number of times to repeat each benchmark (default 3)\n");
+    fprintf(stderr, "-e --seed : Random seed (default 1)\n");
+    fprintf(stderr, "-f --coveredBasesThreshold : Proportion of a segment that must be covered to rescue it (default 0.5)\n");
+    fprintf(stderr, "-g --calibrateEndAlignmentTime : Fit the end alignment time model instead of running the benchmarks\n");
+    fprintf(stderr, "-i --spanningTrees : Number of spanning trees when calibrating the end alignment time model (default 5)\n");
+    fprintf(stderr, "-j --endAlignments : Benchmark makeEndAlignment on simulated ends instead of running the other benchmarks\n");
+    fprintf(stderr, "-k --degrees : Comma separated numbers of sequences in the simulated ends (default 2,10,50,200,500)\n");
+    fprintf(stderr, "-l --lengths : Comma separated lengths of the sequences in the simulated ends (default 100,1000,10000,100000,1000000)\n");
+    fprintf(stderr, "-m --divergences : Comma separated substitution rates between the sequences and their common ancestor (default 0.01,0.05,0.2)\n");
+    fprintf(stderr, "-n --maxEstimatedTime : Skip simulated ends estimated to take longer than this many seconds (default 100)\n");
+    fprintf(stderr, "-o --maximumLength : Maximum length of sequence to align from each side of an end (default 1000000)\n");
+    fprintf(stderr, "-p --diagonalExpansion : Banding diagonal expansion (default as in pairwiseAlignmentBandingParameters_construct)\n");
+    fprintf(stderr, "-q --anchorMatrixBiggerThanThis : Banding anchor matrix size (default as in pairwiseAlignmentBandingParameters_construct)\n");
+    fprintf(stderr, "-r --splitMatrixBiggerThanThis : Banding split matrix size (default as in pairwiseAlignmentBandingParameters_construct)\n");
+    fprintf(stderr, "-s --gapGamma : The gap gamma (default 0.0)\n");
+    fprintf(stderr, "-t --usePosetMerging : Use poset merging instead of progressive merging\n");
+    fprintf(stderr, "-h --help : Print this help screen\n");
+}
+
+int main(int argc, char *argv[]) {
+    int64_t threadNumber = 4;
+    int64_t segmentNumber = 1000000;
+    int64_t regionNumber = 1000000;
+    int64_t repeats = 3;
+    int64_t seed = 1;
+    double coveredBasesThreshold = 0.5;
+    bool calibrate = 0;
+    int64_t spanningTrees = 5;
+    bool benchmarkEndAlignments = 0;
+    stList *degrees = parseNumbers("2,10,50,200,500");
+    stList *sequenceLengths = parseNumbers("100,1000,10000,100000,1000000");
+    stList *divergences = parseNumbers("0.01,0.05,0.2");
+    double maxEstimatedTime = 100.0;
+    int64_t maximumLength = 1000000;
+    int64_t k;
+    float gapGamma = 0.0;
+    bool useProgressiveMerging = 1;
+    PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters = pairwiseAlignmentBandingParameters_construct();
+
+    while (1) {
+        static struct option long_options[] = { { "threads", required_argument, 0, 'a' },
+                { "segments", required_argument, 0, 'b' }, { "regions", required_argument, 0, 'c' },
+                { "repeats", required_argument, 0, 'd' }, { "seed", required_argument, 0, 'e' },
+                { "coveredBasesThreshold", required_argument, 0, 'f' },
+                { "calibrateEndAlignmentTime", no_argument, 0, 'g' }, { "spanningTrees", required_argument, 0, 'i' },
+                { "endAlignments", no_argument, 0, 'j' }, { "degrees", required_argument, 0, 'k' },
+                { "lengths", required_argument, 0, 'l' }, { "divergences", required_argument, 0, 'm' },
+                { "maxEstimatedTime", required_argument, 0, 'n' }, { "maximumLength", required_argument, 0, 'o' },
+                { "diagonalExpansion", required_argument, 0, 'p' },
+                { "anchorMatrixBiggerThanThis", required_argument, 0, 'q' },
+                { "splitMatrixBiggerThanThis", required_argument, 0, 'r' }, { "gapGamma", required_argument, 0, 's' },
+                { "usePosetMerging", no_argument, 0, 't' }, { "help", no_argument, 0, 'h' }, { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+        int key = getopt_long(argc, argv, "a:b:c:d:e:f:ghi:jk:l:m:n:o:p:q:r:s:t", long_options, &option_index);
+        if (key == -1) {
+            break;
+        }
+        switch (key) {
+            case 'a':
+                threadNumber = atol(optarg);
+                break;
+            case 'b':
+                segmentNumber = atol(optarg);
+                break;
+            case 'c':
+                regionNumber = atol(optarg);
+                break;
+            case 'd':
+                repeats = atol(optarg);
+                break;
+            case 'e':
+                seed = atol(optarg);
+                break;
+            case 'f':
+                coveredBasesThreshold = atof(optarg);
+                break;
+            case 'g':
+                calibrate = 1;
+                break;
+            case 'i':
+                spanningTrees = atol(optarg);
+                break;
+            case 'j':
+                benchmarkEndAlignments = 1;
+                break;
+            case 'k':
+                stList_destruct(degrees);
+                degrees = parseNumbers(optarg);
+                break;
+            case 'l':
+                stList_destruct(sequenceLengths);
+                sequenceLengths = parseNumbers(optarg);
+                break;
+            case 'm':
+                stList_destruct(divergences);
+                divergences = parseNumbers(optarg);
+                break;
+            case 'n':
+                maxEstimatedTime = atof(optarg);
+                break;
+            case 'o':
+                maximumLength = atol(optarg);
+                break;
+            case 'p':
+                pairwiseAlignmentBandingParameters->diagonalExpansion = atol(optarg);
+                break;
+            case 'q':
+                //As in cactus_bar, given as the length of the side of the matrix.
+                k = atol(optarg);
+                pairwiseAlignmentBandingParameters->anchorMatrixBiggerThanThis = k * k;
+                break;
+            case 'r':
+                k = atol(optarg);
+                pairwiseAlignmentBandingParameters->splitMatrixBiggerThanThis = k * k;
+                break;
+            case 's':
+                gapGamma = atof(optarg);
+                break;
+            case 't':
+                useProgressiveMerging = 0;
+                break;
+            case 'h':
+                usage();
+                return 0;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    if (threadNumber < 1 || segmentNumber < 1 || regionNumber < 1 || spanningTrees < 1) {
+        usage();
+        return 1;
+    }
+    if (repeats < 1) {
+        repeats = 1;
+    }
+
+    st_randomSeed(seed);
+    if (calibrate) {
+        return calibrateEndAlignmentTime(spanningTrees, repeats);
+    }
+    if (benchmarkEndAlignments) {
+        return benchmarkEndAlignment(degrees, sequenceLengths, divergences, spanningTrees, maximumLength,
+                useProgressiveMerging, gapGamma, pairwiseAlignmentBandingParameters, maxEstimatedTime, repeats);
+    }
+    int failed = benchmarkRescue(threadNumber, segmentNumber, regionNumber, coveredBasesThreshold, repeats);
+
+    return failed ? 1 : 0;
+}
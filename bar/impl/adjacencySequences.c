@@ -39,10 +39,13 @@ static char *getAdjacencySequenceP(Cap *cap, int64_t maxLength) {
     }
 }
 
-AdjacencySequence *adjacencySequence_construct(Cap *cap, int64_t maxLength) {
+/*
+ * Fills in the fields of the adjacency sequence other than the string, given its length.
+ */
+static AdjacencySequence *adjacencySequence_constructP(Cap *cap, char *string, int64_t length) {
     AdjacencySequence *subSequence = (AdjacencySequence *) st_malloc(
             sizeof(AdjacencySequence));
-    subSequence->string = getAdjacencySequenceP(cap, maxLength);
+    subSequence->string = string;
     Cap *adjacentCap = cap_getAdjacency(cap);
     assert(adjacentCap != NULL);
     assert(!cap_getSide(cap));
@@ -50,13 +53,197 @@ AdjacencySequence *adjacencySequence_construct(Cap *cap, int64_t maxLength) {
     subSequence->subsequenceIdentifier = cap_getName(cap_getStrand(cap) ? cap : adjacentCap);
     subSequence->strand = cap_getStrand(cap);
     subSequence->start = cap_getCoordinate(cap) + (cap_getStrand(cap) ? 1 : -1);
-    subSequence->length = strlen(subSequence->string);
+    subSequence->length = length;
     subSequence->hasStubEnd = end_isFree(cap_getEnd(adjacentCap)) && end_isStubEnd(cap_getEnd(adjacentCap));
     return subSequence;
 }
 
+/*
+ * Length of the adjacency, ignoring any maximum length.
+ */
+static int64_t getAdjacencyLength(Cap *cap) {
+    Cap *cap2 = cap_getAdjacency(cap);
+    assert(cap2 != NULL);
+    int64_t length = cap_getStrand(cap) ? cap_getCoordinate(cap2) - cap_getCoordinate(cap) - 1
+            : cap_getCoordinate(cap) - cap_getCoordinate(cap2) - 1;
+    assert(length >= 0);
+    return length;
+}
+
+AdjacencySequence *adjacencySequence_construct(Cap *cap, int64_t maxLength) {
+    char *string = getAdjacencySequenceP(cap, maxLength);
+    return adjacencySequence_constructP(cap, string, strlen(string));
+}
+
+AdjacencySequence *adjacencySequence_constructWithoutString(Cap *cap, int64_t maxLength) {
+    assert(maxLength >= 0);
+    int64_t length = getAdjacencyLength(cap);
+    return adjacencySequence_constructP(cap, NULL, length > maxLength ? maxLength : length);
+}
+
 void adjacencySequence_destruct(AdjacencySequence *subSequence) {
     free(subSequence->string);
     free(subSequence);
 }
 
+/*
+ * Adjacency sequence cache.
+ */
+
+/*
+ * The bases read for one adjacency, as the strings from either of its two caps.
+ */
+typedef struct _CachedAdjacency {
+    char *positiveString; //The first maxLength bases of the adjacency on the positive strand.
+    char *negativeString; //The first maxLength bases of the adjacency on the negative strand.
+} CachedAdjacency;
+
+static void cachedAdjacency_destruct(CachedAdjacency *cachedAdjacency) {
+    free(cachedAdjacency->positiveString);
+    free(cachedAdjacency->negativeString);
+    free(cachedAdjacency);
+}
+
+/*
+ * Gets the cap on the positive strand and left side of the cap's adjacency, which identifies it.
+ */
+static Cap *getPositiveCap(Cap *cap) {
+    if (!cap_getStrand(cap)) {
+        cap = cap_getReverse(cap);
+    }
+    if (cap_getSide(cap)) {
+        cap = cap_getAdjacency(cap);
+        assert(cap != NULL);
+    }
+    assert(cap_getStrand(cap));
+    assert(!cap_getSide(cap));
+    return cap;
+}
+
+static char *readString(AdjacencySequenceCache *cache, Sequence *sequence, int64_t start, int64_t length, bool strand) {
+    cache->sequencesRead++;
+    cache->basesRead += length;
+    return sequence_getString(sequence, start, length, strand);
+}
+
+/*
+ * Reads the bases of the adjacency needed by the cache, reading each base once: the whole adjacency
+ * if the two flanks of maxLength bases overlap, else the two flanks.
+ */
+static CachedAdjacency *readAdjacency(AdjacencySequenceCache *cache, Cap *positiveCap) {
+    Sequence *sequence = cap_getSequence(positiveCap);
+    assert(sequence != NULL);
+    int64_t start = cap_getCoordinate(positiveCap) + 1;
+    int64_t length = getAdjacencyLength(positiveCap);
+    int64_t flankLength = length > cache->maxLength ? cache->maxLength : length;
+    CachedAdjacency *cachedAdjacency = st_malloc(sizeof(CachedAdjacency));
+    if (length <= 2 * cache->maxLength) {
+        char *string = readString(cache, sequence, start, length, 1);
+        cachedAdjacency->positiveString = stString_getSubString(string, 0, flankLength);
+        char *suffix = stString_getSubString(string, length - flankLength, flankLength);
+        cachedAdjacency->negativeString = stString_reverseComplementString(suffix);
+        free(suffix);
+        free(string);
+    } else {
+        cachedAdjacency->positiveString = readString(cache, sequence, start, flankLength, 1);
+        cachedAdjacency->negativeString = readString(cache, sequence, start + length - flankLength, flankLength, 0);
+    }
+    return cachedAdjacency;
+}
+
+AdjacencySequenceCache *adjacencySequenceCache_construct(int64_t maxLength) {
+    assert(maxLength >= 0);
+    AdjacencySequenceCache *cache = st_malloc(sizeof(AdjacencySequenceCache));
+    cache->adjacencies = stHash_construct3((uint64_t (*)(const void *))stIntTuple_hashKey,
+            (int (*)(const void *, const void *))stIntTuple_equalsFn, (void (*)(void *))stIntTuple_destruct,
+            (void (*)(void *))cachedAdjacency_destruct);
+    cache->maxLength = maxLength;
+    cache->sequencesRead = 0;
+    cache->basesRead = 0;
+    cache->adjacencySequencesGot = 0;
+    return cache;
+}
+
+void adjacencySequenceCache_destruct(AdjacencySequenceCache *cache) {
+    stHash_destruct(cache->adjacencies);
+    free(cache);
+}
+
+static int comparePositiveCapsByPosition(const void *a, const void *b) {
+    Cap *cap1 = (Cap *)a, *cap2 = (Cap *)b;
+    int i = cactusMisc_nameCompare(sequence_getName(cap_getSequence(cap1)), sequence_getName(cap_getSequence(cap2)));
+    if (i != 0) {
+        return i;
+    }
+    return cap_getCoordinate(cap1) < cap_getCoordinate(cap2) ? -1 : (cap_getCoordinate(cap1) > cap_getCoordinate(cap2) ? 1 : 0);
+}
+
+void adjacencySequenceCache_prefetch(AdjacencySequenceCache *cache, stList *caps) {
+    stList *positiveCaps = stList_construct();
+    stSortedSet *seen = stSortedSet_construct();
+    for (int64_t i = 0; i < stList_length(caps); i++) {
+        Cap *cap = stList_get(caps, i);
+        if (cap_getSequence(cap) == NULL || cap_getAdjacency(cap) == NULL) {
+            continue;
+        }
+        cap = getPositiveCap(cap);
+        if (stSortedSet_search(seen, cap) == NULL) {
+            stSortedSet_insert(seen, cap);
+            stList_append(positiveCaps, cap);
+        }
+    }
+    stSortedSet_destruct(seen);
+    //Read in order along each sequence.
+    stList_sort(positiveCaps, comparePositiveCapsByPosition);
+    for (int64_t i = 0; i < stList_length(positiveCaps); i++) {
+        Cap *cap = stList_get(positiveCaps, i);
+        stIntTuple *subsequenceIdentifier = stIntTuple_construct1(cap_getName(cap));
+        if (stHash_search(cache->adjacencies, subsequenceIdentifier) == NULL) {
+            stHash_insert(cache->adjacencies, subsequenceIdentifier, readAdjacency(cache, cap));
+        } else {
+            stIntTuple_destruct(subsequenceIdentifier);
+        }
+    }
+    stList_destruct(positiveCaps);
+}
+
+void adjacencySequenceCache_prefetchFlower(AdjacencySequenceCache *cache, Flower *flower) {
+    stList *caps = stList_construct();
+    Flower_CapIterator *capIt = flower_getCapIterator(flower);
+    Cap *cap;
+    while ((cap = flower_getNextCap(capIt)) != NULL) {
+        stList_append(caps, cap);
+    }
+    flower_destructCapIterator(capIt);
+    adjacencySequenceCache_prefetch(cache, caps);
+    stList_destruct(caps);
+}
+
+AdjacencySequence *adjacencySequenceCache_getAdjacencySequence(AdjacencySequenceCache *cache, Cap *cap,
+        int64_t maxLength) {
+    assert(!cap_getSide(cap));
+    assert(maxLength >= 0);
+    int64_t length = getAdjacencyLength(cap);
+    if (maxLength > cache->maxLength && length > cache->maxLength) {
+        //Longer than the cached flanks, so read it directly.
+        cache->sequencesRead++;
+        cache->basesRead += length > maxLength ? maxLength : length;
+        return adjacencySequence_construct(cap, maxLength);
+    }
+    Cap *positiveCap = getPositiveCap(cap);
+    stIntTuple *subsequenceIdentifier = stIntTuple_construct1(cap_getName(positiveCap));
+    CachedAdjacency *cachedAdjacency = stHash_search(cache->adjacencies, subsequenceIdentifier);
+    if (cachedAdjacency == NULL) {
+        cachedAdjacency = readAdjacency(cache, positiveCap);
+        stHash_insert(cache->adjacencies, subsequenceIdentifier, cachedAdjacency);
+    } else {
+        stIntTuple_destruct(subsequenceIdentifier);
+    }
+    cache->adjacencySequencesGot++;
+    if (length > maxLength) {
+        length = maxLength;
+    }
+    char *string = stString_getSubString(cap_getStrand(cap) ? cachedAdjacency->positiveString
+            : cachedAdjacency->negativeString, 0, length);
+    return adjacencySequence_constructP(cap, string, length);
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "sonLib.h"
+#include "cactus.h"
+#include "barProfile.h"
+
+struct _BarProfile {
+    FILE *fileHandle;
+    bool json;
+    int64_t rowNumber;
+};
+
+BarProfile *barProfile_construct(const char *fileName) {
+    BarProfile *profile = st_malloc(sizeof(BarProfile));
+    profile->fileHandle = fopen(fileName, "w");
+    if (profile->fileHandle == NULL) {
+        st_errnoAbort("Opening profile file %s failed", fileName);
+    }
+    int64_t length = strlen(fileName);
+    profile->json = length >= 5 && strcmp(fileName + length - 5, ".json") == 0;
+    profile->rowNumber = 0;
+    if (profile->json) {
+        fprintf(profile->fileHandle, "[");
+    } else {
+        fprintf(profile->fileHandle,
+                "flower,end,stage,sequences,totalSequenceLength,pairwiseAlignments,alignedPairs,seconds,peakRssDelta\n");
+    }
+    return profile;
+}
+
+void barProfile_destruct(BarProfile *profile) {
+    if (profile->json) {
+        fprintf(profile->fileHandle, "\n]\n");
+    }
+    fclose(profile->fileHandle);
+    free(profile);
+}
+
+double barProfile_getTime(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1.0e9;
+}
+
+int64_t barProfile_getPeakRss(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss; //In bytes on OS X.
+#else
+    return ((int64_t) usage.ru_maxrss) * 1024; //In kilobytes on Linux.
+#endif
+}
+
+/*
+ * Writes a row, leaving out the end alignment fields if there is no end.
+ */
+static void writeRow(BarProfile *profile, Flower *flower, End *end, const char *stage, int64_t sequenceNumber,
+        int64_t totalSequenceLength, int64_t pairwiseAlignmentNumber, int64_t alignedPairNumber, double time,
+        int64_t peakRssDelta) {
+    FILE *fileHandle = profile->fileHandle;
+    char *flowerName = cactusMisc_nameToString(flower_getName(flower));
+    char *endName = end != NULL ? cactusMisc_nameToString(end_getName(end)) : stString_copy("");
+    if (profile->json) {
+        fprintf(fileHandle, "%s\n  {\"flower\": \"%s\", ", profile->rowNumber > 0 ? "," : "", flowerName);
+        if (end != NULL) {
+            fprintf(fileHandle, "\"end\": \"%s\", ", endName);
+        }
+        fprintf(fileHandle, "\"stage\": \"%s\", ", stage);
+        if (end != NULL) {
+            fprintf(fileHandle, "\"sequences\": %" PRIi64 ", \"totalSequenceLength\": %" PRIi64 ", "
+                    "\"pairwiseAlignments\": %" PRIi64 ", \"alignedPairs\": %" PRIi64 ", ", sequenceNumber,
+                    totalSequenceLength, pairwiseAlignmentNumber, alignedPairNumber);
+        }
+        fprintf(fileHandle, "\"seconds\": %f, \"peakRssDelta\": %" PRIi64 "}", time, peakRssDelta);
+    } else {
+        fprintf(fileHandle, "%s,%s,%s,", flowerName, endName, stage);
+        if (end != NULL) {
+            fprintf(fileHandle, "%" PRIi64 ",%" PRIi64 ",%" PRIi64 ",%" PRIi64 ",", sequenceNumber, totalSequenceLength,
+                    pairwiseAlignmentNumber, alignedPairNumber);
+        } else {
+            fprintf(fileHandle, ",,,,");
+        }
+        fprintf(fileHandle, "%f,%" PRIi64 "\n", time, peakRssDelta);
+    }
+    profile->rowNumber++;
+    free(flowerName);
+    free(endName);
+}
+
+void barProfile_addEndAlignment(BarProfile *profile, End *end, int64_t sequenceNumber, int64_t totalSequenceLength,
+        int64_t pairwiseAlignmentNumber, int64_t alignedPairNumber, double time, int64_t peakRssDelta) {
+    writeRow(profile, end_getFlower(end), end, "endAlignment", sequenceNumber, totalSequenceLength,
+            pairwiseAlignmentNumber, alignedPairNumber, time, peakRssDelta);
+}
+
+void barProfile_addStage(BarProfile *profile, Flower *flower, const char *stage, double time, int64_t peakRssDelta) {
+    writeRow(profile, flower, NULL, stage, -1, -1, -1, -1, time, peakRssDelta);
+}
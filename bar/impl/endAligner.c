@@ -52,9 +52,261 @@ int alignedPair_cmpFn(const AlignedPair *alignedPair1, const AlignedPair *aligne
     return i;
 }
 
-stSortedSet *makeEndAlignment(StateMachine *sM, End *end, int64_t spanningTrees, int64_t maxSequenceLength,
+/*
+ * One side of an aligned pair, as held by an end alignment before it is sorted.
+ */
+typedef struct _EndAlignmentEntry {
+    int64_t subsequenceIdentifier;
+    int64_t position;
+    int64_t score;
+    int64_t reverseSubsequenceIdentifier;
+    int64_t reversePosition;
+    bool strand;
+    bool reverseStrand;
+} EndAlignmentEntry;
+
+static int endAlignmentEntry_cmpFnP(int64_t subsequenceIdentifier1, int64_t position1, bool strand1,
+        int64_t subsequenceIdentifier2, int64_t position2, bool strand2) {
+    int i = cactusMisc_nameCompare(subsequenceIdentifier1, subsequenceIdentifier2);
+    if(i == 0) {
+        i = position1 > position2 ? 1 : (position1 < position2 ? -1 : 0);
+        if(i == 0) {
+            i = strand1 == strand2 ? 0 : (strand1 ? 1 : -1);
+        }
+    }
+    return i;
+}
+
+/*
+ * Orders entries as alignedPair_cmpFn orders aligned pairs.
+ */
+static int endAlignmentEntry_cmpFn(const EndAlignmentEntry *entry1, const EndAlignmentEntry *entry2) {
+    int i = endAlignmentEntry_cmpFnP(entry1->subsequenceIdentifier, entry1->position, entry1->strand,
+            entry2->subsequenceIdentifier, entry2->position, entry2->strand);
+    if(i == 0) {
+        i = endAlignmentEntry_cmpFnP(entry1->reverseSubsequenceIdentifier, entry1->reversePosition, entry1->reverseStrand,
+                entry2->reverseSubsequenceIdentifier, entry2->reversePosition, entry2->reverseStrand);
+    }
+    return i;
+}
+
+EndAlignment *endAlignment_construct(void) {
+    EndAlignment *endAlignment = st_calloc(1, sizeof(EndAlignment));
+    endAlignment->unsortedMaxLength = 16;
+    endAlignment->unsortedEntries = st_malloc(endAlignment->unsortedMaxLength * sizeof(EndAlignmentEntry));
+    return endAlignment;
+}
+
+void endAlignment_destruct(EndAlignment *endAlignment) {
+    free(endAlignment->subsequenceIdentifiers);
+    free(endAlignment->positions);
+    free(endAlignment->scores);
+    free(endAlignment->reverse);
+    free(endAlignment->strands);
+    free(endAlignment->deleted);
+    free(endAlignment->unsortedEntries);
+    free(endAlignment);
+}
+
+static void endAlignment_addEntry(EndAlignment *endAlignment, int64_t subsequenceIdentifier1, int64_t position1, bool strand1,
+        int64_t score1, int64_t subsequenceIdentifier2, int64_t position2, bool strand2) {
+    if(endAlignment->unsortedEntries == NULL) {
+        st_errAbort("Tried to add an aligned pair to an end alignment that has already been sorted\n");
+    }
+    if(endAlignment->unsortedLength == endAlignment->unsortedMaxLength) {
+        endAlignment->unsortedMaxLength *= 2;
+        endAlignment->unsortedEntries = st_realloc(endAlignment->unsortedEntries,
+                endAlignment->unsortedMaxLength * sizeof(EndAlignmentEntry));
+    }
+    EndAlignmentEntry *entry = &endAlignment->unsortedEntries[endAlignment->unsortedLength++];
+    entry->subsequenceIdentifier = subsequenceIdentifier1;
+    entry->position = position1;
+    entry->strand = strand1;
+    entry->score = score1;
+    entry->reverseSubsequenceIdentifier = subsequenceIdentifier2;
+    entry->reversePosition = position2;
+    entry->reverseStrand = strand2;
+}
+
+void endAlignment_reserve(EndAlignment *endAlignment, int64_t pairNumber) {
+    if(endAlignment->unsortedEntries == NULL) {
+        st_errAbort("Tried to reserve space in an end alignment that has already been sorted\n");
+    }
+    if(endAlignment->unsortedMaxLength < endAlignment->unsortedLength + 2 * pairNumber) {
+        endAlignment->unsortedMaxLength = endAlignment->unsortedLength + 2 * pairNumber;
+        endAlignment->unsortedEntries = st_realloc(endAlignment->unsortedEntries,
+                endAlignment->unsortedMaxLength * sizeof(EndAlignmentEntry));
+    }
+}
+
+void endAlignment_addPair(EndAlignment *endAlignment, int64_t subsequenceIdentifier1, int64_t position1, bool strand1,
+        int64_t subsequenceIdentifier2, int64_t position2, bool strand2, int64_t score1, int64_t score2) {
+    endAlignment_addEntry(endAlignment, subsequenceIdentifier1, position1, strand1, score1,
+            subsequenceIdentifier2, position2, strand2);
+    endAlignment_addEntry(endAlignment, subsequenceIdentifier2, position2, strand2, score2,
+            subsequenceIdentifier1, position1, strand1);
+}
+
+void endAlignment_sort(EndAlignment *endAlignment) {
+    if(endAlignment->unsortedEntries == NULL) {
+        st_errAbort("Tried to sort an end alignment twice\n");
+    }
+    EndAlignmentEntry *entries = endAlignment->unsortedEntries;
+    int64_t length = endAlignment->unsortedLength;
+    qsort(entries, length, sizeof(EndAlignmentEntry), (int (*)(const void *, const void *))endAlignmentEntry_cmpFn);
+
+    endAlignment->length = length;
+    endAlignment->deletedLength = 0;
+    endAlignment->subsequenceIdentifiers = st_malloc(length * sizeof(int64_t));
+    endAlignment->positions = st_malloc(length * sizeof(int64_t));
+    endAlignment->scores = st_malloc(length * sizeof(int64_t));
+    endAlignment->reverse = st_malloc(length * sizeof(int64_t));
+    endAlignment->strands = st_malloc(length * sizeof(bool));
+    endAlignment->deleted = st_calloc(length, sizeof(bool));
+    for(int64_t i=0; i<length; i++) {
+        EndAlignmentEntry *entry = &entries[i];
+        if(i > 0 && endAlignmentEntry_cmpFn(&entries[i-1], entry) == 0) {
+            st_errAbort("Got a duplicate aligned pair in an end alignment: %" PRIi64 " %" PRIi64 " %i\n",
+                    entry->subsequenceIdentifier, entry->position, entry->strand);
+        }
+        endAlignment->subsequenceIdentifiers[i] = entry->subsequenceIdentifier;
+        endAlignment->positions[i] = entry->position;
+        endAlignment->scores[i] = entry->score;
+        endAlignment->strands[i] = entry->strand;
+        //Find the other side of the pair.
+        EndAlignmentEntry reverseEntry;
+        reverseEntry.subsequenceIdentifier = entry->reverseSubsequenceIdentifier;
+        reverseEntry.position = entry->reversePosition;
+        reverseEntry.strand = entry->reverseStrand;
+        reverseEntry.reverseSubsequenceIdentifier = entry->subsequenceIdentifier;
+        reverseEntry.reversePosition = entry->position;
+        reverseEntry.reverseStrand = entry->strand;
+        EndAlignmentEntry *reverse = bsearch(&reverseEntry, entries, length, sizeof(EndAlignmentEntry),
+                (int (*)(const void *, const void *))endAlignmentEntry_cmpFn);
+        if(reverse == NULL) {
+            st_errAbort("Got an aligned pair without its reverse in an end alignment: %" PRIi64 " %" PRIi64 " %i\n",
+                    entry->subsequenceIdentifier, entry->position, entry->strand);
+        }
+        endAlignment->reverse[i] = reverse - entries;
+    }
+    free(entries);
+    endAlignment->unsortedEntries = NULL;
+    endAlignment->unsortedLength = 0;
+    endAlignment->unsortedMaxLength = 0;
+}
+
+int64_t endAlignment_getFirstIndex(EndAlignment *endAlignment, int64_t subsequenceIdentifier, int64_t position) {
+    int64_t i = 0, j = endAlignment->length;
+    while(i < j) {
+        int64_t k = i + (j - i) / 2;
+        int64_t l = cactusMisc_nameCompare(endAlignment->subsequenceIdentifiers[k], subsequenceIdentifier);
+        if(l < 0 || (l == 0 && endAlignment->positions[k] < position)) {
+            i = k + 1;
+        } else {
+            j = k;
+        }
+    }
+    return i;
+}
+
+void endAlignment_deletePair(EndAlignment *endAlignment, int64_t index) {
+    assert(!endAlignment->deleted[index]);
+    assert(!endAlignment->deleted[endAlignment->reverse[index]]);
+    endAlignment->deleted[index] = 1;
+    endAlignment->deleted[endAlignment->reverse[index]] = 1;
+    endAlignment->deletedLength += 2;
+}
+
+int64_t endAlignment_getPairNumber(EndAlignment *endAlignment) {
+    return (endAlignment->length - endAlignment->deletedLength) / 2;
+}
+
+EndAlignment *endAlignment_constructFromSortedSet(stSortedSet *alignedPairs) {
+    EndAlignment *endAlignment = endAlignment_construct();
+    stSortedSetIterator *it = stSortedSet_getIterator(alignedPairs);
+    AlignedPair *aP;
+    while((aP = stSortedSet_getNext(it)) != NULL) {
+        endAlignment_addEntry(endAlignment, aP->subsequenceIdentifier, aP->position, aP->strand, aP->score,
+                aP->reverse->subsequenceIdentifier, aP->reverse->position, aP->reverse->strand);
+    }
+    stSortedSet_destructIterator(it);
+    endAlignment_sort(endAlignment);
+    return endAlignment;
+}
+
+void endAlignment_addToSortedSet(EndAlignment *endAlignment, stSortedSet *alignedPairs) {
+    for(int64_t i=0; i<endAlignment->length; i++) {
+        int64_t j = endAlignment->reverse[i];
+        if(!endAlignment->deleted[i] && i < j) {
+            AlignedPair *alignedPair = alignedPair_construct(
+                    endAlignment->subsequenceIdentifiers[i], endAlignment->positions[i], endAlignment->strands[i],
+                    endAlignment->subsequenceIdentifiers[j], endAlignment->positions[j], endAlignment->strands[j],
+                    endAlignment->scores[i], endAlignment->scores[j]);
+            assert(stSortedSet_search(alignedPairs, alignedPair) == NULL);
+            assert(stSortedSet_search(alignedPairs, alignedPair->reverse) == NULL);
+            stSortedSet_insert(alignedPairs, alignedPair);
+            stSortedSet_insert(alignedPairs, alignedPair->reverse);
+        }
+    }
+}
+
+void endAligner_addAlignedPairs(MultipleAlignment *mA,
+        void (*alignedPairFn)(void *extraArg, int64_t score, int64_t sequence1, int64_t offset1, int64_t sequence2,
+                int64_t offset2), void *extraArg) {
+    while(stList_length(mA->alignedPairs) > 0) {
+        stIntTuple *alignedPair = stList_pop(mA->alignedPairs);
+        assert(stIntTuple_length(alignedPair) == 5);
+        alignedPairFn(extraArg, stIntTuple_get(alignedPair, 0), stIntTuple_get(alignedPair, 1),
+                stIntTuple_get(alignedPair, 2), stIntTuple_get(alignedPair, 3), stIntTuple_get(alignedPair, 4));
+        stIntTuple_destruct(alignedPair);
+    }
+}
+
+/*
+ * The coordinates and score adjustments of a sequence in an end alignment.
+ */
+typedef struct _AlignedSequence {
+    int64_t subsequenceIdentifier;
+    int64_t start;
+    bool strand;
+    int64_t rightEndId;
+    double scoreAdjustmentNonCommonEnds;
+    double scoreAdjustmentCommonEnds;
+} AlignedSequence;
+
+typedef struct _EndAlignmentBuilder {
+    EndAlignment *endAlignment;
+    AlignedSequence *alignedSequences;
+} EndAlignmentBuilder;
+
+static void addAlignedPairToEndAlignment(void *extraArg, int64_t score, int64_t seqIndex1, int64_t offset1,
+        int64_t seqIndex2, int64_t offset2) {
+    EndAlignmentBuilder *builder = extraArg;
+    AlignedSequence *i = &builder->alignedSequences[seqIndex1];
+    AlignedSequence *j = &builder->alignedSequences[seqIndex2];
+    assert(i != j);
+    if(score <= 0) { //Happens when indel probs are included
+        score = 1; //This is the minimum
+    }
+    assert(score > 0 && score <= PAIR_ALIGNMENT_PROB_1);
+    bool commonEnds = i->rightEndId == j->rightEndId;
+    double scoreAdjustment1 = commonEnds ? i->scoreAdjustmentCommonEnds : i->scoreAdjustmentNonCommonEnds;
+    double scoreAdjustment2 = commonEnds ? j->scoreAdjustmentCommonEnds : j->scoreAdjustmentNonCommonEnds;
+    assert(scoreAdjustment1 != INT64_MIN);
+    assert(scoreAdjustment2 != INT64_MIN);
+    endAlignment_addPair(builder->endAlignment,
+            i->subsequenceIdentifier, i->start + (i->strand ? offset1 : -offset1), i->strand,
+            j->subsequenceIdentifier, j->start + (j->strand ? offset2 : -offset2), j->strand,
+            score*scoreAdjustment1, score*scoreAdjustment2); //Do the reweighting here.
+}
+
+EndAlignment *makeCompactEndAlignment(StateMachine *sM, End *end, int64_t spanningTrees, int64_t maxSequenceLength,
         bool useProgressiveMerging, float gapGamma,
-        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters) {
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, AdjacencySequenceCache *adjacencySequenceCache,
+        BarProfile *profile) {
+    double startTime = profile != NULL ? barProfile_getTime() : 0.0;
+    int64_t startPeakRss = profile != NULL ? barProfile_getPeakRss() : 0;
+
     //Make an alignment of the sequences in the ends
 
     //Get the adjacency sequences to be aligned.
@@ -67,7 +319,9 @@ stSortedSet *makeEndAlignment(StateMachine *sM, End *end, int64_t spanningTrees,
         if(cap_getSide(cap)) {
             cap = cap_getReverse(cap);
         }
-        AdjacencySequence *adjacencySequence = adjacencySequence_construct(cap, maxSequenceLength);
+        AdjacencySequence *adjacencySequence = adjacencySequenceCache != NULL
+                ? adjacencySequenceCache_getAdjacencySequence(adjacencySequenceCache, cap, maxSequenceLength)
+                : adjacencySequence_construct(cap, maxSequenceLength);
         stList_append(sequences, adjacencySequence);
         assert(cap_getAdjacency(cap) != NULL);
         End *otherEnd = end_getPositiveOrientation(cap_getEnd(cap_getAdjacency(cap)));
@@ -103,9 +357,8 @@ stSortedSet *makeEndAlignment(StateMachine *sM, End *end, int64_t spanningTrees,
         pairwiseAlignmentsPerSequence[seq1]++;
         pairwiseAlignmentsPerSequence[seq2]++;
     }
-    //Now calculate score adjustments.
-    double *scoreAdjustmentsNonCommonEnds = st_malloc(stList_length(seqFrags) * sizeof(double));
-    double *scoreAdjustmentsCommonEnds = st_malloc(stList_length(seqFrags) * sizeof(double));
+    //Now calculate score adjustments, packing them with the coordinates of each sequence.
+    AlignedSequence *alignedSequences = st_malloc(stList_length(seqFrags) * sizeof(AlignedSequence));
     for(int64_t i=0; i<stList_length(seqFrags); i++) {
         SeqFrag *seqFrag = stList_get(seqFrags, i);
         End *otherEnd = flower_getEnd(end_getFlower(end), seqFrag->rightEndId);
@@ -120,60 +373,48 @@ stSortedSet *makeEndAlignment(StateMachine *sM, End *end, int64_t spanningTrees,
         assert(pairwiseAlignmentsPerSequenceCommonEnds[i] < commonInstanceNumber);
         assert(pairwiseAlignmentsPerSequenceCommonEnds[i] >= 0);
 
-        //scoreAdjustmentsNonCommonEnds[i] = ((double)nonCommonInstanceNumber + commonInstanceNumber - 1)/(pairwiseAlignmentsPerSequenceNonCommonEnds[i] + pairwiseAlignmentsPerSequenceCommonEnds[i]);
-        //scoreAdjustmentsCommonEnds[i] = scoreAdjustmentsNonCommonEnds[i];
+        //alignedSequences[i].scoreAdjustmentNonCommonEnds = ((double)nonCommonInstanceNumber + commonInstanceNumber - 1)/(pairwiseAlignmentsPerSequenceNonCommonEnds[i] + pairwiseAlignmentsPerSequenceCommonEnds[i]);
+        //alignedSequences[i].scoreAdjustmentCommonEnds = alignedSequences[i].scoreAdjustmentNonCommonEnds;
         if(pairwiseAlignmentsPerSequenceNonCommonEnds[i] > 0) {
-            scoreAdjustmentsNonCommonEnds[i] = ((double)nonCommonInstanceNumber)/pairwiseAlignmentsPerSequenceNonCommonEnds[i];
-            assert(scoreAdjustmentsNonCommonEnds[i] >= 1.0);
-            assert(scoreAdjustmentsNonCommonEnds[i] <= nonCommonInstanceNumber);
+            alignedSequences[i].scoreAdjustmentNonCommonEnds = ((double)nonCommonInstanceNumber)/pairwiseAlignmentsPerSequenceNonCommonEnds[i];
+            assert(alignedSequences[i].scoreAdjustmentNonCommonEnds >= 1.0);
+            assert(alignedSequences[i].scoreAdjustmentNonCommonEnds <= nonCommonInstanceNumber);
         }
         else {
-            scoreAdjustmentsNonCommonEnds[i] = INT64_MIN;
+            alignedSequences[i].scoreAdjustmentNonCommonEnds = INT64_MIN;
         }
         if(pairwiseAlignmentsPerSequenceCommonEnds[i] > 0) {
-            scoreAdjustmentsCommonEnds[i] = ((double)commonInstanceNumber-1)/pairwiseAlignmentsPerSequenceCommonEnds[i];
-            assert(scoreAdjustmentsCommonEnds[i] >= 1.0);
-            assert(scoreAdjustmentsCommonEnds[i] <= commonInstanceNumber-1);
+            alignedSequences[i].scoreAdjustmentCommonEnds = ((double)commonInstanceNumber-1)/pairwiseAlignmentsPerSequenceCommonEnds[i];
+            assert(alignedSequences[i].scoreAdjustmentCommonEnds >= 1.0);
+            assert(alignedSequences[i].scoreAdjustmentCommonEnds <= commonInstanceNumber-1);
         }
         else {
-            scoreAdjustmentsCommonEnds[i] = INT64_MIN;
+            alignedSequences[i].scoreAdjustmentCommonEnds = INT64_MIN;
         }
+        AdjacencySequence *adjacencySequence = stList_get(sequences, i);
+        alignedSequences[i].subsequenceIdentifier = adjacencySequence->subsequenceIdentifier;
+        alignedSequences[i].start = adjacencySequence->start;
+        alignedSequences[i].strand = adjacencySequence->strand;
+        alignedSequences[i].rightEndId = seqFrag->rightEndId;
     }
 
-	//Convert the alignment pairs to an alignment of the caps..
-    stSortedSet *sortedAlignment =
-                stSortedSet_construct3((int (*)(const void *, const void *))alignedPair_cmpFn,
-                (void (*)(void *))alignedPair_destruct);
-    while(stList_length(mA->alignedPairs) > 0) {
-        stIntTuple *alignedPair = stList_pop(mA->alignedPairs);
-        assert(stIntTuple_length(alignedPair) == 5);
-        int64_t seqIndex1 = stIntTuple_get(alignedPair, 1);
-        int64_t seqIndex2 = stIntTuple_get(alignedPair, 3);
-        AdjacencySequence *i = stList_get(sequences, seqIndex1);
-        AdjacencySequence *j = stList_get(sequences, seqIndex2);
-        assert(i != j);
-        int64_t offset1 = stIntTuple_get(alignedPair, 2);
-        int64_t offset2 = stIntTuple_get(alignedPair, 4);
-        int64_t score = stIntTuple_get(alignedPair, 0);
-        if(score <= 0) { //Happens when indel probs are included
-            score = 1; //This is the minimum
-        }
-        assert(score > 0 && score <= PAIR_ALIGNMENT_PROB_1);
-        SeqFrag *seqFrag1 = stList_get(seqFrags, seqIndex1);
-        SeqFrag *seqFrag2 = stList_get(seqFrags, seqIndex2);
-        assert(seqFrag1 != seqFrag2);
-        double *scoreAdjustments = seqFrag1->rightEndId == seqFrag2->rightEndId ? scoreAdjustmentsCommonEnds : scoreAdjustmentsNonCommonEnds;
-        assert(scoreAdjustments[seqIndex1] != INT64_MIN);
-        assert(scoreAdjustments[seqIndex2] != INT64_MIN);
-        AlignedPair *alignedPair2 = alignedPair_construct(
-                i->subsequenceIdentifier, i->start + (i->strand ? offset1 : -offset1), i->strand,
-                j->subsequenceIdentifier, j->start + (j->strand ? offset2 : -offset2), j->strand,
-                score*scoreAdjustments[seqIndex1], score*scoreAdjustments[seqIndex2]); //Do the reweighting here.
-        assert(stSortedSet_search(sortedAlignment, alignedPair2) == NULL);
-        assert(stSortedSet_search(sortedAlignment, alignedPair2->reverse) == NULL);
-        stSortedSet_insert(sortedAlignment, alignedPair2);
-        stSortedSet_insert(sortedAlignment, alignedPair2->reverse);
-        stIntTuple_destruct(alignedPair);
+	//Convert the alignment pairs to an alignment of the caps, in one pass over the pairs.
+    EndAlignment *endAlignment = endAlignment_construct();
+    endAlignment_reserve(endAlignment, stList_length(mA->alignedPairs));
+    EndAlignmentBuilder builder;
+    builder.endAlignment = endAlignment;
+    builder.alignedSequences = alignedSequences;
+    endAligner_addAlignedPairs(mA, addAlignedPairToEndAlignment, &builder);
+    endAlignment_sort(endAlignment); //Also checks there are no duplicate pairs.
+
+    if (profile != NULL) {
+        int64_t totalSequenceLength = 0;
+        for (int64_t i = 0; i < stList_length(seqFrags); i++) {
+            totalSequenceLength += ((SeqFrag *)stList_get(seqFrags, i))->length;
+        }
+        barProfile_addEndAlignment(profile, end, stList_length(seqFrags), totalSequenceLength,
+                stList_length(mA->chosenPairwiseAlignments), endAlignment_getPairNumber(endAlignment),
+                barProfile_getTime() - startTime, barProfile_getPeakRss() - startPeakRss);
     }
 
     //Cleanup
@@ -181,11 +422,23 @@ stSortedSet *makeEndAlignment(StateMachine *sM, End *end, int64_t spanningTrees,
     stList_destruct(sequences);
     free(pairwiseAlignmentsPerSequenceNonCommonEnds);
     free(pairwiseAlignmentsPerSequenceCommonEnds);
-    free(scoreAdjustmentsNonCommonEnds);
-    free(scoreAdjustmentsCommonEnds);
+    free(alignedSequences);
     multipleAlignment_destruct(mA);
     stHash_destruct(endInstanceNumbers);
 
+    return endAlignment;
+}
+
+stSortedSet *makeEndAlignment(StateMachine *sM, End *end, int64_t spanningTrees, int64_t maxSequenceLength,
+        bool useProgressiveMerging, float gapGamma,
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters) {
+    EndAlignment *endAlignment = makeCompactEndAlignment(sM, end, spanningTrees, maxSequenceLength,
+            useProgressiveMerging, gapGamma, pairwiseAlignmentBandingParameters, NULL, NULL);
+    stSortedSet *sortedAlignment =
+                stSortedSet_construct3((int (*)(const void *, const void *))alignedPair_cmpFn,
+                (void (*)(void *))alignedPair_destruct);
+    endAlignment_addToSortedSet(endAlignment, sortedAlignment);
+    endAlignment_destruct(endAlignment);
     return sortedAlignment;
 }
 
@@ -201,41 +454,291 @@ void writeEndAlignmentToDisk(End *end, stSortedSet *endAlignment, FILE *fileHand
     stSortedSet_destructIterator(it);
 }
 
-stSortedSet *loadEndAlignmentFromDisk(Flower *flower, FILE *fileHandle, End **end) {
-    stSortedSet *endAlignment =
-                stSortedSet_construct3((int (*)(const void *, const void *))alignedPair_cmpFn,
-                (void (*)(void *))alignedPair_destruct);
+void writeCompactEndAlignmentToDisk(End *end, EndAlignment *endAlignment, FILE *fileHandle) {
+    fprintf(fileHandle, "%s %" PRIi64 "\n", cactusMisc_nameToStringStatic(end_getName(end)),
+            endAlignment->length - endAlignment->deletedLength);
+    for(int64_t i=0; i<endAlignment->length; i++) {
+        if(!endAlignment->deleted[i]) {
+            int64_t j = endAlignment->reverse[i];
+            fprintf(fileHandle, "%" PRIi64 " %" PRIi64 " %i %" PRIi64 " ", endAlignment->subsequenceIdentifiers[i],
+                    endAlignment->positions[i], endAlignment->strands[i], endAlignment->scores[i]);
+            fprintf(fileHandle, "%" PRIi64 " %" PRIi64 " %i %" PRIi64 "\n", endAlignment->subsequenceIdentifiers[j],
+                    endAlignment->positions[j], endAlignment->strands[j], endAlignment->scores[j]);
+        }
+    }
+}
+
+EndAlignment *loadCompactEndAlignmentFromDisk(Flower *flower, FILE *fileHandle, End **end) {
     char *line = stFile_getLineFromFile(fileHandle);
     if(line == NULL) {
         *end = NULL;
         return NULL;
     }
-    Name flowerName;
+    Name endName;
     int64_t lineNumber;
-    int64_t i = sscanf(line, "%" PRIi64 " %" PRIi64 "", &flowerName, &lineNumber);
+    int64_t i = sscanf(line, "%" PRIi64 " %" PRIi64 "", &endName, &lineNumber);
     if(i != 2 || lineNumber < 0) {
         st_errAbort("We encountered a mis-specified name in loading the first line of an end alignment from the disk: '%s'\n", line);
     }
-    free(line);
-    *end = flower_getEnd(flower, flowerName);
+    *end = flower_getEnd(flower, endName);
     if(*end == NULL) {
         st_errAbort("We encountered an end name that is not in the database: '%s'\n", line);
     }
-    for(int64_t i=0; i<lineNumber; i++) {
+    free(line);
+    EndAlignment *endAlignment = endAlignment_construct();
+    for(int64_t k=0; k<lineNumber; k++) {
         line = stFile_getLineFromFile(fileHandle);
         if(line == NULL) {
             st_errAbort("Got a null line when parsing an end alignment\n");
         }
         int64_t sI1, sI2;
         int64_t p1, st1, p2, st2, score1, score2;
-        int64_t i = sscanf(line, "%" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64 "", &sI1, &p1, &st1, &score1, &sI2, &p2, &st2, &score2);
-        (void)i;
-        if(i != 8) {
+        int64_t j = sscanf(line, "%" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64 "", &sI1, &p1, &st1, &score1, &sI2, &p2, &st2, &score2);
+        if(j != 8) {
             st_errAbort("We encountered a mis-specified name in loading an end alignment from the disk: '%s'\n", line);
         }
-        stSortedSet_insert(endAlignment, alignedPair_construct(sI1, p1, st1, sI2, p2, st2, score1, score2));
+        //Each line is one side of a pair, the other side has its own line.
+        endAlignment_addEntry(endAlignment, sI1, p1, st1, score1, sI2, p2, st2);
         free(line);
     }
+    endAlignment_sort(endAlignment);
     return endAlignment;
 }
 
+stSortedSet *loadEndAlignmentFromDisk(Flower *flower, FILE *fileHandle, End **end) {
+    EndAlignment *endAlignment = loadCompactEndAlignmentFromDisk(flower, fileHandle, end);
+    if(endAlignment == NULL) {
+        return NULL;
+    }
+    stSortedSet *sortedAlignment =
+                stSortedSet_construct3((int (*)(const void *, const void *))alignedPair_cmpFn,
+                (void (*)(void *))alignedPair_destruct);
+    endAlignment_addToSortedSet(endAlignment, sortedAlignment);
+    endAlignment_destruct(endAlignment);
+    return sortedAlignment;
+}
+
+/*
+ * Estimating the time taken to make end alignments.
+ */
+
+//Uncalibrated estimates, see endAligner.h.
+const AlignmentTimeModel defaultAlignmentTimeModel = { 1.0e-3, 3.0e-8, 5.0e-7 };
+
+static int cmpLengths(const void *a, const void *b) {
+    int64_t i = *(const int64_t *)a, j = *(const int64_t *)b;
+    return i < j ? -1 : (i > j ? 1 : 0);
+}
+
+/*
+ * Gets the total number of dynamic programming cells over all pairs of the sequences. A pair whose
+ * matrix is no bigger than anchorMatrixBiggerThanThis is aligned in full, otherwise it is banded
+ * around its anchors, to a width set by diagonalExpansion.
+ */
+static double getTotalPairwiseCells(const int64_t *sequenceLengths, int64_t sequenceNumber,
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters) {
+    int64_t *lengths = st_malloc(sizeof(int64_t) * (sequenceNumber + 1));
+    memcpy(lengths, sequenceLengths, sizeof(int64_t) * sequenceNumber);
+    qsort(lengths, sequenceNumber, sizeof(int64_t), cmpLengths);
+    double *cumulativeLengths = st_malloc(sizeof(double) * (sequenceNumber + 1));
+    cumulativeLengths[0] = 0.0;
+    for (int64_t i = 0; i < sequenceNumber; i++) {
+        cumulativeLengths[i + 1] = cumulativeLengths[i] + lengths[i];
+    }
+    double bandWidth = 2 * pairwiseAlignmentBandingParameters->diagonalExpansion + 1;
+    double totalCells = 0.0;
+    //For each sequence, the longer sequences it is paired with are aligned in full up to some length,
+    //and banded beyond it.
+    for (int64_t i = 0, j = sequenceNumber; i < sequenceNumber; i++) {
+        double length = lengths[i];
+        while (j > i + 1 && length * lengths[j - 1] > pairwiseAlignmentBandingParameters->anchorMatrixBiggerThanThis) {
+            j--;
+        }
+        if (j < i + 1) {
+            j = i + 1;
+        }
+        //Full matrices with sequences i+1 to j-1, banded with sequences j onwards.
+        double fullCells = length * (cumulativeLengths[j] - cumulativeLengths[i + 1]);
+        double bandedCells = bandWidth * (length * (sequenceNumber - j) + cumulativeLengths[sequenceNumber] - cumulativeLengths[j]);
+        totalCells += fullCells + bandedCells;
+    }
+    free(lengths);
+    free(cumulativeLengths);
+    return totalCells;
+}
+
+double estimateAlignmentTime(const int64_t *sequenceLengths, int64_t sequenceNumber, int64_t spanningTrees,
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, const AlignmentTimeModel *model) {
+    double time = model->secondsPerAlignment;
+    if (sequenceNumber < 2) {
+        return time;
+    }
+    //Only a subset of the pairs are aligned if there are more than the spanning trees allow,
+    //so scale the totals over all pairs by the proportion aligned.
+    double pairNumber = ((double)sequenceNumber) * (sequenceNumber - 1) / 2;
+    double alignedPairNumber = pairNumber;
+    if (alignedPairNumber > ((double)sequenceNumber) * spanningTrees) {
+        alignedPairNumber = ((double)sequenceNumber) * spanningTrees;
+    }
+    double totalLength = 0.0;
+    for (int64_t i = 0; i < sequenceNumber; i++) {
+        totalLength += sequenceLengths[i];
+    }
+    //Each sequence is in sequenceNumber - 1 pairs.
+    double alignedBases = totalLength * (sequenceNumber - 1) * alignedPairNumber / pairNumber;
+    double cells = getTotalPairwiseCells(sequenceLengths, sequenceNumber, pairwiseAlignmentBandingParameters)
+            * alignedPairNumber / pairNumber;
+    return time + model->secondsPerCell * cells + model->secondsPerAlignedBase * alignedBases;
+}
+
+/*
+ * Gets the lengths of the adjacency sequences of the end, as they will be aligned.
+ */
+static int64_t *getEndSequenceLengths(End *end, int64_t maxSequenceLength, int64_t *sequenceNumber) {
+    int64_t *sequenceLengths = st_malloc(sizeof(int64_t) * (end_getInstanceNumber(end) + 1));
+    *sequenceNumber = 0;
+    End_InstanceIterator *capIt = end_getInstanceIterator(end);
+    Cap *cap;
+    while ((cap = end_getNext(capIt)) != NULL) {
+        Cap *adjacentCap = cap_getAdjacency(cap);
+        assert(adjacentCap != NULL);
+        int64_t length = llabs(cap_getCoordinate(adjacentCap) - cap_getCoordinate(cap)) - 1;
+        sequenceLengths[(*sequenceNumber)++] = length > maxSequenceLength ? maxSequenceLength : length;
+    }
+    end_destructInstanceIterator(capIt);
+    return sequenceLengths;
+}
+
+double estimateEndAlignmentTime(End *end, int64_t spanningTrees, int64_t maxSequenceLength,
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters) {
+    int64_t sequenceNumber;
+    int64_t *sequenceLengths = getEndSequenceLengths(end, maxSequenceLength, &sequenceNumber);
+    double time = estimateAlignmentTime(sequenceLengths, sequenceNumber, spanningTrees,
+            pairwiseAlignmentBandingParameters, &defaultAlignmentTimeModel);
+    free(sequenceLengths);
+    return time;
+}
+
+/*
+ * Estimating the memory taken to make end alignments.
+ */
+
+//Bytes per cell of a pairwise dynamic programming matrix, holding forward and backward values for five states.
+static const double bytesPerCell = 2 * 5 * sizeof(double);
+//Bytes per aligned pair, held as a five element tuple in the multiple alignment and as two entries in the end
+//alignment.
+static const double bytesPerAlignedPair = 8 * sizeof(int64_t) + 2 * sizeof(EndAlignmentEntry);
+//Bytes per base of sequence, held in the adjacency sequence and its copy in the sequence fragment.
+static const double bytesPerBase = 2;
+
+/*
+ * Gets the number of cells in the largest matrix of any pair of the sequences, whose lengths are sorted.
+ * Matrices are computed one at a time, so only the largest is held at once.
+ */
+static double getMaxPairwiseCells(const int64_t *lengths, int64_t sequenceNumber,
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters) {
+    double maxCells = 0.0;
+    if (sequenceNumber < 2) {
+        return maxCells;
+    }
+    //The largest banded matrix is between the two longest sequences, if their matrix is banded.
+    double longest = lengths[sequenceNumber - 1], secondLongest = lengths[sequenceNumber - 2];
+    if (longest * secondLongest > pairwiseAlignmentBandingParameters->anchorMatrixBiggerThanThis) {
+        maxCells = (longest + secondLongest) * (2 * pairwiseAlignmentBandingParameters->diagonalExpansion + 1);
+    }
+    //The largest full matrix pairs each sequence with the longest shorter one whose matrix is not banded.
+    for (int64_t j = 1; j < sequenceNumber; j++) {
+        int64_t i = 0, k = j;
+        while (i < k) {
+            int64_t m = i + (k - i) / 2;
+            if (((double) lengths[m]) * lengths[j] <= pairwiseAlignmentBandingParameters->anchorMatrixBiggerThanThis) {
+                i = m + 1;
+            } else {
+                k = m;
+            }
+        }
+        if (i > 0 && ((double) lengths[i - 1]) * lengths[j] > maxCells) {
+            maxCells = ((double) lengths[i - 1]) * lengths[j];
+        }
+    }
+    return maxCells;
+}
+
+double estimateAlignmentMemory(const int64_t *sequenceLengths, int64_t sequenceNumber, int64_t spanningTrees,
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters) {
+    int64_t *lengths = st_malloc(sizeof(int64_t) * (sequenceNumber + 1));
+    memcpy(lengths, sequenceLengths, sizeof(int64_t) * sequenceNumber);
+    qsort(lengths, sequenceNumber, sizeof(int64_t), cmpLengths);
+    double totalLength = 0.0, alignedPairs = 0.0;
+    for (int64_t i = 0; i < sequenceNumber; i++) {
+        totalLength += lengths[i];
+        //Each pair aligns at most the length of the shorter sequence.
+        alignedPairs += ((double) lengths[i]) * (sequenceNumber - 1 - i);
+    }
+    double pairNumber = ((double) sequenceNumber) * (sequenceNumber - 1) / 2;
+    if (pairNumber > ((double) sequenceNumber) * spanningTrees) {
+        alignedPairs *= ((double) sequenceNumber) * spanningTrees / pairNumber;
+    }
+    double memory = bytesPerCell * getMaxPairwiseCells(lengths, sequenceNumber, pairwiseAlignmentBandingParameters)
+            + bytesPerAlignedPair * alignedPairs + bytesPerBase * totalLength;
+    free(lengths);
+    return memory;
+}
+
+//The smallest matrix, as the length of its side, that anchoring is tightened to.
+static const int64_t minimumAnchorMatrixSide = 10;
+
+double fitAlignmentToMemoryBudget(const int64_t *sequenceLengths, int64_t sequenceNumber, double memoryBudget,
+        int64_t *spanningTrees, PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters) {
+    int64_t minimumAnchorMatrix = minimumAnchorMatrixSide * minimumAnchorMatrixSide;
+    int64_t *lengths = st_malloc(sizeof(int64_t) * (sequenceNumber + 1));
+    memcpy(lengths, sequenceLengths, sizeof(int64_t) * sequenceNumber);
+    qsort(lengths, sequenceNumber, sizeof(int64_t), cmpLengths);
+    double memory;
+    while ((memory = estimateAlignmentMemory(lengths, sequenceNumber, *spanningTrees,
+            pairwiseAlignmentBandingParameters)) > memoryBudget) {
+        //Shrink whichever of the matrices and the aligned pairs takes the most memory, if it can be shrunk.
+        bool canTightenAnchoring = pairwiseAlignmentBandingParameters->anchorMatrixBiggerThanThis > minimumAnchorMatrix;
+        bool canReduceSpanningTrees = *spanningTrees > 1;
+        bool matricesDominate = bytesPerCell * getMaxPairwiseCells(lengths, sequenceNumber,
+                pairwiseAlignmentBandingParameters) >= memory / 2;
+        if (canTightenAnchoring && (matricesDominate || !canReduceSpanningTrees)) {
+            //Halve the side of the largest matrices computed without anchors.
+            pairwiseAlignmentBandingParameters->anchorMatrixBiggerThanThis /= 4;
+            if (pairwiseAlignmentBandingParameters->anchorMatrixBiggerThanThis < minimumAnchorMatrix) {
+                pairwiseAlignmentBandingParameters->anchorMatrixBiggerThanThis = minimumAnchorMatrix;
+            }
+            if (pairwiseAlignmentBandingParameters->repeatMaskMatrixBiggerThanThis
+                    > pairwiseAlignmentBandingParameters->anchorMatrixBiggerThanThis) {
+                pairwiseAlignmentBandingParameters->repeatMaskMatrixBiggerThanThis =
+                        pairwiseAlignmentBandingParameters->anchorMatrixBiggerThanThis;
+            }
+        } else if (canReduceSpanningTrees) {
+            *spanningTrees /= 2;
+        } else {
+            break;
+        }
+    }
+    free(lengths);
+    return memory;
+}
+
+void fitEndAlignmentToMemoryBudget(End *end, int64_t maxSequenceLength, double memoryBudget, int64_t *spanningTrees,
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters) {
+    int64_t sequenceNumber;
+    int64_t *sequenceLengths = getEndSequenceLengths(end, maxSequenceLength, &sequenceNumber);
+    double memory = estimateAlignmentMemory(sequenceLengths, sequenceNumber, *spanningTrees,
+            pairwiseAlignmentBandingParameters);
+    if (memory > memoryBudget) {
+        double fittedMemory = fitAlignmentToMemoryBudget(sequenceLengths, sequenceNumber, memoryBudget,
+                spanningTrees, pairwiseAlignmentBandingParameters);
+        st_logInfo("The alignment of end %s with %" PRIi64 " sequences is predicted to take %.0f bytes, more than the "
+                "budget of %.0f bytes, so aligning it with %" PRIi64 " spanning trees, anchorMatrixBiggerThanThis %"
+                PRIi64 " and repeatMaskMatrixBiggerThanThis %" PRIi64 ", predicted to take %.0f bytes%s\n",
+                cactusMisc_nameToStringStatic(end_getName(end)), sequenceNumber, memory, memoryBudget, *spanningTrees,
+                pairwiseAlignmentBandingParameters->anchorMatrixBiggerThanThis,
+                pairwiseAlignmentBandingParameters->repeatMaskMatrixBiggerThanThis, fittedMemory,
+                fittedMemory > memoryBudget ? ", still over the budget" : "");
+    }
+    free(sequenceLengths);
+}
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+// For fsync, ftruncate, fseeko and ftello declarations (technically POSIX extensions).
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "sonLib.h"
+#include "cactus.h"
+#include "endAlignmentCheckpoint.h"
+
+struct _EndAlignmentCheckpoint {
+    char *fileName;
+    FILE *fileHandle;
+    char *indexFileName;
+    FILE *indexFileHandle;
+    stList *endNames;
+    int64_t completedEndNumber;
+};
+
+/*
+ * Gets the contents of a file, or NULL if it can not be read.
+ */
+static char *readFile(const char *fileName, int64_t *length) {
+    FILE *fileHandle = fopen(fileName, "r");
+    if (fileHandle == NULL) {
+        return NULL;
+    }
+    int64_t size = 0, maxSize = 1024;
+    char *string = st_malloc(maxSize);
+    int64_t i;
+    while ((i = fread(string + size, 1, maxSize - size, fileHandle)) > 0) {
+        size += i;
+        if (size == maxSize) {
+            maxSize *= 2;
+            string = st_realloc(string, maxSize);
+        }
+    }
+    fclose(fileHandle);
+    *length = size;
+    return string;
+}
+
+static int64_t getFileSize(const char *fileName) {
+    FILE *fileHandle = fopen(fileName, "r");
+    if (fileHandle == NULL) {
+        return 0;
+    }
+    fseeko(fileHandle, 0, SEEK_END);
+    int64_t size = ftello(fileHandle);
+    fclose(fileHandle);
+    return size;
+}
+
+/*
+ * Flushes the file and waits until it is on disk.
+ */
+static void syncFile(FILE *fileHandle, const char *fileName) {
+    if (fflush(fileHandle) != 0 || fsync(fileno(fileHandle)) != 0) {
+        st_errnoAbort("Writing the file %s failed", fileName);
+    }
+}
+
+/*
+ * Finds the ends completed by an earlier run from the contents of its index, returning their number,
+ * the length of the file holding their alignments and the length of the index describing them.
+ * Only complete lines are read, and only entries following the given header, matching the names of
+ * the ends in order and lying within the file are accepted.
+ */
+static int64_t parseIndex(char *string, int64_t length, const char *header, stList *endNames, int64_t fileSize,
+        int64_t *completedLength, int64_t *indexLength) {
+    int64_t completedEndNumber = 0, headerLength = strlen(header);
+    *completedLength = 0;
+    *indexLength = headerLength + 1;
+    if (length <= headerLength || memcmp(string, header, headerLength) != 0 || string[headerLength] != '\n') {
+        return 0;
+    }
+    for (int64_t i = *indexLength; i < length && completedEndNumber < stList_length(endNames); i++) {
+        if (string[i] != '\n') {
+            continue;
+        }
+        string[i] = '\0';
+        Name endName;
+        int64_t offset;
+        int charsRead = 0;
+        int j = sscanf(string + *indexLength, "%" PRIi64 " %" PRIi64 "%n", &endName, &offset, &charsRead);
+        string[i] = '\n';
+        if (j != 2 || *indexLength + charsRead != i || endName != *(Name *) stList_get(endNames, completedEndNumber)
+                || offset <= *completedLength || offset > fileSize) {
+            break;
+        }
+        *completedLength = offset;
+        *indexLength = i + 1;
+        completedEndNumber++;
+    }
+    return completedEndNumber;
+}
+
+EndAlignmentCheckpoint *endAlignmentCheckpoint_construct(const char *fileName, const char *header, stList *endNames) {
+    EndAlignmentCheckpoint *checkpoint = st_malloc(sizeof(EndAlignmentCheckpoint));
+    checkpoint->fileName = stString_copy(fileName);
+    checkpoint->indexFileName = stString_print("%s.index", fileName);
+    checkpoint->endNames = endNames;
+    //The header must be a single line.
+    char *headerLine = stString_copy(header);
+    for (char *c = headerLine; *c != '\0'; c++) {
+        if (*c == '\n' || *c == '\r') {
+            *c = ' ';
+        }
+    }
+
+    //Rewrite the index with just the entries accepted, replacing the old one once the new one is on disk.
+    int64_t length, completedLength = 0, indexLength = 0;
+    char *string = readFile(checkpoint->indexFileName, &length);
+    checkpoint->completedEndNumber = string == NULL ? 0 : parseIndex(string, length, headerLine, endNames,
+            getFileSize(fileName), &completedLength, &indexLength);
+    char *temporaryIndexFileName = stString_print("%s.tmp", checkpoint->indexFileName);
+    FILE *indexFileHandle = fopen(temporaryIndexFileName, "w");
+    if (indexFileHandle == NULL) {
+        st_errnoAbort("Opening end alignment index file %s failed", temporaryIndexFileName);
+    }
+    if (checkpoint->completedEndNumber > 0) {
+        fwrite(string, 1, indexLength, indexFileHandle);
+    } else {
+        fprintf(indexFileHandle, "%s\n", headerLine);
+    }
+    syncFile(indexFileHandle, temporaryIndexFileName);
+    fclose(indexFileHandle);
+    free(string);
+
+    //Discard anything written after the last completed end.
+    if (checkpoint->completedEndNumber > 0) {
+        checkpoint->fileHandle = fopen(fileName, "r+");
+        if (checkpoint->fileHandle == NULL || ftruncate(fileno(checkpoint->fileHandle), completedLength) != 0
+                || fseeko(checkpoint->fileHandle, completedLength, SEEK_SET) != 0) {
+            st_errnoAbort("Resuming end alignment file %s failed", fileName);
+        }
+        st_logInfo("Resuming the end alignments in %s after %" PRIi64 " completed ends\n", fileName,
+                checkpoint->completedEndNumber);
+    } else {
+        checkpoint->fileHandle = fopen(fileName, "w");
+        if (checkpoint->fileHandle == NULL) {
+            st_errnoAbort("Opening end alignment file %s failed", fileName);
+        }
+    }
+    syncFile(checkpoint->fileHandle, fileName);
+    if (rename(temporaryIndexFileName, checkpoint->indexFileName) != 0) {
+        st_errnoAbort("Replacing end alignment index file %s failed", checkpoint->indexFileName);
+    }
+    checkpoint->indexFileHandle = fopen(checkpoint->indexFileName, "a");
+    if (checkpoint->indexFileHandle == NULL) {
+        st_errnoAbort("Opening end alignment index file %s failed", checkpoint->indexFileName);
+    }
+    free(headerLine);
+    free(temporaryIndexFileName);
+    return checkpoint;
+}
+
+void endAlignmentCheckpoint_destruct(EndAlignmentCheckpoint *checkpoint) {
+    fclose(checkpoint->fileHandle);
+    fclose(checkpoint->indexFileHandle);
+    free(checkpoint->fileName);
+    free(checkpoint->indexFileName);
+    free(checkpoint);
+}
+
+int64_t endAlignmentCheckpoint_getCompletedEndNumber(EndAlignmentCheckpoint *checkpoint) {
+    return checkpoint->completedEndNumber;
+}
+
+void endAlignmentCheckpoint_add(EndAlignmentCheckpoint *checkpoint, End *end, EndAlignment *endAlignment) {
+    assert(checkpoint->completedEndNumber < stList_length(checkpoint->endNames));
+    assert(end_getName(end) == *(Name *) stList_get(checkpoint->endNames, checkpoint->completedEndNumber));
+    //The alignment is on disk before the index says it is complete.
+    writeCompactEndAlignmentToDisk(end, endAlignment, checkpoint->fileHandle);
+    syncFile(checkpoint->fileHandle, checkpoint->fileName);
+    fprintf(checkpoint->indexFileHandle, "%" PRIi64 " %" PRIi64 "\n", end_getName(end),
+            (int64_t) ftello(checkpoint->fileHandle));
+    syncFile(checkpoint->indexFileHandle, checkpoint->indexFileName);
+    checkpoint->completedEndNumber++;
+}
@@ -4,6 +4,8 @@
  * Released under the MIT license, see LICENSE.txt
  */
 
+#include <math.h>
+
 #include "endAligner.h"
 #include "cactus.h"
 #include "sonLib.h"
@@ -13,6 +15,7 @@
 stList *getInducedAlignment(stSortedSet *endAlignment, AdjacencySequence *adjacencySequence) {
     /*
      * Gets an ordered list of pairs from the end alignment for the given adjacency sequence.
+     * The bar algorithm uses getCompactInducedAlignment, this is kept for testing.
      */
     stList *inducedAlignment = stList_construct();
     if (adjacencySequence->strand) {
@@ -83,15 +86,56 @@ stList *getInducedAlignment(stSortedSet *endAlignment, AdjacencySequence *adjace
     return inducedAlignment;
 }
 
+int64_t *getCompactInducedAlignment(EndAlignment *endAlignment, AdjacencySequence *adjacencySequence, int64_t *length) {
+    /*
+     * Gets the indices of the entries of the end alignment on the given adjacency sequence,
+     * ordered along the adjacency sequence as by getInducedAlignment. The entries lie in a
+     * contiguous range of the end alignment, so this is a scan of that range.
+     */
+    int64_t first, last;
+    if (adjacencySequence->strand) {
+        first = endAlignment_getFirstIndex(endAlignment, adjacencySequence->subsequenceIdentifier, adjacencySequence->start);
+        last = endAlignment_getFirstIndex(endAlignment, adjacencySequence->subsequenceIdentifier,
+                adjacencySequence->start + adjacencySequence->length);
+    } else {
+        first = endAlignment_getFirstIndex(endAlignment, adjacencySequence->subsequenceIdentifier,
+                adjacencySequence->start - adjacencySequence->length + 1);
+        last = endAlignment_getFirstIndex(endAlignment, adjacencySequence->subsequenceIdentifier, adjacencySequence->start + 1);
+    }
+    int64_t *inducedAlignment = st_malloc(sizeof(int64_t) * (last > first ? last - first : 1));
+    *length = 0;
+    for (int64_t i = first; i < last; i++) {
+        if (!endAlignment->deleted[i] && endAlignment->strands[i] == adjacencySequence->strand) {
+            inducedAlignment[(*length)++] = i;
+        }
+    }
+    if (!adjacencySequence->strand) { //Reverse, so the entries are ordered along the adjacency sequence.
+        for (int64_t i = 0, j = *length - 1; i < j; i++, j--) {
+            int64_t k = inducedAlignment[i];
+            inducedAlignment[i] = inducedAlignment[j];
+            inducedAlignment[j] = k;
+        }
+    }
+    return inducedAlignment;
+}
+
+/*
+ * The entries of an end alignment induced by an adjacency sequence, as indices into the end alignment.
+ */
+typedef struct _InducedAlignment {
+    EndAlignment *endAlignment;
+    int64_t *indices;
+    int64_t length;
+} InducedAlignment;
+
 /*
  * Runs along and cumulate the score of the pairs, traversing forward through the induced alignment.
  */
-static int64_t *cumulateScoreForward(stList *inducedAlignment1) {
-    int64_t *iA = st_malloc(sizeof(int64_t) * stList_length(inducedAlignment1));
+static int64_t *cumulateScoreForward(InducedAlignment *inducedAlignment1) {
+    int64_t *iA = st_malloc(sizeof(int64_t) * inducedAlignment1->length);
     int64_t totalScore = 0;
-    for (int64_t i = 0; i < stList_length(inducedAlignment1); i++) {
-        AlignedPair *alignedPair = stList_get(inducedAlignment1, i);
-        totalScore += alignedPair->score;
+    for (int64_t i = 0; i < inducedAlignment1->length; i++) {
+        totalScore += inducedAlignment1->endAlignment->scores[inducedAlignment1->indices[i]];
         iA[i] = totalScore;
     }
     return iA;
@@ -100,12 +144,11 @@ static int64_t *cumulateScoreForward(stList *inducedAlignment1) {
 /*
  * Runs along and cumulate the score of the pairs, traversing backward through the induced alignment.
  */
-static int64_t *cumulateScoreBackward(stList *inducedAlignment1) {
-    int64_t *iA = st_malloc(sizeof(int64_t) * stList_length(inducedAlignment1));
+static int64_t *cumulateScoreBackward(InducedAlignment *inducedAlignment1) {
+    int64_t *iA = st_malloc(sizeof(int64_t) * inducedAlignment1->length);
     int64_t totalScore = 0;
-    for (int64_t i = stList_length(inducedAlignment1) - 1; i >= 0; i--) {
-        AlignedPair *alignedPair = stList_get(inducedAlignment1, i);
-        totalScore += alignedPair->score;
+    for (int64_t i = inducedAlignment1->length - 1; i >= 0; i--) {
+        totalScore += inducedAlignment1->endAlignment->scores[inducedAlignment1->indices[i]];
         iA[i] = totalScore;
     }
     return iA;
@@ -114,15 +157,15 @@ static int64_t *cumulateScoreBackward(stList *inducedAlignment1) {
 /*
  * Chooses a point along the adjacency sequence at which to filter the two alignments,
  */
-static int64_t getCutOff(stList *inducedAlignment1, stList *inducedAlignment2, int64_t *cutOff1, int64_t *cutOff2) {
+static int64_t getCutOff(InducedAlignment *inducedAlignment1, InducedAlignment *inducedAlignment2, int64_t *cutOff1, int64_t *cutOff2) {
     int64_t *cScore1 = cumulateScoreForward(inducedAlignment1);
     int64_t *cScore2 = cumulateScoreBackward(inducedAlignment2);
 
     //Check the score arrays for sanity..
-    for (int64_t i = 1; i < stList_length(inducedAlignment1); i++) {
+    for (int64_t i = 1; i < inducedAlignment1->length; i++) {
         assert(cScore1[i - 1] < cScore1[i]);
     }
-    for (int64_t i = 1; i < stList_length(inducedAlignment2); i++) {
+    for (int64_t i = 1; i < inducedAlignment2->length; i++) {
         assert(cScore2[i - 1] > cScore2[i]);
     }
 
@@ -130,23 +173,25 @@ static int64_t getCutOff(stList *inducedAlignment1, stList *inducedAlignment2, i
     *cutOff1 = 0;
     *cutOff2 = 0;
     int64_t maxScore = -1;
-    if (stList_length(inducedAlignment2) > 0) {
+    if (inducedAlignment2->length > 0) {
         maxScore = cScore2[0];
     }
+    EndAlignment *endAlignment1 = inducedAlignment1->endAlignment;
+    EndAlignment *endAlignment2 = inducedAlignment2->endAlignment;
     int64_t j = 0;
     int64_t pPos1 = INT64_MIN, pPos2 = INT64_MIN;
-    for (int64_t i = 0; i < stList_length(inducedAlignment1); i++) {
-        AlignedPair *alignedPair1 = stList_get(inducedAlignment1, i);
-        assert(alignedPair1->strand);
-        assert(pPos1 <= alignedPair1->position);
-        pPos1 = alignedPair1->position;
-        if (j < stList_length(inducedAlignment2)) {
+    for (int64_t i = 0; i < inducedAlignment1->length; i++) {
+        int64_t alignedPair1 = inducedAlignment1->indices[i];
+        assert(endAlignment1->strands[alignedPair1]);
+        assert(pPos1 <= endAlignment1->positions[alignedPair1]);
+        pPos1 = endAlignment1->positions[alignedPair1];
+        if (j < inducedAlignment2->length) {
             do {
-                AlignedPair *alignedPair2 = stList_get(inducedAlignment2, j);
-                assert(!alignedPair2->strand);
-                assert(pPos2 <= alignedPair2->position);
-                pPos2 = alignedPair2->position;
-                if (alignedPair1->position < alignedPair2->position) {
+                int64_t alignedPair2 = inducedAlignment2->indices[j];
+                assert(!endAlignment2->strands[alignedPair2]);
+                assert(pPos2 <= endAlignment2->positions[alignedPair2]);
+                pPos2 = endAlignment2->positions[alignedPair2];
+                if (endAlignment1->positions[alignedPair1] < endAlignment2->positions[alignedPair2]) {
                     if (cScore1[i] + cScore2[j] >= maxScore) {
                         maxScore = cScore1[i] + cScore2[j];
                         *cutOff1 = i + 1;
@@ -156,13 +201,13 @@ static int64_t getCutOff(stList *inducedAlignment1, stList *inducedAlignment2, i
                 } else {
                     j++;
                 }
-            } while (j < stList_length(inducedAlignment2));
+            } while (j < inducedAlignment2->length);
         } else {
             if (cScore1[i] >= maxScore) {
-                *cutOff1 = stList_length(inducedAlignment1);
+                *cutOff1 = inducedAlignment1->length;
                 *cutOff2 = j;
-                assert(cScore1[stList_length(inducedAlignment1) - 1] >= maxScore);
-                maxScore = cScore1[stList_length(inducedAlignment1) - 1];
+                assert(cScore1[inducedAlignment1->length - 1] >= maxScore);
+                maxScore = cScore1[inducedAlignment1->length - 1];
                 break;
             }
         }
@@ -174,9 +219,9 @@ static int64_t getCutOff(stList *inducedAlignment1, stList *inducedAlignment2, i
     return maxScore;
 }
 
-void updateDeletedPairs(int64_t subsequenceIdentifier, stHash *deletedAlignedPairCounts) {
+int64_t updateDeletedPairs(int64_t subsequenceIdentifier, stHash *deletedAlignedPairCounts) {
 	/*
-	 * Adds one to count for the given sequenceIdentifier;
+	 * Adds one to count for the given sequenceIdentifier, returning the new count;
 	 */
     stIntTuple *i = stIntTuple_construct1(subsequenceIdentifier);
     int64_t *j = stHash_search(deletedAlignedPairCounts, i);
@@ -187,47 +232,176 @@ void updateDeletedPairs(int64_t subsequenceIdentifier, stHash *deletedAlignedPai
     else {
         stIntTuple_destruct(i);
     }
-    (*j)++;
+    return ++(*j);
 }
 
-static void pruneAlignmentsP(stList *inducedAlignment, stSortedSet *endAlignment, int64_t start, int64_t end,
-        stSortedSet *pairsToDelete, stHash *deletedAlignedPairCounts) {
-    for (int64_t i = start; i < end; i++) {
-        AlignedPair *alignedPair = stList_get(inducedAlignment, i);
-        if (stSortedSet_search(endAlignment, alignedPair) != NULL) { //can be missing if we are pruning the reverse strand alignment at the same time
-            assert(stSortedSet_search(endAlignment, alignedPair->reverse) != NULL);
-            updateDeletedPairs(alignedPair->subsequenceIdentifier, deletedAlignedPairCounts);
-            updateDeletedPairs(alignedPair->reverse->subsequenceIdentifier, deletedAlignedPairCounts);
-            stSortedSet_remove(endAlignment, alignedPair);
-            stSortedSet_remove(endAlignment, alignedPair->reverse);
-            if (stSortedSet_search(pairsToDelete, alignedPair) == NULL) { // &&
-                assert(stSortedSet_search(pairsToDelete, alignedPair->reverse) == NULL);
-                stSortedSet_insert(pairsToDelete, alignedPair);
-                stSortedSet_insert(pairsToDelete, alignedPair->reverse);
-            } else {
-                assert(stSortedSet_search(pairsToDelete, alignedPair->reverse) != NULL);
+/*
+ * An indexed max-heap of the caps left to prune. The top is the cap whose adjacency sequence has had the
+ * greatest number of aligned pairs deleted, ties going to the cap that comes last in the initial order.
+ */
+typedef struct _CapQueue {
+    Cap **caps; //The caps, in their initial order.
+    int64_t *counts; //The number of deleted aligned pairs for each cap.
+    int64_t *heap; //Indices of the caps left, as a binary max-heap.
+    int64_t *heapPositions; //The position of each cap in the heap, or -1 once it has been popped.
+    int64_t length; //Number of caps left.
+    stHash *capIndices; //Subsequence identifiers of the caps, as stIntTuples, to their indices.
+} CapQueue;
+
+static int64_t getCapSubsequenceIdentifier(Cap *cap) {
+    return cap_getName(cap_getStrand(cap) ? cap : cap_getAdjacency(cap));
+}
+
+static bool capQueue_greaterThan(CapQueue *capQueue, int64_t i, int64_t j) {
+    return capQueue->counts[i] > capQueue->counts[j] || (capQueue->counts[i] == capQueue->counts[j] && i > j);
+}
+
+static void capQueue_swap(CapQueue *capQueue, int64_t position1, int64_t position2) {
+    int64_t i = capQueue->heap[position1];
+    capQueue->heap[position1] = capQueue->heap[position2];
+    capQueue->heap[position2] = i;
+    capQueue->heapPositions[capQueue->heap[position1]] = position1;
+    capQueue->heapPositions[capQueue->heap[position2]] = position2;
+}
+
+static void capQueue_siftUp(CapQueue *capQueue, int64_t position) {
+    while (position > 0) {
+        int64_t parent = (position - 1) / 2;
+        if (!capQueue_greaterThan(capQueue, capQueue->heap[position], capQueue->heap[parent])) {
+            break;
+        }
+        capQueue_swap(capQueue, position, parent);
+        position = parent;
+    }
+}
+
+static void capQueue_siftDown(CapQueue *capQueue, int64_t position) {
+    while (1) {
+        int64_t largest = position;
+        for (int64_t child = 2 * position + 1; child <= 2 * position + 2 && child < capQueue->length; child++) {
+            if (capQueue_greaterThan(capQueue, capQueue->heap[child], capQueue->heap[largest])) {
+                largest = child;
             }
         }
+        if (largest == position) {
+            break;
+        }
+        capQueue_swap(capQueue, position, largest);
+        position = largest;
+    }
+}
+
+static CapQueue *capQueue_construct(stList *caps, stHash *deletedAlignedPairCounts) {
+    CapQueue *capQueue = st_malloc(sizeof(CapQueue));
+    capQueue->length = stList_length(caps);
+    capQueue->caps = st_malloc(sizeof(Cap *) * (capQueue->length + 1));
+    capQueue->counts = st_malloc(sizeof(int64_t) * (capQueue->length + 1));
+    capQueue->heap = st_malloc(sizeof(int64_t) * (capQueue->length + 1));
+    capQueue->heapPositions = st_malloc(sizeof(int64_t) * (capQueue->length + 1));
+    capQueue->capIndices = stHash_construct3((uint64_t (*)(const void *))stIntTuple_hashKey,
+            (int (*)(const void *, const void *))stIntTuple_equalsFn, (void (*)(void *))stIntTuple_destruct,
+            (void (*)(void *))stIntTuple_destruct);
+    for (int64_t i = 0; i < capQueue->length; i++) {
+        Cap *cap = stList_get(caps, i);
+        assert(!cap_getSide(cap));
+        stIntTuple *subsequenceIdentifier = stIntTuple_construct1(getCapSubsequenceIdentifier(cap));
+        int64_t *deletedPairsCount = stHash_search(deletedAlignedPairCounts, subsequenceIdentifier);
+        assert(stHash_search(capQueue->capIndices, subsequenceIdentifier) == NULL);
+        stHash_insert(capQueue->capIndices, subsequenceIdentifier, stIntTuple_construct1(i));
+        capQueue->caps[i] = cap;
+        capQueue->counts[i] = deletedPairsCount != NULL ? *deletedPairsCount : 0;
+        capQueue->heap[i] = i;
+        capQueue->heapPositions[i] = i;
+    }
+    for (int64_t i = capQueue->length / 2 - 1; i >= 0; i--) {
+        capQueue_siftDown(capQueue, i);
+    }
+    return capQueue;
+}
+
+static void capQueue_destruct(CapQueue *capQueue) {
+    free(capQueue->caps);
+    free(capQueue->counts);
+    free(capQueue->heap);
+    free(capQueue->heapPositions);
+    stHash_destruct(capQueue->capIndices);
+    free(capQueue);
+}
+
+/*
+ * Removes and returns the top cap, or NULL if there are none left.
+ */
+static Cap *capQueue_pop(CapQueue *capQueue) {
+    if (capQueue->length == 0) {
+        return NULL;
+    }
+    int64_t i = capQueue->heap[0];
+    capQueue_swap(capQueue, 0, --capQueue->length);
+    capQueue->heapPositions[i] = -1;
+    capQueue_siftDown(capQueue, 0);
+    return capQueue->caps[i];
+}
+
+/*
+ * Updates the deleted aligned pair count of the cap with the given subsequence identifier, if it is
+ * still in the queue. Counts only increase.
+ */
+static void capQueue_updateCount(CapQueue *capQueue, int64_t subsequenceIdentifier, int64_t count) {
+    stIntTuple *i = stIntTuple_construct1(subsequenceIdentifier);
+    stIntTuple *capIndex = stHash_search(capQueue->capIndices, i);
+    stIntTuple_destruct(i);
+    if (capIndex != NULL && capQueue->heapPositions[stIntTuple_get(capIndex, 0)] != -1) {
+        int64_t j = stIntTuple_get(capIndex, 0);
+        assert(count >= capQueue->counts[j]);
+        capQueue->counts[j] = count;
+        capQueue_siftUp(capQueue, capQueue->heapPositions[j]);
+    }
+}
+
+/*
+ * The counts of deleted aligned pairs for each subsequence, and the queue of caps
+ * still to prune (NULL if there is none), which is kept consistent with them.
+ */
+typedef struct _DeletedAlignedPairs {
+    stHash *deletedAlignedPairCounts;
+    CapQueue *capQueue;
+} DeletedAlignedPairs;
+
+static void updateDeletedAlignedPairs(int64_t subsequenceIdentifier, DeletedAlignedPairs *deletedAlignedPairs) {
+    int64_t count = updateDeletedPairs(subsequenceIdentifier, deletedAlignedPairs->deletedAlignedPairCounts);
+    if (deletedAlignedPairs->capQueue != NULL) {
+        capQueue_updateCount(deletedAlignedPairs->capQueue, subsequenceIdentifier, count);
+    }
+}
+
+static void pruneAlignmentsP(InducedAlignment *inducedAlignment, int64_t start, int64_t end,
+        DeletedAlignedPairs *deletedAlignedPairs) {
+    EndAlignment *endAlignment = inducedAlignment->endAlignment;
+    for (int64_t i = start; i < end; i++) {
+        int64_t alignedPair = inducedAlignment->indices[i];
+        if (!endAlignment->deleted[alignedPair]) { //can be deleted if we are pruning the reverse strand alignment at the same time
+            updateDeletedAlignedPairs(endAlignment->subsequenceIdentifiers[alignedPair], deletedAlignedPairs);
+            updateDeletedAlignedPairs(endAlignment->subsequenceIdentifiers[endAlignment->reverse[alignedPair]], deletedAlignedPairs);
+            endAlignment_deletePair(endAlignment, alignedPair);
+        }
     }
 }
 
-static void pruneAlignments(Cap *cap, stList *inducedAlignment1, stList *inducedAlignment2, stSortedSet *endAlignment1,
-        stSortedSet *endAlignment2, void *deletedAlignedPairCounts) {
+static void pruneAlignments(Cap *cap, InducedAlignment *inducedAlignment1, InducedAlignment *inducedAlignment2,
+        void *deletedAlignedPairs) {
     /*
      * Chooses a point along the adjacency sequence at which to filter the two alignments,
      * then filters the aligned pairs by this point.
      */
     int64_t cutOff1 = 0, cutOff2 = 0;
     getCutOff(inducedAlignment1, inducedAlignment2, &cutOff1, &cutOff2);
-    stSortedSet *pairsToDelete = stSortedSet_construct2((void(*)(void *)) alignedPair_destruct);
     //Now do the actual filtering of the alignments.
-    pruneAlignmentsP(inducedAlignment1, endAlignment1, cutOff1, stList_length(inducedAlignment1), pairsToDelete, deletedAlignedPairCounts);
-    pruneAlignmentsP(inducedAlignment2, endAlignment2, 0, cutOff2, pairsToDelete, deletedAlignedPairCounts);
-    stSortedSet_destruct(pairsToDelete);
+    pruneAlignmentsP(inducedAlignment1, cutOff1, inducedAlignment1->length, deletedAlignedPairs);
+    pruneAlignmentsP(inducedAlignment2, 0, cutOff2, deletedAlignedPairs);
 }
 
-void getScore(Cap *cap, stList *inducedAlignment1, stList *inducedAlignment2, stSortedSet *endAlignment1,
-        stSortedSet *endAlignment2, void *capScoresFnHash) {
+void getScore(Cap *cap, InducedAlignment *inducedAlignment1, InducedAlignment *inducedAlignment2,
+        void *capScoresFnHash) {
 
     int64_t i, j;
     int64_t *maxScore = st_malloc(sizeof(int64_t));
@@ -245,59 +419,58 @@ static int sortCapsFn(const void *cap1, const void *cap2, const void *capScoresF
     return (i > 0) ? 1 : ((i < 0) ? -1 : 0); 
 }
 
-bool isAlignedToStubSequence(AlignedPair *alignedPair, Flower *flower) {
-	Cap *cap = flower_getCap(flower, alignedPair->reverse->subsequenceIdentifier);
+bool isAlignedToStubSequence(EndAlignment *endAlignment, int64_t alignedPair, Flower *flower) {
+	Cap *cap = flower_getCap(flower, endAlignment->subsequenceIdentifiers[endAlignment->reverse[alignedPair]]);
     assert(cap != NULL);
     End *end1 = cap_getEnd(cap), *end2 = cap_getEnd(cap_getAdjacency(cap));
     assert(end1 != NULL && end2 != NULL);
     return (end_isStubEnd(end1) && end_isFree(end1)) || (end_isStubEnd(end2) && end_isFree(end2));
-} 
+}
 
-static int64_t findFirstNonStubAlignment(Flower *flower, stList *inducedAlignment, bool reverse) {
-    AlignedPair *pAlignedPair = NULL;
+static int64_t findFirstNonStubAlignment(Flower *flower, InducedAlignment *inducedAlignment, bool reverse) {
+    EndAlignment *endAlignment = inducedAlignment->endAlignment;
+    int64_t pAlignedPair = -1;
     int64_t j = -1;
-    for (int64_t i = reverse ? stList_length(inducedAlignment) - 1 : 0; i < stList_length(inducedAlignment) && i >= 0; i
+    for (int64_t i = reverse ? inducedAlignment->length - 1 : 0; i < inducedAlignment->length && i >= 0; i
             += reverse ? -1 : 1) {
-        AlignedPair *alignedPair = stList_get(inducedAlignment, i);
-        assert(isAlignedToStubSequence(alignedPair->reverse, flower));
-        assert(pAlignedPair == NULL || pAlignedPair->subsequenceIdentifier == alignedPair->subsequenceIdentifier);
-        if (pAlignedPair == NULL || pAlignedPair->position != alignedPair->position) {
+        int64_t alignedPair = inducedAlignment->indices[i];
+        assert(isAlignedToStubSequence(endAlignment, endAlignment->reverse[alignedPair], flower));
+        assert(pAlignedPair == -1 || endAlignment->subsequenceIdentifiers[pAlignedPair] == endAlignment->subsequenceIdentifiers[alignedPair]);
+        if (pAlignedPair == -1 || endAlignment->positions[pAlignedPair] != endAlignment->positions[alignedPair]) {
             pAlignedPair = alignedPair;
             j = i;
         }
-        if(!isAlignedToStubSequence(alignedPair, flower)) {
+        if(!isAlignedToStubSequence(endAlignment, alignedPair, flower)) {
             assert(j != -1);
             return j;
         }
     }
-    return (reverse ? -1 : stList_length(inducedAlignment));
+    return (reverse ? -1 : inducedAlignment->length);
 }
 
-static void pruneStubAlignments(Cap *cap, stList *inducedAlignment1, stList *inducedAlignment2,
-        stSortedSet *endAlignment1, stSortedSet *endAlignment2, void *deletedAlignedPairCounts) {
+static void pruneStubAlignments(Cap *cap, InducedAlignment *inducedAlignment1, InducedAlignment *inducedAlignment2,
+        void *deletedAlignedPairs) {
     assert(cap != NULL);
     End *end = cap_getEnd(cap);
     assert(cap_getAdjacency(cap) != NULL);
     End *adjacentEnd = cap_getEnd(cap_getAdjacency(cap));
     assert(end != NULL);
     assert(adjacentEnd != NULL);
-    int64_t cutOff1 = stList_length(inducedAlignment1) - 1;
+    int64_t cutOff1 = inducedAlignment1->length - 1;
     int64_t cutOff2 = 0;
     if (end_isStubEnd(adjacentEnd) && end_isFree(adjacentEnd)) {
         cutOff1 = findFirstNonStubAlignment(end_getFlower(end), inducedAlignment1, 1);
-        assert(stList_length(inducedAlignment2) == 0);
-        cutOff2 = stList_length(inducedAlignment2);
+        assert(inducedAlignment2->length == 0);
+        cutOff2 = inducedAlignment2->length;
     }
     if (end_isStubEnd(end) && end_isFree(end)) {
-        assert(stList_length(inducedAlignment1) == 0);
+        assert(inducedAlignment1->length == 0);
         cutOff1 = -1;
         cutOff2 = findFirstNonStubAlignment(end_getFlower(end), inducedAlignment2, 0);
     }
-    stSortedSet *pairsToDelete = stSortedSet_construct2((void(*)(void *)) alignedPair_destruct);
     //Now do the actual filtering of the alignments.
-    pruneAlignmentsP(inducedAlignment1, endAlignment1, cutOff1 + 1, stList_length(inducedAlignment1), pairsToDelete, deletedAlignedPairCounts);
-    pruneAlignmentsP(inducedAlignment2, endAlignment2, 0, cutOff2, pairsToDelete, deletedAlignedPairCounts);
-    stSortedSet_destruct(pairsToDelete);
+    pruneAlignmentsP(inducedAlignment1, cutOff1 + 1, inducedAlignment1->length, deletedAlignedPairs);
+    pruneAlignmentsP(inducedAlignment2, 0, cutOff2, deletedAlignedPairs);
 }
 
 /*
@@ -305,8 +478,8 @@ static void pruneStubAlignments(Cap *cap, stList *inducedAlignment1, stList *ind
  */
 
 static int makeFlowerAlignmentP(Cap *cap, stHash *endAlignments,
-        void(*fn)(Cap *, stList *, stList *, stSortedSet *, stSortedSet *, void *), void *extraArg) {
-    stSortedSet *endAlignment1 = stHash_search(endAlignments, end_getPositiveOrientation(cap_getEnd(cap)));
+        void(*fn)(Cap *, InducedAlignment *, InducedAlignment *, void *), void *extraArg) {
+    EndAlignment *endAlignment1 = stHash_search(endAlignments, end_getPositiveOrientation(cap_getEnd(cap)));
     assert(endAlignment1 != NULL);
 
     Cap *adjacentCap = cap_getAdjacency(cap);
@@ -314,34 +487,45 @@ static int makeFlowerAlignmentP(Cap *cap, stHash *endAlignments,
     assert(cap_getSide(adjacentCap));
     assert(cap_getStrand(adjacentCap));
     adjacentCap = cap_getReverse(adjacentCap);
-    stSortedSet *endAlignment2 = stHash_search(endAlignments, end_getPositiveOrientation(cap_getEnd(adjacentCap)));
+    EndAlignment *endAlignment2 = stHash_search(endAlignments, end_getPositiveOrientation(cap_getEnd(adjacentCap)));
     assert(endAlignment2 != NULL);
 
-    AdjacencySequence *adjacencySequence1 = adjacencySequence_construct(cap, INT64_MAX);
-    AdjacencySequence *adjacencySequence2 = adjacencySequence_construct(adjacentCap, INT64_MAX);
+    //The induced alignments only need the coordinates of the adjacency, not its bases.
+    AdjacencySequence *adjacencySequence1 = adjacencySequence_constructWithoutString(cap, INT64_MAX);
+    AdjacencySequence *adjacencySequence2 = adjacencySequence_constructWithoutString(adjacentCap, INT64_MAX);
     assert(adjacencySequence1->length == adjacencySequence2->length);
     assert(adjacencySequence1->subsequenceIdentifier == adjacencySequence2->subsequenceIdentifier);
     assert(adjacencySequence1->strand == !adjacencySequence2->strand);
     assert(adjacencySequence2->start == adjacencySequence1->start + adjacencySequence1->length - 1);
 
-    stList *inducedAlignment1 = getInducedAlignment(endAlignment1, adjacencySequence1);
-    stList *inducedAlignment2 = getInducedAlignment(endAlignment2, adjacencySequence2);
-    stList_reverse(inducedAlignment2);
+    InducedAlignment inducedAlignment1, inducedAlignment2;
+    inducedAlignment1.endAlignment = endAlignment1;
+    inducedAlignment1.indices = getCompactInducedAlignment(endAlignment1, adjacencySequence1, &inducedAlignment1.length);
+    inducedAlignment2.endAlignment = endAlignment2;
+    inducedAlignment2.indices = getCompactInducedAlignment(endAlignment2, adjacencySequence2, &inducedAlignment2.length);
+    for (int64_t i = 0, j = inducedAlignment2.length - 1; i < j; i++, j--) { //Reverse, to order it as inducedAlignment1.
+        int64_t k = inducedAlignment2.indices[i];
+        inducedAlignment2.indices[i] = inducedAlignment2.indices[j];
+        inducedAlignment2.indices[j] = k;
+    }
 
-    fn(cap, inducedAlignment1, inducedAlignment2, endAlignment1, endAlignment2, extraArg);
+    fn(cap, &inducedAlignment1, &inducedAlignment2, extraArg);
 
     //Cleanup.
     adjacencySequence_destruct(adjacencySequence1);
     adjacencySequence_destruct(adjacencySequence2);
-    stList_destruct(inducedAlignment1);
-    stList_destruct(inducedAlignment2);
+    free(inducedAlignment1.indices);
+    free(inducedAlignment2.indices);
     return 1;
 }
 
-static stSortedSet *makeFlowerAlignment2(Flower *flower, stHash *endAlignments, bool pruneOutStubAlignments) {
+static stSortedSet *makeFlowerAlignment2(Flower *flower, stHash *endAlignments, bool pruneOutStubAlignments,
+        BarProfile *profile) {
     /*
      * Makes the alignments of the ends, in "endAlignments", consistent with one another using the bar algorithm.
      */
+    double startTime = profile != NULL ? barProfile_getTime() : 0.0;
+    int64_t startPeakRss = profile != NULL ? barProfile_getPeakRss() : 0;
 
     //Get the subsequences in the alignment that need to be pruned.
     End *end;
@@ -370,45 +554,31 @@ static stSortedSet *makeFlowerAlignment2(Flower *flower, stHash *endAlignments,
     //Now do the actual pruning
     stHash *deletedAlignedPairCounts = stHash_construct3((uint64_t (*)(const void *))stIntTuple_hashKey,
             (int (*)(const void *, const void *))stIntTuple_equalsFn, (void (*)(void *))stIntTuple_destruct, free);
+    DeletedAlignedPairs deletedAlignedPairs;
+    deletedAlignedPairs.deletedAlignedPairCounts = deletedAlignedPairCounts;
+    deletedAlignedPairs.capQueue = capQueue_construct(caps, deletedAlignedPairCounts);
     stList *freeStubCaps = stList_construct(); //Caps that we'll use when pruning the stub only ends of alignments.
-    while (stList_length(caps) > 0) {
-        //Pick cap with greatest number of deleted aligned pairs.
-        //This bias the bar algorithm to pick cutpoints that consistent
-        //with previously selected cutpoints.
-        Cap *cap = NULL;
-        int64_t deletedPairsForChosenCap = 0;
-        int64_t capIndex = INT64_MAX;
-        for(int64_t i=0; i<stList_length(caps); i++) {
-            Cap *cap2 = stList_get(caps, i);
-            assert(!cap_getSide(cap2));
-            stIntTuple *sequenceIdentifier = stIntTuple_construct1(cap_getName(cap_getStrand(cap2) ? cap2 : cap_getAdjacency(cap2)));
-            int64_t *deletedPairsCount = stHash_search(deletedAlignedPairCounts, sequenceIdentifier);
-            stIntTuple_destruct(sequenceIdentifier);
-            if(cap == NULL || deletedPairsForChosenCap == 0 || (deletedPairsCount != NULL && *deletedPairsCount >= deletedPairsForChosenCap)) {
-                cap = cap2;
-                capIndex = i;
-                if(deletedPairsCount != NULL) {
-                    deletedPairsForChosenCap = *deletedPairsCount;
-                }
-            }
-        }
-        //Having chosen the cap, remove it
-        assert(cap != NULL);
-        stList_remove(caps, capIndex);
+    Cap *cap;
+    //Pick cap with greatest number of deleted aligned pairs, the latest in the ordering by score if tied.
+    //This bias the bar algorithm to pick cutpoints that consistent
+    //with previously selected cutpoints.
+    while ((cap = capQueue_pop(deletedAlignedPairs.capQueue)) != NULL) {
         //Do the filtering.
-        makeFlowerAlignmentP(cap, endAlignments, pruneAlignments, deletedAlignedPairCounts);
+        makeFlowerAlignmentP(cap, endAlignments, pruneAlignments, &deletedAlignedPairs);
         assert(cap_getAdjacency(cap) != NULL);
         if ((end_isFree(cap_getEnd(cap)) && end_isStubEnd(cap_getEnd(cap))) || (end_isFree(
                 cap_getEnd(cap_getAdjacency(cap))) && end_isStubEnd(cap_getEnd(cap_getAdjacency(cap))))) {
             stList_append(freeStubCaps, cap);
         } 
     }
+    capQueue_destruct(deletedAlignedPairs.capQueue);
+    deletedAlignedPairs.capQueue = NULL;
     stList_destruct(caps);
     stHash_destruct(capScoresFnHash);
 
     if (pruneOutStubAlignments) { //This is used to remove matches only containing stub sequences at end of an end alignment.
     	while (stList_length(freeStubCaps) > 0) {
-        	makeFlowerAlignmentP(stList_pop(freeStubCaps), endAlignments, pruneStubAlignments, deletedAlignedPairCounts);
+        	makeFlowerAlignmentP(stList_pop(freeStubCaps), endAlignments, pruneStubAlignments, &deletedAlignedPairs);
         }
     }
     stList_destruct(freeStubCaps);
@@ -416,24 +586,20 @@ static stSortedSet *makeFlowerAlignment2(Flower *flower, stHash *endAlignments,
     //Now convert to set of final aligned pairs to return.
     stSortedSet *sortedAlignment = stSortedSet_construct3((int(*)(const void *, const void *)) alignedPair_cmpFn,
             (void(*)(void *)) alignedPair_destruct);
-    stList *endAlignmentsList = stHash_getValues(endAlignments);
-    while (stList_length(endAlignmentsList) > 0) {
-        stSortedSet *endAlignment = stList_pop(endAlignmentsList);
-        while (stSortedSet_size(endAlignment) > 0) {
-            AlignedPair *alignedPair = stSortedSet_getFirst(endAlignment);
-            stSortedSet_remove(endAlignment, alignedPair);
-            assert(stSortedSet_search(endAlignment, alignedPair->reverse) != NULL);
-            stSortedSet_remove(endAlignment, alignedPair->reverse);
-            assert(stSortedSet_search(sortedAlignment, alignedPair) == NULL);
-            assert(stSortedSet_search(sortedAlignment, alignedPair->reverse) == NULL);
-            stSortedSet_insert(sortedAlignment, alignedPair);
-            stSortedSet_insert(sortedAlignment, alignedPair->reverse);
-        }
+    stList *ends = stHash_getKeys(endAlignments);
+    while (stList_length(ends) > 0) { //Free each end alignment as soon as it is converted.
+        EndAlignment *endAlignment = stHash_remove(endAlignments, stList_pop(ends));
+        endAlignment_addToSortedSet(endAlignment, sortedAlignment);
+        endAlignment_destruct(endAlignment);
     }
-    stList_destruct(endAlignmentsList);
+    stList_destruct(ends);
     stHash_destruct(endAlignments);
     stHash_destruct(deletedAlignedPairCounts);
 
+    if (profile != NULL) {
+        barProfile_addStage(profile, flower, "prune", barProfile_getTime() - startTime,
+                barProfile_getPeakRss() - startPeakRss);
+    }
     return sortedAlignment;
 }
 
@@ -523,7 +689,7 @@ static stSortedSet *getEndsToAlign(Flower *flower, int64_t maxSequenceLength) {
 
 static void computeMissingEndAlignments(StateMachine *sM, Flower *flower, stHash *endAlignments, int64_t spanningTrees,
         int64_t maxSequenceLength, bool useProgressiveMerging, float gapGamma,
-        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters) {
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, double memoryBudget, BarProfile *profile) {
     /*
      * Creates end alignments for the ends that
      * do not have an alignment in the "endAlignments" hash, only creating
@@ -532,32 +698,64 @@ static void computeMissingEndAlignments(StateMachine *sM, Flower *flower, stHash
     //Make the end alignments, representing each as an adjacency alignment.
     stSortedSet *endsToAlign = getEndsToAlign(flower, maxSequenceLength);
     End *end;
+    //Read the adjacency sequences of the ends to align in one ordered pass, each adjacency being shared by the
+    //alignments of the two ends it joins.
+    AdjacencySequenceCache *adjacencySequenceCache = adjacencySequenceCache_construct(maxSequenceLength);
+    stList *caps = stList_construct();
     Flower_EndIterator *endIterator = flower_getEndIterator(flower);
+    while ((end = flower_getNextEnd(endIterator)) != NULL) {
+        if (stHash_search(endAlignments, end) == NULL && stSortedSet_search(endsToAlign, end) != NULL) {
+            Cap *cap;
+            End_InstanceIterator *capIt = end_getInstanceIterator(end);
+            while ((cap = end_getNext(capIt)) != NULL) {
+                stList_append(caps, cap);
+            }
+            end_destructInstanceIterator(capIt);
+        }
+    }
+    flower_destructEndIterator(endIterator);
+    adjacencySequenceCache_prefetch(adjacencySequenceCache, caps);
+    stList_destruct(caps);
+
+    endIterator = flower_getEndIterator(flower);
     while ((end = flower_getNextEnd(endIterator)) != NULL) {
         if (stHash_search(endAlignments, end) == NULL) {
             if (stSortedSet_search(endsToAlign, end) != NULL) {
+                //Align with copies of the parameters, which are loosened for ends too big for the memory budget.
+                int64_t endSpanningTrees = spanningTrees;
+                PairwiseAlignmentParameters endParameters = *pairwiseAlignmentBandingParameters;
+                if (memoryBudget > 0) {
+                    fitEndAlignmentToMemoryBudget(end, maxSequenceLength, memoryBudget, &endSpanningTrees,
+                            &endParameters);
+                }
                 stHash_insert(
                         endAlignments,
                         end,
-                        makeEndAlignment(sM, end, spanningTrees, maxSequenceLength,
+                        makeCompactEndAlignment(sM, end, endSpanningTrees, maxSequenceLength,
                                 useProgressiveMerging, gapGamma,
-                                pairwiseAlignmentBandingParameters));
+                                &endParameters, adjacencySequenceCache, profile));
             } else {
-                stHash_insert(endAlignments, end, stSortedSet_construct());
+                EndAlignment *endAlignment = endAlignment_construct();
+                endAlignment_sort(endAlignment);
+                stHash_insert(endAlignments, end, endAlignment);
             }
         }
     }
     flower_destructEndIterator(endIterator);
     stSortedSet_destruct(endsToAlign);
+    st_logInfo("Read %" PRIi64 " bases in %" PRIi64 " strings for %" PRIi64 " adjacency sequences\n",
+            adjacencySequenceCache->basesRead, adjacencySequenceCache->sequencesRead,
+            adjacencySequenceCache->adjacencySequencesGot);
+    adjacencySequenceCache_destruct(adjacencySequenceCache);
 }
 
 stSortedSet *makeFlowerAlignment(StateMachine *sM, Flower *flower, int64_t spanningTrees, int64_t maxSequenceLength,
         bool useProgressiveMerging, float gapGamma,
         PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, bool pruneOutStubAlignments) {
-    stHash *endAlignments = stHash_construct2(NULL, (void(*)(void *)) stSortedSet_destruct);
+    stHash *endAlignments = stHash_construct2(NULL, (void(*)(void *)) endAlignment_destruct);
     computeMissingEndAlignments(sM, flower, endAlignments, spanningTrees, maxSequenceLength,
-            useProgressiveMerging, gapGamma, pairwiseAlignmentBandingParameters);
-    return makeFlowerAlignment2(flower, endAlignments, pruneOutStubAlignments);
+            useProgressiveMerging, gapGamma, pairwiseAlignmentBandingParameters, -1, NULL);
+    return makeFlowerAlignment2(flower, endAlignments, pruneOutStubAlignments, NULL);
 }
 
 static void loadEndAlignments(Flower *flower, stHash *endAlignments, stList *listOfEndAlignments) {
@@ -567,8 +765,8 @@ static void loadEndAlignments(Flower *flower, stHash *endAlignments, stList *lis
     for (int64_t i = 0; i < stList_length(listOfEndAlignments); i++) {
         End *end;
         FILE *fileHandle = fopen(stList_get(listOfEndAlignments, i), "r");
-        stSortedSet *alignment;
-        while((alignment = loadEndAlignmentFromDisk(flower, fileHandle, &end)) != NULL) {
+        EndAlignment *alignment;
+        while((alignment = loadCompactEndAlignmentFromDisk(flower, fileHandle, &end)) != NULL) {
             assert(stHash_search(endAlignments, end) == NULL);
             stHash_insert(endAlignments, end, alignment);
         }
@@ -578,14 +776,15 @@ static void loadEndAlignments(Flower *flower, stHash *endAlignments, stList *lis
 
 stSortedSet *makeFlowerAlignment3(StateMachine *sM, Flower *flower, stList *listOfEndAlignmentFiles, int64_t spanningTrees,
         int64_t maxSequenceLength, bool useProgressiveMerging, float gapGamma,
-        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, bool pruneOutStubAlignments) {
-    stHash *endAlignments = stHash_construct2(NULL, (void(*)(void *)) stSortedSet_destruct);
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, bool pruneOutStubAlignments,
+        double memoryBudget, BarProfile *profile) {
+    stHash *endAlignments = stHash_construct2(NULL, (void(*)(void *)) endAlignment_destruct);
     if(listOfEndAlignmentFiles != NULL) {
         loadEndAlignments(flower, endAlignments, listOfEndAlignmentFiles);
     }
     computeMissingEndAlignments(sM, flower, endAlignments, spanningTrees, maxSequenceLength,
-            useProgressiveMerging, gapGamma, pairwiseAlignmentBandingParameters);
-    return makeFlowerAlignment2(flower, endAlignments, pruneOutStubAlignments);
+            useProgressiveMerging, gapGamma, pairwiseAlignmentBandingParameters, memoryBudget, profile);
+    return makeFlowerAlignment2(flower, endAlignments, pruneOutStubAlignments, profile);
 }
 
 /*
@@ -630,3 +829,81 @@ stSortedSet *getEndsToAlignSeparately(Flower *flower, int64_t maxSequenceLength,
     }
     return largeEndsToAlign;
 }
+
+stSortedSet *getEndsToAlignSeparatelyByTime(Flower *flower, int64_t maxSequenceLength, int64_t spanningTrees,
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, double largeEndTime) {
+    /*
+     * As getEndsToAlignSeparately, but picks the end alignments estimated to take at least "largeEndTime" seconds.
+     */
+    stSortedSet *endsToAlign = getEndsToAlign(flower, maxSequenceLength);
+    stSortedSetIterator *it = stSortedSet_getIterator(endsToAlign);
+    End *end;
+    stSortedSet *largeEndsToAlign = stSortedSet_construct();
+    while ((end = stSortedSet_getNext(it)) != NULL) {
+        if (estimateEndAlignmentTime(end, spanningTrees, maxSequenceLength, pairwiseAlignmentBandingParameters)
+                >= largeEndTime) {
+            stSortedSet_insert(largeEndsToAlign, end);
+        }
+    }
+    stSortedSet_destructIterator(it);
+    stSortedSet_destruct(endsToAlign);
+    if (stSortedSet_size(largeEndsToAlign) <= 1) {
+        stSortedSet_destruct(largeEndsToAlign);
+        return stSortedSet_construct();
+    }
+    return largeEndsToAlign;
+}
+
+typedef struct _jobTime {
+    double time;
+    int64_t index;
+} JobTime;
+
+static int cmpJobTimes(const void *a, const void *b) {
+    //Longest first, ties by index so the grouping is deterministic.
+    const JobTime *jobTime1 = a, *jobTime2 = b;
+    if (jobTime1->time != jobTime2->time) {
+        return jobTime1->time > jobTime2->time ? -1 : 1;
+    }
+    return jobTime1->index < jobTime2->index ? -1 : (jobTime1->index > jobTime2->index ? 1 : 0);
+}
+
+int64_t *groupEndAlignmentJobs(const double *endAlignmentTimes, int64_t endAlignmentNumber, double jobTime,
+        int64_t *groupNumber) {
+    /*
+     * Uses enough groups for each to take about jobTime, and greedily gives the longest remaining end
+     * alignment to the group with the least work so far.
+     */
+    double totalTime = 0.0;
+    for (int64_t i = 0; i < endAlignmentNumber; i++) {
+        totalTime += endAlignmentTimes[i];
+    }
+    *groupNumber = jobTime > 0.0 ? (int64_t) ceil(totalTime / jobTime) : endAlignmentNumber;
+    if (*groupNumber > endAlignmentNumber) {
+        *groupNumber = endAlignmentNumber;
+    }
+    if (*groupNumber < 1) {
+        *groupNumber = 1;
+    }
+    JobTime *order = st_malloc(sizeof(JobTime) * (endAlignmentNumber + 1));
+    for (int64_t i = 0; i < endAlignmentNumber; i++) {
+        order[i].time = endAlignmentTimes[i];
+        order[i].index = i;
+    }
+    qsort(order, endAlignmentNumber, sizeof(JobTime), cmpJobTimes);
+    double *groupTimes = st_calloc(*groupNumber, sizeof(double));
+    int64_t *groups = st_malloc(sizeof(int64_t) * (endAlignmentNumber + 1));
+    for (int64_t i = 0; i < endAlignmentNumber; i++) {
+        int64_t group = 0;
+        for (int64_t j = 1; j < *groupNumber; j++) {
+            if (groupTimes[j] < groupTimes[group]) {
+                group = j;
+            }
+        }
+        groups[order[i].index] = group;
+        groupTimes[group] += order[i].time;
+    }
+    free(order);
+    free(groupTimes);
+    return groups;
+}
@@ -89,15 +89,104 @@ static bedRegion *seekToProperBedRegion(bedRegion *beds, size_t numBeds,
     return pivotRegion;
 }
 
+// Find the first bed region with the given name, or the first with a
+// greater name if there is none.
+static bedRegion *seekToFirstBedRegion(bedRegion *beds, size_t numBeds, Name name) {
+    size_t start = 0;
+    size_t stop = numBeds;
+    while (start < stop) {
+        size_t pivot = start + (stop - start) / 2;
+        if (bedRegion_name(beds + pivot) < name) {
+            start = pivot + 1;
+        } else {
+            stop = pivot;
+        }
+    }
+    return beds + start;
+}
+
+// Get the number of bases in the interval [start, stop) covered by
+// the region.
+static int64_t getCoveredBases(const bedRegion *region, int64_t start, int64_t stop) {
+    if (bedRegion_start(region) > start) {
+        start = bedRegion_start(region);
+    }
+    if (bedRegion_stop(region) < stop) {
+        stop = bedRegion_stop(region);
+    }
+    return stop > start ? stop - start : 0;
+}
+
+static bool shouldRescue(stPinchSegment *segment, int64_t numCoveredBases, double coveredBasesThreshold) {
+    // Rescue if more than "coveredBasesThreshold" proportion of the
+    // segment's bases are covered.
+    return ((double) numCoveredBases) / stPinchSegment_getLength(segment) > coveredBasesThreshold;
+}
+
 // Find any regions in this thread covered by outgroups that are in
 // segments with no block, and "rescue" them into single-degree blocks
 // if they pass the filter (i.e. are longer than minSegmentLength, and
 // have more than coveredBasesThreshold proportion of their bases
 // covered in the coverage file).
+//
+// The segments of the thread come in increasing order, as do the
+// regions for the sequence in the sorted bed array, so this makes a
+// single sweep along both.
 void rescueCoveredRegions(stPinchThread *thread, bedRegion *beds, size_t numBeds,
                           Name name, int64_t minSegmentLength,
                           double coveredBasesThreshold) {
-    bedRegion *lastRegion = beds + numBeds - 1;
+    bedRegion *endRegion = beds + numBeds;
+    // The first region that may overlap the current segment or any
+    // after it.
+    bedRegion *cursor = seekToFirstBedRegion(beds, numBeds, name);
+    stPinchSegment *segment = stPinchThread_getFirst(thread);
+    while (segment != NULL && cursor < endRegion && bedRegion_name(cursor) == name) {
+        if (stPinchSegment_getBlock(segment) == NULL
+            && stPinchSegment_getLength(segment) >= minSegmentLength) {
+            int64_t segmentStart = stPinchSegment_getStart(segment);
+            int64_t segmentEnd = stPinchSegment_getStart(segment) + stPinchSegment_getLength(segment);
+
+            // Skip the regions that end before this segment, and so
+            // before all the segments that follow it.
+            while (cursor < endRegion && bedRegion_name(cursor) == name
+                   && bedRegion_stop(cursor) <= segmentStart) {
+                cursor++;
+            }
+
+            // Find the total number of bases covered by an outgroup
+            // in this adjacency.
+            int64_t numCoveredBases = 0;
+            for (bedRegion *region = cursor;
+                 region < endRegion
+                     && bedRegion_name(region) == name
+                     && bedRegion_start(region) < segmentEnd;
+                 region++) {
+                numCoveredBases += getCoveredBases(region, segmentStart, segmentEnd);
+            }
+            if (shouldRescue(segment, numCoveredBases, coveredBasesThreshold)) {
+                stPinchBlock_construct2(segment);
+            }
+        }
+        segment = stPinchSegment_get3Prime(segment);
+    }
+    // Once past the sequence's regions, nothing is covered, so the
+    // remaining segments are only rescued if the threshold allows
+    // uncovered segments.
+    for (; segment != NULL; segment = stPinchSegment_get3Prime(segment)) {
+        if (stPinchSegment_getBlock(segment) == NULL
+            && stPinchSegment_getLength(segment) >= minSegmentLength
+            && shouldRescue(segment, 0, coveredBasesThreshold)) {
+            stPinchBlock_construct2(segment);
+        }
+    }
+}
+
+// As rescueCoveredRegions, but with a binary search of the bed array
+// for each segment. Kept for testing and benchmarking.
+void rescueCoveredRegions_binarySearch(stPinchThread *thread, bedRegion *beds, size_t numBeds,
+                                       Name name, int64_t minSegmentLength,
+                                       double coveredBasesThreshold) {
+    bedRegion *endRegion = beds + numBeds;
     stPinchSegment *segment = stPinchThread_getFirst(thread);
     while (segment != NULL) {
         if (stPinchSegment_getBlock(segment) == NULL
@@ -109,18 +198,15 @@ void rescueCoveredRegions(stPinchThread *thread, bedRegion *beds, size_t numBeds
             // in this adjacency.
             int64_t numCoveredBases = 0;
             for (bedRegion *region = seekToProperBedRegion(beds, numBeds, segment, name);
-                 region <= lastRegion
-                     && bedRegion_start(region) < segmentEnd
-                     && bedRegion_name(region) <= name;
+                 region < endRegion
+                     && (bedRegion_name(region) < name
+                         || (bedRegion_name(region) == name && bedRegion_start(region) < segmentEnd));
                  region++) {
-                int64_t start = segmentStart > bedRegion_start(region) ? segmentStart : bedRegion_start(region);
-                int64_t end = segmentEnd > bedRegion_stop(region) ? bedRegion_stop(region) : segmentEnd;
-                numCoveredBases += end - start;
+                if (bedRegion_name(region) == name) {
+                    numCoveredBases += getCoveredBases(region, segmentStart, segmentEnd);
+                }
             }
-            if (((double) numCoveredBases) / stPinchSegment_getLength(segment) > coveredBasesThreshold) {
-                // This region has more than "coveredBasesThreshold"
-                // proportion of its bases covered, so it should be
-                // rescued.
+            if (shouldRescue(segment, numCoveredBases, coveredBasesThreshold)) {
                 stPinchBlock_construct2(segment);
             }
         }
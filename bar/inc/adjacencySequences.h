@@ -34,10 +34,52 @@ typedef struct _AdjacencySequence {
  */
 AdjacencySequence *adjacencySequence_construct(Cap *cap, int64_t maxLength);
 
+/*
+ * As adjacencySequence_construct, but without reading the bases: the string is NULL.
+ */
+AdjacencySequence *adjacencySequence_constructWithoutString(Cap *cap, int64_t maxLength);
+
 /*
  * Destructs the adjacency sequence.
  */
 void adjacencySequence_destruct(AdjacencySequence *subSequence);
 
+/*
+ * Store of the adjacency sequences read for a flower, so that each adjacency is read from the database
+ * once, rather than once for each of its two caps. For each adjacency it holds the first maxLength bases
+ * from either side.
+ */
+typedef struct _AdjacencySequenceCache {
+        stHash *adjacencies; //Subsequence identifiers, as stIntTuples, to the bases read for them.
+        int64_t maxLength;
+        int64_t sequencesRead; //Number of strings read from the database.
+        int64_t basesRead; //Number of bases in those strings.
+        int64_t adjacencySequencesGot; //Number of adjacency sequences got from the cache.
+} AdjacencySequenceCache;
+
+/*
+ * Constructs an empty cache, for adjacency sequences of up to maxLength bases.
+ */
+AdjacencySequenceCache *adjacencySequenceCache_construct(int64_t maxLength);
+
+void adjacencySequenceCache_destruct(AdjacencySequenceCache *cache);
+
+/*
+ * Reads the adjacencies of the given caps into the cache, in order along each sequence.
+ */
+void adjacencySequenceCache_prefetch(AdjacencySequenceCache *cache, stList *caps);
+
+/*
+ * Reads the adjacencies of all the caps in the flower into the cache.
+ */
+void adjacencySequenceCache_prefetchFlower(AdjacencySequenceCache *cache, Flower *flower);
+
+/*
+ * As adjacencySequence_construct, but gets the string from the cache, reading it into the cache
+ * if not present. Only reads directly if maxLength is greater than the cache's.
+ */
+AdjacencySequence *adjacencySequenceCache_getAdjacencySequence(AdjacencySequenceCache *cache, Cap *cap,
+        int64_t maxLength);
+
 
 #endif /* ADJACENCYSEQUENCES_H_ */
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+/*
+ * barProfile.h
+ *
+ * A profile of where bar spends its time and memory, written as one row per
+ * end alignment or stage of a flower.
+ */
+
+#ifndef BARPROFILE_H_
+#define BARPROFILE_H_
+
+#include "sonLib.h"
+#include "cactus.h"
+
+typedef struct _BarProfile BarProfile;
+
+/*
+ * Opens a profile written to the given file, as JSON if the file name ends
+ * in ".json", otherwise as CSV with a header line.
+ */
+BarProfile *barProfile_construct(const char *fileName);
+
+/*
+ * Finishes writing the profile and closes its file.
+ */
+void barProfile_destruct(BarProfile *profile);
+
+/*
+ * The wall clock time, in seconds, for timing the rows of a profile.
+ */
+double barProfile_getTime(void);
+
+/*
+ * The peak resident set size of the process so far, in bytes.
+ */
+int64_t barProfile_getPeakRss(void);
+
+/*
+ * Adds a row for an end alignment, giving the number and total length of its
+ * adjacency sequences, the number of pairwise alignments chosen to make it,
+ * the number of aligned pairs in it, the time taken and the increase in the
+ * peak resident set size while making it.
+ */
+void barProfile_addEndAlignment(BarProfile *profile, End *end, int64_t sequenceNumber, int64_t totalSequenceLength,
+        int64_t pairwiseAlignmentNumber, int64_t alignedPairNumber, double time, int64_t peakRssDelta);
+
+/*
+ * Adds a row for a stage of processing a flower that is not specific to an
+ * end, such as "prune", "anneal" or "melt".
+ */
+void barProfile_addStage(BarProfile *profile, Flower *flower, const char *stage, double time, int64_t peakRssDelta);
+
+#endif /* BARPROFILE_H_ */
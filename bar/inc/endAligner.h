@@ -17,6 +17,9 @@
 #include "sonLib.h"
 #include "cactus.h"
 #include "pairwiseAligner.h"
+#include "multipleAligner.h"
+#include "adjacencySequences.h"
+#include "barProfile.h"
 
 typedef struct _AlignedPair {
     int64_t subsequenceIdentifier;
@@ -42,6 +45,104 @@ void alignedPair_destruct(AlignedPair *alignedPair);
  */
 int alignedPair_cmpFn(const AlignedPair *alignedPair1, const AlignedPair *alignedPair2);
 
+/*
+ * A compact end alignment. Each aligned pair is stored twice, once from each side, in
+ * parallel arrays sorted in alignedPair_cmpFn order, so the pairs of an adjacency sequence
+ * lie in a contiguous range. reverse[i] is the index of the other side of entry i. Pairs are
+ * deleted by marking both of their entries, so indices stay valid while pruning.
+ */
+typedef struct _EndAlignment {
+    int64_t length; //Number of entries, twice the number of pairs, including deleted ones.
+    int64_t deletedLength; //Number of deleted entries.
+    int64_t *subsequenceIdentifiers;
+    int64_t *positions;
+    int64_t *scores;
+    int64_t *reverse;
+    bool *strands;
+    bool *deleted;
+    //Entries added, but not yet sorted into the arrays above.
+    struct _EndAlignmentEntry *unsortedEntries;
+    int64_t unsortedLength;
+    int64_t unsortedMaxLength;
+} EndAlignment;
+
+/*
+ * Constructs an empty end alignment.
+ */
+EndAlignment *endAlignment_construct(void);
+
+/*
+ * Destructs the end alignment.
+ */
+void endAlignment_destruct(EndAlignment *endAlignment);
+
+/*
+ * Adds an aligned pair, with the same arguments as alignedPair_construct. The pair is not
+ * visible until endAlignment_sort is called.
+ */
+void endAlignment_addPair(EndAlignment *endAlignment, int64_t subsequenceIdentifier1, int64_t position1, bool strand1,
+        int64_t subsequenceIdentifier2, int64_t position2, bool strand2, int64_t score1, int64_t score2);
+
+/*
+ * Makes room for the given number of pairs to be added without reallocating.
+ */
+void endAlignment_reserve(EndAlignment *endAlignment, int64_t pairNumber);
+
+/*
+ * Sorts the pairs added to the end alignment. Must be called once, after the last pair has
+ * been added and before the end alignment is otherwise used.
+ */
+void endAlignment_sort(EndAlignment *endAlignment);
+
+/*
+ * Returns the index of the first entry whose (subsequenceIdentifier, position) is
+ * greater than or equal to the given one, or endAlignment->length if there is none.
+ */
+int64_t endAlignment_getFirstIndex(EndAlignment *endAlignment, int64_t subsequenceIdentifier, int64_t position);
+
+/*
+ * Deletes the pair containing the given entry, by marking both of its entries as deleted.
+ */
+void endAlignment_deletePair(EndAlignment *endAlignment, int64_t index);
+
+/*
+ * Returns the number of pairs that have not been deleted.
+ */
+int64_t endAlignment_getPairNumber(EndAlignment *endAlignment);
+
+/*
+ * Constructs a compact end alignment holding the same pairs as a set of aligned pairs
+ * (as returned by makeEndAlignment), which must contain both sides of each pair.
+ */
+EndAlignment *endAlignment_constructFromSortedSet(stSortedSet *alignedPairs);
+
+/*
+ * Adds the pairs of the end alignment that have not been deleted to the given set of
+ * aligned pairs, ordered by alignedPair_cmpFn.
+ */
+void endAlignment_addToSortedSet(EndAlignment *endAlignment, stSortedSet *alignedPairs);
+
+/*
+ * Passes each aligned pair of the multiple alignment to alignedPairFn, with its score and the index
+ * of and offset in each of its sequences, popping and destructing the pairs of mA->alignedPairs.
+ * makeCompactEndAlignment uses it to repack the pairs, through the AlignedSequence of each sequence,
+ * into the end alignment. The pairs are still all made by makeAlignment first; the callback is where
+ * a makeAlignment that produced the pairs one at a time would feed them in.
+ */
+void endAligner_addAlignedPairs(MultipleAlignment *mA,
+        void (*alignedPairFn)(void *extraArg, int64_t score, int64_t sequence1, int64_t offset1, int64_t sequence2,
+                int64_t offset2), void *extraArg);
+
+/*
+ * As makeEndAlignment, but returns a compact end alignment. If adjacencySequenceCache is not NULL the
+ * adjacency sequences are got from it, rather than read from the database. If profile is not NULL a
+ * row for the end alignment is added to it.
+ */
+EndAlignment *makeCompactEndAlignment(StateMachine *sM, End *end, int64_t spanningTrees, int64_t maxSequenceLength,
+        bool useProgressiveMerging, float gapGamma,
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, AdjacencySequenceCache *adjacencySequenceCache,
+        BarProfile *profile);
+
 /*
  * Creates a global alignment (as a set of aligned pairs) of the sequences from the end,
  * the pairs returned are ordered according
@@ -61,5 +162,69 @@ void writeEndAlignmentToDisk(End *end, stSortedSet *endAlignment, FILE *fileHand
  */
 stSortedSet *loadEndAlignmentFromDisk(Flower *flower, FILE *fileHandle, End **end);
 
+/*
+ * As writeEndAlignmentToDisk, but for a compact end alignment, skipping deleted pairs.
+ */
+void writeCompactEndAlignmentToDisk(End *end, EndAlignment *endAlignment, FILE *fileHandle);
+
+/*
+ * As loadEndAlignmentFromDisk, but returns a compact end alignment.
+ */
+EndAlignment *loadCompactEndAlignmentFromDisk(Flower *flower, FILE *fileHandle, End **end);
+
+/*
+ * Coefficients of a linear model of the time, in seconds, taken by makeEndAlignment.
+ */
+typedef struct _AlignmentTimeModel {
+    double secondsPerAlignment; //Fixed cost of each end alignment.
+    double secondsPerCell; //For each cell of the pairwise dynamic programming matrices.
+    double secondsPerAlignedBase; //For each base in each pairwise alignment, in taking and merging the posteriors.
+} AlignmentTimeModel;
+
+/*
+ * The default model. Its coefficients are rough estimates that have not been calibrated, so the times
+ * used by --largeEndTime and --endAlignmentJobTime are only relative. Fit them for a machine with
+ * cactus_barBenchmark --calibrateEndAlignmentTime --spanningTrees [spanningTrees], which also prints
+ * the error of the default model on each end it times.
+ */
+extern const AlignmentTimeModel defaultAlignmentTimeModel;
+
+/*
+ * Estimates the time to align the sequences of the given lengths with makeAlignment, using
+ * the given model. The number of pairwise alignments is bounded by spanningTrees, and the size
+ * of their matrices by the banding parameters.
+ */
+double estimateAlignmentTime(const int64_t *sequenceLengths, int64_t sequenceNumber, int64_t spanningTrees,
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, const AlignmentTimeModel *model);
+
+/*
+ * Estimates the time makeEndAlignment will take for the end, with the default model.
+ */
+double estimateEndAlignmentTime(End *end, int64_t spanningTrees, int64_t maxSequenceLength,
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters);
+
+/*
+ * Estimates the peak memory, in bytes, taken to align the sequences of the given lengths with
+ * makeAlignment and convert the result to an end alignment: the largest pairwise matrix, the aligned
+ * pairs and the sequences.
+ */
+double estimateAlignmentMemory(const int64_t *sequenceLengths, int64_t sequenceNumber, int64_t spanningTrees,
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters);
+
+/*
+ * If the alignment of the sequences is estimated to take more than memoryBudget bytes, tightens the
+ * anchoring (anchorMatrixBiggerThanThis and repeatMaskMatrixBiggerThanThis) or reduces the spanning
+ * trees, whichever saves the most, until it fits or neither can be reduced further. Modifies the
+ * given parameters and returns the estimated memory with them.
+ */
+double fitAlignmentToMemoryBudget(const int64_t *sequenceLengths, int64_t sequenceNumber, double memoryBudget,
+        int64_t *spanningTrees, PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters);
+
+/*
+ * As fitAlignmentToMemoryBudget, for the alignment of the end, logging the parameters chosen if they
+ * were changed.
+ */
+void fitEndAlignmentToMemoryBudget(End *end, int64_t maxSequenceLength, double memoryBudget, int64_t *spanningTrees,
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters);
 
 #endif /* ENDALIGNER_H_ */
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+/*
+ * endAlignmentCheckpoint.h
+ *
+ * Writes precomputed end alignments to a file one end at a time, keeping an
+ * index of the completed ends in "[fileName].index", so that a run that is
+ * interrupted can be restarted from the last completed end. The file made by
+ * a restarted run is byte-identical to that of an uninterrupted one.
+ */
+
+#ifndef ENDALIGNMENTCHECKPOINT_H_
+#define ENDALIGNMENTCHECKPOINT_H_
+
+#include "sonLib.h"
+#include "cactus.h"
+#include "endAligner.h"
+
+typedef struct _EndAlignmentCheckpoint EndAlignmentCheckpoint;
+
+/*
+ * Opens the given end alignment file for writing the alignments of the ends with the given
+ * names (a list of Name pointers), in that order. If the index of an earlier run with the same
+ * header (describing the run, for example its arguments) and ends is found, the ends it completed
+ * are kept and anything written after the last of them is discarded, otherwise the file is
+ * started from scratch.
+ */
+EndAlignmentCheckpoint *endAlignmentCheckpoint_construct(const char *fileName, const char *header, stList *endNames);
+
+/*
+ * Closes the file and its index.
+ */
+void endAlignmentCheckpoint_destruct(EndAlignmentCheckpoint *checkpoint);
+
+/*
+ * The number of ends, from the start of the list of end names, whose alignments are complete.
+ */
+int64_t endAlignmentCheckpoint_getCompletedEndNumber(EndAlignmentCheckpoint *checkpoint);
+
+/*
+ * Writes the alignment of the next end to the file, as writeCompactEndAlignmentToDisk, then
+ * records it as completed in the index once it is on disk.
+ */
+void endAlignmentCheckpoint_add(EndAlignmentCheckpoint *checkpoint, End *end, EndAlignment *endAlignment);
+
+#endif /* ENDALIGNMENTCHECKPOINT_H_ */
@@ -15,6 +15,7 @@
 #define FLOWER_ALIGNER_H_
 
 #include "pairwiseAligner.h"
+#include "barProfile.h"
 
 /*
  * Constructs an alignment for the flower by constructing an alignment for each end
@@ -28,17 +29,36 @@ stSortedSet *makeFlowerAlignment(StateMachine *sM, Flower *flower, int64_t spann
         PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, bool pruneOutStubAlignments);
 
 /*
- * As above, but including alignments from disk.
+ * As above, but including alignments from disk. If memoryBudget is positive, ends whose alignments are
+ * predicted to take more than that many bytes are aligned with parameters fitted to it by
+ * fitEndAlignmentToMemoryBudget. If profile is not NULL, rows for the end alignments made and for the
+ * pruning are added to it.
  */
 stSortedSet *makeFlowerAlignment3(StateMachine *sM, Flower *flower, stList *listOfEndAlignmentFiles, int64_t spanningTrees,
         int64_t maxSequenceLength, bool useProgressiveMerging, float gapGamma,
-        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, bool pruneOutStubAlignments);
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, bool pruneOutStubAlignments,
+        double memoryBudget, BarProfile *profile);
 
 /*
  * Ascertain which ends should be aligned separately.
  */
 stSortedSet *getEndsToAlignSeparately(Flower *flower, int64_t maxSequenceLength, int64_t largeEndSize);
 
+/*
+ * As above, but picks the ends whose alignments are estimated by estimateEndAlignmentTime to take
+ * at least largeEndTime seconds.
+ */
+stSortedSet *getEndsToAlignSeparatelyByTime(Flower *flower, int64_t maxSequenceLength, int64_t spanningTrees,
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, double largeEndTime);
+
+/*
+ * Divides end alignments with the given estimated times into groups that each take about jobTime
+ * seconds, balancing the time between the groups. Returns the group of each end alignment, numbered
+ * from 0, and sets groupNumber to the number of groups.
+ */
+int64_t *groupEndAlignmentJobs(const double *endAlignmentTimes, int64_t endAlignmentNumber, double jobTime,
+        int64_t *groupNumber);
+
 /*
  * The total number of unaligned bases in adjacencies incident with the end.
  */
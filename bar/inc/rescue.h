@@ -19,4 +19,10 @@ int bedRegion_cmp(const bedRegion *region1, const bedRegion *region2);
 void rescueCoveredRegions(stPinchThread *thread, bedRegion *beds, size_t numBeds,
                           Name name, int64_t minSegmentLength, double coveredBasesThreshold);
 
+// As rescueCoveredRegions, but with a binary search of the bed array
+// for each segment rather than a single sweep along the thread. Kept
+// for testing and benchmarking.
+void rescueCoveredRegions_binarySearch(stPinchThread *thread, bedRegion *beds, size_t numBeds,
+                                       Name name, int64_t minSegmentLength, double coveredBasesThreshold);
+
 #endif // RESCUE_H_
@@ -91,6 +91,84 @@ static void testAdjacencySequence_7(CuTest *testCase) {
    teardown(testCase);
 }
 
+static void checkAdjacencySequencesEqual(CuTest *testCase, AdjacencySequence *adjacencySequence1,
+        AdjacencySequence *adjacencySequence2) {
+    CuAssertIntEquals(testCase, adjacencySequence1->subsequenceIdentifier, adjacencySequence2->subsequenceIdentifier);
+    CuAssertIntEquals(testCase, adjacencySequence1->start, adjacencySequence2->start);
+    CuAssertIntEquals(testCase, adjacencySequence1->strand, adjacencySequence2->strand);
+    CuAssertIntEquals(testCase, adjacencySequence1->length, adjacencySequence2->length);
+    CuAssertIntEquals(testCase, adjacencySequence1->hasStubEnd, adjacencySequence2->hasStubEnd);
+    if (adjacencySequence1->string != NULL && adjacencySequence2->string != NULL) {
+        CuAssertStrEquals(testCase, adjacencySequence1->string, adjacencySequence2->string);
+    }
+}
+
+static void testAdjacencySequence_withoutString(CuTest *testCase) {
+    setup(testCase);
+    Cap *caps[] = { cap1, cap_getReverse(cap2), cap7, cap9, cap11 };
+    for (int64_t i = 0; i < 5; i++) {
+        for (int64_t maxLength = 0; maxLength < 8; maxLength++) {
+            AdjacencySequence *adjacencySequence = adjacencySequence_construct(caps[i], maxLength);
+            AdjacencySequence *adjacencySequence2 = adjacencySequence_constructWithoutString(caps[i], maxLength);
+            CuAssertTrue(testCase, adjacencySequence2->string == NULL);
+            checkAdjacencySequencesEqual(testCase, adjacencySequence, adjacencySequence2);
+            adjacencySequence_destruct(adjacencySequence);
+            adjacencySequence_destruct(adjacencySequence2);
+        }
+    }
+    teardown(testCase);
+}
+
+static void testAdjacencySequenceCache(CuTest *testCase) {
+    setup(testCase);
+    //The adjacencies have lengths 4, 5, 1, 6, 4 and 0, so with flanks of two bases, those of length 5 and 6
+    //are read as two flanks and the others whole.
+    int64_t cacheMaxLengths[] = { 2, 100 };
+    int64_t expectedBasesRead[] = { 17, 20 };
+    int64_t expectedSequencesRead[] = { 8, 6 };
+    for (int64_t i = 0; i < 2; i++) {
+        AdjacencySequenceCache *cache = adjacencySequenceCache_construct(cacheMaxLengths[i]);
+        adjacencySequenceCache_prefetchFlower(cache, flower);
+        CuAssertIntEquals(testCase, expectedBasesRead[i], cache->basesRead);
+        CuAssertIntEquals(testCase, expectedSequencesRead[i], cache->sequencesRead);
+        //Get every adjacency sequence, from both of its caps, several times: no more bases should be read.
+        for (int64_t repeat = 0; repeat < 2; repeat++) {
+            Flower_CapIterator *capIt = flower_getCapIterator(flower);
+            Cap *cap;
+            while ((cap = flower_getNextCap(capIt)) != NULL) {
+                if (cap_getSide(cap)) {
+                    cap = cap_getReverse(cap);
+                }
+                for (int64_t maxLength = 0; maxLength <= cacheMaxLengths[i]; maxLength++) {
+                    AdjacencySequence *adjacencySequence = adjacencySequence_construct(cap, maxLength);
+                    AdjacencySequence *adjacencySequence2 = adjacencySequenceCache_getAdjacencySequence(cache, cap,
+                            maxLength);
+                    checkAdjacencySequencesEqual(testCase, adjacencySequence, adjacencySequence2);
+                    adjacencySequence_destruct(adjacencySequence);
+                    adjacencySequence_destruct(adjacencySequence2);
+                }
+            }
+            flower_destructCapIterator(capIt);
+        }
+        CuAssertIntEquals(testCase, expectedBasesRead[i], cache->basesRead);
+        CuAssertIntEquals(testCase, expectedSequencesRead[i], cache->sequencesRead);
+        adjacencySequenceCache_destruct(cache);
+    }
+    //Adjacencies not prefetched are read into the cache when first got.
+    AdjacencySequenceCache *cache = adjacencySequenceCache_construct(100);
+    AdjacencySequence *adjacencySequence = adjacencySequenceCache_getAdjacencySequence(cache, cap7, INT64_MAX);
+    CuAssertStrEquals(testCase, "CCGGTT", adjacencySequence->string);
+    adjacencySequence_destruct(adjacencySequence);
+    adjacencySequence = adjacencySequenceCache_getAdjacencySequence(cache, cap_getReverse(cap8), 100);
+    CuAssertStrEquals(testCase, "AACCGG", adjacencySequence->string);
+    adjacencySequence_destruct(adjacencySequence);
+    CuAssertIntEquals(testCase, 6, cache->basesRead);
+    CuAssertIntEquals(testCase, 1, cache->sequencesRead);
+    CuAssertIntEquals(testCase, 2, cache->adjacencySequencesGot);
+    adjacencySequenceCache_destruct(cache);
+    teardown(testCase);
+}
+
 CuSuite* adjacencySequenceTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, testAdjacencySequence_1);
@@ -100,5 +178,7 @@ CuSuite* adjacencySequenceTestSuite(void) {
     SUITE_ADD_TEST(suite, testAdjacencySequence_5);
     SUITE_ADD_TEST(suite, testAdjacencySequence_6);
     SUITE_ADD_TEST(suite, testAdjacencySequence_7);
+    SUITE_ADD_TEST(suite, testAdjacencySequence_withoutString);
+    SUITE_ADD_TEST(suite, testAdjacencySequenceCache);
     return suite;
 }
@@ -7,6 +7,7 @@
 #include "flowersShared.h"
 #include "endAligner.h"
 #include "adjacencySequences.h"
+#include "endAlignmentCheckpoint.h"
 #include "pairwiseAligner.h"
 
 void test_alignedPair_cmpFn(CuTest *testCase) {
@@ -149,10 +150,372 @@ static void testReadAndWriteEndAlignments(CuTest *testCase) {
     teardown(testCase);
 }
 
+static char *getFileString(const char *fileName) {
+    FILE *fileHandle = fopen(fileName, "r");
+    stList *lines = stList_construct3(0, free);
+    char *line;
+    while((line = stFile_getLineFromFile(fileHandle)) != NULL) {
+        stList_append(lines, line);
+    }
+    fclose(fileHandle);
+    char *string = stString_join2("\n", lines);
+    stList_destruct(lines);
+    return string;
+}
+
+static void testCompactEndAlignment(CuTest *testCase) {
+    setup(testCase);
+    for (int64_t test = 0; test < 100; test++) {
+        //Make random pairs, in both a compact end alignment and a set of aligned pairs.
+        stSortedSet *sortedAlignment = stSortedSet_construct3((int (*)(const void *, const void *))alignedPair_cmpFn,
+                (void (*)(void *))alignedPair_destruct);
+        EndAlignment *endAlignment = endAlignment_construct();
+        int64_t pairNumber = st_randomInt(0, 200);
+        if (st_random() > 0.5) { //Reserving room, even too little, must not change the result.
+            endAlignment_reserve(endAlignment, st_randomInt(0, 2 * pairNumber + 1));
+        }
+        for (int64_t i = 0; i < pairNumber; i++) {
+            AlignedPair *alignedPair = alignedPair_construct(st_randomInt(0, 5), st_randomInt(-10, 10), st_random() > 0.5,
+                    st_randomInt(0, 5), st_randomInt(-10, 10), st_random() > 0.5, st_randomInt(1, 100), st_randomInt(1, 100));
+            if (alignedPair_cmpFn(alignedPair, alignedPair->reverse) == 0 || stSortedSet_search(sortedAlignment, alignedPair) != NULL
+                    || stSortedSet_search(sortedAlignment, alignedPair->reverse) != NULL) {
+                alignedPair_destruct(alignedPair->reverse);
+                alignedPair_destruct(alignedPair);
+                continue;
+            }
+            stSortedSet_insert(sortedAlignment, alignedPair);
+            stSortedSet_insert(sortedAlignment, alignedPair->reverse);
+            endAlignment_addPair(endAlignment, alignedPair->subsequenceIdentifier, alignedPair->position, alignedPair->strand,
+                    alignedPair->reverse->subsequenceIdentifier, alignedPair->reverse->position, alignedPair->reverse->strand,
+                    alignedPair->score, alignedPair->reverse->score);
+        }
+        endAlignment_sort(endAlignment);
+
+        //Check the entries are in the order of the set, with the right reverses.
+        CuAssertIntEquals(testCase, stSortedSet_size(sortedAlignment), endAlignment->length);
+        CuAssertIntEquals(testCase, stSortedSet_size(sortedAlignment) / 2, endAlignment_getPairNumber(endAlignment));
+        stSortedSetIterator *it = stSortedSet_getIterator(sortedAlignment);
+        AlignedPair *alignedPair;
+        int64_t i = 0;
+        while ((alignedPair = stSortedSet_getNext(it)) != NULL) {
+            int64_t j = endAlignment->reverse[i];
+            CuAssertIntEquals(testCase, i, endAlignment->reverse[j]);
+            CuAssertIntEquals(testCase, alignedPair->subsequenceIdentifier, endAlignment->subsequenceIdentifiers[i]);
+            CuAssertIntEquals(testCase, alignedPair->position, endAlignment->positions[i]);
+            CuAssertIntEquals(testCase, alignedPair->strand, endAlignment->strands[i]);
+            CuAssertIntEquals(testCase, alignedPair->score, endAlignment->scores[i]);
+            CuAssertIntEquals(testCase, alignedPair->reverse->subsequenceIdentifier, endAlignment->subsequenceIdentifiers[j]);
+            CuAssertIntEquals(testCase, alignedPair->reverse->position, endAlignment->positions[j]);
+            CuAssertIntEquals(testCase, alignedPair->reverse->strand, endAlignment->strands[j]);
+            CuAssertIntEquals(testCase, alignedPair->reverse->score, endAlignment->scores[j]);
+            //Check the first index of its coordinate.
+            int64_t k = endAlignment_getFirstIndex(endAlignment, alignedPair->subsequenceIdentifier, alignedPair->position);
+            CuAssertTrue(testCase, k <= i);
+            CuAssertTrue(testCase, k == 0 || endAlignment->subsequenceIdentifiers[k-1] != alignedPair->subsequenceIdentifier
+                    || endAlignment->positions[k-1] < alignedPair->position);
+            i++;
+        }
+        stSortedSet_destructIterator(it);
+
+        //Check it converts to and from sets of aligned pairs, and serialises the same way.
+        EndAlignment *endAlignment2 = endAlignment_constructFromSortedSet(sortedAlignment);
+        stSortedSet *sortedAlignment2 = stSortedSet_construct3((int (*)(const void *, const void *))alignedPair_cmpFn,
+                (void (*)(void *))alignedPair_destruct);
+        endAlignment_addToSortedSet(endAlignment2, sortedAlignment2);
+        CuAssertTrue(testCase, stSortedSet_equals(sortedAlignment, sortedAlignment2));
+
+        char *temporaryEndAlignmentFile = "temporaryEndAlignmentFile.end";
+        FILE *fileHandle = fopen(temporaryEndAlignmentFile, "w");
+        writeEndAlignmentToDisk(end1, sortedAlignment, fileHandle);
+        fclose(fileHandle);
+        char *string = getFileString(temporaryEndAlignmentFile);
+        fileHandle = fopen(temporaryEndAlignmentFile, "w");
+        writeCompactEndAlignmentToDisk(end1, endAlignment, fileHandle);
+        fclose(fileHandle);
+        char *string2 = getFileString(temporaryEndAlignmentFile);
+        CuAssertStrEquals(testCase, string, string2);
+        fileHandle = fopen(temporaryEndAlignmentFile, "r");
+        End *end;
+        EndAlignment *endAlignment3 = loadCompactEndAlignmentFromDisk(flower, fileHandle, &end);
+        fclose(fileHandle);
+        CuAssertPtrEquals(testCase, end1, end);
+        CuAssertIntEquals(testCase, endAlignment->length, endAlignment3->length);
+        for (int64_t i = 0; i < endAlignment->length; i++) {
+            CuAssertIntEquals(testCase, endAlignment->reverse[i], endAlignment3->reverse[i]);
+            CuAssertIntEquals(testCase, endAlignment->scores[i], endAlignment3->scores[i]);
+        }
+
+        //Delete some pairs, and check they are gone from the set and from the file.
+        for (int64_t i = 0; i < endAlignment->length; i++) {
+            if (!endAlignment->deleted[i] && st_random() > 0.5) {
+                endAlignment_deletePair(endAlignment, i);
+            }
+        }
+        stSortedSet *sortedAlignment3 = stSortedSet_construct3((int (*)(const void *, const void *))alignedPair_cmpFn,
+                (void (*)(void *))alignedPair_destruct);
+        endAlignment_addToSortedSet(endAlignment, sortedAlignment3);
+        CuAssertIntEquals(testCase, 2 * endAlignment_getPairNumber(endAlignment), stSortedSet_size(sortedAlignment3));
+        fileHandle = fopen(temporaryEndAlignmentFile, "w");
+        writeEndAlignmentToDisk(end1, sortedAlignment3, fileHandle);
+        fclose(fileHandle);
+        char *string3 = getFileString(temporaryEndAlignmentFile);
+        fileHandle = fopen(temporaryEndAlignmentFile, "w");
+        writeCompactEndAlignmentToDisk(end1, endAlignment, fileHandle);
+        fclose(fileHandle);
+        char *string4 = getFileString(temporaryEndAlignmentFile);
+        CuAssertStrEquals(testCase, string3, string4);
+
+        //cleanup
+        free(string);
+        free(string2);
+        free(string3);
+        free(string4);
+        stFile_rmtree(temporaryEndAlignmentFile);
+        endAlignment_destruct(endAlignment);
+        endAlignment_destruct(endAlignment2);
+        endAlignment_destruct(endAlignment3);
+        stSortedSet_destruct(sortedAlignment);
+        stSortedSet_destruct(sortedAlignment2);
+        stSortedSet_destruct(sortedAlignment3);
+    }
+    teardown(testCase);
+}
+
+static void testEndAlignmentProfile(CuTest *testCase) {
+    setup(testCase);
+    End *ends[3] = { end1, end2, end3 };
+    char *fileNames[2] = { "temporaryProfile.csv", "temporaryProfile.json" };
+    for (int64_t format = 0; format < 2; format++) {
+        BarProfile *profile = barProfile_construct(fileNames[format]);
+        for (int64_t endIndex = 0; endIndex < 3; endIndex++) {
+            EndAlignment *endAlignment = makeCompactEndAlignment(stateMachine, ends[endIndex], 5, 4, 0, 0.5,
+                    pairwiseParameters, NULL, profile);
+            endAlignment_destruct(endAlignment);
+        }
+        barProfile_addStage(profile, flower, "prune", 0.5, 0);
+        barProfile_destruct(profile);
+
+        char *string = getFileString(fileNames[format]);
+        stList *lines = stString_splitByString(string, "\n");
+        //Every line ends in a newline, so the last token is empty.
+        CuAssertStrEquals(testCase, "", stList_get(lines, stList_length(lines) - 1));
+        if (format == 0) {
+            //A header, then a row for each end alignment, then one for the stage.
+            CuAssertIntEquals(testCase, 6, stList_length(lines));
+            for (int64_t i = 0; i < 5; i++) {
+                stList *fields = stString_splitByString(stList_get(lines, i), ",");
+                CuAssertIntEquals(testCase, 9, stList_length(fields));
+                if (i > 0 && i < 4) {
+                    CuAssertStrEquals(testCase, "endAlignment", stList_get(fields, 2));
+                    int64_t sequenceNumber;
+                    CuAssertIntEquals(testCase, 1, sscanf(stList_get(fields, 3), "%" PRIi64, &sequenceNumber));
+                    CuAssertIntEquals(testCase, end_getInstanceNumber(ends[i - 1]), sequenceNumber);
+                }
+                stList_destruct(fields);
+            }
+            CuAssertTrue(testCase, strstr(stList_get(lines, 4), ",prune,,,,,0.500000,0") != NULL);
+        } else {
+            //Brackets enclosing a line for each row.
+            CuAssertIntEquals(testCase, 7, stList_length(lines));
+            CuAssertStrEquals(testCase, "[", stList_get(lines, 0));
+            CuAssertStrEquals(testCase, "]", stList_get(lines, 5));
+            for (int64_t i = 1; i < 5; i++) {
+                CuAssertTrue(testCase, strstr(stList_get(lines, i), "  {\"flower\": ") == stList_get(lines, i));
+            }
+            CuAssertTrue(testCase, strstr(stList_get(lines, 4), "\"stage\": \"prune\"") != NULL);
+        }
+        stList_destruct(lines);
+        free(string);
+        stFile_rmtree(fileNames[format]);
+    }
+    teardown(testCase);
+}
+
+/*
+ * Checks that an interrupted, checkpointed run of end alignments resumes to give the file an
+ * uninterrupted run gives.
+ */
+static void testEndAlignmentCheckpoint(CuTest *testCase) {
+    setup(testCase);
+    End *ends[3] = { end1, end2, end3 };
+    EndAlignment *endAlignments[3];
+    Name names[3];
+    stList *endNames = stList_construct();
+    for (int64_t endIndex = 0; endIndex < 3; endIndex++) {
+        endAlignments[endIndex] = makeCompactEndAlignment(stateMachine, ends[endIndex], 5, 4, 0, 0.5,
+                pairwiseParameters, NULL, NULL);
+        names[endIndex] = end_getName(ends[endIndex]);
+        stList_append(endNames, &names[endIndex]);
+    }
+    char *fileName = "temporaryEndAlignmentFile.end";
+    char *indexFileName = "temporaryEndAlignmentFile.end.index";
+
+    //Without a checkpoint.
+    FILE *fileHandle = fopen(fileName, "w");
+    for (int64_t endIndex = 0; endIndex < 3; endIndex++) {
+        writeCompactEndAlignmentToDisk(ends[endIndex], endAlignments[endIndex], fileHandle);
+    }
+    fclose(fileHandle);
+    char *expectedString = getFileString(fileName);
+    stFile_rmtree(fileName);
+
+    for (int64_t interruptedEnds = 0; interruptedEnds <= 3; interruptedEnds++) {
+        //Complete some ends, then leave part of the next one, and part of its index entry, as an interruption would.
+        EndAlignmentCheckpoint *checkpoint = endAlignmentCheckpoint_construct(fileName, "run", endNames);
+        CuAssertIntEquals(testCase, 0, endAlignmentCheckpoint_getCompletedEndNumber(checkpoint));
+        for (int64_t endIndex = 0; endIndex < interruptedEnds; endIndex++) {
+            endAlignmentCheckpoint_add(checkpoint, ends[endIndex], endAlignments[endIndex]);
+        }
+        endAlignmentCheckpoint_destruct(checkpoint);
+        fileHandle = fopen(fileName, "a");
+        fprintf(fileHandle, "%" PRIi64 " 10\n1 2", names[0]);
+        fclose(fileHandle);
+        fileHandle = fopen(indexFileName, "a");
+        fprintf(fileHandle, "%" PRIi64, names[0]);
+        fclose(fileHandle);
+
+        //A run with another header starts again.
+        if (interruptedEnds == 1) {
+            checkpoint = endAlignmentCheckpoint_construct(fileName, "another run", endNames);
+            CuAssertIntEquals(testCase, 0, endAlignmentCheckpoint_getCompletedEndNumber(checkpoint));
+            endAlignmentCheckpoint_add(checkpoint, ends[0], endAlignments[0]);
+            endAlignmentCheckpoint_destruct(checkpoint);
+        }
+
+        //A run with the same header resumes after the completed ends.
+        checkpoint = endAlignmentCheckpoint_construct(fileName, "run", endNames);
+        CuAssertIntEquals(testCase, interruptedEnds == 1 ? 0 : interruptedEnds,
+                endAlignmentCheckpoint_getCompletedEndNumber(checkpoint));
+        for (int64_t endIndex = endAlignmentCheckpoint_getCompletedEndNumber(checkpoint); endIndex < 3; endIndex++) {
+            endAlignmentCheckpoint_add(checkpoint, ends[endIndex], endAlignments[endIndex]);
+        }
+        endAlignmentCheckpoint_destruct(checkpoint);
+        char *string = getFileString(fileName);
+        CuAssertStrEquals(testCase, expectedString, string);
+        free(string);
+
+        //Restarting a finished run leaves the file as it is.
+        checkpoint = endAlignmentCheckpoint_construct(fileName, "run", endNames);
+        CuAssertIntEquals(testCase, 3, endAlignmentCheckpoint_getCompletedEndNumber(checkpoint));
+        endAlignmentCheckpoint_destruct(checkpoint);
+        string = getFileString(fileName);
+        CuAssertStrEquals(testCase, expectedString, string);
+        free(string);
+        stFile_rmtree(fileName);
+        stFile_rmtree(indexFileName);
+    }
+
+    free(expectedString);
+    stList_destruct(endNames);
+    for (int64_t endIndex = 0; endIndex < 3; endIndex++) {
+        endAlignment_destruct(endAlignments[endIndex]);
+    }
+    teardown(testCase);
+}
+
+/*
+ * Checks estimateAlignmentTime against a sum over every pair of sequences.
+ */
+static void testEstimateAlignmentTime(CuTest *testCase) {
+    PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+    p->anchorMatrixBiggerThanThis = 100 * 100;
+    p->diagonalExpansion = 4;
+    AlignmentTimeModel cellModel = { 0.0, 1.0, 0.0 }, baseModel = { 0.0, 0.0, 1.0 }, overheadModel = { 1.0, 0.0, 0.0 };
+    for (int64_t test = 0; test < 100; test++) {
+        int64_t sequenceNumber = st_randomInt(0, 30);
+        int64_t spanningTrees = st_randomInt(1, 20);
+        int64_t *lengths = st_malloc(sizeof(int64_t) * (sequenceNumber + 1));
+        for (int64_t i = 0; i < sequenceNumber; i++) {
+            lengths[i] = st_randomInt(0, 300);
+        }
+        double cells = 0.0, bases = 0.0;
+        for (int64_t i = 0; i < sequenceNumber; i++) {
+            for (int64_t j = i + 1; j < sequenceNumber; j++) {
+                cells += lengths[i] * lengths[j] <= p->anchorMatrixBiggerThanThis ? lengths[i] * lengths[j] :
+                        (lengths[i] + lengths[j]) * (2 * p->diagonalExpansion + 1);
+                bases += lengths[i] + lengths[j];
+            }
+        }
+        double pairs = sequenceNumber * (sequenceNumber - 1) / 2;
+        if (pairs > sequenceNumber * spanningTrees) {
+            cells *= sequenceNumber * spanningTrees / pairs;
+            bases *= sequenceNumber * spanningTrees / pairs;
+        }
+        CuAssertDblEquals(testCase, cells, estimateAlignmentTime(lengths, sequenceNumber, spanningTrees, p, &cellModel),
+                1.0e-6 * (cells + 1));
+        CuAssertDblEquals(testCase, bases, estimateAlignmentTime(lengths, sequenceNumber, spanningTrees, p, &baseModel),
+                1.0e-6 * (bases + 1));
+        CuAssertDblEquals(testCase, 1.0, estimateAlignmentTime(lengths, sequenceNumber, spanningTrees, p, &overheadModel),
+                1.0e-9);
+        free(lengths);
+    }
+    pairwiseAlignmentBandingParameters_destruct(p);
+}
+
+static void testFitAlignmentToMemoryBudget(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+        p->anchorMatrixBiggerThanThis = st_randomInt(1, 1000) * st_randomInt(1, 1000);
+        p->repeatMaskMatrixBiggerThanThis = st_randomInt(1, 1000) * st_randomInt(1, 1000);
+        p->diagonalExpansion = st_randomInt(0, 20);
+        int64_t sequenceNumber = st_randomInt(0, 30);
+        int64_t spanningTrees = st_randomInt(1, 20);
+        int64_t *lengths = st_malloc(sizeof(int64_t) * (sequenceNumber + 1));
+        int64_t *reversedLengths = st_malloc(sizeof(int64_t) * (sequenceNumber + 1));
+        for (int64_t i = 0; i < sequenceNumber; i++) {
+            lengths[i] = st_randomInt(0, 3000);
+            reversedLengths[sequenceNumber - 1 - i] = lengths[i];
+        }
+        double memory = estimateAlignmentMemory(lengths, sequenceNumber, spanningTrees, p);
+        //The estimate does not depend on the order of the sequences, and is at least the memory of the sequences.
+        CuAssertDblEquals(testCase, memory, estimateAlignmentMemory(reversedLengths, sequenceNumber, spanningTrees, p),
+                1.0e-6 * memory);
+        for (int64_t i = 0; i < sequenceNumber; i++) {
+            CuAssertTrue(testCase, memory >= lengths[i]);
+        }
+
+        //With a budget it already fits in nothing changes.
+        PairwiseAlignmentParameters unchanged = *p;
+        int64_t unchangedSpanningTrees = spanningTrees;
+        CuAssertDblEquals(testCase, memory, fitAlignmentToMemoryBudget(lengths, sequenceNumber, memory,
+                &unchangedSpanningTrees, &unchanged), 1.0e-6 * memory);
+        CuAssertIntEquals(testCase, spanningTrees, unchangedSpanningTrees);
+        CuAssertIntEquals(testCase, p->anchorMatrixBiggerThanThis, unchanged.anchorMatrixBiggerThanThis);
+        CuAssertIntEquals(testCase, p->repeatMaskMatrixBiggerThanThis, unchanged.repeatMaskMatrixBiggerThanThis);
+
+        //With a smaller budget the estimate with the fitted parameters is returned, and fits unless
+        //nothing more can be reduced.
+        double memoryBudget = memory * st_random();
+        PairwiseAlignmentParameters fitted = *p;
+        int64_t fittedSpanningTrees = spanningTrees;
+        double fittedMemory = fitAlignmentToMemoryBudget(lengths, sequenceNumber, memoryBudget, &fittedSpanningTrees,
+                &fitted);
+        CuAssertDblEquals(testCase, fittedMemory, estimateAlignmentMemory(lengths, sequenceNumber, fittedSpanningTrees,
+                &fitted), 1.0e-6 * memory);
+        CuAssertTrue(testCase, fittedMemory <= memory);
+        CuAssertTrue(testCase, fittedSpanningTrees >= 1 && fittedSpanningTrees <= spanningTrees);
+        CuAssertTrue(testCase, fitted.anchorMatrixBiggerThanThis <= p->anchorMatrixBiggerThanThis);
+        CuAssertTrue(testCase, fitted.repeatMaskMatrixBiggerThanThis <= p->repeatMaskMatrixBiggerThanThis);
+        if (fittedMemory > memoryBudget) {
+            CuAssertIntEquals(testCase, 1, fittedSpanningTrees);
+            CuAssertTrue(testCase, fitted.anchorMatrixBiggerThanThis <= 100);
+        }
+
+        free(lengths);
+        free(reversedLengths);
+        pairwiseAlignmentBandingParameters_destruct(p);
+    }
+}
+
 CuSuite* endAlignerTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, testMakeEndAlignments);
     SUITE_ADD_TEST(suite, testReadAndWriteEndAlignments);
     SUITE_ADD_TEST(suite, test_alignedPair_cmpFn);
+    SUITE_ADD_TEST(suite, testCompactEndAlignment);
+    SUITE_ADD_TEST(suite, testEstimateAlignmentTime);
+    SUITE_ADD_TEST(suite, testEndAlignmentProfile);
+    SUITE_ADD_TEST(suite, testFitAlignmentToMemoryBudget);
+    SUITE_ADD_TEST(suite, testEndAlignmentCheckpoint);
     return suite;
 }
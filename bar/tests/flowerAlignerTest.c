@@ -12,6 +12,8 @@
 
 stList *getInducedAlignment(stSortedSet *endAlignment, AdjacencySequence *adjacencySequence);
 
+int64_t *getCompactInducedAlignment(EndAlignment *endAlignment, AdjacencySequence *adjacencySequence, int64_t *length);
+
 static int getRandomPosition(AdjacencySequence *adjacencySequence) {
     if(adjacencySequence->strand) {
         return st_randomInt(adjacencySequence->start, adjacencySequence->start + adjacencySequence->length);
@@ -103,6 +105,99 @@ void test_getInducedAlignment(CuTest *testCase) {
     }
 }
 
+void test_getCompactInducedAlignment(CuTest *testCase) {
+    for(int64_t test=0; test<100; test++) {
+        setup(testCase);
+
+        stSortedSet *sortedAlignment = stSortedSet_construct3((int (*)(const void *, const void *))alignedPair_cmpFn,
+                       (void (*)(void *))alignedPair_destruct);
+        EndAlignment *endAlignment = endAlignment_construct();
+
+        stList *adjacencySequences = stList_construct3(0, (void (*)(void *))adjacencySequence_destruct);
+        Cap *caps[] = { cap1, cap_getReverse(cap4),
+                cap5, cap_getReverse(cap8),
+                cap9 };
+        for(int64_t i=0; i<5; i++) {
+            stList_append(adjacencySequences, adjacencySequence_construct(caps[i], INT64_MAX));
+        }
+
+        //Make random aligned pairs, skipping any that are already present
+        while(st_random() > 0.001) {
+            AdjacencySequence *aS1 = st_randomChoice(adjacencySequences);
+            AdjacencySequence *aS2 = st_randomChoice(adjacencySequences);
+            if(aS1 != aS2) {
+                int64_t score1 = st_randomInt(1, PAIR_ALIGNMENT_PROB_1), score2 = st_randomInt(1, PAIR_ALIGNMENT_PROB_1);
+                AlignedPair *alignedPair =
+                        alignedPair_construct(aS1->subsequenceIdentifier, getRandomPosition(aS1), aS1->strand,
+                                              aS2->subsequenceIdentifier, getRandomPosition(aS2), aS2->strand,
+                                              score1, score2);
+                if(stSortedSet_search(sortedAlignment, alignedPair) != NULL || stSortedSet_search(sortedAlignment, alignedPair->reverse) != NULL) {
+                    alignedPair_destruct(alignedPair->reverse);
+                    alignedPair_destruct(alignedPair);
+                    continue;
+                }
+                stSortedSet_insert(sortedAlignment, alignedPair);
+                stSortedSet_insert(sortedAlignment, alignedPair->reverse);
+                endAlignment_addPair(endAlignment, alignedPair->subsequenceIdentifier, alignedPair->position, alignedPair->strand,
+                        alignedPair->reverse->subsequenceIdentifier, alignedPair->reverse->position, alignedPair->reverse->strand,
+                        score1, score2);
+            }
+        }
+        endAlignment_sort(endAlignment);
+        CuAssertIntEquals(testCase, stSortedSet_size(sortedAlignment), endAlignment->length);
+
+        //Delete some pairs from both, as the bar algorithm does
+        for(int64_t i=0; i<endAlignment->length; i++) {
+            if(!endAlignment->deleted[i] && st_random() > 0.7) {
+                int64_t j = endAlignment->reverse[i];
+                AlignedPair *alignedPair = alignedPair_construct(endAlignment->subsequenceIdentifiers[i], endAlignment->positions[i],
+                        endAlignment->strands[i], endAlignment->subsequenceIdentifiers[j], endAlignment->positions[j],
+                        endAlignment->strands[j], 0, 0);
+                AlignedPair *alignedPair2 = stSortedSet_search(sortedAlignment, alignedPair);
+                CuAssertTrue(testCase, alignedPair2 != NULL);
+                stSortedSet_remove(sortedAlignment, alignedPair2->reverse);
+                stSortedSet_remove(sortedAlignment, alignedPair2);
+                alignedPair_destruct(alignedPair2->reverse);
+                alignedPair_destruct(alignedPair2);
+                alignedPair_destruct(alignedPair->reverse);
+                alignedPair_destruct(alignedPair);
+                endAlignment_deletePair(endAlignment, i);
+            }
+        }
+        CuAssertIntEquals(testCase, stSortedSet_size(sortedAlignment), 2 * endAlignment_getPairNumber(endAlignment));
+
+        for(int64_t i=0; i<stList_length(adjacencySequences); i++) {
+            AdjacencySequence *adjacencySequence = stList_get(adjacencySequences, i);
+            stList *inducedAlignment = getInducedAlignment(sortedAlignment, adjacencySequence);
+            int64_t length;
+            int64_t *inducedAlignment2 = getCompactInducedAlignment(endAlignment, adjacencySequence, &length);
+
+            CuAssertIntEquals(testCase, stList_length(inducedAlignment), length);
+            for(int64_t j=0; j<stList_length(inducedAlignment); j++) {
+                AlignedPair *aP = stList_get(inducedAlignment, j);
+                int64_t k = inducedAlignment2[j];
+                CuAssertTrue(testCase, !endAlignment->deleted[k]);
+                CuAssertIntEquals(testCase, aP->subsequenceIdentifier, endAlignment->subsequenceIdentifiers[k]);
+                CuAssertIntEquals(testCase, aP->position, endAlignment->positions[k]);
+                CuAssertIntEquals(testCase, aP->strand, endAlignment->strands[k]);
+                CuAssertIntEquals(testCase, aP->score, endAlignment->scores[k]);
+                CuAssertIntEquals(testCase, aP->reverse->subsequenceIdentifier, endAlignment->subsequenceIdentifiers[endAlignment->reverse[k]]);
+                CuAssertIntEquals(testCase, aP->reverse->position, endAlignment->positions[endAlignment->reverse[k]]);
+                CuAssertIntEquals(testCase, aP->reverse->strand, endAlignment->strands[endAlignment->reverse[k]]);
+            }
+
+            stList_destruct(inducedAlignment);
+            free(inducedAlignment2);
+        }
+
+        //cleanup
+        stList_destruct(adjacencySequences);
+        endAlignment_destruct(endAlignment);
+        stSortedSet_destruct(sortedAlignment);
+        teardown(testCase);
+    }
+}
+
 /*
  * Just runs the flower alignment through, doesn't really check its okay.
  */
@@ -126,9 +221,44 @@ void test_flowerAlignerRandom(CuTest *testCase) {
     teardown(testCase);
 }
 
+/*
+ * Checks that every end alignment is put in a group, and that no group takes more than the target
+ * time by more than its longest end alignment.
+ */
+void test_groupEndAlignmentJobs(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        int64_t endAlignmentNumber = st_randomInt(0, 100);
+        double *times = st_malloc(sizeof(double) * (endAlignmentNumber + 1));
+        double totalTime = 0.0, maxTime = 0.0;
+        for (int64_t i = 0; i < endAlignmentNumber; i++) {
+            times[i] = st_random() < 0.1 ? st_random() * 100 : st_random();
+            totalTime += times[i];
+            maxTime = times[i] > maxTime ? times[i] : maxTime;
+        }
+        double jobTime = st_random() * 10 + 0.1;
+        int64_t groupNumber;
+        int64_t *groups = groupEndAlignmentJobs(times, endAlignmentNumber, jobTime, &groupNumber);
+        CuAssertTrue(testCase, groupNumber >= 1);
+        CuAssertTrue(testCase, endAlignmentNumber == 0 || groupNumber <= endAlignmentNumber);
+        double *groupTimes = st_calloc(groupNumber, sizeof(double));
+        for (int64_t i = 0; i < endAlignmentNumber; i++) {
+            CuAssertTrue(testCase, groups[i] >= 0 && groups[i] < groupNumber);
+            groupTimes[groups[i]] += times[i];
+        }
+        for (int64_t i = 0; i < groupNumber; i++) {
+            CuAssertTrue(testCase, groupTimes[i] <= totalTime / groupNumber + maxTime + 1.0e-9);
+        }
+        free(groupTimes);
+        free(groups);
+        free(times);
+    }
+}
+
 CuSuite* flowerAlignerTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, test_getInducedAlignment);
+    SUITE_ADD_TEST(suite, test_getCompactInducedAlignment);
     SUITE_ADD_TEST(suite, test_flowerAlignerRandom);
+    SUITE_ADD_TEST(suite, test_groupEndAlignmentJobs);
     return suite;
 }
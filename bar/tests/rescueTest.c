@@ -159,8 +159,88 @@ static void test_rescueRandomSequences(CuTest *testCase) {
     }
 }
 
+// Check that the segments rescued are exactly those without a block,
+// at least minSegmentLength long and with more than the threshold
+// proportion of their bases covered.
+static void checkRescueAgainstCoverage(CuTest *testCase,
+                                       void (*rescueFn)(stPinchThread *, bedRegion *, size_t, Name, int64_t, double)) {
+    for (int64_t testNum = 0; testNum < 100; testNum++) {
+        stPinchThreadSet *threadSet = stPinchThreadSet_getRandomGraph();
+        int64_t minSegmentLength = st_randomInt(1, 5);
+        double coveredBasesThreshold = st_random() < 0.1 ? 0.0 : st_random();
+
+        // Make random coverage for every other thread, so some
+        // threads have no regions.
+        stHash *coverages = stHash_construct2(NULL, free);
+        stPinchThreadSetIt threadIt = stPinchThreadSet_getIt(threadSet);
+        stPinchThread *thread;
+        bedRegion *bedRegionArray = NULL;
+        size_t numBeds = 0, bedRegionArraySize = 0;
+        while ((thread = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
+            int64_t threadEnd = stPinchThread_getStart(thread) + stPinchThread_getLength(thread);
+            bool *coverageArray = st_calloc(threadEnd, sizeof(bool));
+            if (st_random() < 0.5) {
+                double proportionCovered = st_random();
+                for (int64_t i = stPinchThread_getStart(thread); i < threadEnd; i++) {
+                    coverageArray[i] = st_random() < proportionCovered;
+                }
+                bedRegionArray = getBedRegionArray(stPinchThread_getName(thread), coverageArray, threadEnd,
+                                                   bedRegionArray, &numBeds, &bedRegionArraySize);
+            }
+            stHash_insert(coverages, thread, coverageArray);
+        }
+        if (numBeds > 0) {
+            qsort(bedRegionArray, numBeds, sizeof(bedRegion), (int (*)(const void *, const void *)) bedRegion_cmp);
+        }
+
+        threadIt = stPinchThreadSet_getIt(threadSet);
+        while ((thread = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
+            bool *coverageArray = stHash_search(coverages, thread);
+            // Work out which segments should be blocked afterwards.
+            stList *expectBlock = stList_construct();
+            stPinchSegment *segment;
+            for (segment = stPinchThread_getFirst(thread); segment != NULL; segment = stPinchSegment_get3Prime(segment)) {
+                bool blocked = stPinchSegment_getBlock(segment) != NULL;
+                if (!blocked && stPinchSegment_getLength(segment) >= minSegmentLength) {
+                    int64_t numCoveredBases = 0;
+                    for (int64_t i = stPinchSegment_getStart(segment);
+                         i < stPinchSegment_getStart(segment) + stPinchSegment_getLength(segment); i++) {
+                        numCoveredBases += coverageArray[i];
+                    }
+                    blocked = ((double) numCoveredBases) / stPinchSegment_getLength(segment) > coveredBasesThreshold;
+                }
+                stList_append(expectBlock, blocked ? segment : NULL);
+            }
+            rescueFn(thread, bedRegionArray, numBeds, stPinchThread_getName(thread), minSegmentLength,
+                     coveredBasesThreshold);
+            int64_t i = 0;
+            for (segment = stPinchThread_getFirst(thread); segment != NULL; segment = stPinchSegment_get3Prime(segment)) {
+                CuAssertTrue(testCase, i < stList_length(expectBlock));
+                CuAssertIntEquals(testCase, stList_get(expectBlock, i++) != NULL,
+                                  stPinchSegment_getBlock(segment) != NULL);
+            }
+            CuAssertIntEquals(testCase, stList_length(expectBlock), i);
+            stList_destruct(expectBlock);
+        }
+
+        stHash_destruct(coverages);
+        stPinchThreadSet_destruct(threadSet);
+        free(bedRegionArray);
+    }
+}
+
+static void test_rescueMatchesCoverage(CuTest *testCase) {
+    checkRescueAgainstCoverage(testCase, rescueCoveredRegions);
+}
+
+static void test_rescueBinarySearchMatchesCoverage(CuTest *testCase) {
+    checkRescueAgainstCoverage(testCase, rescueCoveredRegions_binarySearch);
+}
+
 CuSuite *rescueTestSuite(void) {
     CuSuite *suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, test_rescueRandomSequences);
+    SUITE_ADD_TEST(suite, test_rescueMatchesCoverage);
+    SUITE_ADD_TEST(suite, test_rescueBinarySearchMatchesCoverage);
     return suite;
 }
@@ -7,8 +7,257 @@
 
 #include "sonLib.h"
 #include "stPinchGraphs.h"
+#include "stGiantComponent.h"
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+
+/*
+ * Edges are sorted by giving each a 64 bit key that orders it by
+ * (weight, node1, node2), when the ranges of those values fit, and radix
+ * sorting the keys a byte at a time. Otherwise we fall back to qsort.
+ */
+
+typedef struct _edgeKey {
+    uint64_t key;
+    int64_t index;
+} EdgeKey;
+
+typedef struct _indexedEdge {
+    stCaf_WeightedEdge edge;
+    int64_t index;
+} IndexedEdge;
+
+static int64_t bitsNeeded(uint64_t i) {
+    int64_t bits = 0;
+    while (i > 0) {
+        bits++;
+        i >>= 1;
+    }
+    return bits;
+}
+
+static void radixSortEdgeKeys(EdgeKey *keys, int64_t keyNumber, int64_t bits) {
+    EdgeKey *from = keys;
+    EdgeKey *to = st_malloc(sizeof(EdgeKey) * keyNumber);
+    EdgeKey *buffer = to;
+    int64_t counts[256];
+    for (int64_t shift = 0; shift < bits; shift += 8) {
+        memset(counts, 0, sizeof(counts));
+        for (int64_t i = 0; i < keyNumber; i++) {
+            counts[(from[i].key >> shift) & 0xFF]++;
+        }
+        if (counts[(from[0].key >> shift) & 0xFF] == keyNumber) {
+            continue; //Every key has the same byte here, so nothing moves
+        }
+        int64_t offset = 0;
+        for (int64_t i = 0; i < 256; i++) {
+            int64_t count = counts[i];
+            counts[i] = offset;
+            offset += count;
+        }
+        for (int64_t i = 0; i < keyNumber; i++) {
+            to[counts[(from[i].key >> shift) & 0xFF]++] = from[i];
+        }
+        EdgeKey *swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != keys) {
+        memcpy(keys, from, sizeof(EdgeKey) * keyNumber);
+    }
+    free(buffer);
+}
+
+static int indexedEdge_cmp(const IndexedEdge *edge1, const IndexedEdge *edge2) {
+    if (edge1->edge.weight != edge2->edge.weight) {
+        return edge1->edge.weight < edge2->edge.weight ? -1 : 1;
+    }
+    if (edge1->edge.node1 != edge2->edge.node1) {
+        return edge1->edge.node1 < edge2->edge.node1 ? -1 : 1;
+    }
+    if (edge1->edge.node2 != edge2->edge.node2) {
+        return edge1->edge.node2 < edge2->edge.node2 ? -1 : 1;
+    }
+    return edge1->index < edge2->index ? -1 : (edge1->index > edge2->index ? 1 : 0);
+}
+
+/*
+ * Returns the indices of the edges in ascending (weight, node1, node2) order.
+ * The nodes must be in [0, nodeNumber).
+ */
+static int64_t *getEdgeOrder(const stCaf_WeightedEdge *edges, int64_t edgeNumber, int64_t nodeNumber) {
+    int64_t *order = st_malloc(sizeof(int64_t) * (edgeNumber + 1));
+    if (edgeNumber == 0) {
+        return order;
+    }
+    int64_t minWeight = INT64_MAX, maxWeight = INT64_MIN;
+    for (int64_t i = 0; i < edgeNumber; i++) {
+        minWeight = edges[i].weight < minWeight ? edges[i].weight : minWeight;
+        maxWeight = edges[i].weight > maxWeight ? edges[i].weight : maxWeight;
+    }
+    int64_t weightBits = bitsNeeded((uint64_t) maxWeight - (uint64_t) minWeight);
+    int64_t nodeBits = bitsNeeded(nodeNumber > 0 ? nodeNumber - 1 : 0);
+    if (weightBits + 2 * nodeBits <= 64) {
+        EdgeKey *keys = st_malloc(sizeof(EdgeKey) * edgeNumber);
+        for (int64_t i = 0; i < edgeNumber; i++) {
+            uint64_t weight = (uint64_t) edges[i].weight - (uint64_t) minWeight;
+            keys[i].key = nodeBits == 0 ? weight :
+                    (((weight << nodeBits) | (uint64_t) edges[i].node1) << nodeBits) | (uint64_t) edges[i].node2;
+            keys[i].index = i;
+        }
+        radixSortEdgeKeys(keys, edgeNumber, weightBits + 2 * nodeBits);
+        for (int64_t i = 0; i < edgeNumber; i++) {
+            order[i] = keys[i].index;
+        }
+        free(keys);
+    } else {
+        IndexedEdge *indexedEdges = st_malloc(sizeof(IndexedEdge) * edgeNumber);
+        for (int64_t i = 0; i < edgeNumber; i++) {
+            indexedEdges[i].edge = edges[i];
+            indexedEdges[i].index = i;
+        }
+        qsort(indexedEdges, edgeNumber, sizeof(IndexedEdge), (int(*)(const void *, const void *)) indexedEdge_cmp);
+        for (int64_t i = 0; i < edgeNumber; i++) {
+            order[i] = indexedEdges[i].index;
+        }
+        free(indexedEdges);
+    }
+    return order;
+}
+
+static int64_t findComponent(int64_t *parents, int64_t node) {
+    while (parents[node] != node) {
+        parents[node] = parents[parents[node]]; //Path halving
+        node = parents[node];
+    }
+    return node;
+}
+
+int64_t stCaf_breakupComponentGreedilyFlat(int64_t nodeNumber, const stCaf_WeightedEdge *edges, int64_t edgeNumber,
+        int64_t maxComponentSize, int64_t *edgesToDelete) {
+    for (int64_t i = 0; i < edgeNumber; i++) {
+        if (edges[i].node1 < 0 || edges[i].node1 >= nodeNumber || edges[i].node2 < 0 || edges[i].node2 >= nodeNumber) {
+            st_errAbort("Edge %" PRIi64 " refers to a node outside of the range [0, %" PRIi64 ")", i, nodeNumber);
+        }
+    }
+    /*
+     * Make a component for each node in the graph
+     */
+    int64_t *parents = st_malloc(sizeof(int64_t) * (nodeNumber + 1));
+    int64_t *sizes = st_malloc(sizeof(int64_t) * (nodeNumber + 1));
+    for (int64_t i = 0; i < nodeNumber; i++) {
+        parents[i] = i;
+        sizes[i] = 1;
+    }
+
+    //Go through the edges best (highest) first, putting them into the graph unless they make too large a component.
+    int64_t *order = getEdgeOrder(edges, edgeNumber, nodeNumber);
+    int64_t edgesToDeleteNumber = 0;
+    int64_t totalComponents = nodeNumber;
+    for (int64_t i = edgeNumber - 1; i >= 0; i--) {
+        const stCaf_WeightedEdge *edge = &edges[order[i]];
+        int64_t component1 = findComponent(parents, edge->node1);
+        int64_t component2 = findComponent(parents, edge->node2);
+        if (component1 == component2) { //The edge is already contained within one component.
+            continue;
+        }
+        if (sizes[component1] + sizes[component2] > maxComponentSize) { //This edge would make a too large component, so reject
+            edgesToDelete[edgesToDeleteNumber++] = order[i];
+            continue;
+        }
+        //Merge the smaller component into the larger
+        if (sizes[component1] < sizes[component2]) {
+            int64_t component3 = component1;
+            component1 = component2;
+            component2 = component3;
+        }
+        parents[component2] = component1;
+        sizes[component1] += sizes[component2];
+        totalComponents -= 1;
+    }
+
+    st_logDebug(
+            "We broke a graph with %" PRIi64 " nodes and %" PRIi64 " edges for a max component size of %" PRIi64 " into %" PRIi64 " distinct components with %" PRIi64 " edges, discarding %" PRIi64 " edges\n",
+            nodeNumber, edgeNumber, maxComponentSize, totalComponents, edgeNumber - edgesToDeleteNumber, edgesToDeleteNumber);
+
+    //Cleanup
+    free(order);
+    free(parents);
+    free(sizes);
+
+    return edgesToDeleteNumber;
+}
+
+static int int64_cmp(const int64_t *i, const int64_t *j) {
+    return *i < *j ? -1 : (*i > *j ? 1 : 0);
+}
+
+stList *stCaf_breakupComponentGreedily(stList *nodes, stList *edges, int64_t maxComponentSize) {
+    /*
+     * Number the nodes 0 to n-1. They usually already are, otherwise we
+     * number them by rank.
+     */
+    int64_t nodeNumber = stList_length(nodes);
+    int64_t *nodeValues = st_malloc(sizeof(int64_t) * (nodeNumber + 1));
+    bool dense = true;
+    for (int64_t i = 0; i < nodeNumber; i++) {
+        nodeValues[i] = stIntTuple_get(stList_get(nodes, i), 0);
+        dense = dense && nodeValues[i] >= 0 && nodeValues[i] < nodeNumber;
+    }
+    if (dense) { //Check they are a permutation
+        bool *seen = st_calloc(nodeNumber + 1, sizeof(bool));
+        for (int64_t i = 0; i < nodeNumber && dense; i++) {
+            dense = !seen[nodeValues[i]];
+            seen[nodeValues[i]] = true;
+        }
+        free(seen);
+    }
+    if (!dense) {
+        qsort(nodeValues, nodeNumber, sizeof(int64_t), (int(*)(const void *, const void *)) int64_cmp);
+        for (int64_t i = 1; i < nodeNumber; i++) {
+            assert(nodeValues[i - 1] != nodeValues[i]);
+        }
+    }
+
+    int64_t edgeNumber = stList_length(edges);
+    stCaf_WeightedEdge *flatEdges = st_malloc(sizeof(stCaf_WeightedEdge) * (edgeNumber + 1));
+    for (int64_t i = 0; i < edgeNumber; i++) {
+        stIntTuple *edge = stList_get(edges, i);
+        flatEdges[i].weight = stIntTuple_get(edge, 0);
+        for (int64_t j = 1; j <= 2; j++) {
+            int64_t node = stIntTuple_get(edge, j);
+            if (!dense) {
+                int64_t *rank = bsearch(&node, nodeValues, nodeNumber, sizeof(int64_t),
+                        (int(*)(const void *, const void *)) int64_cmp);
+                if (rank == NULL) {
+                    st_errAbort("Edge refers to node %" PRIi64 ", which is not in the list of nodes", node);
+                }
+                node = rank - nodeValues;
+            }
+            if (j == 1) {
+                flatEdges[i].node1 = node;
+            } else {
+                flatEdges[i].node2 = node;
+            }
+        }
+    }
+
+    int64_t *edgesToDeleteIndices = st_malloc(sizeof(int64_t) * (edgeNumber + 1));
+    int64_t edgesToDeleteNumber = stCaf_breakupComponentGreedilyFlat(nodeNumber, flatEdges, edgeNumber, maxComponentSize,
+            edgesToDeleteIndices);
+    stList *edgesToDelete = stList_construct();
+    for (int64_t i = 0; i < edgesToDeleteNumber; i++) {
+        stList_append(edgesToDelete, stList_get(edges, edgesToDeleteIndices[i]));
+    }
+
+    //Cleanup
+    free(nodeValues);
+    free(flatEdges);
+    free(edgesToDeleteIndices);
+
+    return edgesToDelete;
+}
 
 static void *getValue(stHash *hash, int64_t node) {
     stIntTuple *nodeTuple = stIntTuple_construct1(node);
@@ -17,7 +266,7 @@ static void *getValue(stHash *hash, int64_t node) {
     return object;
 }
 
-stList *stCaf_breakupComponentGreedily(stList *nodes, stList *edges, int64_t maxComponentSize) {
+stList *stCaf_breakupComponentGreedilyUsingSortedSets(stList *nodes, stList *edges, int64_t maxComponentSize) {
     /*
      * Make a component for each node in the graph
      */
@@ -90,25 +339,27 @@ stList *stCaf_breakupComponentGreedily(stList *nodes, stList *edges, int64_t max
     return edgesToDelete;
 }
 
-static void convertToNodesAndEdges(stList *adjacencyComponent, stList **nodes, stList **edges) {
-    //Make nodes
-    *nodes = stList_construct3(0, (void(*)(void *)) stIntTuple_destruct);
+/*
+ * Numbers the pinch ends of the adjacency component by their index in it and
+ * returns the edges between them, weighted by their multiplicity.
+ */
+static stCaf_WeightedEdge *convertToNodesAndEdges(stList *adjacencyComponent, int64_t *edgeNumber) {
+    //Number the nodes
+    int64_t nodeNumber = stList_length(adjacencyComponent);
     stHash *pinchEndsToNodesHash = stHash_construct3(stPinchEnd_hashFn, stPinchEnd_equalsFn, NULL, NULL);
-    for (int64_t i = 0; i < stList_length(adjacencyComponent); i++) {
-        stIntTuple *node = stIntTuple_construct1(i);
-        stList_append(*nodes, node);
+    int64_t *nodes = st_malloc(sizeof(int64_t) * (nodeNumber + 1));
+    for (int64_t i = 0; i < nodeNumber; i++) {
+        nodes[i] = i;
         assert(stHash_search(pinchEndsToNodesHash, stList_get(adjacencyComponent, i)) == NULL);
-        stHash_insert(pinchEndsToNodesHash, stList_get(adjacencyComponent, i), node);
+        stHash_insert(pinchEndsToNodesHash, stList_get(adjacencyComponent, i), &nodes[i]);
     }
-    //Make edges
 
-    //First build a hash of edges to their multiplicity
-    stHash *edgesToMultiplicityHash = stHash_construct3((uint64_t(*)(const void *)) stIntTuple_hashKey,
-            (int(*)(const void *, const void *)) stIntTuple_equalsFn, (void(*)(void *)) stIntTuple_destruct,
-            (void(*)(void *)) stIntTuple_destruct);
-    for (int64_t i = 0; i < stList_length(adjacencyComponent); i++) {
+    //First list every edge, once per thread that traverses it
+    int64_t adjacencyNumber = 0, adjacencyCapacity = nodeNumber + 1;
+    stCaf_WeightedEdge *adjacencies = st_malloc(sizeof(stCaf_WeightedEdge) * adjacencyCapacity);
+    for (int64_t i = 0; i < nodeNumber; i++) {
         stPinchEnd *pinchEnd1 = stList_get(adjacencyComponent, i);
-        int64_t node1 = stIntTuple_get(stHash_search(pinchEndsToNodesHash, pinchEnd1), 0);
+        int64_t node1 = i;
         stPinchBlockIt segmentIt = stPinchBlock_getSegmentIterator(stPinchEnd_getBlock(pinchEnd1));
         stPinchSegment *segment;
         while ((segment = stPinchBlockIt_getNext(&segmentIt)) != NULL) {
@@ -119,17 +370,16 @@ static void convertToNodesAndEdges(stList *adjacencyComponent, stList **nodes, s
                     stPinchEnd pinchEnd2 = stPinchEnd_constructStatic(stPinchSegment_getBlock(segment2),
                             stPinchEnd_endOrientation(traverse5Prime, segment2));
                     assert(stHash_search(pinchEndsToNodesHash, &pinchEnd2) != NULL);
-                    int64_t node2 = stIntTuple_get(stHash_search(pinchEndsToNodesHash, &pinchEnd2), 0);
+                    int64_t node2 = *(int64_t *) stHash_search(pinchEndsToNodesHash, &pinchEnd2);
                     if (node1 != node2) { //Ignore self edges
-                        stIntTuple *edge = node1 < node2 ? stIntTuple_construct2(node1, node2) : stIntTuple_construct2(node2, node1);
-                        int64_t multiplicity = 1;
-                        if (stHash_search(edgesToMultiplicityHash, edge) != NULL) {
-                            stIntTuple *count = stHash_removeAndFreeKey(edgesToMultiplicityHash, edge);
-                            multiplicity += stIntTuple_get(count, 0);
-                            stIntTuple_destruct(count);
-                            assert(multiplicity > 1);
+                        if (adjacencyNumber == adjacencyCapacity) {
+                            adjacencyCapacity *= 2;
+                            adjacencies = st_realloc(adjacencies, sizeof(stCaf_WeightedEdge) * adjacencyCapacity);
                         }
-                        stHash_insert(edgesToMultiplicityHash, edge, stIntTuple_construct1(multiplicity));
+                        stCaf_WeightedEdge *adjacency = &adjacencies[adjacencyNumber++];
+                        adjacency->weight = 0;
+                        adjacency->node1 = node1 < node2 ? node1 : node2;
+                        adjacency->node2 = node1 < node2 ? node2 : node1;
                     }
                     break;
                 }
@@ -137,18 +387,31 @@ static void convertToNodesAndEdges(stList *adjacencyComponent, stList **nodes, s
             }
         }
     }
-    //Now build edges, scoring them according to their multiplicity
-    *edges = stList_construct3(0, (void(*)(void *)) stIntTuple_destruct);
-    stHashIterator *hashIt = stHash_getIterator(edgesToMultiplicityHash);
-    stIntTuple *edge;
-    while ((edge = stHash_getNext(hashIt)) != NULL) {
-        stIntTuple *count = stHash_search(edgesToMultiplicityHash, edge);
-        stList_append(*edges, stIntTuple_construct3(stIntTuple_get(count, 0), stIntTuple_get(edge, 0), stIntTuple_get(edge, 1)));
+
+    //Now sort them, so that copies of an edge are together, and score each edge by its multiplicity
+    int64_t *order = getEdgeOrder(adjacencies, adjacencyNumber, nodeNumber);
+    stCaf_WeightedEdge *edges = st_malloc(sizeof(stCaf_WeightedEdge) * (adjacencyNumber + 1));
+    *edgeNumber = 0;
+    for (int64_t i = 0; i < adjacencyNumber; i++) {
+        stCaf_WeightedEdge *adjacency = &adjacencies[order[i]];
+        if (*edgeNumber > 0 && edges[*edgeNumber - 1].node1 == adjacency->node1
+                && edges[*edgeNumber - 1].node2 == adjacency->node2) {
+            edges[*edgeNumber - 1].weight++;
+        } else {
+            edges[*edgeNumber].weight = 1;
+            edges[*edgeNumber].node1 = adjacency->node1;
+            edges[*edgeNumber].node2 = adjacency->node2;
+            (*edgeNumber)++;
+        }
     }
 
     //Cleanup
+    free(order);
+    free(adjacencies);
+    free(nodes);
     stHash_destruct(pinchEndsToNodesHash);
-    stHash_destruct(edgesToMultiplicityHash);
+
+    return edges;
 }
 
 static void breakEdges(stPinchThreadSet *threadSet, stPinchEnd *pinchEnd1, stPinchEnd *pinchEnd2) {
@@ -198,17 +461,19 @@ void stCaf_breakupComponentsGreedily(stPinchThreadSet *threadSet, float maximumA
         stList *adjacencyComponent = stList_get(adjacencyComponents, i);
         if (maximumAdjacencyComponentSize < stList_length(adjacencyComponent)) {
             //Get graph description
-            stList *nodes, *edges;
-            convertToNodesAndEdges(adjacencyComponent, &nodes, &edges);
+            int64_t edgeNumber;
+            stCaf_WeightedEdge *edges = convertToNodesAndEdges(adjacencyComponent, &edgeNumber);
             //Get the edges to remove
-            stList *edgesToDelete = stCaf_breakupComponentGreedily(nodes, edges, maximumAdjacencyComponentSize);
+            int64_t *edgesToDelete = st_malloc(sizeof(int64_t) * (edgeNumber + 1));
+            int64_t edgesToDeleteNumber = stCaf_breakupComponentGreedilyFlat(stList_length(adjacencyComponent), edges, edgeNumber,
+                    maximumAdjacencyComponentSize, edgesToDelete);
             //Break edges;
             int64_t unbrokenEdges = 0;
-            for (int64_t j = 0; j < stList_length(edgesToDelete); j++) {
-                stIntTuple *edge = stList_get(edgesToDelete, j);
-                assert(stIntTuple_get(edge, 1) < stIntTuple_get(edge, 2));
-                stPinchEnd *pinchEnd1 = stList_get(adjacencyComponent, stIntTuple_get(edge, 1));
-                stPinchEnd *pinchEnd2 = stList_get(adjacencyComponent, stIntTuple_get(edge, 2));
+            for (int64_t j = 0; j < edgesToDeleteNumber; j++) {
+                stCaf_WeightedEdge *edge = &edges[edgesToDelete[j]];
+                assert(edge->node1 < edge->node2);
+                stPinchEnd *pinchEnd1 = stList_get(adjacencyComponent, edge->node1);
+                stPinchEnd *pinchEnd2 = stList_get(adjacencyComponent, edge->node2);
                 if (stPinchBlock_getDegree(stPinchEnd_getBlock(pinchEnd1)) > 1 && stPinchBlock_getDegree(stPinchEnd_getBlock(pinchEnd2))
                         > 1) {
                     breakEdges(threadSet, pinchEnd1, pinchEnd2);
@@ -216,14 +481,13 @@ void stCaf_breakupComponentsGreedily(stPinchThreadSet *threadSet, float maximumA
                     unbrokenEdges++;
                 }
             }
-            if (stList_length(edgesToDelete) > 0) {
+            if (edgesToDeleteNumber > 0) {
                 st_logInfo("Pinch graph component with %" PRIi64 " nodes and %" PRIi64 " edges is being split up by breaking %" PRIi64 " edges to reduce size to less than %" PRIi64 " max, but found %" PRIi64 " pointless edges \n",
-                           stList_length(nodes), stList_length(edges), stList_length(edgesToDelete), maximumAdjacencyComponentSize, unbrokenEdges);
+                           stList_length(adjacencyComponent), edgeNumber, edgesToDeleteNumber, maximumAdjacencyComponentSize, unbrokenEdges);
             }
             //Cleanup
-            stList_destruct(edges);
-            stList_destruct(nodes);
-            stList_destruct(edgesToDelete);
+            free(edges);
+            free(edgesToDelete);
         }
     }
     stList_destruct(adjacencyComponents);
@@ -12,6 +12,7 @@
 #include "stPinchPhylogeny.h"
 #include "stCaf.h"
 #include "stCafPhylogeny.h"
+#include "stCafScheduler.h"
 
 // Struct of constant things that gets passed around. Since these are
 // only set once in a run, they could be global variables, but this is
@@ -28,20 +29,37 @@ typedef struct {
     stHash *eventToSpeciesNode;
     stTree *speciesStTree;
     stSet *speciesToSplitOn;
+    stCaf_Scheduler *treeBuildingPool;
+    // Chain homology units -> CachedDistanceMatrix, shared between tree
+    // building and the bad-chain detection so the feature columns of a
+    // chain are only extracted once.
+    stHash *unitsToDistanceMatrices;
 } TreeBuildingConstants;
 
+// The (non-bootstrapped) substitution distance matrix of a homology
+// unit, as used to find bad chains.
+typedef struct {
+    stMatrix *distanceMatrix;
+    int64_t numFeatureColumns; // Number of feature columns it was built from.
+} CachedDistanceMatrix;
+
 // Gets passed to buildTreeForHomologyUnit.
 typedef struct {
     HomologyUnit *homologyUnit;
     TreeBuildingConstants *constants;
     stHash *homologyUnitsToTrees;
+    // If set, only compute the distance matrix for the cache, don't
+    // build any trees.
+    bool onlyDistanceMatrix;
 } TreeBuildingInput;
 
 // Gets returned from buildTreeForHomologyUnit and passed into
 // addTreeToHash.
 typedef struct {
     stHash *homologyUnitsToTrees;
+    stHash *unitsToDistanceMatrices;
     stTree *tree;
+    CachedDistanceMatrix *distanceMatrix;
     HomologyUnit *homologyUnit;
     bool wasSimple;
     bool wasSingleCopy;
@@ -61,6 +79,38 @@ static int64_t numSimpleBlocksSkipped = 0;
 static int64_t numSingleCopyBlocksSkipped = 0;
 static FILE *gDebugFile;
 static stHash *gThreadStrings;
+// How much feature-column extraction the bad-chain detection avoided
+// by reusing the distance matrices left behind by tree building.
+static int64_t numDistanceMatricesReused = 0;
+static int64_t numFeatureColumnsReused = 0;
+static int64_t numDistanceMatricesComputed = 0;
+
+static CachedDistanceMatrix *CachedDistanceMatrix_construct(stMatrix *distanceMatrix, int64_t numFeatureColumns) {
+    CachedDistanceMatrix *ret = st_malloc(sizeof(CachedDistanceMatrix));
+    ret->distanceMatrix = distanceMatrix;
+    ret->numFeatureColumns = numFeatureColumns;
+    return ret;
+}
+
+static void CachedDistanceMatrix_destruct(CachedDistanceMatrix *cachedDistanceMatrix) {
+    stMatrix_destruct(cachedDistanceMatrix->distanceMatrix);
+    free(cachedDistanceMatrix);
+}
+
+// Drop any cached distance matrix for the unit. Must be called before
+// a unit is freed, or when its feature columns may have changed.
+static void uncacheDistanceMatrix(stHash *unitsToDistanceMatrices, HomologyUnit *unit) {
+    CachedDistanceMatrix *cachedDistanceMatrix = stHash_remove(unitsToDistanceMatrices, unit);
+    if (cachedDistanceMatrix != NULL) {
+        CachedDistanceMatrix_destruct(cachedDistanceMatrix);
+    }
+}
+
+static void cacheDistanceMatrix(stHash *unitsToDistanceMatrices, HomologyUnit *unit,
+                                CachedDistanceMatrix *cachedDistanceMatrix) {
+    uncacheDistanceMatrix(unitsToDistanceMatrices, unit);
+    stHash_insert(unitsToDistanceMatrices, unit, cachedDistanceMatrix);
+}
 
 HomologyUnit *HomologyUnit_construct(HomologyUnitType unitType, void *unit) {
     HomologyUnit *ret = st_malloc(sizeof(HomologyUnit));
@@ -500,6 +550,40 @@ static double scoreTree(stTree *tree, enum stCaf_ScoringMethod scoringMethod, st
     return ret;
 }
 
+// Get the contextual feature blocks for a homology unit.
+static stList *getFeatureBlocksForHomologyUnit(HomologyUnit *unit, stCaf_PhylogenyParameters *params,
+                                               stHash *threadStrings) {
+    if (unit->unitType == BLOCK) {
+        return stFeatureBlock_getContextualFeatureBlocks(
+            unit->unit, params->maxBaseDistance,
+            params->maxBlockDistance,
+            params->ignoreUnalignedBases,
+            params->onlyIncludeCompleteFeatureBlocks,
+            threadStrings);
+    }
+    assert(unit->unitType == CHAIN);
+    return stFeatureBlock_getContextualFeatureBlocksForChainedBlocks(
+        unit->unit, params->maxBaseDistance,
+        params->maxBlockDistance,
+        params->ignoreUnalignedBases,
+        params->onlyIncludeCompleteFeatureBlocks,
+        threadStrings);
+}
+
+// Get the (non-bootstrapped, corrected) substitution distance matrix
+// from the substitution diffs.
+static stMatrix *getSubstitutionDistanceMatrix(stMatrixDiffs *snpDiffs, stCaf_PhylogenyParameters *params) {
+    stMatrix *substitutionMatrix = stPinchPhylogeny_constructMatrixFromDiffs(snpDiffs, false, 0);
+    stMatrix *substitutionDistanceMatrix = stPinchPhylogeny_getSymmetricDistanceMatrix(substitutionMatrix);
+    if (params->distanceCorrectionMethod == JUKES_CANTOR) {
+        stPhylogeny_applyJukesCantorCorrection(substitutionDistanceMatrix);
+    } else {
+        assert(params->distanceCorrectionMethod == NONE);
+    }
+    stMatrix_destruct(substitutionMatrix);
+    return substitutionDistanceMatrix;
+}
+
 // Build a tree from a set of feature columns and root it according to
 // the rooting method.
 static stTree *buildTree(stList *featureColumns,
@@ -938,17 +1022,54 @@ static double getAvgSupportValue(stSortedSet *splitBranches) {
     return totalSupport/stSortedSet_size(splitBranches);
 }
 
-// Small wrapper function to tell the pool to build, reconcile, and
-// bootstrap a tree for a homology unit.
+// Rough estimate of the work needed to build the trees for a homology
+// unit, used to schedule the largest units first. Gathering the
+// feature columns walks every segment out to maxBaseDistance on each
+// side, and each tree built is (at least) cubic in the degree.
+static int64_t estimateTreeBuildingCost(HomologyUnit *unit, stCaf_PhylogenyParameters *params) {
+    int64_t degree = stPinchBlock_getDegree(getCanonicalBlockForHomologyUnit(unit));
+    if (degree <= 2) {
+        // Will be skipped as a simple phylogeny.
+        return 1;
+    }
+    int64_t length = 0;
+    if (unit->unitType == BLOCK) {
+        length = stPinchBlock_getLength(unit->unit);
+    } else {
+        assert(unit->unitType == CHAIN);
+        for (int64_t i = 0; i < stList_length(unit->unit); i++) {
+            length += stPinchBlock_getLength(stList_get(unit->unit, i));
+        }
+    }
+    int64_t treesBuilt = params->numTrees * stList_length(params->treeBuildingMethods);
+    return degree * (length + 2 * params->maxBaseDistance) + treesBuilt * degree * degree * degree;
+}
+
+// Small wrapper function to tell the scheduler to build, reconcile,
+// and bootstrap a tree for a homology unit.
 static void pushHomologyUnitToPool(HomologyUnit *unit,
                                    TreeBuildingConstants *constants,
                                    stHash *homologyUnitsToTrees,
-                                   stThreadPool *threadPool) {
+                                   stCaf_Scheduler *scheduler) {
     TreeBuildingInput *input = st_malloc(sizeof(TreeBuildingInput));
     input->constants = constants;
     input->homologyUnit = unit;
     input->homologyUnitsToTrees = homologyUnitsToTrees;
-    stThreadPool_push(threadPool, input);
+    input->onlyDistanceMatrix = false;
+    stCaf_Scheduler_push(scheduler, input, estimateTreeBuildingCost(unit, constants->params));
+}
+
+// Tell the scheduler to compute only the distance matrix of a unit,
+// for the bad-chain detection.
+static void pushDistanceMatrixJobToPool(HomologyUnit *unit, TreeBuildingConstants *constants) {
+    TreeBuildingInput *input = st_malloc(sizeof(TreeBuildingInput));
+    input->constants = constants;
+    input->homologyUnit = unit;
+    input->homologyUnitsToTrees = NULL;
+    input->onlyDistanceMatrix = true;
+    stPinchBlock *block = getCanonicalBlockForHomologyUnit(unit);
+    int64_t cost = stPinchBlock_getDegree(block) * (stPinchBlock_getLength(block) + 2 * constants->params->maxBaseDistance);
+    stCaf_Scheduler_push(constants->treeBuildingPool, input, cost);
 }
 
 static stTree *chooseBestAndMostResolvedTree(stList *trees,
@@ -991,8 +1112,23 @@ static TreeBuildingResult *buildTreeForHomologyUnit(TreeBuildingInput *input) {
 
     TreeBuildingResult *ret = st_calloc(1, sizeof(TreeBuildingResult));
     ret->homologyUnitsToTrees = input->homologyUnitsToTrees;
+    ret->unitsToDistanceMatrices = input->constants->unitsToDistanceMatrices;
     ret->homologyUnit = unit;
 
+    if (input->onlyDistanceMatrix) {
+        stList *featureBlocks = getFeatureBlocksForHomologyUnit(unit, params, input->constants->threadStrings);
+        stList *featureColumns = stFeatureColumn_getFeatureColumns(featureBlocks);
+        int64_t degree = stPinchBlock_getDegree(getCanonicalBlockForHomologyUnit(unit));
+        stMatrixDiffs *snpDiffs = stPinchPhylogeny_getMatrixDiffsFromSubstitutions(featureColumns, degree, NULL);
+        ret->distanceMatrix = CachedDistanceMatrix_construct(getSubstitutionDistanceMatrix(snpDiffs, params),
+                                                             stList_length(featureColumns));
+        stMatrixDiffs_destruct(snpDiffs);
+        stList_destruct(featureColumns);
+        stList_destruct(featureBlocks);
+        free(input);
+        return ret;
+    }
+
     if (stCaf_hasSimplePhylogeny(unit, input->constants->flower)) {
         // No point trying to build a phylogeny for certain blocks.
         free(input);
@@ -1007,24 +1143,7 @@ static TreeBuildingResult *buildTreeForHomologyUnit(TreeBuildingInput *input) {
     }
 
     // Get the feature blocks.
-    stList *featureBlocks;
-
-    if (unit->unitType == BLOCK) {
-        featureBlocks = stFeatureBlock_getContextualFeatureBlocks(
-            unit->unit, params->maxBaseDistance,
-            params->maxBlockDistance,
-            params->ignoreUnalignedBases,
-            params->onlyIncludeCompleteFeatureBlocks,
-            input->constants->threadStrings);
-    } else {
-        assert(unit->unitType == CHAIN);
-        featureBlocks = stFeatureBlock_getContextualFeatureBlocksForChainedBlocks(
-            unit->unit, params->maxBaseDistance,
-            params->maxBlockDistance,
-            params->ignoreUnalignedBases,
-            params->onlyIncludeCompleteFeatureBlocks,
-            input->constants->threadStrings);
-    }
+    stList *featureBlocks = getFeatureBlocksForHomologyUnit(unit, params, input->constants->threadStrings);
 
     // Make feature columns
     stList *featureColumns = stFeatureColumn_getFeatureColumns(featureBlocks);
@@ -1041,6 +1160,14 @@ static TreeBuildingResult *buildTreeForHomologyUnit(TreeBuildingInput *input) {
     stMatrixDiffs *snpDiffs = stPinchPhylogeny_getMatrixDiffsFromSubstitutions(featureColumns, degree, NULL);
     stMatrixDiffs *breakpointDiffs = stPinchPhylogeny_getMatrixDiffsFromBreakpoints(featureColumns, degree, NULL);
 
+    if (unit->unitType == CHAIN) {
+        // The bad-chain detection needs exactly this distance matrix,
+        // so leave it in the cache rather than extracting the feature
+        // columns again later.
+        ret->distanceMatrix = CachedDistanceMatrix_construct(getSubstitutionDistanceMatrix(snpDiffs, params),
+                                                             stList_length(featureColumns));
+    }
+
     // rand() has a global lock on it! Better to contest it once and
     // use that as a seed than to contest it several thousand times
     // per tree...
@@ -1124,9 +1251,17 @@ static TreeBuildingResult *buildTreeForHomologyUnit(TreeBuildingInput *input) {
     return ret;
 }
 
-// Gets run as a "finisher" in the thread pool, so it's run in series
-// and we don't have to lock the hash.
+// Gets run as a "finisher" by the scheduler, so it's run in series
+// and we don't have to lock the hashes.
 static void addTreeToHash(TreeBuildingResult *result) {
+    if (result->distanceMatrix != NULL) {
+        cacheDistanceMatrix(result->unitsToDistanceMatrices, result->homologyUnit, result->distanceMatrix);
+    }
+    if (result->homologyUnitsToTrees == NULL) {
+        // Only the distance matrix was asked for.
+        free(result);
+        return;
+    }
     if (stHash_search(result->homologyUnitsToTrees, result->homologyUnit)) {
         stHash_remove(result->homologyUnitsToTrees, result->homologyUnit);
     }
@@ -1238,6 +1373,7 @@ void splitOnSplitBranch(stCaf_SplitBranch *splitBranch,
 
     assert(stHash_search(homologyUnitsToTrees, unit) == root);
     stHash_remove(homologyUnitsToTrees, unit);
+    uncacheDistanceMatrix(constants->unitsToDistanceMatrices, unit);
 
     // Actually perform the split according to the partition.
     stList *partitionedUnits = stCaf_splitHomologyUnit(unit, partition,
@@ -1332,7 +1468,7 @@ static void destructTree(stTree *tree) {
 // branches, and adds the new split branches to the set.
 static void recomputeAffectedTrees(stSet *homologyUnitsToUpdate,
                                    TreeBuildingConstants *constants,
-                                   stThreadPool *treeBuildingPool,
+                                   stCaf_Scheduler *treeBuildingPool,
                                    stHash *homologyUnitsToTrees,
                                    stSortedSet *splitBranches) {
     stSetIterator *homologyUnitsToUpdateIt = stSet_getIterator(homologyUnitsToUpdate);
@@ -1343,6 +1479,8 @@ static void recomputeAffectedTrees(stSet *homologyUnitsToUpdate,
         stTree *oldTree = stHash_search(homologyUnitsToTrees, unitToUpdate);
         stCaf_removeSplitBranches(unitToUpdate, oldTree,
                                   constants->speciesToSplitOn, splitBranches);
+        // Its feature columns may have changed.
+        uncacheDistanceMatrix(constants->unitsToDistanceMatrices, unitToUpdate);
         stList_append(unitsToPush, unitToUpdate);
     }
     stSet_destructIterator(homologyUnitsToUpdateIt);
@@ -1353,7 +1491,7 @@ static void recomputeAffectedTrees(stSet *homologyUnitsToUpdate,
     }
 
     // Wait for the trees to be done.
-    stThreadPool_wait(treeBuildingPool);
+    stCaf_Scheduler_wait(treeBuildingPool);
     homologyUnitsToUpdateIt = stSet_getIterator(homologyUnitsToUpdate);
     while ((unitToUpdate = stSet_getNext(homologyUnitsToUpdateIt)) != NULL) {
         stTree *tree = stHash_search(homologyUnitsToTrees, unitToUpdate);
@@ -1371,7 +1509,7 @@ static void splitUsingSingleBranch(stCaf_SplitBranch *splitBranch,
                                    stSortedSet *splitBranches,
                                    TreeBuildingConstants *constants,
                                    stHash *blocksToHomologyUnits,
-                                   stThreadPool *treeBuildingPool,
+                                   stCaf_Scheduler *treeBuildingPool,
                                    stHash *homologyUnitsToTrees) {
     totalSupport += splitBranch->support;
     stSet *homologyUnitsToUpdate = stSet_construct();
@@ -1390,7 +1528,7 @@ static void splitUsingHighlyConfidentBranches(stCaf_SplitBranch *splitBranch,
                                               stSortedSet *splitBranches,
                                               TreeBuildingConstants *constants,
                                               stHash *blocksToHomologyUnits,
-                                              stThreadPool *treeBuildingPool,
+                                              stCaf_Scheduler *treeBuildingPool,
                                               stHash *homologyUnitsToTrees) {
     stSet *homologyUnitsToUpdate = stSet_construct();
     while (splitBranch != NULL && splitBranch->support > constants->params->doSplitsWithSupportHigherThanThisAllAtOnce) {
@@ -1581,14 +1719,14 @@ static stTree **getIndexToSpecies(HomologyUnit *unit, TreeBuildingConstants *con
     return indexToSpecies;
 }
 
-static stHash *getBadDivergences(stSet *homologyUnits, TreeBuildingConstants *constants, Flower *flower, stHash *unitToDistanceMatrix) {
+static stHash *getBadDivergences(stSet *homologyUnits, TreeBuildingConstants *constants, Flower *flower, stHash *unitsToDistanceMatrices) {
     stHash *speciesPairToSingleCopyDivergences = stHash_construct2(NULL, (void (*)(void *)) stHash_destruct);
     stSetIterator *it = stSet_getIterator(homologyUnits);
     HomologyUnit *unit;
     while ((unit = stSet_getNext(it)) != NULL) {
         if (stCaf_isSingleCopy(unit, flower)) {
             stTree **indexToSpecies = getIndexToSpecies(unit, constants, flower);
-            stMatrix *distanceMatrix = stHash_search(unitToDistanceMatrix, unit);
+            stMatrix *distanceMatrix = ((CachedDistanceMatrix *) stHash_search(unitsToDistanceMatrices, unit))->distanceMatrix;
 
             for (int64_t i = 0; i < stMatrix_m(distanceMatrix); i++) {
                 stTree *species_i = indexToSpecies[i];
@@ -1679,61 +1817,58 @@ static stHash *getBadDivergences(stSet *homologyUnits, TreeBuildingConstants *co
     return speciesPairToBadDivergence;
 }
 
-static stHash *getDistanceMatricesForUnits(stSet *homologyUnits, TreeBuildingConstants *constants, stCaf_PhylogenyParameters *params) {
-    stHash *unitToDistanceMatrix = stHash_construct2(NULL, (void (*)(void *)) stMatrix_destruct);
+// Make sure every unit has a distance matrix in the shared cache,
+// reusing those left behind by tree building and computing the rest in
+// parallel on the tree-building pool. Returns the cache.
+static stHash *getDistanceMatricesForUnits(stSet *homologyUnits, TreeBuildingConstants *constants) {
+    int64_t reused = 0, featureColumnsReused = 0, computed = 0;
     stSetIterator *it = stSet_getIterator(homologyUnits);
     HomologyUnit *unit;
     while ((unit = stSet_getNext(it)) != NULL) {
         assert(unit->unitType == CHAIN);
-        stList *featureBlocks = stFeatureBlock_getContextualFeatureBlocksForChainedBlocks(
-            unit->unit, params->maxBaseDistance,
-            params->maxBlockDistance,
-            params->ignoreUnalignedBases,
-            params->onlyIncludeCompleteFeatureBlocks,
-            constants->threadStrings);
-
-        // Make feature columns
-        stList *featureColumns = stFeatureColumn_getFeatureColumns(featureBlocks);
-
-        // Get the degree (= number of segments in the block/chain).
-        int64_t degree = stPinchBlock_getDegree(getCanonicalBlockForHomologyUnit(unit));
-
-        // Get the matrix diffs.
-        stMatrixDiffs *snpDiffs = stPinchPhylogeny_getMatrixDiffsFromSubstitutions(featureColumns, degree, NULL);
-
-        // Make substitution matrix
-        stMatrix *substitutionMatrix = stPinchPhylogeny_constructMatrixFromDiffs(snpDiffs, false, 0);
-
-        //Combine the matrices into distance matrices
-        stMatrix *substitutionDistanceMatrix = stPinchPhylogeny_getSymmetricDistanceMatrix(substitutionMatrix);
-        if (params->distanceCorrectionMethod == JUKES_CANTOR) {
-            stPhylogeny_applyJukesCantorCorrection(substitutionDistanceMatrix);
+        CachedDistanceMatrix *cachedDistanceMatrix = stHash_search(constants->unitsToDistanceMatrices, unit);
+        if (cachedDistanceMatrix != NULL) {
+            reused++;
+            featureColumnsReused += cachedDistanceMatrix->numFeatureColumns;
         } else {
-            assert(params->distanceCorrectionMethod == NONE);
+            pushDistanceMatrixJobToPool(unit, constants);
+            computed++;
         }
+    }
+    stSet_destructIterator(it);
+    stCaf_Scheduler_wait(constants->treeBuildingPool);
+
+    numDistanceMatricesReused += reused;
+    numFeatureColumnsReused += featureColumnsReused;
+    numDistanceMatricesComputed += computed;
+    st_logInfo("Got distance matrices for %" PRIi64 " chains, reusing %" PRIi64 " (%" PRIi64
+               " feature columns) and computing %" PRIi64 "\n", stSet_size(homologyUnits),
+               reused, featureColumnsReused, computed);
+    return constants->unitsToDistanceMatrices;
+}
 
-        stHash_insert(unitToDistanceMatrix, unit, substitutionDistanceMatrix);
-
-        stList_destruct(featureBlocks);
-        stList_destruct(featureColumns);
-
-        stMatrix_destruct(substitutionMatrix);
-
-        stMatrixDiffs_destruct(snpDiffs);
+// Destruct a set of homology units, first dropping their cached
+// distance matrices.
+static void destructHomologyUnits(stSet *homologyUnits, TreeBuildingConstants *constants) {
+    stSetIterator *it = stSet_getIterator(homologyUnits);
+    HomologyUnit *unit;
+    while ((unit = stSet_getNext(it)) != NULL) {
+        uncacheDistanceMatrix(constants->unitsToDistanceMatrices, unit);
     }
-    return unitToDistanceMatrix;
+    stSet_destructIterator(it);
+    stSet_destruct(homologyUnits);
 }
 
 stSet *stCaf_getBadChains(stSet *homologyUnits, TreeBuildingConstants *constants, stCaf_PhylogenyParameters *params, Flower *flower) {
     stSet *ret = stSet_construct2(free);
-    stHash *unitToDistanceMatrix = getDistanceMatricesForUnits(homologyUnits, constants, params);
-    stHash *badDivergences = getBadDivergences(homologyUnits, constants, flower, unitToDistanceMatrix);
+    stHash *unitsToDistanceMatrices = getDistanceMatricesForUnits(homologyUnits, constants);
+    stHash *badDivergences = getBadDivergences(homologyUnits, constants, flower, unitsToDistanceMatrices);
 
     stSetIterator *it = stSet_getIterator(homologyUnits);
     HomologyUnit *unit;
     while ((unit = stSet_getNext(it)) != NULL) {
         assert(unit->unitType == CHAIN);
-        stMatrix *distanceMatrix = stHash_search(unitToDistanceMatrix, unit);
+        stMatrix *distanceMatrix = ((CachedDistanceMatrix *) stHash_search(unitsToDistanceMatrices, unit))->distanceMatrix;
         stTree **indexToSpecies = getIndexToSpecies(unit, constants, flower);
 
         bool unitIsBad = false;
@@ -1782,7 +1917,6 @@ stSet *stCaf_getBadChains(stSet *homologyUnits, TreeBuildingConstants *constants
         free(indexToSpecies);
     }
     stSet_destructIterator(it);
-    stHash_destruct(unitToDistanceMatrix);
     stHash_destruct(badDivergences);
     return ret;
 }
@@ -1904,7 +2038,7 @@ static void stCaf_removeBadChains(stPinchThreadSet *threadSet,
            numBadBlocksRemoved, numBadColumnsRemoved);
     stSet_destructIterator(it);
     stSet_destruct(badChains);
-    stSet_destruct(homologyUnits);
+    destructHomologyUnits(homologyUnits, constants);
 }
 
 void stCaf_buildTreesToRemoveAncientHomologies(stPinchThreadSet *threadSet,
@@ -1945,11 +2079,19 @@ void stCaf_buildTreesToRemoveAncientHomologies(stPinchThreadSet *threadSet,
     constants.eventToSpeciesNode = eventToSpeciesNode;
     constants.speciesStTree = speciesStTree;
     constants.speciesToSplitOn = speciesToSplitOn;
+    stCaf_Scheduler *treeBuildingPool = stCaf_Scheduler_construct(
+        params->numTreeBuildingThreads,
+        (void *(*)(void *)) buildTreeForHomologyUnit,
+        (void (*)(void *)) addTreeToHash);
+    constants.treeBuildingPool = treeBuildingPool;
+    constants.unitsToDistanceMatrices = stHash_construct2(NULL, (void (*)(void *)) CachedDistanceMatrix_destruct);
 
     for (int64_t i = 0; i < stList_length(params->treeBuildingMethods); i++) {
         enum stCaf_TreeBuildingMethod *method = stList_get(params->treeBuildingMethods, i);
         if (*method == REMOVE_BAD_CHAINS) {
             stCaf_removeBadChains(threadSet, &constants, params, flower);
+            stCaf_Scheduler_destruct(treeBuildingPool);
+            stHash_destruct(constants.unitsToDistanceMatrices);
             // This will cause a memory leak
             return;
         }
@@ -1979,11 +2121,6 @@ void stCaf_buildTreesToRemoveAncientHomologies(stPinchThreadSet *threadSet,
     printf("\n");
     stSet_destructIterator(speciesToSplitOnIt);
 
-    stThreadPool *treeBuildingPool = stThreadPool_construct(
-        params->numTreeBuildingThreads,
-        (void *(*)(void *)) buildTreeForHomologyUnit,
-        (void (*)(void *)) addTreeToHash);
-
     gDebugFile = debugFile;
 
     // This hash stores a mapping (kept up-to-date after every split)
@@ -2021,7 +2158,7 @@ void stCaf_buildTreesToRemoveAncientHomologies(stPinchThreadSet *threadSet,
     stSet_destructIterator(homologyUnitIt);
 
     // We need the trees to be done before we can continue.
-    stThreadPool_wait(treeBuildingPool);
+    stCaf_Scheduler_wait(treeBuildingPool);
 
     if (debugFile != NULL) {
         blockIt = stPinchThreadSet_getBlockIt(threadSet);
@@ -2043,7 +2180,7 @@ void stCaf_buildTreesToRemoveAncientHomologies(stPinchThreadSet *threadSet,
     } else {
         stSet *chainHomologyUnits = stCaf_getHomologyUnits(flower, threadSet, NULL, CHAIN);
         stCaf_printBadChainSummary(chainHomologyUnits, &constants, params, flower);
-        stSet_destruct(chainHomologyUnits);
+        destructHomologyUnits(chainHomologyUnits, &constants);
     }
 
     // All the blocks have their trees computed. Find the split
@@ -2133,13 +2270,19 @@ void stCaf_buildTreesToRemoveAncientHomologies(stPinchThreadSet *threadSet,
             numSingleDegreeSegmentsDropped,
             ((float)numSingleDegreeSegmentsDropped)/stPinchThreadSet_getTotalBlockNumber(threadSet),
             numBasesDroppedFromSingleDegreeSegments);
+    fprintf(stdout, "Tree-building took %lf seconds of wall time over %" PRIi64 " threads:\n",
+            stCaf_Scheduler_getWallTime(treeBuildingPool), stCaf_Scheduler_getNumThreads(treeBuildingPool));
+    stCaf_Scheduler_printWorkerStats(treeBuildingPool, stdout);
 
     // Get the bad chains again. NB: We have to recompute the
     // homologyUnits set even if unitType is CHAIN, because the
     // structure of the cactus graph may have changed.
     stSet *chainHomologyUnits = stCaf_getHomologyUnits(flower, threadSet, NULL, CHAIN);
     stCaf_printBadChainSummary(chainHomologyUnits, &constants, params, flower);
-    stSet_destruct(chainHomologyUnits);
+    destructHomologyUnits(chainHomologyUnits, &constants);
+    fprintf(stdout, "The bad-chain detection reused %" PRIi64 " distance matrices (built from %" PRIi64
+            " feature columns) from tree building and had to compute %" PRIi64 " itself.\n",
+            numDistanceMatricesReused, numFeatureColumnsReused, numDistanceMatricesComputed);
 
     //Cleanup
     for (int64_t i = 0; i < stTree_getNumNodes(speciesStTree); i++) {
@@ -2147,7 +2290,8 @@ void stCaf_buildTreesToRemoveAncientHomologies(stPinchThreadSet *threadSet,
     }
     free(speciesMRCAMatrix);
     stTree_destruct(speciesStTree);
-    stThreadPool_destruct(treeBuildingPool);
+    stCaf_Scheduler_destruct(treeBuildingPool);
+    stHash_destruct(constants.unitsToDistanceMatrices);
     stHash_destruct(homologyUnitsToTrees);
     stHash_destruct(blocksToHomologyUnits);
     if (debugFile != NULL) {
@@ -0,0 +1,272 @@
+/*
+ * scheduler.c
+ *
+ *  A size-aware, work-stealing batch scheduler. Jobs are queued with an
+ *  estimated cost, then on wait they are sorted longest-first and dealt
+ *  out to the least loaded worker (the LPT heuristic). Each worker runs
+ *  its own queue from the largest job down; when it is empty it steals
+ *  the smallest job left on the queue of the worker with the most
+ *  remaining estimated work, so mis-estimated costs still balance out.
+ */
+
+#include "sonLib.h"
+#include "stCafScheduler.h"
+#include <pthread.h>
+#include <time.h>
+
+typedef struct {
+    void *job;
+    int64_t cost;
+    int64_t order; // Push order, used to make the sort deterministic.
+} ScheduledJob;
+
+typedef struct {
+    stCaf_Scheduler *scheduler;
+    int64_t index;
+    pthread_mutex_t lock;
+    // The jobs dealt to this worker, in descending cost order. The
+    // worker takes from first, thieves take from last.
+    ScheduledJob *jobs;
+    int64_t first;
+    int64_t last;
+    int64_t capacity;
+    int64_t remainingCost;
+    // Stats, accumulated over all calls to wait.
+    double busyTime;
+    int64_t jobsRun;
+    int64_t jobsStolen;
+} Worker;
+
+struct _stCaf_Scheduler {
+    int64_t numThreads;
+    void *(*workerFn)(void *);
+    void (*finisherFn)(void *);
+    pthread_mutex_t finisherLock;
+    ScheduledJob *pending;
+    int64_t pendingLength;
+    int64_t pendingCapacity;
+    Worker *workers;
+    double wallTime;
+};
+
+static double getTime(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1.0e9;
+}
+
+stCaf_Scheduler *stCaf_Scheduler_construct(int64_t numThreads,
+                                           void *(*workerFn)(void *),
+                                           void (*finisherFn)(void *)) {
+    if (numThreads < 1) {
+        st_errAbort("The scheduler needs at least one thread, got %" PRIi64, numThreads);
+    }
+    stCaf_Scheduler *scheduler = st_calloc(1, sizeof(stCaf_Scheduler));
+    scheduler->numThreads = numThreads;
+    scheduler->workerFn = workerFn;
+    scheduler->finisherFn = finisherFn;
+    pthread_mutex_init(&scheduler->finisherLock, NULL);
+    scheduler->workers = st_calloc(numThreads, sizeof(Worker));
+    for (int64_t i = 0; i < numThreads; i++) {
+        Worker *worker = &scheduler->workers[i];
+        worker->scheduler = scheduler;
+        worker->index = i;
+        pthread_mutex_init(&worker->lock, NULL);
+    }
+    return scheduler;
+}
+
+void stCaf_Scheduler_destruct(stCaf_Scheduler *scheduler) {
+    assert(scheduler->pendingLength == 0);
+    for (int64_t i = 0; i < scheduler->numThreads; i++) {
+        pthread_mutex_destroy(&scheduler->workers[i].lock);
+        free(scheduler->workers[i].jobs);
+    }
+    pthread_mutex_destroy(&scheduler->finisherLock);
+    free(scheduler->workers);
+    free(scheduler->pending);
+    free(scheduler);
+}
+
+void stCaf_Scheduler_push(stCaf_Scheduler *scheduler, void *job, int64_t cost) {
+    if (scheduler->pendingLength == scheduler->pendingCapacity) {
+        scheduler->pendingCapacity = scheduler->pendingCapacity * 2 + 16;
+        scheduler->pending = st_realloc(scheduler->pending, scheduler->pendingCapacity * sizeof(ScheduledJob));
+    }
+    ScheduledJob *scheduledJob = &scheduler->pending[scheduler->pendingLength];
+    scheduledJob->job = job;
+    scheduledJob->cost = cost;
+    scheduledJob->order = scheduler->pendingLength++;
+}
+
+// Sorts in descending order of cost, breaking ties by push order.
+static int scheduledJob_cmp(const void *a, const void *b) {
+    const ScheduledJob *job1 = a;
+    const ScheduledJob *job2 = b;
+    if (job1->cost != job2->cost) {
+        return job1->cost > job2->cost ? -1 : 1;
+    }
+    return job1->order < job2->order ? -1 : (job1->order > job2->order ? 1 : 0);
+}
+
+static void worker_append(Worker *worker, ScheduledJob *job) {
+    if (worker->last == worker->capacity) {
+        worker->capacity = worker->capacity * 2 + 16;
+        worker->jobs = st_realloc(worker->jobs, worker->capacity * sizeof(ScheduledJob));
+    }
+    worker->jobs[worker->last++] = *job;
+    worker->remainingCost += job->cost;
+}
+
+// Takes the largest job from the worker's own queue.
+static bool worker_takeOwn(Worker *worker, ScheduledJob *job) {
+    bool found = false;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->first < worker->last) {
+        *job = worker->jobs[worker->first++];
+        worker->remainingCost -= job->cost;
+        found = true;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return found;
+}
+
+// Steals the smallest job from the worker with the most remaining
+// work. Returns false once every queue is empty.
+static bool worker_steal(Worker *thief, ScheduledJob *job) {
+    stCaf_Scheduler *scheduler = thief->scheduler;
+    for (;;) {
+        Worker *victim = NULL;
+        int64_t maxRemaining = -1;
+        for (int64_t i = 0; i < scheduler->numThreads; i++) {
+            Worker *worker = &scheduler->workers[i];
+            pthread_mutex_lock(&worker->lock);
+            if (worker->first < worker->last && worker->remainingCost > maxRemaining) {
+                maxRemaining = worker->remainingCost;
+                victim = worker;
+            }
+            pthread_mutex_unlock(&worker->lock);
+        }
+        if (victim == NULL) {
+            return false;
+        }
+        pthread_mutex_lock(&victim->lock);
+        bool found = false;
+        if (victim->first < victim->last) {
+            *job = victim->jobs[--victim->last];
+            victim->remainingCost -= job->cost;
+            found = true;
+        }
+        pthread_mutex_unlock(&victim->lock);
+        if (found) {
+            return true;
+        }
+        // Lost a race for the last job in that queue, look again.
+    }
+}
+
+static void *worker_run(void *arg) {
+    Worker *worker = arg;
+    stCaf_Scheduler *scheduler = worker->scheduler;
+    ScheduledJob job;
+    for (;;) {
+        bool stolen = false;
+        if (!worker_takeOwn(worker, &job)) {
+            if (!worker_steal(worker, &job)) {
+                break;
+            }
+            stolen = true;
+        }
+        double startTime = getTime();
+        void *result = scheduler->workerFn(job.job);
+        if (scheduler->finisherFn != NULL) {
+            pthread_mutex_lock(&scheduler->finisherLock);
+            scheduler->finisherFn(result);
+            pthread_mutex_unlock(&scheduler->finisherLock);
+        }
+        worker->busyTime += getTime() - startTime;
+        worker->jobsRun++;
+        if (stolen) {
+            worker->jobsStolen++;
+        }
+    }
+    return NULL;
+}
+
+void stCaf_Scheduler_wait(stCaf_Scheduler *scheduler) {
+    if (scheduler->pendingLength == 0) {
+        return;
+    }
+    double startTime = getTime();
+
+    // Deal the jobs out longest-first, each to the least loaded worker.
+    qsort(scheduler->pending, scheduler->pendingLength, sizeof(ScheduledJob), scheduledJob_cmp);
+    for (int64_t i = 0; i < scheduler->numThreads; i++) {
+        Worker *worker = &scheduler->workers[i];
+        worker->first = 0;
+        worker->last = 0;
+        worker->remainingCost = 0;
+    }
+    for (int64_t i = 0; i < scheduler->pendingLength; i++) {
+        Worker *leastLoaded = &scheduler->workers[0];
+        for (int64_t j = 1; j < scheduler->numThreads; j++) {
+            if (scheduler->workers[j].remainingCost < leastLoaded->remainingCost) {
+                leastLoaded = &scheduler->workers[j];
+            }
+        }
+        worker_append(leastLoaded, &scheduler->pending[i]);
+    }
+    scheduler->pendingLength = 0;
+
+    pthread_t *threads = st_malloc(scheduler->numThreads * sizeof(pthread_t));
+    for (int64_t i = 0; i < scheduler->numThreads; i++) {
+        if (pthread_create(&threads[i], NULL, worker_run, &scheduler->workers[i]) != 0) {
+            st_errAbort("Could not create scheduler worker thread");
+        }
+    }
+    for (int64_t i = 0; i < scheduler->numThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    scheduler->wallTime += getTime() - startTime;
+}
+
+int64_t stCaf_Scheduler_getNumThreads(stCaf_Scheduler *scheduler) {
+    return scheduler->numThreads;
+}
+
+double stCaf_Scheduler_getBusyTime(stCaf_Scheduler *scheduler, int64_t worker) {
+    assert(worker >= 0 && worker < scheduler->numThreads);
+    return scheduler->workers[worker].busyTime;
+}
+
+int64_t stCaf_Scheduler_getJobsRun(stCaf_Scheduler *scheduler, int64_t worker) {
+    assert(worker >= 0 && worker < scheduler->numThreads);
+    return scheduler->workers[worker].jobsRun;
+}
+
+int64_t stCaf_Scheduler_getJobsStolen(stCaf_Scheduler *scheduler, int64_t worker) {
+    assert(worker >= 0 && worker < scheduler->numThreads);
+    return scheduler->workers[worker].jobsStolen;
+}
+
+double stCaf_Scheduler_getWallTime(stCaf_Scheduler *scheduler) {
+    return scheduler->wallTime;
+}
+
+void stCaf_Scheduler_printWorkerStats(stCaf_Scheduler *scheduler, FILE *fileHandle) {
+    double wallTime = scheduler->wallTime;
+    double totalBusyTime = 0.0;
+    for (int64_t i = 0; i < scheduler->numThreads; i++) {
+        Worker *worker = &scheduler->workers[i];
+        totalBusyTime += worker->busyTime;
+        fprintf(fileHandle, "Worker %" PRIi64 " was busy for %lf of %lf seconds (%.1lf%%), "
+                "running %" PRIi64 " jobs of which %" PRIi64 " were stolen\n",
+                i, worker->busyTime, wallTime,
+                wallTime > 0.0 ? 100.0 * worker->busyTime / wallTime : 0.0,
+                worker->jobsRun, worker->jobsStolen);
+    }
+    fprintf(fileHandle, "Overall worker utilisation was %.1lf%%\n",
+            wallTime > 0.0 ? 100.0 * totalBusyTime / (wallTime * scheduler->numThreads) : 0.0);
+}
@@ -0,0 +1,67 @@
+/*
+ * stCafScheduler.h
+ *
+ *  A size-aware, work-stealing replacement for stThreadPool, used to
+ *  run batches of jobs whose costs are very skewed (e.g. tree building
+ *  for a handful of huge chains next to millions of tiny blocks).
+ */
+
+#ifndef STCAF_SCHEDULER_H_
+#define STCAF_SCHEDULER_H_
+
+#include "sonLib.h"
+
+typedef struct _stCaf_Scheduler stCaf_Scheduler;
+
+/*
+ * Creates a scheduler with numThreads workers. As with stThreadPool,
+ * workerFn is run in parallel on every job and finisherFn is run, one
+ * call at a time, on the value returned by workerFn.
+ */
+stCaf_Scheduler *stCaf_Scheduler_construct(int64_t numThreads,
+                                           void *(*workerFn)(void *),
+                                           void (*finisherFn)(void *));
+
+void stCaf_Scheduler_destruct(stCaf_Scheduler *scheduler);
+
+/*
+ * Queues a job with the given estimated cost (in arbitrary units, only
+ * the relative values matter). Jobs are not started until
+ * stCaf_Scheduler_wait is called.
+ */
+void stCaf_Scheduler_push(stCaf_Scheduler *scheduler, void *job, int64_t cost);
+
+/*
+ * Runs all the queued jobs and returns when they are all finished.
+ * Jobs are dealt out longest-first to the least loaded worker, and a
+ * worker that runs out of jobs steals from the worker with the most
+ * remaining estimated work.
+ */
+void stCaf_Scheduler_wait(stCaf_Scheduler *scheduler);
+
+int64_t stCaf_Scheduler_getNumThreads(stCaf_Scheduler *scheduler);
+
+/*
+ * Wall-clock seconds the given worker spent running jobs, summed over
+ * all the calls to stCaf_Scheduler_wait so far.
+ */
+double stCaf_Scheduler_getBusyTime(stCaf_Scheduler *scheduler, int64_t worker);
+
+/*
+ * Number of jobs the given worker ran, and how many of those it stole
+ * from another worker's queue.
+ */
+int64_t stCaf_Scheduler_getJobsRun(stCaf_Scheduler *scheduler, int64_t worker);
+int64_t stCaf_Scheduler_getJobsStolen(stCaf_Scheduler *scheduler, int64_t worker);
+
+/*
+ * Total wall-clock seconds spent inside stCaf_Scheduler_wait.
+ */
+double stCaf_Scheduler_getWallTime(stCaf_Scheduler *scheduler);
+
+/*
+ * Prints the per-worker busy time and utilisation to the given file.
+ */
+void stCaf_Scheduler_printWorkerStats(stCaf_Scheduler *scheduler, FILE *fileHandle);
+
+#endif /* STCAF_SCHEDULER_H_ */
@@ -19,6 +19,29 @@
  */
 stList *stCaf_breakupComponentGreedily(stList *nodes, stList *edges, int64_t maxComponentSize);
 
+/*
+ * An edge, as used by stCaf_breakupComponentGreedilyFlat.
+ */
+typedef struct _stCaf_WeightedEdge {
+    int64_t weight;
+    int64_t node1;
+    int64_t node2;
+} stCaf_WeightedEdge;
+
+/*
+ * As stCaf_breakupComponentGreedily, but with the nodes numbered 0 to nodeNumber-1 and the edges in an array.
+ * Writes the indices of the edges to delete into edgesToDelete, which must have room for edgeNumber
+ * entries, in the same order as stCaf_breakupComponentGreedily would return them, and returns how many there are.
+ */
+int64_t stCaf_breakupComponentGreedilyFlat(int64_t nodeNumber, const stCaf_WeightedEdge *edges, int64_t edgeNumber,
+        int64_t maxComponentSize, int64_t *edgesToDelete);
+
+/*
+ * The original implementation of stCaf_breakupComponentGreedily, which keeps each component in an
+ * stSortedSet. Kept as a reference for testing and benchmarking; it returns the same edges in the same order.
+ */
+stList *stCaf_breakupComponentGreedilyUsingSortedSets(stList *nodes, stList *edges, int64_t maxComponentSize);
+
 /*
  * Break up component extra large compoonents greedily.
  */
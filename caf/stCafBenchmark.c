@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+/*
+ * Benchmarks the caf routines against their reference implementations on
+ * random inputs, checking that they give identical results.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "sonLib.h"
+#include "stGiantComponent.h"
+
+static double getTime(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1.0e9;
+}
+
+/*
+ * Makes a random graph shaped like a giant adjacency component: edges mostly
+ * join nearby nodes, so the graph is connected, and most have small
+ * multiplicities, so the weights have many ties.
+ */
+static stCaf_WeightedEdge *makeRandomGraph(int64_t nodeNumber, int64_t edgeNumber) {
+    stCaf_WeightedEdge *edges = st_malloc(sizeof(stCaf_WeightedEdge) * edgeNumber);
+    for (int64_t i = 0; i < edgeNumber; i++) {
+        int64_t node1 = st_randomInt(0, nodeNumber);
+        int64_t node2 = st_random() < 0.9 ? (node1 + st_randomInt(0, 100)) % nodeNumber : st_randomInt(0, nodeNumber);
+        edges[i].weight = st_random() < 0.9 ? 1 : st_randomInt(2, 50);
+        edges[i].node1 = node1;
+        edges[i].node2 = node2;
+    }
+    return edges;
+}
+
+/*
+ * Times stCaf_breakupComponentGreedilyUsingSortedSets,
+ * stCaf_breakupComponentGreedily and stCaf_breakupComponentGreedilyFlat on
+ * the same graph. Returns non-zero if they delete different edges.
+ */
+static int benchmarkBreakupComponentGreedily(int64_t nodeNumber, int64_t edgeNumber, int64_t maxComponentSize,
+        int64_t repeats, bool skipSortedSets) {
+    stCaf_WeightedEdge *edges = makeRandomGraph(nodeNumber, edgeNumber);
+    stList *nodes = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    for (int64_t i = 0; i < nodeNumber; i++) {
+        stList_append(nodes, stIntTuple_construct1(i));
+    }
+    stList *edgeTuples = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    for (int64_t i = 0; i < edgeNumber; i++) {
+        stList_append(edgeTuples, stIntTuple_construct3(edges[i].weight, edges[i].node1, edges[i].node2));
+    }
+
+    double sortedSetTime = 0.0, listTime = 0.0, flatTime = 0.0;
+    int64_t *edgesToDelete = st_malloc(sizeof(int64_t) * (edgeNumber > 0 ? edgeNumber : 1));
+    int64_t edgesToDeleteNumber = 0;
+    bool identical = 1;
+    for (int64_t r = 0; r < repeats; r++) {
+        double startTime = getTime();
+        edgesToDeleteNumber = stCaf_breakupComponentGreedilyFlat(nodeNumber, edges, edgeNumber, maxComponentSize,
+                edgesToDelete);
+        flatTime += getTime() - startTime;
+
+        startTime = getTime();
+        stList *listEdgesToDelete = stCaf_breakupComponentGreedily(nodes, edgeTuples, maxComponentSize);
+        listTime += getTime() - startTime;
+
+        // The list functions return the tuples themselves, so compare by identity.
+        identical = identical && stList_length(listEdgesToDelete) == edgesToDeleteNumber;
+        for (int64_t i = 0; identical && i < edgesToDeleteNumber; i++) {
+            identical = stList_get(listEdgesToDelete, i) == stList_get(edgeTuples, edgesToDelete[i]);
+        }
+        stList_destruct(listEdgesToDelete);
+
+        if (!skipSortedSets) {
+            startTime = getTime();
+            stList *sortedSetEdgesToDelete = stCaf_breakupComponentGreedilyUsingSortedSets(nodes, edgeTuples,
+                    maxComponentSize);
+            sortedSetTime += getTime() - startTime;
+
+            // This may return either copy of a duplicated edge, so compare by value.
+            identical = identical && stList_length(sortedSetEdgesToDelete) == edgesToDeleteNumber;
+            for (int64_t i = 0; identical && i < edgesToDeleteNumber; i++) {
+                identical = stIntTuple_equalsFn(stList_get(sortedSetEdgesToDelete, i),
+                        stList_get(edgeTuples, edgesToDelete[i]));
+            }
+            stList_destruct(sortedSetEdgesToDelete);
+        }
+    }
+
+    fprintf(stdout, "stCaf_breakupComponentGreedily: %" PRIi64 " nodes, %" PRIi64 " edges, max component size %"
+            PRIi64 ", %" PRIi64 " edges deleted: ", nodeNumber, edgeNumber, maxComponentSize, edgesToDeleteNumber);
+    if (!skipSortedSets) {
+        fprintf(stdout, "sorted sets %lf s, ", sortedSetTime / repeats);
+    }
+    fprintf(stdout, "union-find %lf s, flat union-find %lf s, results %s\n", listTime / repeats, flatTime / repeats,
+            identical ? "identical" : "DIFFERENT");
+
+    free(edgesToDelete);
+    stList_destruct(edgeTuples);
+    stList_destruct(nodes);
+    free(edges);
+    return !identical;
+}
+
+static void usage(void) {
+    fprintf(stderr, "stCafBenchmark [options]\n");
+    fprintf(stderr, "-a --nodes : Number of nodes in the random graph (default 1000000)\n");
+    fprintf(stderr, "-b --edges : Number of edges in the random graph (default 4000000)\n");
+    fprintf(stderr, "-c --maxComponentSize : Largest component size allowed (default 1000)\n");
+    fprintf(stderr, "-d --repeats : Number of times to repeat each benchmark (default 3)\n");
+    fprintf(stderr, "-e --seed : Random seed (default 1)\n");
+    fprintf(stderr, "-f --skipSortedSets : Don't run the sorted set reference implementation\n");
+    fprintf(stderr, "-h --help : Print this help screen\n");
+}
+
+int main(int argc, char *argv[]) {
+    int64_t nodeNumber = 1000000;
+    int64_t edgeNumber = 4000000;
+    int64_t maxComponentSize = 1000;
+    int64_t repeats = 3;
+    int64_t seed = 1;
+    bool skipSortedSets = 0;
+
+    while (1) {
+        static struct option long_options[] = { { "nodes", required_argument, 0, 'a' },
+                { "edges", required_argument, 0, 'b' }, { "maxComponentSize", required_argument, 0, 'c' },
+                { "repeats", required_argument, 0, 'd' }, { "seed", required_argument, 0, 'e' },
+                { "skipSortedSets", no_argument, 0, 'f' }, { "help", no_argument, 0, 'h' }, { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+        int key = getopt_long(argc, argv, "a:b:c:d:e:fh", long_options, &option_index);
+        if (key == -1) {
+            break;
+        }
+        switch (key) {
+            case 'a':
+                nodeNumber = atol(optarg);
+                break;
+            case 'b':
+                edgeNumber = atol(optarg);
+                break;
+            case 'c':
+                maxComponentSize = atol(optarg);
+                break;
+            case 'd':
+                repeats = atol(optarg);
+                break;
+            case 'e':
+                seed = atol(optarg);
+                break;
+            case 'f':
+                skipSortedSets = 1;
+                break;
+            case 'h':
+                usage();
+                return 0;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    if (nodeNumber < 1 || edgeNumber < 0 || maxComponentSize < 1) {
+        usage();
+        return 1;
+    }
+    if (repeats < 1) {
+        repeats = 1;
+    }
+
+    st_randomSeed(seed);
+    int failed = benchmarkBreakupComponentGreedily(nodeNumber, edgeNumber, maxComponentSize, repeats, skipSortedSets);
+
+    return failed ? 1 : 0;
+}
@@ -136,6 +136,50 @@ static void testBreakUpComponentGreedily(CuTest *testCase) {
     }
 }
 
+static void testBreakUpComponentGreedily_sameAsSortedSets(CuTest *testCase) {
+    /*
+     * Checks the union-find implementation rejects exactly the edges the
+     * original stSortedSet implementation does, in the same order, for node
+     * labels that are and aren't 0..n-1, and for weights that do and don't
+     * fit the radix sort.
+     */
+    for (int64_t test = 0; test < 100; test++) {
+        st_logInfo("Starting union-find versus sorted set random test %" PRIi64 "\n", test);
+        int64_t nodeNumber = st_randomInt(1, 500);
+        int64_t labelling = st_randomInt(0, 3);
+        int64_t weighting = st_randomInt(0, 3);
+        stList *nodeLabels = stList_construct3(0, (void(*)(void *)) stIntTuple_destruct);
+        for (int64_t i = 0; i < nodeNumber; i++) {
+            int64_t label = labelling == 0 ? nodeNumber - 1 - i : (labelling == 1 ? 3 + 7 * i : -1000000 + 1000003 * i);
+            stList_append(nodeLabels, stIntTuple_construct1(label));
+        }
+        stList *labelledEdges = stList_construct3(0, (void(*)(void *)) stIntTuple_destruct);
+        int64_t edgeNumber = st_randomInt(0, 5 * nodeNumber);
+        for (int64_t i = 0; i < edgeNumber; i++) {
+            int64_t weight = weighting == 0 ? st_randomInt(1, 4) : (weighting == 1 ? st_randomInt(-50, 50) : st_randomInt(0, 1000) * (INT64_C(1) << 52));
+            int64_t node1 = stIntTuple_get(stList_get(nodeLabels, st_randomInt(0, nodeNumber)), 0);
+            int64_t node2 = stIntTuple_get(stList_get(nodeLabels, st_randomInt(0, nodeNumber)), 0);
+            stList_append(labelledEdges, stIntTuple_construct3(weight, node1, node2));
+            if (st_random() < 0.1) { //Duplicate edges
+                stList_append(labelledEdges, stIntTuple_construct3(weight, node1, node2));
+            }
+        }
+        int64_t maxSize = st_randomInt(1, nodeNumber + 1);
+
+        stList *edgesToDelete = stCaf_breakupComponentGreedily(nodeLabels, labelledEdges, maxSize);
+        stList *expectedEdgesToDelete = stCaf_breakupComponentGreedilyUsingSortedSets(nodeLabels, labelledEdges, maxSize);
+        CuAssertIntEquals(testCase, stList_length(expectedEdgesToDelete), stList_length(edgesToDelete));
+        for (int64_t i = 0; i < stList_length(edgesToDelete); i++) {
+            CuAssertTrue(testCase, stIntTuple_equalsFn(stList_get(expectedEdgesToDelete, i), stList_get(edgesToDelete, i)));
+        }
+
+        stList_destruct(edgesToDelete);
+        stList_destruct(expectedEdgesToDelete);
+        stList_destruct(labelledEdges);
+        stList_destruct(nodeLabels);
+    }
+}
+
 static int64_t getSizeOfLargestAdjacencyComponent(stList *adjacencyComponents) {
     int64_t largestAdjacencyComponentSizeInGraph = 0;
     for (int64_t i = 0; i < stList_length(adjacencyComponents); i++) {
@@ -183,6 +227,7 @@ static void testBreakUpPinchGraphAdjacencyComponentsGreedily(CuTest *testCase) {
 CuSuite* giantComponentTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, testBreakUpComponentGreedily);
+    SUITE_ADD_TEST(suite, testBreakUpComponentGreedily_sameAsSortedSets);
     SUITE_ADD_TEST(suite, testBreakUpPinchGraphAdjacencyComponentsGreedily);
     return suite;
 }
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "CuTest.h"
+#include "sonLib.h"
+#include "stCafScheduler.h"
+
+typedef struct {
+    int64_t cost;
+    int64_t timesRun;
+    int64_t timesFinished;
+} TestJob;
+
+// Only touched by the finisher, which the scheduler runs serially.
+static int64_t finishedInsideFinisher;
+static int64_t jobsFinished;
+
+static void *runTestJob(TestJob *job) {
+    // Burn time roughly in proportion to the cost.
+    volatile double x = 0.0;
+    for (int64_t i = 0; i < job->cost * 1000; i++) {
+        x += sqrt((double) i);
+    }
+    job->timesRun++;
+    return job;
+}
+
+static void finishTestJob(TestJob *job) {
+    finishedInsideFinisher++;
+    assert(finishedInsideFinisher == 1);
+    job->timesFinished++;
+    jobsFinished++;
+    finishedInsideFinisher--;
+}
+
+static void testScheduler_runsEveryJobOnce(CuTest *testCase) {
+    for (int64_t test = 0; test < 20; test++) {
+        st_logInfo("Starting scheduler random test %" PRIi64 "\n", test);
+        int64_t numThreads = st_randomInt(1, 8);
+        int64_t numJobs = st_randomInt(0, 2000);
+        stCaf_Scheduler *scheduler = stCaf_Scheduler_construct(numThreads, (void *(*)(void *)) runTestJob,
+                                                               (void (*)(void *)) finishTestJob);
+        TestJob *jobs = st_calloc(numJobs, sizeof(TestJob));
+        // Two rounds, to check the scheduler can be reused.
+        for (int64_t round = 0; round < 2; round++) {
+            jobsFinished = 0;
+            for (int64_t i = 0; i < numJobs; i++) {
+                // Very skewed: a few huge jobs and lots of tiny ones.
+                jobs[i].cost = st_random() < 0.01 ? st_randomInt(100, 1000) : st_randomInt(0, 3);
+                stCaf_Scheduler_push(scheduler, &jobs[i], jobs[i].cost);
+            }
+            stCaf_Scheduler_wait(scheduler);
+            CuAssertIntEquals(testCase, numJobs, jobsFinished);
+            for (int64_t i = 0; i < numJobs; i++) {
+                CuAssertIntEquals(testCase, round + 1, jobs[i].timesRun);
+                CuAssertIntEquals(testCase, round + 1, jobs[i].timesFinished);
+            }
+        }
+
+        // Check the per-worker stats add up.
+        int64_t totalJobsRun = 0;
+        for (int64_t i = 0; i < numThreads; i++) {
+            CuAssertTrue(testCase, stCaf_Scheduler_getBusyTime(scheduler, i) >= 0.0);
+            CuAssertTrue(testCase, stCaf_Scheduler_getBusyTime(scheduler, i) <= stCaf_Scheduler_getWallTime(scheduler) + 0.01);
+            CuAssertTrue(testCase, stCaf_Scheduler_getJobsStolen(scheduler, i) <= stCaf_Scheduler_getJobsRun(scheduler, i));
+            totalJobsRun += stCaf_Scheduler_getJobsRun(scheduler, i);
+        }
+        CuAssertIntEquals(testCase, 2 * numJobs, totalJobsRun);
+        if (st_getLogLevel() >= info) {
+            stCaf_Scheduler_printWorkerStats(scheduler, stderr);
+        }
+
+        stCaf_Scheduler_destruct(scheduler);
+        free(jobs);
+    }
+}
+
+static void testScheduler_noFinisher(CuTest *testCase) {
+    stCaf_Scheduler *scheduler = stCaf_Scheduler_construct(3, (void *(*)(void *)) runTestJob, NULL);
+    TestJob jobs[10];
+    for (int64_t i = 0; i < 10; i++) {
+        jobs[i].cost = i;
+        jobs[i].timesRun = 0;
+        stCaf_Scheduler_push(scheduler, &jobs[i], jobs[i].cost);
+    }
+    stCaf_Scheduler_wait(scheduler);
+    for (int64_t i = 0; i < 10; i++) {
+        CuAssertIntEquals(testCase, 1, jobs[i].timesRun);
+    }
+    // Waiting with nothing queued is a no-op.
+    stCaf_Scheduler_wait(scheduler);
+    stCaf_Scheduler_destruct(scheduler);
+}
+
+CuSuite* schedulerTestSuite(void) {
+    CuSuite* suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testScheduler_runsEveryJobOnce);
+    SUITE_ADD_TEST(suite, testScheduler_noFinisher);
+    return suite;
+}
@@ -99,6 +99,23 @@ struct Tree *neighbour_joining_buildtree( struct ClusterGroup *,
 					  unsigned int);
 
 
+/**********************************************************************
+ FUNCTION: exhaustive_neighbour_joining_buildtree
+ DESCRIPTION: 
+   As neighbour_joining_buildtree, but scans every pair of nodes in
+   every iteration
+ ARGS: 
+    As neighbour_joining_buildtree
+ RETURNS:
+    A Tree (trees.h)
+ NOTES: The original O(n^3) implementation, kept as a reference for
+   testing and benchmarking neighbour_joining_buildtree, which finds
+   the same pairs (and so the same tree) using sorted rows
+ **********************************************************************/
+struct Tree *exhaustive_neighbour_joining_buildtree( struct ClusterGroup *,
+						     unsigned int);
+
+
 /**********************************************************************
  FUNCTION: UPGMA_buildtree
  DESCRIPTION: 
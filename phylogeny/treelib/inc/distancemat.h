@@ -59,12 +59,33 @@ struct DistanceMatrix {
    distance is assigned (inspiration from ISMB99 poster by Huson,
    Smith and Warnow).
 
+   5. The alignment columns are encoded once and the pairs of
+   sequences compared in bulk, with SSE2/AVX2 where available. The
+   result is bit-identical to calc_scalar_DistanceMatrix.
+
  *********************************************************************/
 void calc_DistanceMatrix(struct DistanceMatrix *, 
 			 struct Alignment *,
 			 unsigned int,
 			 unsigned int );
 
+/*********************************************************************
+ FUNCTION: calc_scalar_DistanceMatrix
+ DESCRIPTION: 
+   As calc_DistanceMatrix, but compares the sequences one character at
+   a time
+ RETURNS: 
+ ARGS: 
+   As calc_DistanceMatrix
+ NOTES: 
+   The original implementation, kept as a reference for testing and
+   benchmarking calc_DistanceMatrix
+ *********************************************************************/
+void calc_scalar_DistanceMatrix(struct DistanceMatrix *, 
+				struct Alignment *,
+				unsigned int,
+				unsigned int );
+
 /*********************************************************************
  FUNCTION: clone_DistanceMatrix
  DESCRIPTION: 
@@ -6,6 +6,8 @@
  **  (and vice versa)
  **********************************************************************/
 
+#include <math.h>
+
 #include "buildtree.h"
 
 /**********************************************************************
@@ -176,23 +178,255 @@ void leaf_find_buildtree( struct Tnode *node,
 
 
 
+/*********************** pruned pair selection ************************/
+
+/* Below this many leaves the exhaustive scan is as fast as sorting */
+#define MIN_PRUNED_NJ_SIZE 32
+
+/* A row is compacted once a scan has skipped this many times more
+   dead entries than live ones */
+#define NJ_ROW_COMPACTION_RATIO 2
+
+struct NJEntry {
+  Distance d;
+  unsigned int j;
+};
+
+/* For each slot of the nodes array, the distances from the node in that
+   slot to the nodes that were alive when it was created, in ascending
+   order. created[] records the iteration in which each slot was last
+   filled (0 for the leaves), so an entry (d, j) of row i is current
+   exactly when slot j is alive and created[j] <= created[i]; otherwise
+   the pair lives in row j, or one of the nodes has been joined. The
+   leaves' rows only hold the leaves with a lower index, so that every
+   pair is stored once. */
+
+struct NJRows {
+  struct NJEntry **entries;
+  unsigned int *start;
+  unsigned int *length;
+  unsigned int *created;
+};
+
+
 /**********************************************************************
- FUNCTION: neighbour_joining_buildtree
+ FUNCTION: compare_NJEntry
  DESCRIPTION: 
-   Returns a phylogenetic tree of the sequences in the 
-   given alignment, using Saitou and Nei's neighbour-joining 
-   algorithm
+   qsort comparator ordering NJEntrys by ascending distance, with any
+   NaNs last
+ **********************************************************************/
+static int compare_NJEntry( const void *a, const void *b ) {
+  Distance da = ((const struct NJEntry *) a)->d;
+  Distance db = ((const struct NJEntry *) b)->d;
+
+  if (da < db) 
+    return -1;
+  if (da > db) 
+    return 1;
+  if (isnan(da)) 
+    return isnan(db) ? 0 : 1;
+  return isnan(db) ? -1 : 0;
+}
+
+
+/**********************************************************************
+ FUNCTION: fill_row_NJRows
+ DESCRIPTION: 
+   (Re)builds the sorted row for slot i, from the given candidate
+   columns, and stamps it with the given iteration
+ **********************************************************************/
+static void fill_row_NJRows( struct NJRows *rows,
+			     struct DistanceMatrix *mat,
+			     struct Tnode **nodes,
+			     unsigned int i,
+			     unsigned int num_columns,
+			     unsigned int created ) {
+  unsigned int m, len = 0;
+
+  for( m=0; m < num_columns; m++ ) {
+    if (m == i || nodes[m] == NULL) continue;
+    rows->entries[i][len].d = m > i ? mat->data[m][i] : mat->data[i][m];
+    rows->entries[i][len].j = m;
+    len++;
+  }
+  qsort( rows->entries[i], len, sizeof(struct NJEntry), compare_NJEntry );
+  rows->start[i] = 0;
+  rows->length[i] = len;
+  rows->created[i] = created;
+}
+
+
+/**********************************************************************
+ FUNCTION: new_NJRows
+ DESCRIPTION: 
+   Sorts the rows of the leaves' distance matrix
+ **********************************************************************/
+static struct NJRows *new_NJRows( struct DistanceMatrix *mat,
+				  struct Tnode **nodes,
+				  unsigned int numseqs ) {
+  unsigned int i;
+  struct NJRows *rows;
+
+  rows = (struct NJRows *) malloc_util( sizeof(struct NJRows) );
+  rows->entries = (struct NJEntry **) malloc_util( numseqs * sizeof(struct NJEntry *) );
+  rows->start = (unsigned int *) malloc_util( numseqs * sizeof(unsigned int) );
+  rows->length = (unsigned int *) malloc_util( numseqs * sizeof(unsigned int) );
+  rows->created = (unsigned int *) malloc_util( numseqs * sizeof(unsigned int) );
+  for( i=0; i < numseqs; i++ ) {
+    /* leaves only need the lower triangle, but the slot may be reused
+       for a joined node, which needs a full row */
+    rows->entries[i] = (struct NJEntry *) malloc_util( (i + 1) * sizeof(struct NJEntry) );
+    fill_row_NJRows( rows, mat, nodes, i, i, 0 );
+  }
+
+  return rows;
+}
+
+
+/**********************************************************************
+ FUNCTION: free_NJRows
+ **********************************************************************/
+static void *free_NJRows( struct NJRows *rows, unsigned int numseqs ) {
+  unsigned int i;
+
+  for( i=0; i < numseqs; i++ ) {
+    rows->entries[i] = free_util( rows->entries[i] );
+  }
+  rows->entries = free_util( rows->entries );
+  rows->start = free_util( rows->start );
+  rows->length = free_util( rows->length );
+  rows->created = free_util( rows->created );
+  return free_util( rows );
+}
+
+
+/**********************************************************************
+ FUNCTION: joined_row_NJRows
+ DESCRIPTION: 
+   Rebuilds the row of the node just created in slot i
+ **********************************************************************/
+static void joined_row_NJRows( struct NJRows *rows,
+			       struct DistanceMatrix *mat,
+			       struct Tnode **nodes,
+			       unsigned int numseqs,
+			       unsigned int i,
+			       unsigned int iteration ) {
+  if (rows->created[i] == 0) {
+    rows->entries[i] = (struct NJEntry *) 
+      realloc_util( rows->entries[i], numseqs * sizeof(struct NJEntry) );
+  }
+  fill_row_NJRows( rows, mat, nodes, i, numseqs, iteration );
+}
+
+
+/**********************************************************************
+ FUNCTION: select_pair_NJRows
+ DESCRIPTION: 
+   Finds the pair of live nodes minimising d(i,j) - (r[i] + r[j]),
+   exactly as the exhaustive scan in neighbour_joining_buildtree does
+ ARGS: 
+   The sorted rows, the nodes, the r values, the number of slots, and
+   the locations of the pair, which are left alone if no pair has a
+   value below FLT_MAX (as the exhaustive scan does)
+ NOTES: 
+   Scans each row in ascending order of distance and stops as soon as
+   d - (r[i] + max(r)), which rounds to no more than the value of any
+   later pair in the row, exceeds the best value so far (RapidNJ,
+   Simonsen et al. 2008). Ties are broken as the exhaustive scan
+   breaks them, on the lowest (larger index, smaller index).
+ **********************************************************************/
+static void select_pair_NJRows( struct NJRows *rows,
+				struct Tnode **nodes,
+				Distance *r,
+				unsigned int numseqs,
+				unsigned int *mini,
+				unsigned int *minj ) {
+  unsigned int i, j, k, hi, lo, found, live, dead;
+  unsigned int besthi = 0, bestlo = 0;
+  struct NJEntry *row;
+  Distance rmax, bound;
+  double dist, best;
+
+  rmax = -FLT_MAX;
+  for( i=0; i < numseqs; i++ ) {
+    if (nodes[i] != NULL && r[i] > rmax) 
+      rmax = r[i];
+  }
+
+  found = 0;
+  best = FLT_MAX;
+  for( i=0; i < numseqs; i++ ) {
+    if (nodes[i] == NULL) continue;
+    row = rows->entries[i];
+
+    /* entries never come back to life, so step over the dead ones at the front */
+    while (rows->start[i] < rows->length[i] && 
+	   (nodes[row[rows->start[i]].j] == NULL || 
+	    rows->created[row[rows->start[i]].j] > rows->created[i])) 
+      rows->start[i]++;
+
+    live = dead = 0;
+    for( k=rows->start[i]; k < rows->length[i]; k++ ) {
+      j = row[k].j;
+      if (nodes[j] == NULL || rows->created[j] > rows->created[i]) {
+	dead++;
+	continue;
+      }
+      live++;
+
+      bound = row[k].d - (r[i] + rmax);
+      if (found ? bound > best : bound >= FLT_MAX) 
+	break;
+
+      dist = row[k].d - (r[i] + r[j]);
+      hi = i > j ? i : j;
+      lo = i > j ? j : i;
+      if (found ? 
+	  (dist < best || (dist == best && (hi < besthi || (hi == besthi && lo < bestlo)))) :
+	  dist < best) {
+	found = 1;
+	best = dist;
+	besthi = hi;
+	bestlo = lo;
+      }
+    }
+
+    if (dead > NJ_ROW_COMPACTION_RATIO * live + MIN_PRUNED_NJ_SIZE) {
+      for( k=rows->start[i], live=0; k < rows->length[i]; k++ ) {
+	j = row[k].j;
+	if (nodes[j] != NULL && rows->created[j] <= rows->created[i]) 
+	  row[live++] = row[k];
+      }
+      rows->start[i] = 0;
+      rows->length[i] = live;
+    }
+  }
+
+  if (found) {
+    *mini = besthi;
+    *minj = bestlo;
+  }
+}
+
+
+
+
+/**********************************************************************
+ FUNCTION: build_neighbour_joining_tree
+ DESCRIPTION: 
+   Does the work for neighbour_joining_buildtree and
+   exhaustive_neighbour_joining_buildtree
  ARGS: 
     A ClusterGroup pointer (cluster.h)
     Boolean, for whether to calc information needed for later bootstrapping
+    Boolean, for whether the pair to join may be found with the sorted
+      rows rather than the exhaustive scan
  RETURNS:
     A Tree (trees.h)
- NOTES: The function allocates all the memory necessary for the tree.
-   The caller should call free_tree (tree.h) to free this memory when
-   the tree is no longer needed
  **********************************************************************/
-struct Tree *neighbour_joining_buildtree( struct ClusterGroup *group,
-					  unsigned int bootstrap) { 
+static struct Tree *build_neighbour_joining_tree( struct ClusterGroup *group,
+						  unsigned int bootstrap,
+						  unsigned int use_pruning ) { 
   unsigned int numseqs, i, j;       /*** The current pair of nodes   ***/
   unsigned int k, m, nodecount;     /*** loop counters               ***/
   unsigned int row, column;         /*** matrix indices              ***/
@@ -206,6 +440,7 @@ struct Tree *neighbour_joining_buildtree( struct ClusterGroup *group,
   double fnumseqs;                  /*** divisor for sums            ***/
   double dmj, dmi, ri, minsofar, dist, dij, dist_i, dist_j, dist_k;
   Distance *r;                        /*** stores the r values         ***/
+  struct NJRows *rows = NULL;       /*** sorted rows, when pruning   ***/
 
 
   /* METHOD ***********************************
@@ -233,6 +468,11 @@ struct Tree *neighbour_joining_buildtree( struct ClusterGroup *group,
      I have also used a modified version of Bill Bruno's idea to attempt
      to eliminate negative branch lengths in generated trees.
 
+     For larger trees, the pair to join is found with sorted rows and
+     an upper bound (see select_pair_NJRows) instead of scanning every
+     pair; it is always the pair the scan would find, so the tree is
+     the same.
+
   ********************************************/
 
 
@@ -264,6 +504,10 @@ struct Tree *neighbour_joining_buildtree( struct ClusterGroup *group,
       }
       r[i] = ri / (fnumseqs - 2.0);
     }
+
+    if (use_pruning && numseqs >= MIN_PRUNED_NJ_SIZE) {
+      rows = new_NJRows( mat, nodes, numseqs );
+    }
     
     
     /******* main loop ************************/
@@ -272,20 +516,25 @@ struct Tree *neighbour_joining_buildtree( struct ClusterGroup *group,
 
       /* do the intialisation necessary for each iteration here */
 
-      minsofar = FLT_MAX;  /* from float.h */
+      if (rows != NULL) {
+	select_pair_NJRows( rows, nodes, r, numseqs, &mini, &minj );
+      }
+      else {
+	minsofar = FLT_MAX;  /* from float.h */
 
-      /******* for each pair of matrix entries *********************/
+	/******* for each pair of matrix entries *********************/
 
-      for( i=0; i < numseqs; i++ ) {
-	if (nodes[i] == NULL) continue;
-	for( j=0; j < i; j++ ) {
-	  if (nodes[j] == NULL) continue;
+	for( i=0; i < numseqs; i++ ) {
+	  if (nodes[i] == NULL) continue;
+	  for( j=0; j < i; j++ ) {
+	    if (nodes[j] == NULL) continue;
 	  
-	  dist = mat->data[i][j] - (r[i] + r[j]);
-	  if (dist < minsofar) {
-	    minsofar = dist;
-	    mini = i;
-	    minj = j;
+	    dist = mat->data[i][j] - (r[i] + r[j]);
+	    if (dist < minsofar) {
+	      minsofar = dist;
+	      mini = i;
+	      minj = j;
+	    }
 	  }
 	}
       }
@@ -386,6 +635,10 @@ struct Tree *neighbour_joining_buildtree( struct ClusterGroup *group,
       
       fnumseqs -= 1.0;
       r[mini] /= fnumseqs - 2.0;
+
+      if (rows != NULL) {
+	joined_row_NJRows( rows, mat, nodes, numseqs, mini, nodecount + 1 );
+      }
       
     }
     /******* end of main loop ******************/
@@ -483,6 +736,9 @@ struct Tree *neighbour_joining_buildtree( struct ClusterGroup *group,
 
 
     r = free_util( r );
+    if (rows != NULL) {
+      rows = free_NJRows( rows, numseqs );
+    }
   }
   else {
     /* deal with the trivial case of less than three leaves */
@@ -511,6 +767,47 @@ struct Tree *neighbour_joining_buildtree( struct ClusterGroup *group,
 
 
 
+/**********************************************************************
+ FUNCTION: neighbour_joining_buildtree
+ DESCRIPTION: 
+   Returns a phylogenetic tree of the sequences in the 
+   given alignment, using Saitou and Nei's neighbour-joining 
+   algorithm
+ ARGS: 
+    A ClusterGroup pointer (cluster.h)
+    Boolean, for whether to calc information needed for later bootstrapping
+ RETURNS:
+    A Tree (trees.h)
+ NOTES: The function allocates all the memory necessary for the tree.
+   The caller should call free_tree (tree.h) to free this memory when
+   the tree is no longer needed
+ **********************************************************************/
+struct Tree *neighbour_joining_buildtree( struct ClusterGroup *group,
+					  unsigned int bootstrap) { 
+  return build_neighbour_joining_tree( group, bootstrap, 1 );
+}
+
+
+
+/**********************************************************************
+ FUNCTION: exhaustive_neighbour_joining_buildtree
+ DESCRIPTION: 
+   As neighbour_joining_buildtree, but scans every pair of nodes in
+   every iteration
+ ARGS: 
+    As neighbour_joining_buildtree
+ RETURNS:
+    A Tree (trees.h)
+ NOTES: The original O(n^3) implementation, kept as a reference for
+   testing and benchmarking neighbour_joining_buildtree
+ **********************************************************************/
+struct Tree *exhaustive_neighbour_joining_buildtree( struct ClusterGroup *group,
+						     unsigned int bootstrap) { 
+  return build_neighbour_joining_tree( group, bootstrap, 0 );
+}
+
+
+
 /**********************************************************************
  FUNCTION: UPGMA_buildtree
  DESCRIPTION: 
@@ -7,6 +7,12 @@
 
 #include "distancemat.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 
 /*********************** static variables *****************************/
 
@@ -45,49 +51,178 @@ static int dayhoff_pams[]={
 
 
 
+#define SCALAR_COLUMN_COUNTING 0
+#define VECTOR_COLUMN_COUNTING 1
+
+/* Counts in a float are exact up to 2^24; past that the vectorised
+   integer counts would no longer match the original float sums */
+#define MAX_VECTOR_COUNTED_LENGTH (1U << 24)
+
+#if defined(__AVX2__)
+#define COLUMN_BLOCK_WIDTH 32
+#else
+#define COLUMN_BLOCK_WIDTH 16
+#endif
+
+/* The byte counters in the vector loops wrap after 255 increments */
+#define MAX_BLOCKS_PER_FLUSH 255
+
+
 /*********************************************************************
- FUNCTION: calc_DistanceMatrix
+ FUNCTION: encode_columns_DistanceMatrix
  DESCRIPTION: 
-   Produces a distance matrix from the given multiple alignment
- RETURNS: struct DistanceMatrix
+   Copies the columns of the alignment, in the order given by the
+   column list, into one row of bytes per sequence. Gap characters 
+   become 0 and rows are padded with 0 to a multiple of the block width.
+ RETURNS: unsigned char * (numseqs rows of padded_length bytes), or
+   NULL if a sequence contains a NUL, which could not be told apart
+   from a gap
  ARGS: 
-   A DistanceMatrix to fill in
    A multiple alignment
-   A boolean indicating whether or not random columns should be used
-     for purposes of bootstrapping
-   A boolean indicating whether the Kimura distance adjustment is to 
-       be used or not.
+   The column list
+   The padded row length
  NOTES: 
-   0. the given DistanceMatrix and Alignment should be of the same order
+ *********************************************************************/
 
-   1. The matrix produced is in bottom-left triangular format; don't you
-   go trying to access that top-right section (I'm warning you...)
+static unsigned char *encode_columns_DistanceMatrix( struct Alignment *aln,
+						     unsigned int *columnlist,
+						     unsigned int padded_length ) {
+  unsigned int i, k;
+  unsigned char *rows, *row;
+  char c;
+
+  rows = (unsigned char *) calloc_util( (size_t) aln->numseqs * padded_length + 1, 
+					 sizeof(unsigned char) );
+  for( i=0; i < aln->numseqs; i++ ) {
+    row = rows + (size_t) i * padded_length;
+    for( k=0; k < aln->length; k++ ) {
+      c = aln->seqs[i]->seq[columnlist[k]];
+      if (c == '\0') {
+	free_util( rows );
+	return NULL;
+      }
+      if (c == '.' || c == '-' || c == ' ')
+	row[k] = 0;
+      else
+	row[k] = (unsigned char) c;
+    }
+  }
 
-   2. At the moment, the function calculates distance based on sequence
-   identity, using Kimura's function if that option is raised.
+  return rows;
+}
 
-   3. If use_rand_cols is true, then the matrix is constructed using
-   random sampling  of columns, for the purposes of bootstrapping. At 
-   the moment, the native function 'rand' is used to do this, suitable 
-   seeded by time (by the caller). This may prove unsatisfactory...
 
-   4. Where no information is available to determine the distance 
-   between two sequences, a value of twice the maximum observed 
-   distance is assigned (inspiration from ISMB99 poster by Huson,
-   Smith and Warnow).
+/*********************************************************************
+ FUNCTION: count_encoded_columns
+ DESCRIPTION: 
+   Counts the columns at which neither of the two encoded rows has a
+   gap, and how many of those have different characters
+ RETURNS:
+ ARGS: 
+   Two encoded rows (see encode_columns_DistanceMatrix)
+   The padded row length
+   Locations for the valid and mismatch counts
+ NOTES: 
+ *********************************************************************/
+
+static void count_encoded_columns( const unsigned char *a,
+				   const unsigned char *b,
+				   unsigned int padded_length,
+				   unsigned int *valid,
+				   unsigned int *mismatch ) {
+#if defined(__AVX2__)
+  unsigned long long valid_lanes[4], mismatch_lanes[4];
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i one = _mm256_set1_epi8(1);
+  __m256i valid_sum = zero, mismatch_sum = zero;
+  __m256i valid_acc, mismatch_acc, x, y, gap, differ;
+  unsigned int k = 0, flush_at;
+
+  while (k < padded_length) {
+    flush_at = padded_length - k > MAX_BLOCKS_PER_FLUSH * COLUMN_BLOCK_WIDTH ? 
+      k + MAX_BLOCKS_PER_FLUSH * COLUMN_BLOCK_WIDTH : padded_length;
+    valid_acc = mismatch_acc = zero;
+    for( ; k < flush_at; k += COLUMN_BLOCK_WIDTH ) {
+      x = _mm256_loadu_si256( (const __m256i *) (a + k) );
+      y = _mm256_loadu_si256( (const __m256i *) (b + k) );
+      gap = _mm256_or_si256( _mm256_cmpeq_epi8( x, zero ), _mm256_cmpeq_epi8( y, zero ) );
+      differ = _mm256_andnot_si256( _mm256_or_si256( gap, _mm256_cmpeq_epi8( x, y ) ), one );
+      valid_acc = _mm256_add_epi8( valid_acc, _mm256_andnot_si256( gap, one ) );
+      mismatch_acc = _mm256_add_epi8( mismatch_acc, differ );
+    }
+    valid_sum = _mm256_add_epi64( valid_sum, _mm256_sad_epu8( valid_acc, zero ) );
+    mismatch_sum = _mm256_add_epi64( mismatch_sum, _mm256_sad_epu8( mismatch_acc, zero ) );
+  }
+  _mm256_storeu_si256( (__m256i *) valid_lanes, valid_sum );
+  _mm256_storeu_si256( (__m256i *) mismatch_lanes, mismatch_sum );
+  *valid = (unsigned int) (valid_lanes[0] + valid_lanes[1] + valid_lanes[2] + valid_lanes[3]);
+  *mismatch = (unsigned int) (mismatch_lanes[0] + mismatch_lanes[1] + 
+			      mismatch_lanes[2] + mismatch_lanes[3]);
+#elif defined(__SSE2__)
+  unsigned long long valid_lanes[2], mismatch_lanes[2];
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi8(1);
+  __m128i valid_sum = zero, mismatch_sum = zero;
+  __m128i valid_acc, mismatch_acc, x, y, gap, differ;
+  unsigned int k = 0, flush_at;
+
+  while (k < padded_length) {
+    flush_at = padded_length - k > MAX_BLOCKS_PER_FLUSH * COLUMN_BLOCK_WIDTH ? 
+      k + MAX_BLOCKS_PER_FLUSH * COLUMN_BLOCK_WIDTH : padded_length;
+    valid_acc = mismatch_acc = zero;
+    for( ; k < flush_at; k += COLUMN_BLOCK_WIDTH ) {
+      x = _mm_loadu_si128( (const __m128i *) (a + k) );
+      y = _mm_loadu_si128( (const __m128i *) (b + k) );
+      gap = _mm_or_si128( _mm_cmpeq_epi8( x, zero ), _mm_cmpeq_epi8( y, zero ) );
+      differ = _mm_andnot_si128( _mm_or_si128( gap, _mm_cmpeq_epi8( x, y ) ), one );
+      valid_acc = _mm_add_epi8( valid_acc, _mm_andnot_si128( gap, one ) );
+      mismatch_acc = _mm_add_epi8( mismatch_acc, differ );
+    }
+    valid_sum = _mm_add_epi64( valid_sum, _mm_sad_epu8( valid_acc, zero ) );
+    mismatch_sum = _mm_add_epi64( mismatch_sum, _mm_sad_epu8( mismatch_acc, zero ) );
+  }
+  _mm_storeu_si128( (__m128i *) valid_lanes, valid_sum );
+  _mm_storeu_si128( (__m128i *) mismatch_lanes, mismatch_sum );
+  *valid = (unsigned int) (valid_lanes[0] + valid_lanes[1]);
+  *mismatch = (unsigned int) (mismatch_lanes[0] + mismatch_lanes[1]);
+#else
+  /* Portable version; branch free so the compiler can vectorise it */
+  unsigned int k, both, valid_count = 0, mismatch_count = 0;
+
+  for( k=0; k < padded_length; k++ ) {
+    both = (a[k] != 0) & (b[k] != 0);
+    valid_count += both;
+    mismatch_count += both & (a[k] != b[k]);
+  }
+  *valid = valid_count;
+  *mismatch = mismatch_count;
+#endif
+}
 
+
+/*********************************************************************
+ FUNCTION: fill_DistanceMatrix
+ DESCRIPTION: 
+   Does the work for calc_DistanceMatrix and calc_scalar_DistanceMatrix
+ RETURNS:
+ ARGS: 
+   As calc_DistanceMatrix, plus the way to count columns
+ NOTES: 
  *********************************************************************/
 
-void calc_DistanceMatrix( struct DistanceMatrix *mat,
-			  struct Alignment *aln,
-			  unsigned int use_rand_cols,
-			  unsigned int use_kimura ) {
+static void fill_DistanceMatrix( struct DistanceMatrix *mat,
+				 struct Alignment *aln,
+				 unsigned int use_rand_cols,
+				 unsigned int use_kimura,
+				 unsigned int counting ) {
 
   /* this function will take alignment and return a distance matrix */
   /* This gives a clear separation between tree making and distances */
 
   unsigned int i, j, k, table_index, num_undefined_distances, mem_increment;
+  unsigned int padded_length, valid, mismatch;
   unsigned int *columnlist;
+  unsigned char *encoded;
   Distance residuecount, distance, max_observed_distance;
   Distance **undefined_distances;
 
@@ -102,6 +237,13 @@ void calc_DistanceMatrix( struct DistanceMatrix *mat,
     }
   }
 
+  encoded = NULL;
+  padded_length = 0;
+  if (counting == VECTOR_COLUMN_COUNTING && aln->length <= MAX_VECTOR_COUNTED_LENGTH) {
+    padded_length = (aln->length + COLUMN_BLOCK_WIDTH - 1) / COLUMN_BLOCK_WIDTH * COLUMN_BLOCK_WIDTH;
+    encoded = encode_columns_DistanceMatrix( aln, columnlist, padded_length );
+  }
+
   max_observed_distance = 0.0;
   mem_increment = 10;
   undefined_distances = NULL;
@@ -113,19 +255,29 @@ void calc_DistanceMatrix( struct DistanceMatrix *mat,
       residuecount = distance = 0.0;
       mat->data[i][j] = 0.0;
 
-      for( k=0; k < aln->length; k++) {
-	if ( aln->seqs[i]->seq[columnlist[k]] == '.' || 
-	     aln->seqs[j]->seq[columnlist[k]] == '.' ||
-	     aln->seqs[i]->seq[columnlist[k]] == '-' || 
-	     aln->seqs[j]->seq[columnlist[k]] == '-' ||
-	     aln->seqs[i]->seq[columnlist[k]] == ' ' ||
-	     aln->seqs[j]->seq[columnlist[k]] == ' ')
-	  continue;
-
-	/* neither character is a gap, so proceed */
-	residuecount += 1.0;
-	if ( aln->seqs[i]->seq[columnlist[k]] != aln->seqs[j]->seq[columnlist[k]]) 
-	  distance += 1.0;
+      if (encoded != NULL) {
+	count_encoded_columns( encoded + (size_t) i * padded_length,
+			       encoded + (size_t) j * padded_length,
+			       padded_length, &valid, &mismatch );
+	/* exact, as the counts are at most 2^24 */
+	residuecount = (Distance) valid;
+	distance = (Distance) mismatch;
+      }
+      else {
+	for( k=0; k < aln->length; k++) {
+	  if ( aln->seqs[i]->seq[columnlist[k]] == '.' || 
+	       aln->seqs[j]->seq[columnlist[k]] == '.' ||
+	       aln->seqs[i]->seq[columnlist[k]] == '-' || 
+	       aln->seqs[j]->seq[columnlist[k]] == '-' ||
+	       aln->seqs[i]->seq[columnlist[k]] == ' ' ||
+	       aln->seqs[j]->seq[columnlist[k]] == ' ')
+	    continue;
+
+	  /* neither character is a gap, so proceed */
+	  residuecount += 1.0;
+	  if ( aln->seqs[i]->seq[columnlist[k]] != aln->seqs[j]->seq[columnlist[k]]) 
+	    distance += 1.0;
+	}
       }
 
       /* if residue count was zero here, there must have been a gap in every position;
@@ -187,6 +339,9 @@ void calc_DistanceMatrix( struct DistanceMatrix *mat,
   }
 
   columnlist = free_util( columnlist );
+  if (encoded != NULL) {
+    encoded = free_util( encoded );
+  }
   if (undefined_distances != NULL) {
     undefined_distances = free_util( undefined_distances );
   }
@@ -194,6 +349,76 @@ void calc_DistanceMatrix( struct DistanceMatrix *mat,
 
 
 
+/*********************************************************************
+ FUNCTION: calc_DistanceMatrix
+ DESCRIPTION: 
+   Produces a distance matrix from the given multiple alignment
+ RETURNS: struct DistanceMatrix
+ ARGS: 
+   A DistanceMatrix to fill in
+   A multiple alignment
+   A boolean indicating whether or not random columns should be used
+     for purposes of bootstrapping
+   A boolean indicating whether the Kimura distance adjustment is to 
+       be used or not.
+ NOTES: 
+   0. the given DistanceMatrix and Alignment should be of the same order
+
+   1. The matrix produced is in bottom-left triangular format; don't you
+   go trying to access that top-right section (I'm warning you...)
+
+   2. At the moment, the function calculates distance based on sequence
+   identity, using Kimura's function if that option is raised.
+
+   3. If use_rand_cols is true, then the matrix is constructed using
+   random sampling  of columns, for the purposes of bootstrapping. At 
+   the moment, the native function 'rand' is used to do this, suitable 
+   seeded by time (by the caller). This may prove unsatisfactory...
+
+   4. Where no information is available to determine the distance 
+   between two sequences, a value of twice the maximum observed 
+   distance is assigned (inspiration from ISMB99 poster by Huson,
+   Smith and Warnow).
+
+   5. The alignment columns are encoded once, gaps as zero, and the
+   valid and mismatching columns of each pair are counted in bulk
+   (with SSE2/AVX2 where the compiler allows it). The result is
+   bit-identical to calc_scalar_DistanceMatrix, which is kept as a
+   reference implementation.
+
+ *********************************************************************/
+
+void calc_DistanceMatrix( struct DistanceMatrix *mat,
+			  struct Alignment *aln,
+			  unsigned int use_rand_cols,
+			  unsigned int use_kimura ) {
+  fill_DistanceMatrix( mat, aln, use_rand_cols, use_kimura, VECTOR_COLUMN_COUNTING );
+}
+
+
+
+/*********************************************************************
+ FUNCTION: calc_scalar_DistanceMatrix
+ DESCRIPTION: 
+   As calc_DistanceMatrix, but compares the sequences one character at
+   a time
+ RETURNS: 
+ ARGS: 
+   As calc_DistanceMatrix
+ NOTES: 
+   This is the original implementation, kept to check and benchmark
+   calc_DistanceMatrix against
+ *********************************************************************/
+
+void calc_scalar_DistanceMatrix( struct DistanceMatrix *mat,
+				 struct Alignment *aln,
+				 unsigned int use_rand_cols,
+				 unsigned int use_kimura ) {
+  fill_DistanceMatrix( mat, aln, use_rand_cols, use_kimura, SCALAR_COLUMN_COUNTING );
+}
+
+
+
 /*********************************************************************
  FUNCTION: clone_DistanceMatrix
  DESCRIPTION: 
@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+/*
+ * Benchmarks the treelib routines used for building trees against their
+ * reference implementations on random alignments, checking that they
+ * give bit-identical results.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "treelib.h"
+
+static double getTime(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1.0e9;
+}
+
+/*
+ * Makes a random alignment of DNA with the given proportion of gap
+ * characters. Each sequence is a mutated copy of a random earlier one,
+ * so the distances have a tree-like structure.
+ */
+static struct Alignment *makeRandomAlignment(unsigned int numSeqs, unsigned int length, double gapProportion) {
+    static const char bases[] = "ACGT";
+    static const char gaps[] = "-. ";
+    struct Alignment *aln = malloc_util(sizeof(struct Alignment));
+    aln->numseqs = numSeqs;
+    aln->length = length;
+    aln->seqs = malloc_util(numSeqs * sizeof(struct Sequence *));
+    // The ungapped sequences, from which the descendants are copied.
+    char **ungapped = malloc_util(numSeqs * sizeof(char *));
+    for (unsigned int i = 0; i < numSeqs; i++) {
+        ungapped[i] = malloc_util(length + 1);
+        char *parent = i > 0 ? ungapped[rand() % i] : NULL;
+        double mutationRate = 0.1 * rand() / RAND_MAX;
+        for (unsigned int k = 0; k < length; k++) {
+            if (parent == NULL || (double) rand() / RAND_MAX < mutationRate) {
+                ungapped[i][k] = bases[rand() % 4];
+            } else {
+                ungapped[i][k] = parent[k];
+            }
+        }
+        ungapped[i][length] = '\0';
+
+        struct Sequence *seq = empty_Sequence();
+        seq->length = length;
+        seq->name = malloc_util(MAX_NAME_LENGTH);
+        snprintf(seq->name, MAX_NAME_LENGTH, "seq%u", i);
+        seq->seq = malloc_util(length + 1);
+        for (unsigned int k = 0; k <= length; k++) {
+            seq->seq[k] = k < length && (double) rand() / RAND_MAX < gapProportion ? gaps[rand() % 3] : ungapped[i][k];
+        }
+        aln->seqs[i] = seq;
+    }
+    for (unsigned int i = 0; i < numSeqs; i++) {
+        free_util(ungapped[i]);
+    }
+    free_util(ungapped);
+    return aln;
+}
+
+static int distanceMatricesIdentical(struct DistanceMatrix *mat1, struct DistanceMatrix *mat2) {
+    for (int i = 0; i < mat1->size; i++) {
+        if (memcmp(mat1->data[i], mat2->data[i], (i + 1) * sizeof(Distance)) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Times calc_DistanceMatrix against calc_scalar_DistanceMatrix. Returns
+ * non-zero if they disagree.
+ */
+static int benchmarkDistanceMatrix(struct Alignment *aln, unsigned int repeats,
+                                   unsigned int useBootstrap, unsigned int useKimura, unsigned int seed) {
+    double scalarTime = 0.0, vectorTime = 0.0;
+    int identical = 1;
+    for (unsigned int r = 0; r < repeats; r++) {
+        struct DistanceMatrix *scalarMat = empty_DistanceMatrix(aln->numseqs);
+        struct DistanceMatrix *vectorMat = empty_DistanceMatrix(aln->numseqs);
+
+        // Reseed so both see the same bootstrap columns.
+        srand(seed + r);
+        double startTime = getTime();
+        calc_scalar_DistanceMatrix(scalarMat, aln, useBootstrap, useKimura);
+        scalarTime += getTime() - startTime;
+
+        srand(seed + r);
+        startTime = getTime();
+        calc_DistanceMatrix(vectorMat, aln, useBootstrap, useKimura);
+        vectorTime += getTime() - startTime;
+
+        identical = identical && distanceMatricesIdentical(scalarMat, vectorMat);
+        free_DistanceMatrix(scalarMat);
+        free_DistanceMatrix(vectorMat);
+    }
+    fprintf(stdout, "calc_DistanceMatrix: %u sequences x %u columns, bootstrap %u, kimura %u: "
+            "scalar %lf s, vectorised %lf s, speedup %.2lfx, results %s\n",
+            aln->numseqs, aln->length, useBootstrap, useKimura,
+            scalarTime / repeats, vectorTime / repeats,
+            vectorTime > 0.0 ? scalarTime / vectorTime : 0.0,
+            identical ? "identical" : "DIFFERENT");
+    return !identical;
+}
+
+static int tnodesIdentical(struct Tnode *node1, struct Tnode *node2) {
+    if (node1 == NULL || node2 == NULL) {
+        return node1 == node2;
+    }
+    return node1->nodenumber == node2->nodenumber
+            && memcmp(&node1->distance, &node2->distance, sizeof(double)) == 0
+            && tnodesIdentical(node1->left, node2->left) && tnodesIdentical(node1->right, node2->right);
+}
+
+static int treesIdentical(struct Tree *tree1, struct Tree *tree2) {
+    return tree1->numnodes == tree2->numnodes && tnodesIdentical(tree1->child[0], tree2->child[0])
+            && tnodesIdentical(tree1->child[1], tree2->child[1]) && tnodesIdentical(tree1->child[2], tree2->child[2]);
+}
+
+/*
+ * Fills the matrix with uniform random distances, rounded to a few
+ * values so that the ties between pairs get exercised.
+ */
+static void fillRandomDistanceMatrix(struct DistanceMatrix *mat, unsigned int numValues) {
+    for (int i = 0; i < mat->size; i++) {
+        mat->data[i][i] = 0.0;
+        for (int j = 0; j < i; j++) {
+            mat->data[i][j] = (Distance) (1 + rand() % numValues) / numValues;
+        }
+    }
+}
+
+/*
+ * Times neighbour_joining_buildtree against
+ * exhaustive_neighbour_joining_buildtree on the given matrix (which
+ * both modify, so each gets a copy). Returns non-zero if the trees differ.
+ */
+static int benchmarkNeighbourJoining(struct ClusterGroup *group, struct DistanceMatrix *mat,
+                                     unsigned int repeats, const char *description) {
+    double exhaustiveTime = 0.0, prunedTime = 0.0;
+    int identical = 1;
+    for (unsigned int r = 0; r < repeats; r++) {
+        group->matrix = clone_DistanceMatrix(mat);
+        double startTime = getTime();
+        struct Tree *exhaustiveTree = exhaustive_neighbour_joining_buildtree(group, 0);
+        exhaustiveTime += getTime() - startTime;
+        group->matrix = free_DistanceMatrix(group->matrix);
+
+        group->matrix = clone_DistanceMatrix(mat);
+        startTime = getTime();
+        struct Tree *prunedTree = neighbour_joining_buildtree(group, 0);
+        prunedTime += getTime() - startTime;
+        group->matrix = free_DistanceMatrix(group->matrix);
+
+        identical = identical && treesIdentical(exhaustiveTree, prunedTree);
+        free_Tree(exhaustiveTree);
+        free_Tree(prunedTree);
+    }
+    fprintf(stdout, "neighbour_joining_buildtree: %u leaves, %s: "
+            "exhaustive %lf s, pruned %lf s, speedup %.2lfx, trees %s\n",
+            group->numclusters, description, exhaustiveTime / repeats, prunedTime / repeats,
+            prunedTime > 0.0 ? exhaustiveTime / prunedTime : 0.0,
+            identical ? "identical" : "DIFFERENT");
+    return !identical;
+}
+
+static void usage(void) {
+    fprintf(stderr, "treelibBenchmark [options]\n");
+    fprintf(stderr, "-a --sequences : Number of sequences in each random alignment (default 200)\n");
+    fprintf(stderr, "-b --length : Number of columns in each random alignment (default 5000)\n");
+    fprintf(stderr, "-c --gapProportion : Proportion of gap characters (default 0.1)\n");
+    fprintf(stderr, "-d --repeats : Number of times to repeat each benchmark (default 3)\n");
+    fprintf(stderr, "-e --seed : Random seed (default 1)\n");
+    fprintf(stderr, "-f --njLeaves : Number of leaves in the neighbour-joining benchmarks (default 1000)\n");
+    fprintf(stderr, "-h --help : Print this help screen\n");
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int numSeqs = 200;
+    unsigned int length = 5000;
+    double gapProportion = 0.1;
+    unsigned int repeats = 3;
+    unsigned int seed = 1;
+    unsigned int njLeaves = 1000;
+
+    while (1) {
+        static struct option long_options[] = { { "sequences", required_argument, 0, 'a' },
+                { "length", required_argument, 0, 'b' }, { "gapProportion", required_argument, 0, 'c' },
+                { "repeats", required_argument, 0, 'd' }, { "seed", required_argument, 0, 'e' },
+                { "njLeaves", required_argument, 0, 'f' },                { "help", no_argument, 0, 'h' }, { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+        int key = getopt_long(argc, argv, "a:b:c:d:e:f:h", long_options, &option_index);
+        if (key == -1) {
+            break;
+        }
+        switch (key) {
+            case 'a':
+                numSeqs = atoi(optarg);
+                break;
+            case 'b':
+                length = atoi(optarg);
+                break;
+            case 'c':
+                gapProportion = atof(optarg);
+                break;
+            case 'd':
+                repeats = atoi(optarg);
+                break;
+            case 'e':
+                seed = atoi(optarg);
+                break;
+            case 'f':
+                njLeaves = atoi(optarg);
+                break;
+            case 'h':
+                usage();
+                return 0;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    if (repeats < 1) {
+        repeats = 1;
+    }
+
+    srand(seed);
+    struct Alignment *aln = makeRandomAlignment(numSeqs, length, gapProportion);
+    int failed = 0;
+    for (unsigned int useBootstrap = 0; useBootstrap <= 1; useBootstrap++) {
+        for (unsigned int useKimura = 0; useKimura <= 1; useKimura++) {
+            failed |= benchmarkDistanceMatrix(aln, repeats, useBootstrap, useKimura, seed);
+        }
+    }
+    free_Alignment(aln);
+
+    // Neighbour joining on distances from a random alignment, as in
+    // msa2tree, and on random distances with many ties.
+    aln = makeRandomAlignment(njLeaves, 200, gapProportion);
+    struct ClusterGroup *group = alignment_to_ClusterGroup(aln, 0);
+    struct DistanceMatrix *mat = empty_DistanceMatrix(njLeaves);
+    calc_DistanceMatrix(mat, aln, 0, 1);
+    failed |= benchmarkNeighbourJoining(group, mat, repeats, "alignment distances");
+    fillRandomDistanceMatrix(mat, 50);
+    failed |= benchmarkNeighbourJoining(group, mat, repeats, "random distances");
+    mat = free_DistanceMatrix(mat);
+    group = free_ClusterGroup(group);
+    free_Alignment(aln);
+
+    return failed ? 1 : 0;
+}
@@ -24,6 +24,7 @@ void usage() {
     fprintf(stderr, "-c --secondaryDisk : The location of secondary disk\n");
     fprintf(stderr, "-g --referenceEventString : String identifying the reference event.\n");
     fprintf(stderr, "-j --bottomUpPhase : Do bottom up stage instead of top down.\n");
+    fprintf(stderr, "-k --reportColumnPatterns : Report the number of distinct column patterns of each block whose bases are called, and the compression ratio, to stderr.\n");
     fprintf(stderr, "-h --help : Print this help screen\n");
 }
 
@@ -40,6 +41,7 @@ int main(int argc, char *argv[]) {
     char * secondaryDatabaseString = NULL;
     char *referenceEventString = (char *) cactusMisc_getDefaultReferenceEventHeader();
     bool bottomUpPhase = 0;
+    bool reportColumnPatterns = 0;
 
     ///////////////////////////////////////////////////////////////////////////
     // (0) Parse the inputs handed by genomeCactus.py / setup stuff.
@@ -47,11 +49,11 @@ int main(int argc, char *argv[]) {
 
     while (1) {
         static struct option long_options[] = { { "logLevel", required_argument, 0, 'a' }, { "cactusDisk", required_argument, 0, 'b' }, { "secondaryDisk", required_argument, 0, 'd' }, { "referenceEventString", required_argument, 0, 'g' }, { "help", no_argument,
-                0, 'h' }, { "bottomUpPhase", no_argument, 0, 'j' }, { 0, 0, 0, 0 } };
+                0, 'h' }, { "bottomUpPhase", no_argument, 0, 'j' }, { "reportColumnPatterns", no_argument, 0, 'k' }, { 0, 0, 0, 0 } };
 
         int option_index = 0;
 
-        int key = getopt_long(argc, argv, "a:b:c:d:e:g:hi:j", long_options, &option_index);
+        int key = getopt_long(argc, argv, "a:b:c:d:e:g:hi:jk", long_options, &option_index);
 
         if (key == -1) {
             break;
@@ -76,6 +78,9 @@ int main(int argc, char *argv[]) {
             case 'j':
                 bottomUpPhase = 1;
                 break;
+            case 'k':
+                reportColumnPatterns = 1;
+                break;
             default:
                 usage();
                 return 1;
@@ -100,6 +105,9 @@ int main(int argc, char *argv[]) {
 
     st_logInfo("referenceEventString = %s\n", referenceEventString);
     st_logInfo("bottomUpPhase = %i\n", bottomUpPhase);
+    if (reportColumnPatterns) {
+        setColumnPatternReportFile(stderr);
+    }
 
     stKVDatabaseConf *kvDatabaseConf = stKVDatabaseConf_constructFromString(cactusDiskDatabaseString);
     CactusDisk *cactusDisk = cactusDisk_construct(kvDatabaseConf, false, true);
@@ -140,7 +148,10 @@ int main(int argc, char *argv[]) {
             assert(sequenceDatabase != NULL);
 
             cactusDisk_preCacheSegmentStrings(cactusDisk, flowers);
+            int64_t stringCacheMisses = cactusDisk_getStringCacheMissNumber(cactusDisk);
             bottomUp(flowers, sequenceDatabase, referenceEventName, !flower_hasParentGroup(flower), generateJukesCantorMatrix);
+            st_logInfo("Building the reference of flower %" PRIi64 " missed the string cache %" PRIi64 " times\n",
+                    flower_getName(flower), cactusDisk_getStringCacheMissNumber(cactusDisk) - stringCacheMisses);
 
             // Unload the nested flowers to save memory. They haven't
             // been changed, so we don't write them to the cactus
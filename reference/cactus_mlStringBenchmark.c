@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+/*
+ * Benchmarks getBlockBaseProbs, the one pass version of Felsenstein's algorithm used to call the
+ * bases of the reference, and getBlockBaseProbsByPattern, which computes each distinct column pattern
+ * once, against the recursive getBlockBaseProbsRecursively, on random blocks and trees, reporting the
+ * times, the compression ratio and the largest difference between the base probabilities.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "cactus.h"
+#include "sonLib.h"
+#include "blockMLString.h"
+
+static double getTime(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1.0e9;
+}
+
+/*
+ * Only the addresses of the events are used, as the keys of the strings of the leaves.
+ */
+static char *events;
+static int64_t eventNumber;
+
+static stTree *makeNode(double *branchLengths, int64_t branchLengthNumber) {
+    Event *event = (Event *) &events[eventNumber++];
+    return makePhylogeneticTreeNode(generateJukesCantorMatrix(branchLengths[st_randomInt(0, branchLengthNumber)]), event);
+}
+
+/*
+ * Makes a tree with the given number of leaves, either a caterpillar (each internal node having one
+ * leaf as a child), whose depth is the number of leaves, or a balanced binary tree.
+ */
+static stTree *makeTree(int64_t leafNumber, bool caterpillar, double *branchLengths, int64_t branchLengthNumber) {
+    stTree *tree = makeNode(branchLengths, branchLengthNumber);
+    if (leafNumber > 1) {
+        int64_t leftLeafNumber = caterpillar ? 1 : leafNumber / 2;
+        stTree_setParent(makeTree(leftLeafNumber, caterpillar, branchLengths, branchLengthNumber), tree);
+        stTree_setParent(makeTree(leafNumber - leftLeafNumber, caterpillar, branchLengths, branchLengthNumber), tree);
+    }
+    return tree;
+}
+
+/*
+ * Adds strings to the leaves which differ from the ancestral string at a proportion (mutationRate) of the
+ * positions, chosen at random.
+ */
+static void addLeafStrings(stTree *tree, stHash *eventsToStrings, int64_t stringsPerLeaf, char *ancestralString,
+        double mutationRate, int64_t blockLength) {
+    if (stTree_getChildNumber(tree) == 0) {
+        stList *strings = stList_construct3(0, free);
+        for (int64_t i = 0; i < stringsPerLeaf; i++) {
+            char *string = st_malloc(blockLength + 1);
+            for (int64_t j = 0; j < blockLength; j++) {
+                string[j] = st_random() < mutationRate ? "ACGTNacgt"[st_randomInt(0, 9)] : ancestralString[j];
+            }
+            string[blockLength] = '\0';
+            stList_append(strings, string);
+        }
+        stHash_insert(eventsToStrings, getEvent(tree), strings);
+    }
+    for (int64_t i = 0; i < stTree_getChildNumber(tree); i++) {
+        addLeafStrings(stTree_getChild(tree, i), eventsToStrings, stringsPerLeaf, ancestralString, mutationRate, blockLength);
+    }
+}
+
+void usage() {
+    fprintf(stderr, "cactus_mlStringBenchmark, version 0.1\n");
+    fprintf(stderr, "-a --logLevel : Set the log level\n");
+    fprintf(stderr, "-n --leafNumber : The number of leaves of the tree. Default=100\n");
+    fprintf(stderr, "-t --balanced : Make a balanced binary tree, rather than a caterpillar (whose depth is the number of leaves)\n");
+    fprintf(stderr, "-l --blockLength : The length of the blocks. Default=1000\n");
+    fprintf(stderr, "-s --stringsPerLeaf : The number of strings of each leaf. Default=1\n");
+    fprintf(stderr, "-b --branchLengths : The number of distinct branch lengths. Default=3\n");
+    fprintf(stderr, "-i --iterations : The number of blocks to compute the base probabilities of. Default=100\n");
+    fprintf(stderr, "-m --mutationRate : The proportion of the bases of each string which differ from those of a common ancestor. Default=1.0\n");
+    fprintf(stderr, "-h --help : Print this help screen\n");
+}
+
+int main(int argc, char *argv[]) {
+    char *logLevelString = NULL;
+    int64_t leafNumber = 100;
+    bool caterpillar = 1;
+    int64_t blockLength = 1000;
+    int64_t stringsPerLeaf = 1;
+    int64_t branchLengthNumber = 3;
+    int64_t iterations = 100;
+    double mutationRate = 1.0;
+    int64_t j;
+
+    while (1) {
+        static struct option long_options[] = { { "logLevel", required_argument, 0, 'a' }, { "leafNumber",
+                required_argument, 0, 'n' }, { "balanced", no_argument, 0, 't' }, { "blockLength", required_argument,
+                0, 'l' }, { "stringsPerLeaf", required_argument, 0, 's' }, { "branchLengths", required_argument, 0, 'b' }, {
+                "iterations", required_argument, 0, 'i' }, { "mutationRate", required_argument, 0, 'm' }, { "help", no_argument,
+                0, 'h' }, { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+        int key = getopt_long(argc, argv, "a:n:tl:s:b:i:m:h", long_options, &option_index);
+        if (key == -1) {
+            break;
+        }
+
+        switch (key) {
+        case 'a':
+            logLevelString = stString_copy(optarg);
+            break;
+        case 'n':
+            j = sscanf(optarg, "%" PRIi64, &leafNumber);
+            assert(j == 1);
+            break;
+        case 't':
+            caterpillar = 0;
+            break;
+        case 'l':
+            j = sscanf(optarg, "%" PRIi64, &blockLength);
+            assert(j == 1);
+            break;
+        case 's':
+            j = sscanf(optarg, "%" PRIi64, &stringsPerLeaf);
+            assert(j == 1);
+            break;
+        case 'b':
+            j = sscanf(optarg, "%" PRIi64, &branchLengthNumber);
+            assert(j == 1);
+            break;
+        case 'i':
+            j = sscanf(optarg, "%" PRIi64, &iterations);
+            assert(j == 1);
+            break;
+        case 'm':
+            j = sscanf(optarg, "%lf", &mutationRate);
+            assert(j == 1);
+            break;
+        case 'h':
+            usage();
+            return 0;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (leafNumber < 1 || blockLength < 1 || stringsPerLeaf < 0 || branchLengthNumber < 1 || iterations < 1) {
+        usage();
+        return 1;
+    }
+
+    st_setLogLevelFromString(logLevelString);
+
+    double *branchLengths = st_malloc(sizeof(double) * branchLengthNumber);
+    for (int64_t i = 0; i < branchLengthNumber; i++) {
+        branchLengths[i] = 0.01 + st_random() * 0.2;
+    }
+    events = st_malloc(2 * leafNumber);
+    eventNumber = 0;
+    stTree *tree = makeTree(leafNumber, caterpillar, branchLengths, branchLengthNumber);
+    stHash *eventsToStrings = stHash_construct2(NULL, (void (*)(void *)) stList_destruct);
+    char *ancestralString = st_malloc(blockLength + 1);
+    for (int64_t j = 0; j < blockLength; j++) {
+        ancestralString[j] = "ACGT"[st_randomInt(0, 4)];
+    }
+    addLeafStrings(tree, eventsToStrings, stringsPerLeaf, ancestralString, mutationRate, blockLength);
+
+    double recursiveTime = 0.0, onePassTime = 0.0, patternTime = 0.0, maxRelativeDifference = 0.0;
+    int64_t differences = 0, patternNumber = 0;
+    for (int64_t i = 0; i < iterations; i++) {
+        double startTime = getTime();
+        double *baseProbs = getBlockBaseProbsRecursively(tree, eventsToStrings, blockLength);
+        recursiveTime += getTime() - startTime;
+        startTime = getTime();
+        double *baseProbs2 = getBlockBaseProbs(tree, eventsToStrings, blockLength);
+        onePassTime += getTime() - startTime;
+        startTime = getTime();
+        double *baseProbs3 = getBlockBaseProbsByPattern(tree, eventsToStrings, blockLength, &patternNumber);
+        patternTime += getTime() - startTime;
+        for (int64_t k = 0; k < blockLength * 4; k++) {
+            double otherBaseProbs[2] = { baseProbs2[k], baseProbs3[k] };
+            for (int64_t l = 0; l < 2; l++) {
+                if (baseProbs[k] != otherBaseProbs[l]) {
+                    differences++;
+                    double relativeDifference = fabs(baseProbs[k] - otherBaseProbs[l]) / fmax(fabs(baseProbs[k]), DBL_MIN);
+                    maxRelativeDifference = relativeDifference > maxRelativeDifference ? relativeDifference : maxRelativeDifference;
+                }
+            }
+        }
+        free(baseProbs);
+        free(baseProbs2);
+        free(baseProbs3);
+    }
+    fprintf(stdout, "%s tree of %" PRIi64 " leaves, %" PRIi64 " strings per leaf with a mutation rate of %f, %" PRIi64
+            " distinct branch lengths, %" PRIi64 " blocks of length %" PRIi64 "\n", caterpillar ? "Caterpillar" : "Balanced",
+            leafNumber, stringsPerLeaf, mutationRate, branchLengthNumber, iterations, blockLength);
+    fprintf(stdout, "Recursive: %f seconds\n", recursiveTime);
+    fprintf(stdout, "One pass: %f seconds (%.2fx)\n", onePassTime, recursiveTime / onePassTime);
+    fprintf(stdout, "By pattern: %f seconds (%.2fx), %" PRIi64 " column patterns, a compression ratio of %f\n", patternTime,
+            recursiveTime / patternTime, patternNumber, ((double) blockLength) / patternNumber);
+    fprintf(stdout, "Base probabilities differing: %" PRIi64 ", max relative difference %g\n", differences,
+            maxRelativeDifference);
+
+    stHash_destruct(eventsToStrings);
+    cleanupPhylogeneticTree(tree);
+    free(events);
+    free(branchLengths);
+    free(ancestralString);
+    return differences > 0;
+}
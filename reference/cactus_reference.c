@@ -17,6 +17,7 @@
 #include "cactusReference.h"
 #include "stMatchingAlgorithms.h"
 #include "stReferenceProblem2.h"
+#include "stCafScheduler.h"
 
 void usage() {
     fprintf(stderr, "cactus_reference [flower names], version 0.1\n");
@@ -48,9 +49,23 @@ void usage() {
     fprintf(
     stderr, "-q --makeScaffolds : Scaffold across regions of adjacency uncertainty.\n");
 
+    fprintf(
+    stderr, "-t --threads : The number of threads to build the references of the nested flowers of a flower with. Default=1\n");
+
+    fprintf(
+    stderr, "-u --maxOptimisationTime : Stop updating the reference of a flower after this many seconds, logging its score trajectory.\n");
+
+    fprintf(
+    stderr, "-v --minRoundImprovement : Stop updating the reference of a flower once a round improves its score by less than this proportion of the max possible score, logging its score trajectory.\n");
+
     fprintf(stderr, "-h --help : Print this help screen\n");
 }
 
+static void finishNestedFlower(Flower *nestedFlower) {
+    cactusDisk_addUpdateRequest(flower_getCactusDisk(nestedFlower), nestedFlower);
+    flower_unload(nestedFlower);
+}
+
 int main(int argc, char *argv[]) {
     /*
      * Script for adding a reference genome to a flower.
@@ -75,6 +90,9 @@ int main(int argc, char *argv[]) {
     int64_t numberOfNsForScaffoldGap = 10;
     int64_t minNumberOfSequencesToSupportAdjacency = 1;
     bool makeScaffolds = 0;
+    int64_t threads = 1;
+    double maxOptimisationTime = -1.0;
+    double minRoundImprovement = -1.0;
 
     ///////////////////////////////////////////////////////////////////////////
     // (0) Parse the inputs handed by genomeCactus.py / setup stuff.
@@ -89,11 +107,12 @@ int main(int argc, char *argv[]) {
         required_argument, 0, 's' }, { "maxWalkForCalculatingZ", required_argument, 0, 'l' }, { "ignoreUnalignedGaps",
         no_argument, 0, 'm' }, { "wiggle", required_argument, 0, 'n' }, { "numberOfNs", required_argument, 0, 'o' }, {
                 "minNumberOfSequencesToSupportAdjacency", required_argument, 0, 'p' }, { "makeScaffolds", no_argument,
-                0, 'q' }, { "help", no_argument, 0, 'h' }, { 0, 0, 0, 0 } };
+                0, 'q' }, { "threads", required_argument, 0, 't' }, { "maxOptimisationTime",
+                required_argument, 0, 'u' }, { "minRoundImprovement", required_argument, 0, 'v' }, { "help", no_argument, 0, 'h' }, { 0, 0, 0, 0 } };
 
         int option_index = 0;
 
-        int key = getopt_long(argc, argv, "a:c:d:e:g:i:jk:hl:mn:o:p:qs:", long_options, &option_index);
+        int key = getopt_long(argc, argv, "a:c:d:e:g:i:jk:hl:mn:o:p:qs:t:u:v:", long_options, &option_index);
 
         if (key == -1) {
             break;
@@ -188,6 +207,30 @@ int main(int argc, char *argv[]) {
         case 'q':
             makeScaffolds = 1;
             break;
+        case 't':
+            j = sscanf(optarg, "%" PRIi64 "", &threads);
+            assert(j == 1);
+            if (threads < 1) {
+                stThrowNew(REFERENCE_BUILDING_EXCEPTION, "The number of threads is not valid (must be >= 1): %" PRIi64 "",
+                        threads);
+            }
+            break;
+        case 'u':
+            j = sscanf(optarg, "%lf", &maxOptimisationTime);
+            assert(j == 1);
+            if (maxOptimisationTime <= 0.0) {
+                stThrowNew(REFERENCE_BUILDING_EXCEPTION, "The maxOptimisationTime parameter is not valid (must be > 0): %f",
+                        maxOptimisationTime);
+            }
+            break;
+        case 'v':
+            j = sscanf(optarg, "%lf", &minRoundImprovement);
+            assert(j == 1);
+            if (minRoundImprovement <= 0.0) {
+                stThrowNew(REFERENCE_BUILDING_EXCEPTION, "The minRoundImprovement parameter is not valid (must be > 0): %f",
+                        minRoundImprovement);
+            }
+            break;
         default:
             usage();
             return 1;
@@ -211,6 +254,9 @@ int main(int argc, char *argv[]) {
     st_logInfo("Min number of sequences to required to support an adjacency is: %" PRIi64 "\n",
             minNumberOfSequencesToSupportAdjacency);
     st_logInfo("Make scaffolds is: %i\n", makeScaffolds);
+    st_logInfo("The number of threads is: %" PRIi64 "\n", threads);
+    st_logInfo("The max optimisation time is: %f\n", maxOptimisationTime);
+    st_logInfo("The min round improvement is: %f\n", minRoundImprovement);
 
     ///////////////////////////////////////////////////////////////////////////
     // (0) Check the inputs.
@@ -234,6 +280,15 @@ int main(int argc, char *argv[]) {
     useSimulatedAnnealing ? exponentiallyDecreasingTemperatureFn
     : constantTemperatureFn;
 
+    //The z-score tables depend only on theta, so are shared by all the flowers.
+    ReferenceZScoreTables *zScoreTables = referenceZScoreTables_construct(theta);
+
+    /*
+     * The nested flowers of a flower are independent once it has its reference, so with more than one
+     * thread their z-scores are calculated concurrently (see buildReferencesOfNestedFlowers).
+     */
+    stCaf_Scheduler *scheduler = threads > 1 ? referenceBuilder_constructScheduler(threads) : NULL;
+
     FlowerStream *flowerStream = flowerWriter_getFlowerStream(cactusDisk, stdin);
     Flower *flower;
     while ((flower = flowerStream_getNext(flowerStream)) != NULL) {
@@ -247,24 +302,16 @@ int main(int argc, char *argv[]) {
         stList_destruct(flowers);
 
         if (!flower_hasParentGroup(flower)) {
-            buildReferenceTopDown(flower, referenceEventString, permutations, matchingAlgorithm, temperatureFn, theta,
-                    phi, maxWalkForCalculatingZ, ignoreUnalignedGaps, wiggle, numberOfNsForScaffoldGap,
-                    minNumberOfSequencesToSupportAdjacency, makeScaffolds);
+            buildReferenceTopDown(flower, referenceEventString, permutations, matchingAlgorithm, temperatureFn,
+                    zScoreTables, phi, maxWalkForCalculatingZ, ignoreUnalignedGaps, wiggle, numberOfNsForScaffoldGap,
+                    minNumberOfSequencesToSupportAdjacency, makeScaffolds,
+                    maxOptimisationTime, minRoundImprovement);
             cactusDisk_addUpdateRequest(cactusDisk, flower);
         }
-        Flower_GroupIterator *groupIt = flower_getGroupIterator(flower);
-        Group *group;
-        while ((group = flower_getNextGroup(groupIt)) != NULL) {
-            Flower *subFlower = group_getNestedFlower(group);
-            if (subFlower != NULL) {
-                buildReferenceTopDown(subFlower, referenceEventString, permutations,
-                        matchingAlgorithm, temperatureFn, theta, phi, maxWalkForCalculatingZ, ignoreUnalignedGaps,
-                        wiggle, numberOfNsForScaffoldGap, minNumberOfSequencesToSupportAdjacency, makeScaffolds);
-                cactusDisk_addUpdateRequest(cactusDisk, subFlower);
-                flower_unload(subFlower);
-            }
-        }
-        flower_destructGroupIterator(groupIt);
+        buildReferencesOfNestedFlowers(flower, scheduler, finishNestedFlower, referenceEventString, permutations,
+                matchingAlgorithm, temperatureFn, zScoreTables, phi, maxWalkForCalculatingZ, ignoreUnalignedGaps, wiggle,
+                numberOfNsForScaffoldGap, minNumberOfSequencesToSupportAdjacency, makeScaffolds, maxOptimisationTime,
+                minRoundImprovement);
         assert(!flower_isParentLoaded(flower));
         cactusDisk_clearCache(cactusDisk);
     }
@@ -275,6 +322,13 @@ int main(int argc, char *argv[]) {
 
     cactusDisk_write(cactusDisk);
     st_logInfo("Updated the flower on disk\n");
+    if (scheduler != NULL) {
+        if (st_getLogLevel() >= info) {
+            stCaf_Scheduler_printWorkerStats(scheduler, stderr);
+        }
+        stCaf_Scheduler_destruct(scheduler);
+    }
+    referenceZScoreTables_destruct(zScoreTables);
 
     ///////////////////////////////////////////////////////////////////////////
     //Clean up.
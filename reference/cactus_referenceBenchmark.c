@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+/*
+ * Benchmarks the z-scores looked up in a ZScoreTable against calculateZScore,
+ * on the segment lengths and gaps of the threads of real flowers, or of random
+ * threads, reporting the times and the largest relative error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "cactus.h"
+#include "sonLib.h"
+#include "stReferenceProblem2.h"
+#include "zScoreTable.h"
+
+static double getTime(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1.0e9;
+}
+
+/*
+ * The z-scores to compute, as triples of the 5 segment length, 3 segment length and gap.
+ */
+typedef struct _geometries {
+    int64_t *values;
+    int64_t length;
+    int64_t maxLength;
+} Geometries;
+
+static void geometries_add(Geometries *geometries, int64_t length5Segment, int64_t length3Segment, int64_t gap) {
+    if (geometries->length + 3 > geometries->maxLength) {
+        geometries->maxLength = 2 * geometries->maxLength + 3;
+        geometries->values = st_realloc(geometries->values, sizeof(int64_t) * geometries->maxLength);
+    }
+    geometries->values[geometries->length++] = length5Segment;
+    geometries->values[geometries->length++] = length3Segment;
+    geometries->values[geometries->length++] = gap;
+}
+
+/*
+ * Adds the z-scores calculateZ would compute along the thread starting from the given stub cap,
+ * treating every block end as a node: each 3 cap is paired with the next maxWalk 5 caps, the
+ * segment lengths being the distances to the caps before and after.
+ */
+static void addThreadGeometries(Cap *cap, int64_t maxWalk, Geometries *geometries) {
+    Sequence *sequence = cap_getSequence(cap);
+    stList *caps = stList_construct();
+    while (1) {
+        stList_append(caps, cap);
+        cap = cap_getAdjacency(cap);
+        stList_append(caps, cap);
+        if (end_isStubEnd(end_getPositiveOrientation(cap_getEnd(cap))) || cap_getOtherSegmentCap(cap) == NULL) {
+            break;
+        }
+        cap = cap_getOtherSegmentCap(cap);
+    }
+    int64_t capNumber = stList_length(caps);
+    for (int64_t i = 0; i < capNumber; i += 2) {
+        Cap *_3Cap = stList_get(caps, i);
+        int64_t length3Segment = cap_getCoordinate(_3Cap) - (i > 0 ? cap_getCoordinate(stList_get(caps, i - 1)) :
+                sequence_getStart(sequence)) + 1;
+        for (int64_t j = i + 1; j < capNumber && j <= i + 2 * maxWalk - 1; j += 2) {
+            Cap *_5Cap = stList_get(caps, j);
+            int64_t length5Segment = (j + 1 < capNumber ? cap_getCoordinate(stList_get(caps, j + 1)) :
+                    sequence_getStart(sequence) + sequence_getLength(sequence)) - cap_getCoordinate(_5Cap) + 1;
+            int64_t gap = cap_getCoordinate(_5Cap) - cap_getCoordinate(_3Cap);
+            geometries_add(geometries, length5Segment > 0 ? length5Segment : 1, length3Segment > 0 ? length3Segment : 1,
+                    gap > 0 ? gap : 1);
+        }
+    }
+    stList_destruct(caps);
+}
+
+static void addFlowerGeometries(Flower *flower, int64_t maxWalk, Geometries *geometries) {
+    Flower_EndIterator *endIt = flower_getEndIterator(flower);
+    End *end;
+    while ((end = flower_getNextEnd(endIt)) != NULL) {
+        if (end_isStubEnd(end)) {
+            End_InstanceIterator *capIt = end_getInstanceIterator(end);
+            Cap *cap;
+            while ((cap = end_getNext(capIt)) != NULL) {
+                cap = cap_getStrand(cap) ? cap : cap_getReverse(cap);
+                if (!cap_getSide(cap) && cap_getSequence(cap) != NULL) {
+                    addThreadGeometries(cap, maxWalk, geometries);
+                }
+            }
+            end_destructInstanceIterator(capIt);
+        }
+    }
+    flower_destructEndIterator(endIt);
+    Flower_GroupIterator *groupIt = flower_getGroupIterator(flower);
+    Group *group;
+    while ((group = flower_getNextGroup(groupIt)) != NULL) {
+        if (!group_isLeaf(group)) {
+            addFlowerGeometries(group_getNestedFlower(group), maxWalk, geometries);
+        }
+    }
+    flower_destructGroupIterator(groupIt);
+}
+
+/*
+ * Adds the z-scores of random threads, whose blocks and unaligned gaps have exponentially
+ * distributed lengths.
+ */
+static void addRandomGeometries(int64_t threadNumber, int64_t threadLength, int64_t maxWalk, Geometries *geometries) {
+    int64_t *coordinates = st_malloc(sizeof(int64_t) * (2 * threadLength + 2));
+    for (int64_t t = 0; t < threadNumber; t++) {
+        int64_t x = 0;
+        for (int64_t i = 0; i < 2 * threadLength + 2; i++) {
+            x += 1 + (int64_t) (-log(1.0 - st_random()) * (i % 2 == 0 ? 100 : 50));
+            coordinates[i] = x;
+        }
+        for (int64_t i = 0; i < 2 * threadLength + 2; i += 2) {
+            int64_t length3Segment = coordinates[i] - (i > 0 ? coordinates[i - 1] : 0) + 1;
+            for (int64_t j = i + 1; j < 2 * threadLength + 2 && j <= i + 2 * maxWalk - 1; j += 2) {
+                int64_t length5Segment = (j + 1 < 2 * threadLength + 2 ? coordinates[j + 1] : x + 1) - coordinates[j] + 1;
+                geometries_add(geometries, length5Segment, length3Segment, coordinates[j] - coordinates[i]);
+            }
+        }
+    }
+    free(coordinates);
+}
+
+/*
+ * Times calculateZScore and a ZScoreTable on the geometries, and checks the largest relative error
+ * of the table, relative to the smallest score calculateZ adds. Returns non-zero if the table is
+ * less accurate than maxRelativeError.
+ */
+static int benchmarkZScores(Geometries *geometries, double theta, double maxRelativeError, int64_t repeats) {
+    int64_t scoreNumber = geometries->length / 3;
+    double exactTime = 0.0, tableTime = 0.0, constructionTime = 0.0, exactTotal = 0.0, tableTotal = 0.0;
+    double worstRelativeError = 0.0;
+    for (int64_t r = 0; r < repeats; r++) {
+        double startTime = getTime();
+        ZScoreTable *table = zScoreTable_construct(theta, maxRelativeError);
+        constructionTime += getTime() - startTime;
+
+        startTime = getTime();
+        exactTotal = 0.0;
+        for (int64_t i = 0; i < geometries->length; i += 3) {
+            exactTotal += calculateZScore(geometries->values[i], geometries->values[i + 1], geometries->values[i + 2], theta);
+        }
+        exactTime += getTime() - startTime;
+
+        startTime = getTime();
+        tableTotal = 0.0;
+        for (int64_t i = 0; i < geometries->length; i += 3) {
+            tableTotal += zScoreTable_get(table, geometries->values[i], geometries->values[i + 1], geometries->values[i + 2]);
+        }
+        tableTime += getTime() - startTime;
+
+        if (r == 0) {
+            for (int64_t i = 0; i < geometries->length; i += 3) {
+                double exactScore = calculateZScore(geometries->values[i], geometries->values[i + 1],
+                        geometries->values[i + 2], theta);
+                double score = zScoreTable_get(table, geometries->values[i], geometries->values[i + 1],
+                        geometries->values[i + 2]);
+                double relativeError = fabs(score - exactScore) / (fabs(exactScore) > 1e-10 ? fabs(exactScore) : 1e-10);
+                if (!(relativeError <= worstRelativeError)) {
+                    worstRelativeError = relativeError;
+                }
+            }
+            fprintf(stdout, "theta %g: tables %s, checked relative error %g, ", theta,
+                    zScoreTable_isExact(table) ? "not used" : "used", zScoreTable_getMaxRelativeError(table));
+        }
+        zScoreTable_destruct(table);
+    }
+    fprintf(stdout, "%" PRIi64 " scores: calculateZScore %lf s, table %lf s (+%lf s to make), speedup %.2fx, "
+            "max relative error %g, totals %g %g\n", scoreNumber, exactTime / repeats, tableTime / repeats,
+            constructionTime / repeats, tableTime > 0.0 ? exactTime / tableTime : 0.0, worstRelativeError, exactTotal,
+            tableTotal);
+    return !(worstRelativeError <= maxRelativeError);
+}
+
+static void usage(void) {
+    fprintf(stderr, "cactus_referenceBenchmark [options]\n");
+    fprintf(stderr, "-a --logLevel : Set the log level\n");
+    fprintf(stderr, "-c --cactusDisk : The location of the flower disk directory. If given, the flowers to take "
+            "the threads of, and their nested flowers, are read from stdin, otherwise random threads are used.\n");
+    fprintf(stderr, "-d --repeats : Number of times to repeat each benchmark (default 3)\n");
+    fprintf(stderr, "-e --seed : Random seed (default 1)\n");
+    fprintf(stderr, "-f --threads : Number of random threads (default 1000)\n");
+    fprintf(stderr, "-g --threadLength : Number of blocks in each random thread (default 1000)\n");
+    fprintf(stderr, "-k --thetas : Comma separated values of theta (default 0.0001,0.001,0.01)\n");
+    fprintf(stderr, "-l --maxWalkForCalculatingZ : The max number segments along a thread to pair a cap with (default 100)\n");
+    fprintf(stderr, "-m --maxRelativeError : The largest relative error allowed in the table (default 0.000001)\n");
+    fprintf(stderr, "-h --help : Print this help screen\n");
+}
+
+int main(int argc, char *argv[]) {
+    char *logLevelString = NULL;
+    char *cactusDiskDatabaseString = NULL;
+    int64_t repeats = 3;
+    int64_t seed = 1;
+    int64_t threadNumber = 1000;
+    int64_t threadLength = 1000;
+    char *thetasString = "0.0001,0.001,0.01";
+    int64_t maxWalk = 100;
+    double maxRelativeError = 0.000001;
+
+    while (1) {
+        static struct option long_options[] = { { "logLevel", required_argument, 0, 'a' },
+                { "cactusDisk", required_argument, 0, 'c' }, { "repeats", required_argument, 0, 'd' },
+                { "seed", required_argument, 0, 'e' }, { "threads", required_argument, 0, 'f' },
+                { "threadLength", required_argument, 0, 'g' }, { "thetas", required_argument, 0, 'k' },
+                { "maxWalkForCalculatingZ", required_argument, 0, 'l' },
+                { "maxRelativeError", required_argument, 0, 'm' }, { "help", no_argument, 0, 'h' }, { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+        int key = getopt_long(argc, argv, "a:c:d:e:f:g:k:l:m:h", long_options, &option_index);
+        if (key == -1) {
+            break;
+        }
+        switch (key) {
+            case 'a':
+                logLevelString = optarg;
+                break;
+            case 'c':
+                cactusDiskDatabaseString = optarg;
+                break;
+            case 'd':
+                repeats = atol(optarg);
+                break;
+            case 'e':
+                seed = atol(optarg);
+                break;
+            case 'f':
+                threadNumber = atol(optarg);
+                break;
+            case 'g':
+                threadLength = atol(optarg);
+                break;
+            case 'k':
+                thetasString = optarg;
+                break;
+            case 'l':
+                maxWalk = atol(optarg);
+                break;
+            case 'm':
+                maxRelativeError = atof(optarg);
+                break;
+            case 'h':
+                usage();
+                return 0;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    if (threadNumber < 0 || threadLength < 0 || maxWalk < 1) {
+        usage();
+        return 1;
+    }
+    if (repeats < 1) {
+        repeats = 1;
+    }
+    st_setLogLevelFromString(logLevelString);
+    st_randomSeed(seed);
+
+    Geometries geometries = { NULL, 0, 0 };
+    if (cactusDiskDatabaseString != NULL) {
+        stKVDatabaseConf *kvDatabaseConf = stKVDatabaseConf_constructFromString(cactusDiskDatabaseString);
+        CactusDisk *cactusDisk = cactusDisk_construct(kvDatabaseConf, false, true);
+        FlowerStream *flowerStream = flowerWriter_getFlowerStream(cactusDisk, stdin);
+        Flower *flower;
+        while ((flower = flowerStream_getNext(flowerStream)) != NULL) {
+            addFlowerGeometries(flower, maxWalk, &geometries);
+        }
+        cactusDisk_destruct(cactusDisk);
+        stKVDatabaseConf_destruct(kvDatabaseConf);
+    } else {
+        addRandomGeometries(threadNumber, threadLength, maxWalk, &geometries);
+    }
+
+    int failed = 0;
+    stList *thetas = stString_splitByString(thetasString, ",");
+    for (int64_t i = 0; i < stList_length(thetas); i++) {
+        double theta = atof(stList_get(thetas, i));
+        if (theta < 0.0 || theta > 1.0) {
+            st_errAbort("The theta parameter is not valid %f", theta);
+        }
+        failed = benchmarkZScores(&geometries, theta, maxRelativeError, repeats) || failed;
+    }
+    stList_destruct(thetas);
+    free(geometries.values);
+
+    return failed ? 1 : 0;
+}
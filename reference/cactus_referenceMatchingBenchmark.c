@@ -0,0 +1,512 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+/*
+ * Benchmarks the matching algorithms and makeReferenceGreedily2 on the reference problems of
+ * real flowers. Given a cactus disk (and flower names on stdin, as for cactus_reference) the
+ * problems are written to a file, building the references in memory as cactus_reference would
+ * so that the nested flowers get the stub intervals of their parents. Given such a file, each
+ * problem is replayed for each matching algorithm, reporting the time, peak memory, total score
+ * and bad adjacency count of the resulting reference.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "cactus.h"
+#include "sonLib.h"
+#include "cactusReference.h"
+#include "stCheckEdges.h"
+#include "stPerfectMatching.h"
+#include "stMatchingAlgorithms.h"
+#include "stReferenceProblem2.h"
+
+static double getTime(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1.0e9;
+}
+
+////////////////////////////////////
+////////////////////////////////////
+//Writing the problems
+////////////////////////////////////
+////////////////////////////////////
+
+typedef struct _problemParameters {
+    const char *referenceEventString;
+    int64_t permutations;
+    double theta;
+    double phi;
+    int64_t maxWalkForCalculatingZ;
+    bool ignoreUnalignedGaps;
+    double wiggle;
+    ReferenceZScoreTables *zScoreTables; //Made from theta by writeProblems.
+} ProblemParameters;
+
+static void writeProblemAndBuildReference(Flower *flower, ProblemParameters *parameters, FILE *fileHandle) {
+    /*
+     * The reference is built as cactus_reference would (with greedy matching) but never written to the disk.
+     */
+    ReferenceBuilder *builder = referenceBuilder_construct(flower, parameters->referenceEventString,
+            parameters->permutations, chooseMatching_greedy, constantTemperatureFn, parameters->zScoreTables,
+            parameters->phi, parameters->maxWalkForCalculatingZ, parameters->ignoreUnalignedGaps, parameters->wiggle,
+            10, 1, 0, -1.0, -1.0);
+    referenceBuilder_writeProblem(builder, fileHandle);
+    referenceBuilder_optimise(builder);
+    referenceBuilder_makeReference(builder);
+}
+
+static void writeProblems(CactusDisk *cactusDisk, ProblemParameters *parameters, FILE *fileHandle) {
+    parameters->zScoreTables = referenceZScoreTables_construct(parameters->theta);
+    FlowerStream *flowerStream = flowerWriter_getFlowerStream(cactusDisk, stdin);
+    Flower *flower;
+    while ((flower = flowerStream_getNext(flowerStream)) != NULL) {
+        stList *flowers = stList_construct();
+        stList_append(flowers, flower);
+        preCacheNestedFlowers(cactusDisk, flowers);
+        stList_destruct(flowers);
+        if (!flower_hasParentGroup(flower)) {
+            writeProblemAndBuildReference(flower, parameters, fileHandle);
+        }
+        Flower_GroupIterator *groupIt = flower_getGroupIterator(flower);
+        Group *group;
+        while ((group = flower_getNextGroup(groupIt)) != NULL) {
+            Flower *subFlower = group_getNestedFlower(group);
+            if (subFlower != NULL) {
+                writeProblemAndBuildReference(subFlower, parameters, fileHandle);
+                flower_unload(subFlower);
+            }
+        }
+        flower_destructGroupIterator(groupIt);
+        cactusDisk_clearCache(cactusDisk);
+    }
+    referenceZScoreTables_destruct(parameters->zScoreTables);
+}
+
+////////////////////////////////////
+////////////////////////////////////
+//Reading the problems
+////////////////////////////////////
+////////////////////////////////////
+
+typedef struct _adjacencies {
+    int64_t length;
+    int64_t *nodes; //Pairs of nodes.
+    double *weights;
+} Adjacencies;
+
+typedef struct _referenceProblem {
+    int64_t flowerName;
+    int64_t nodeNumber;
+    int64_t stubNodeNumber;
+    int64_t *stubNodes;
+    int64_t intervalNumber;
+    int64_t *intervals; //Pairs of the first and last nodes of the intervals.
+    Adjacencies stubAdjacencies;
+    Adjacencies adjacencies;
+    Adjacencies directAdjacencies;
+} ReferenceProblem;
+
+static int64_t readLabel(FILE *fileHandle, const char *label) {
+    char string[100];
+    int64_t length;
+    if (fscanf(fileHandle, "%99s %" PRIi64, string, &length) != 2 || strcmp(string, label) != 0 || length < 0) {
+        st_errAbort("Expected %s in the reference problem file", label);
+    }
+    return length;
+}
+
+static int64_t *readNodes(FILE *fileHandle, int64_t length) {
+    int64_t *nodes = st_malloc(sizeof(int64_t) * (length > 0 ? length : 1));
+    for (int64_t i = 0; i < length; i++) {
+        if (fscanf(fileHandle, "%" PRIi64, &nodes[i]) != 1) {
+            st_errAbort("Reading the nodes of the reference problem file failed");
+        }
+    }
+    return nodes;
+}
+
+static void readAdjacencies(FILE *fileHandle, const char *label, Adjacencies *adjacencies) {
+    adjacencies->length = readLabel(fileHandle, label);
+    adjacencies->nodes = st_malloc(sizeof(int64_t) * 2 * (adjacencies->length > 0 ? adjacencies->length : 1));
+    adjacencies->weights = st_malloc(sizeof(double) * (adjacencies->length > 0 ? adjacencies->length : 1));
+    for (int64_t i = 0; i < adjacencies->length; i++) {
+        if (fscanf(fileHandle, "%" PRIi64 " %" PRIi64 " %lf", &adjacencies->nodes[2 * i], &adjacencies->nodes[2 * i + 1],
+                &adjacencies->weights[i]) != 3) {
+            st_errAbort("Reading the %s of the reference problem file failed", label);
+        }
+    }
+}
+
+/*
+ * Reads the next problem written by referenceBuilder_writeProblem, or returns NULL at the end of the file.
+ */
+static ReferenceProblem *readProblem(FILE *fileHandle) {
+    ReferenceProblem *problem = st_calloc(1, sizeof(ReferenceProblem));
+    int i = fscanf(fileHandle, " referenceProblem %" PRIi64 " %" PRIi64, &problem->flowerName, &problem->nodeNumber);
+    if (i != 2) {
+        if (i != EOF) {
+            st_errAbort("Expected a reference problem in the reference problem file");
+        }
+        free(problem);
+        return NULL;
+    }
+    problem->stubNodeNumber = readLabel(fileHandle, "stubNodes");
+    problem->stubNodes = readNodes(fileHandle, problem->stubNodeNumber);
+    problem->intervalNumber = readLabel(fileHandle, "intervals");
+    problem->intervals = readNodes(fileHandle, 2 * problem->intervalNumber);
+    readAdjacencies(fileHandle, "stubAdjacencies", &problem->stubAdjacencies);
+    readAdjacencies(fileHandle, "adjacencies", &problem->adjacencies);
+    readAdjacencies(fileHandle, "directAdjacencies", &problem->directAdjacencies);
+    return problem;
+}
+
+static void referenceProblem_destruct(ReferenceProblem *problem) {
+    Adjacencies *adjacencies[3] = { &problem->stubAdjacencies, &problem->adjacencies, &problem->directAdjacencies };
+    for (int64_t i = 0; i < 3; i++) {
+        free(adjacencies[i]->nodes);
+        free(adjacencies[i]->weights);
+    }
+    free(problem->stubNodes);
+    free(problem->intervals);
+    free(problem);
+}
+
+static refAdjList *getAdjList(ReferenceProblem *problem, Adjacencies *adjacencies) {
+    refAdjList *aL = refAdjList_construct(problem->nodeNumber);
+    for (int64_t i = 0; i < adjacencies->length; i++) {
+        refAdjList_addToWeight(aL, adjacencies->nodes[2 * i], adjacencies->nodes[2 * i + 1], adjacencies->weights[i]);
+    }
+    return aL;
+}
+
+////////////////////////////////////
+////////////////////////////////////
+//Replaying the problems
+////////////////////////////////////
+////////////////////////////////////
+
+typedef struct _matchingAlgorithm {
+    const char *name;
+    stList *(*matchingAlgorithm)(stList *edges, int64_t nodeNumber); //NULL to use the intervals in the file.
+} MatchingAlgorithm;
+
+static MatchingAlgorithm matchingAlgorithms[] = { { "given", NULL }, { "greedy", chooseMatching_greedy }, {
+        "maxCardinality", chooseMatching_maximumCardinalityMatching }, { "maxWeight", chooseMatching_maximumWeightMatching }, {
+        "blossom5", chooseMatching_blossom5 } };
+static const int64_t matchingAlgorithmNumber = sizeof(matchingAlgorithms) / sizeof(MatchingAlgorithm);
+
+typedef struct _result {
+    double matchingTime;
+    double orderingTime;
+    int64_t peakMemory; //In kilobytes.
+    int64_t matchedWeight;
+    double score;
+    double maxPossibleScore;
+    int64_t badAdjacencies;
+} Result;
+
+static int64_t makeStubIntervals(ReferenceProblem *problem, reference *ref,
+        stList *(*matchingAlgorithm)(stList *edges, int64_t nodeNumber)) {
+    /*
+     * Makes the intervals of the empty reference as getStubEdgesInTopLevelFlower does, returning the total
+     * weight of the chosen edges.
+     */
+    refAdjList *stubAL = getAdjList(problem, &problem->stubAdjacencies);
+    stList *adjacencyEdges = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    stSortedSet *stubNodesSet = stSortedSet_construct3((int (*)(const void *, const void *)) stIntTuple_cmpFn,
+            (void (*)(void *)) stIntTuple_destruct);
+    for (int64_t i = 0; i < problem->stubNodeNumber; i++) {
+        int64_t node1 = problem->stubNodes[i];
+        stSortedSet_insert(stubNodesSet, stIntTuple_construct1(node1));
+        for (int64_t j = i + 1; j < problem->stubNodeNumber; j++) {
+            int64_t node2 = problem->stubNodes[j];
+            double score = refAdjList_getWeight(stubAL, node1, node2);
+            int64_t score2 = score > INT64_MAX ? INT64_MAX : score;
+            stList_append(adjacencyEdges, constructWeightedEdge(node1, node2, score2));
+        }
+    }
+    checkEdges(adjacencyEdges, stubNodesSet, 1, 0);
+    stList *chosenAdjacencyEdges = getPerfectMatching(stubNodesSet, adjacencyEdges, matchingAlgorithm);
+    int64_t matchedWeight = 0;
+    for (int64_t i = 0; i < stList_length(chosenAdjacencyEdges); i++) {
+        stIntTuple *adjacencyEdge = stList_get(chosenAdjacencyEdges, i);
+        reference_makeNewInterval(ref, -stIntTuple_get(adjacencyEdge, 0), stIntTuple_get(adjacencyEdge, 1));
+        matchedWeight += stIntTuple_get(adjacencyEdge, 2);
+    }
+    stList_destruct(chosenAdjacencyEdges);
+    stList_destruct(adjacencyEdges);
+    stSortedSet_destruct(stubNodesSet);
+    refAdjList_destruct(stubAL);
+    return matchedWeight;
+}
+
+static void solveProblem(ReferenceProblem *problem, MatchingAlgorithm *matchingAlgorithm, double wiggle, Result *result) {
+    double startTime = getTime();
+    reference *ref = reference_construct(problem->nodeNumber);
+    if (matchingAlgorithm->matchingAlgorithm == NULL) {
+        for (int64_t i = 0; i < problem->intervalNumber; i++) {
+            reference_makeNewInterval(ref, problem->intervals[2 * i], problem->intervals[2 * i + 1]);
+        }
+    } else {
+        result->matchedWeight = makeStubIntervals(problem, ref, matchingAlgorithm->matchingAlgorithm);
+    }
+    result->matchingTime = getTime() - startTime;
+
+    refAdjList *aL = getAdjList(problem, &problem->adjacencies);
+    refAdjList *dAL = getAdjList(problem, &problem->directAdjacencies);
+    startTime = getTime();
+    makeReferenceGreedily2(aL, dAL, ref, wiggle);
+    result->orderingTime = getTime() - startTime;
+    result->score = getReferenceScore(aL, ref);
+    result->maxPossibleScore = refAdjList_getMaxPossibleScore(aL);
+    result->badAdjacencies = getBadAdjacencyCount(dAL, ref);
+    refAdjList_destruct(aL);
+    refAdjList_destruct(dAL);
+    reference_destruct(ref);
+}
+
+/*
+ * Solves the problem in a child process, so the peak memory is that of the one run and a failing algorithm
+ * (e.g. blossom5 without its binary) is reported rather than ending the benchmark. Returns non-zero
+ * if the run succeeded. The peak memory includes the problem, which the child shares with this process.
+ */
+static bool runProblem(ReferenceProblem *problem, MatchingAlgorithm *matchingAlgorithm, double wiggle, Result *result) {
+    int fileDescriptors[2];
+    if (pipe(fileDescriptors) != 0) {
+        st_errnoAbort("Making a pipe failed");
+    }
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0) {
+        st_errnoAbort("Forking failed");
+    }
+    if (pid == 0) {
+        close(fileDescriptors[0]);
+        Result childResult = { 0 };
+        solveProblem(problem, matchingAlgorithm, wiggle, &childResult);
+        bool written = write(fileDescriptors[1], &childResult, sizeof(Result)) == sizeof(Result);
+        _exit(written ? 0 : 1);
+    }
+    close(fileDescriptors[1]);
+    bool succeeded = 1;
+    for (int64_t i = 0; i < sizeof(Result);) {
+        ssize_t j = read(fileDescriptors[0], ((char *) result) + i, sizeof(Result) - i);
+        if (j <= 0) {
+            succeeded = 0;
+            break;
+        }
+        i += j;
+    }
+    close(fileDescriptors[0]);
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid) {
+        st_errnoAbort("Waiting for the run of %s failed", matchingAlgorithm->name);
+    }
+    result->peakMemory = usage.ru_maxrss;
+    return succeeded && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void replayProblems(FILE *fileHandle, bool *chosenAlgorithms, double wiggle) {
+    Result totals[matchingAlgorithmNumber];
+    int64_t failures[matchingAlgorithmNumber];
+    memset(totals, 0, sizeof(totals));
+    memset(failures, 0, sizeof(failures));
+    fprintf(stdout, "flower\tnodes\tstubs\talgorithm\tmatchingSeconds\torderingSeconds\tpeakMemoryKb\tmatchedWeight\t"
+            "score\tmaxPossibleScore\tbadAdjacencies\n");
+    ReferenceProblem *problem;
+    int64_t problemNumber = 0;
+    while ((problem = readProblem(fileHandle)) != NULL) {
+        problemNumber++;
+        for (int64_t i = 0; i < matchingAlgorithmNumber; i++) {
+            if (!chosenAlgorithms[i]) {
+                continue;
+            }
+            Result result;
+            memset(&result, 0, sizeof(Result));
+            if (!runProblem(problem, &matchingAlgorithms[i], wiggle, &result)) {
+                fprintf(stdout, "%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\t%s\tfailed\n", problem->flowerName,
+                        problem->nodeNumber, problem->stubNodeNumber, matchingAlgorithms[i].name);
+                failures[i]++;
+                continue;
+            }
+            fprintf(stdout, "%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\t%s\t%f\t%f\t%" PRIi64 "\t%" PRIi64 "\t%f\t%f\t%" PRIi64 "\n",
+                    problem->flowerName, problem->nodeNumber, problem->stubNodeNumber, matchingAlgorithms[i].name,
+                    result.matchingTime, result.orderingTime, result.peakMemory, result.matchedWeight, result.score,
+                    result.maxPossibleScore, result.badAdjacencies);
+            totals[i].matchingTime += result.matchingTime;
+            totals[i].orderingTime += result.orderingTime;
+            totals[i].peakMemory = result.peakMemory > totals[i].peakMemory ? result.peakMemory : totals[i].peakMemory;
+            totals[i].matchedWeight += result.matchedWeight;
+            totals[i].score += result.score;
+            totals[i].maxPossibleScore += result.maxPossibleScore;
+            totals[i].badAdjacencies += result.badAdjacencies;
+        }
+        referenceProblem_destruct(problem);
+    }
+    for (int64_t i = 0; i < matchingAlgorithmNumber; i++) {
+        if (chosenAlgorithms[i]) {
+            fprintf(stdout, "total\t%" PRIi64 "\t%" PRIi64 "\t%s\t%f\t%f\t%" PRIi64 "\t%" PRIi64 "\t%f\t%f\t%" PRIi64 "\n",
+                    problemNumber, failures[i], matchingAlgorithms[i].name, totals[i].matchingTime, totals[i].orderingTime,
+                    totals[i].peakMemory, totals[i].matchedWeight, totals[i].score, totals[i].maxPossibleScore,
+                    totals[i].badAdjacencies);
+        }
+    }
+}
+
+void usage() {
+    fprintf(stderr, "cactus_referenceMatchingBenchmark, version 0.1\n");
+    fprintf(stderr, "-a --logLevel : Set the log level\n");
+    fprintf(stderr, "-c --cactusDisk : The cactus disk to write the reference problems of, taking flower names on stdin\n");
+    fprintf(stderr, "-o --outputFile : The file to write the reference problems to\n");
+    fprintf(stderr, "-f --inputFile : A file of reference problems to replay\n");
+    fprintf(stderr,
+            "-e --matchingAlgorithms : Comma separated names of the algorithms to replay, from 'given' (the intervals in the file), "
+            "'greedy', 'maxCardinality', 'maxWeight' and 'blossom5'. Default=all\n");
+    fprintf(stderr, "-g --referenceEventString : String identifying the reference event.\n");
+    fprintf(stderr, "-i --permutations : Number of permutations used to build the references written\n");
+    fprintf(stderr, "-k --theta : The value of theta\n");
+    fprintf(stderr, "-s --phi : The value of phi\n");
+    fprintf(stderr, "-l --maxWalkForCalculatingZ : The max number segments along a thread before stopping calculating z-scores\n");
+    fprintf(stderr, "-m --ignoreUnalignedGaps : Don't consider unaligned sequence (gaps) when calculating the score function.\n");
+    fprintf(stderr, "-n --wiggle : The wiggle of makeReferenceGreedily2\n");
+    fprintf(stderr, "-h --help : Print this help screen\n");
+}
+
+int main(int argc, char *argv[]) {
+    char *logLevelString = NULL;
+    char *cactusDiskDatabaseString = NULL;
+    char *outputFile = NULL;
+    char *inputFile = NULL;
+    bool chosenAlgorithms[matchingAlgorithmNumber];
+    for (int64_t i = 0; i < matchingAlgorithmNumber; i++) {
+        chosenAlgorithms[i] = 1;
+    }
+    ProblemParameters parameters = { cactusMisc_getDefaultReferenceEventHeader(), 10, 0.001, 1.0, 10000, 0, 0.95 };
+    int64_t j;
+
+    while (1) {
+        static struct option long_options[] = { { "logLevel", required_argument, 0, 'a' }, { "cactusDisk",
+                required_argument, 0, 'c' }, { "outputFile", required_argument, 0, 'o' }, { "inputFile",
+                required_argument, 0, 'f' }, { "matchingAlgorithms", required_argument, 0, 'e' }, {
+                "referenceEventString", required_argument, 0, 'g' }, { "permutations", required_argument, 0, 'i' }, {
+                "theta", required_argument, 0, 'k' }, { "phi", required_argument, 0, 's' }, { "maxWalkForCalculatingZ",
+                required_argument, 0, 'l' }, { "ignoreUnalignedGaps", no_argument, 0, 'm' }, { "wiggle",
+                required_argument, 0, 'n' }, { "help", no_argument, 0, 'h' }, { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+        int key = getopt_long(argc, argv, "a:c:o:f:e:g:i:k:s:l:mn:h", long_options, &option_index);
+        if (key == -1) {
+            break;
+        }
+
+        switch (key) {
+        case 'a':
+            logLevelString = stString_copy(optarg);
+            break;
+        case 'c':
+            cactusDiskDatabaseString = stString_copy(optarg);
+            break;
+        case 'o':
+            outputFile = stString_copy(optarg);
+            break;
+        case 'f':
+            inputFile = stString_copy(optarg);
+            break;
+        case 'e': {
+            for (int64_t i = 0; i < matchingAlgorithmNumber; i++) {
+                chosenAlgorithms[i] = 0;
+            }
+            stList *names = stString_splitByString(optarg, ",");
+            for (int64_t i = 0; i < stList_length(names); i++) {
+                int64_t k = 0;
+                while (k < matchingAlgorithmNumber && strcmp(matchingAlgorithms[k].name, stList_get(names, i)) != 0) {
+                    k++;
+                }
+                if (k == matchingAlgorithmNumber) {
+                    stThrowNew(REFERENCE_BUILDING_EXCEPTION, "Input error: unrecognized matching algorithm: %s",
+                            (char *) stList_get(names, i));
+                }
+                chosenAlgorithms[k] = 1;
+            }
+            stList_destruct(names);
+            break;
+        }
+        case 'g':
+            parameters.referenceEventString = stString_copy(optarg);
+            break;
+        case 'i':
+            j = sscanf(optarg, "%" PRIi64, &parameters.permutations);
+            assert(j == 1);
+            break;
+        case 'k':
+            j = sscanf(optarg, "%lf", &parameters.theta);
+            assert(j == 1);
+            break;
+        case 's':
+            j = sscanf(optarg, "%lf", &parameters.phi);
+            assert(j == 1);
+            break;
+        case 'l':
+            j = sscanf(optarg, "%" PRIi64, &parameters.maxWalkForCalculatingZ);
+            assert(j == 1);
+            break;
+        case 'm':
+            parameters.ignoreUnalignedGaps = 1;
+            break;
+        case 'n':
+            j = sscanf(optarg, "%lf", &parameters.wiggle);
+            assert(j == 1);
+            break;
+        case 'h':
+            usage();
+            return 0;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    st_setLogLevelFromString(logLevelString);
+
+    if (cactusDiskDatabaseString != NULL) {
+        if (outputFile == NULL) {
+            usage();
+            return 1;
+        }
+        FILE *fileHandle = fopen(outputFile, "w");
+        if (fileHandle == NULL) {
+            st_errnoAbort("Opening the reference problem file %s failed", outputFile);
+        }
+        stKVDatabaseConf *kvDatabaseConf = stKVDatabaseConf_constructFromString(cactusDiskDatabaseString);
+        CactusDisk *cactusDisk = cactusDisk_construct(kvDatabaseConf, false, true);
+        writeProblems(cactusDisk, &parameters, fileHandle);
+        fclose(fileHandle);
+        cactusDisk_destruct(cactusDisk);
+        stKVDatabaseConf_destruct(kvDatabaseConf);
+    } else if (inputFile != NULL) {
+        FILE *fileHandle = fopen(inputFile, "r");
+        if (fileHandle == NULL) {
+            st_errnoAbort("Opening the reference problem file %s failed", inputFile);
+        }
+        replayProblems(fileHandle, chosenAlgorithms, parameters.wiggle);
+        fclose(fileHandle);
+    } else {
+        usage();
+        return 1;
+    }
+    return 0;
+}
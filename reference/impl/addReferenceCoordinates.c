@@ -178,11 +178,28 @@ static char *terminalAdjacencyWriteFn(Cap *cap) {
 }
 
 static stHash *segmentWriteFn_flowerToPhylogeneticTreeHash;
+static stHash *segmentWriteFn_flowerToSegmentStringsHash;
+
+static SegmentStrings *getSegmentStrings(Flower *flower) {
+    /*
+     * Gets the strings of all the segments of the flower the first time one of its blocks is called.
+     */
+    SegmentStrings *segmentStrings = stHash_search(segmentWriteFn_flowerToSegmentStringsHash, flower);
+    if (segmentStrings == NULL) {
+        stList *flowers = stList_construct();
+        stList_append(flowers, flower);
+        segmentStrings = segmentStrings_construct(flowers);
+        stList_destruct(flowers);
+        stHash_insert(segmentWriteFn_flowerToSegmentStringsHash, flower, segmentStrings);
+    }
+    return segmentStrings;
+}
 
 static char *segmentWriteFn(Segment *segment) {
-    stTree *phylogeneticTree = stHash_search(segmentWriteFn_flowerToPhylogeneticTreeHash, block_getFlower(segment_getBlock(segment)));
+    Flower *flower = block_getFlower(segment_getBlock(segment));
+    stTree *phylogeneticTree = stHash_search(segmentWriteFn_flowerToPhylogeneticTreeHash, flower);
     assert(phylogeneticTree != NULL);
-    char *segmentString = getMaximumLikelihoodString(phylogeneticTree, segment_getBlock(segment));
+    char *segmentString = getMaximumLikelihoodString2(phylogeneticTree, segment_getBlock(segment), getSegmentStrings(flower));
     //We append a zero to a segment string if it is part of block containing only a reference segment, else we append a 1.
     //We use these boolean values to determine if a sequence contains only these trivial strings, and is therefore trivial.
     char *appendedSegmentString = stString_print("%s%c ", segmentString, block_getInstanceNumber(segment_getBlock(segment)) == 1 ? '0' : '1');
@@ -308,6 +325,7 @@ void bottomUp(stList *flowers, stKVDatabase *sequenceDatabase, Name referenceEve
         assert(refEvent != NULL);
         stHash_insert(segmentWriteFn_flowerToPhylogeneticTreeHash, flower, getPhylogeneticTreeRootedAtGivenEvent(refEvent, generateSubstitutionMatrix));
     }
+    segmentWriteFn_flowerToSegmentStringsHash = stHash_construct2(NULL, (void (*)(void *))segmentStrings_destruct);
 
     if (isTop) {
         stList *threadStrings = buildRecursiveThreadsInList(sequenceDatabase, caps, segmentWriteFn,
@@ -335,6 +353,7 @@ void bottomUp(stList *flowers, stKVDatabase *sequenceDatabase, Name referenceEve
         buildRecursiveThreads(sequenceDatabase, caps, segmentWriteFn, terminalAdjacencyWriteFn);
     }
     stHash_destruct(segmentWriteFn_flowerToPhylogeneticTreeHash);
+    stHash_destruct(segmentWriteFn_flowerToSegmentStringsHash);
     stList_destruct(caps);
 }
 
@@ -2,11 +2,14 @@
 #include <ctype.h>
 #include "cactus.h"
 #include "sonLib.h"
+#include "segmentStrings.h"
 
 /*
  * Code to calculate a maximum likelihood (ML) string for a block using Felsenstein's pruning algorithm.
  */
 
+typedef struct _mlTree MLTree;
+
 /////
 // Code to for creating a phylogenetic model of a given event tree with associated substitution matrices.
 ////
@@ -24,15 +27,27 @@ Event *getEvent(stTree *tree) {
     return ((void **) stTree_getClientData(tree))[1];
 }
 
+static void mlTree_destruct(MLTree *mlTree);
+
+stTree *makePhylogeneticTreeNode(stMatrix *substitutionMatrix, Event *event) {
+    /*
+     * Makes a node of a phylogenetic tree. The third attribute is the MLTree of the tree rooted at the node,
+     * made the first time it is needed (see getMLTree).
+     */
+    stTree *tree = stTree_construct();
+    void **attributes = st_malloc(sizeof(void *) * 3);
+    attributes[0] = substitutionMatrix;
+    attributes[1] = event;
+    attributes[2] = NULL;
+    stTree_setClientData(tree, attributes);
+    return tree;
+}
+
 static stTree *getPhylogeneticTree(Event *event, Event *eventToTreatAsParent,
         stMatrix *(*generateSubstitutionMatrix)(double)) {
-    stTree *tree = stTree_construct();
     stMatrix *matrix = generateSubstitutionMatrix(
             event_getBranchLength(eventToTreatAsParent == NULL ? event : eventToTreatAsParent));
-    void **attributes = st_malloc(sizeof(void *) * 2);
-    attributes[0] = matrix;
-    attributes[1] = event;
-    stTree_setClientData(tree, attributes);
+    stTree *tree = makePhylogeneticTreeNode(matrix, event);
     for (int64_t i = 0; i < event_getChildNumber(event); i++) {
         if (eventToTreatAsParent != event_getChild(event, i)) {
             stTree_setParent(getPhylogeneticTree(event_getChild(event, i), NULL, generateSubstitutionMatrix), tree);
@@ -71,6 +86,10 @@ void cleanupPhylogeneticTreeP(stTree *tree) {
         cleanupPhylogeneticTreeP(stTree_getChild(tree, i));
     }
     stMatrix_destruct(getSubMatrix(tree));
+    MLTree *mlTree = ((void **) stTree_getClientData(tree))[2];
+    if (mlTree != NULL) {
+        mlTree_destruct(mlTree);
+    }
     free(stTree_getClientData(tree));
 }
 
@@ -240,11 +259,345 @@ static double *computeBaseProbs(stTree *tree, stHash *eventsToStrings, int64_t b
     }
 }
 
+double *getBlockBaseProbsRecursively(stTree *tree, stHash *eventsToStrings, int64_t blockLength) {
+    return computeBaseProbs(tree, eventsToStrings, blockLength);
+}
+
+///
+// The following computes the same base probabilities as computeBaseProbs in one post-order pass over the
+// nodes of the tree, without allocating anything per node or position.
+///
+
+struct _mlTree {
+    int64_t nodeNumber;
+    Event **events; //The events of the nodes, in post-order.
+    int64_t *childNumbers;
+    int64_t *matrixIndices; //The index of the substitution matrix of each node in matrices.
+    int64_t matrixNumber;
+    double *matrices; //The distinct substitution matrices, 16 values each, column by column.
+    double *leafProbs; //The products of each matrix and the base probs of A, C, G, T and N, 20 values each.
+    int64_t bufferNumber; //The most base probs arrays in use at once during the pass.
+    double **buffers;
+    int64_t bufferLength; //The number of positions the buffers have room for.
+};
+
+static int64_t getMatrixIndex(MLTree *mlTree, stMatrix *substitutionMatrix) {
+    /*
+     * Gets the index of the matrix, adding it if no identical matrix (e.g. from an identical branch length) has been seen.
+     */
+    assert(stMatrix_n(substitutionMatrix) == 4 && stMatrix_m(substitutionMatrix) == 4);
+    double matrix[16];
+    for (int64_t i = 0; i < 4; i++) {
+        for (int64_t j = 0; j < 4; j++) {
+            matrix[j * 4 + i] = *stMatrix_getCell(substitutionMatrix, i, j);
+        }
+    }
+    for (int64_t i = 0; i < mlTree->matrixNumber; i++) {
+        if (memcmp(&mlTree->matrices[i * 16], matrix, sizeof(matrix)) == 0) {
+            return i;
+        }
+    }
+    memcpy(&mlTree->matrices[mlTree->matrixNumber * 16], matrix, sizeof(matrix));
+    //The leaf probs are the columns of the matrix, or their sum for an N, added in the order
+    //stMatrix_multiplySquareMatrixAndColumnVector adds them.
+    double *leafProbs = &mlTree->leafProbs[mlTree->matrixNumber * 20];
+    for (int64_t k = 0; k < 4; k++) {
+        double n = 0.0;
+        for (int64_t j = 0; j < 4; j++) {
+            leafProbs[j * 4 + k] = matrix[j * 4 + k];
+            n += matrix[j * 4 + k];
+        }
+        leafProbs[16 + k] = n;
+    }
+    return mlTree->matrixNumber++;
+}
+
+static void addNodesInPostOrder(MLTree *mlTree, stTree *tree, int64_t *stackSize) {
+    int64_t initialStackSize = *stackSize;
+    for (int64_t i = 0; i < stTree_getChildNumber(tree); i++) {
+        addNodesInPostOrder(mlTree, stTree_getChild(tree, i), stackSize);
+    }
+    //The base probs of the children are replaced by those of the node.
+    *stackSize = initialStackSize + 1;
+    if (*stackSize > mlTree->bufferNumber) {
+        mlTree->bufferNumber = *stackSize;
+    }
+    int64_t i = mlTree->nodeNumber++;
+    mlTree->events[i] = getEvent(tree);
+    mlTree->childNumbers[i] = stTree_getChildNumber(tree);
+    mlTree->matrixIndices[i] = getMatrixIndex(mlTree, getSubMatrix(tree));
+}
+
+static MLTree *mlTree_construct(stTree *tree) {
+    int64_t nodeNumber = stTree_getNumNodes(tree);
+    MLTree *mlTree = st_calloc(1, sizeof(MLTree));
+    mlTree->events = st_malloc(sizeof(Event *) * nodeNumber);
+    mlTree->childNumbers = st_malloc(sizeof(int64_t) * nodeNumber);
+    mlTree->matrixIndices = st_malloc(sizeof(int64_t) * nodeNumber);
+    mlTree->matrices = st_malloc(sizeof(double) * 16 * nodeNumber);
+    mlTree->leafProbs = st_malloc(sizeof(double) * 20 * nodeNumber);
+    int64_t stackSize = 0;
+    addNodesInPostOrder(mlTree, tree, &stackSize);
+    assert(mlTree->nodeNumber == nodeNumber && stackSize == 1);
+    mlTree->buffers = st_calloc(mlTree->bufferNumber, sizeof(double *));
+    return mlTree;
+}
+
+static void mlTree_destruct(MLTree *mlTree) {
+    for (int64_t i = 0; i < mlTree->bufferNumber; i++) {
+        free(mlTree->buffers[i]);
+    }
+    free(mlTree->buffers);
+    free(mlTree->events);
+    free(mlTree->childNumbers);
+    free(mlTree->matrixIndices);
+    free(mlTree->matrices);
+    free(mlTree->leafProbs);
+    free(mlTree);
+}
+
+static MLTree *getMLTree(stTree *tree) {
+    /*
+     * Gets the MLTree of the tree, kept with the tree (see makePhylogeneticTreeNode) as it is used for each block.
+     */
+    void **attributes = stTree_getClientData(tree);
+    if (attributes[2] == NULL) {
+        attributes[2] = mlTree_construct(tree);
+    }
+    return attributes[2];
+}
+
+static inline int64_t baseToIndex(char base) {
+    switch (base) {
+    case 'A':
+    case 'a':
+        return 0;
+    case 'C':
+    case 'c':
+        return 1;
+    case 'G':
+    case 'g':
+        return 2;
+    case 'T':
+    case 't':
+        return 3;
+    default: //An N, marginalised over all possibilities.
+        return 4;
+    }
+}
+
+static void setLeafBaseProbs(double *baseProbs, stList *strings, double *leafProbs, int64_t blockLength) {
+    /*
+     * As the leaf case of computeBaseProbs. Multiplying by the first string's probs is skipped, as multiplying
+     * by 1.0 changes nothing.
+     */
+    if (strings == NULL || stList_length(strings) == 0) {
+        for (int64_t i = 0; i < blockLength * 4; i++) {
+            baseProbs[i] = 1.0;
+        }
+        return;
+    }
+    char *string = stList_get(strings, 0);
+    for (int64_t i = 0; i < blockLength; i++) {
+        memcpy(&baseProbs[i * 4], &leafProbs[baseToIndex(string[i]) * 4], sizeof(double) * 4);
+    }
+    for (int64_t j = 1; j < stList_length(strings); j++) {
+        string = stList_get(strings, j);
+        for (int64_t i = 0; i < blockLength; i++) {
+            double *p = &leafProbs[baseToIndex(string[i]) * 4];
+            double *b = &baseProbs[i * 4];
+            for (int64_t k = 0; k < 4; k++) {
+                b[k] *= p[k];
+            }
+        }
+    }
+}
+
+static void transformBaseProbs(double *baseProbs, double *matrix, int64_t blockLength) {
+    /*
+     * As transformBaseProbsBySubstitutionMatrix, for a matrix stored column by column, summing in the same order.
+     */
+    for (int64_t i = 0; i < blockLength; i++) {
+        double *b = &baseProbs[i * 4];
+        double v[4] = { b[0], b[1], b[2], b[3] };
+        for (int64_t k = 0; k < 4; k++) {
+            b[k] = matrix[k] * v[0];
+        }
+        for (int64_t j = 1; j < 4; j++) {
+            for (int64_t k = 0; k < 4; k++) {
+                b[k] += matrix[j * 4 + k] * v[j];
+            }
+        }
+    }
+}
+
+static double *computeBaseProbsInOnePass(MLTree *mlTree, stHash *eventsToStrings, int64_t blockLength) {
+    /*
+     * Computes the base probs of the root of the tree, as computeBaseProbs, returning one of the
+     * MLTree's buffers. The base probs of the nodes are kept on a stack, those of the children of a
+     * node being replaced by those of the node.
+     */
+    if (blockLength > mlTree->bufferLength) {
+        mlTree->bufferLength = blockLength;
+        for (int64_t i = 0; i < mlTree->bufferNumber; i++) {
+            free(mlTree->buffers[i]);
+            mlTree->buffers[i] = st_malloc(sizeof(double) * 4 * blockLength);
+        }
+    }
+    int64_t stackSize = 0;
+    for (int64_t i = 0; i < mlTree->nodeNumber; i++) {
+        int64_t childNumber = mlTree->childNumbers[i];
+        if (childNumber == 0) {
+            setLeafBaseProbs(mlTree->buffers[stackSize++], stHash_search(eventsToStrings, mlTree->events[i]),
+                    &mlTree->leafProbs[mlTree->matrixIndices[i] * 20], blockLength);
+        } else {
+            stackSize -= childNumber;
+            double *baseProbs = mlTree->buffers[stackSize++];
+            for (int64_t j = 1; j < childNumber; j++) {
+                double *childBaseProbs = mlTree->buffers[stackSize - 1 + j];
+                for (int64_t k = 0; k < blockLength * 4; k++) {
+                    baseProbs[k] *= childBaseProbs[k];
+                }
+            }
+            transformBaseProbs(baseProbs, &mlTree->matrices[mlTree->matrixIndices[i] * 16], blockLength);
+        }
+    }
+    assert(stackSize == 1);
+    return mlTree->buffers[0];
+}
+
+double *getBlockBaseProbs(stTree *tree, stHash *eventsToStrings, int64_t blockLength) {
+    double *baseProbs = st_malloc(sizeof(double) * 4 * (blockLength > 0 ? blockLength : 1));
+    memcpy(baseProbs, computeBaseProbsInOnePass(getMLTree(tree), eventsToStrings, blockLength), sizeof(double) * 4 * blockLength);
+    return baseProbs;
+}
+
+///
+// The following computes the base probs of each distinct pattern of leaf bases in the columns of a block once.
+///
+
+static FILE *columnPatternReportFile = NULL;
+
+void setColumnPatternReportFile(FILE *fileHandle) {
+    columnPatternReportFile = fileHandle;
+}
+
+static bool columnsAreEqual(stList *strings, int64_t column1, int64_t column2) {
+    for (int64_t i = 0; i < stList_length(strings); i++) {
+        char *string = stList_get(strings, i);
+        if (baseToIndex(string[column1]) != baseToIndex(string[column2])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int64_t *getColumnPatterns(stList *strings, int64_t blockLength, int64_t **patternColumns, int64_t *patternNumber) {
+    /*
+     * Gets the index of the pattern of each column of the strings, the patterns being numbered in the order
+     * they first occur, and the first column with each pattern. Columns have the same pattern if their bases
+     * are the same in each string (counting all the non ACGT characters as Ns).
+     */
+    uint64_t *hashes = st_calloc(blockLength, sizeof(uint64_t));
+    for (int64_t i = 0; i < stList_length(strings); i++) {
+        char *string = stList_get(strings, i);
+        for (int64_t j = 0; j < blockLength; j++) {
+            hashes[j] = (hashes[j] ^ (uint64_t) baseToIndex(string[j])) * 1099511628211ULL;
+        }
+    }
+    int64_t tableSize = 1;
+    while (tableSize < 2 * blockLength) {
+        tableSize *= 2;
+    }
+    int64_t *table = st_malloc(sizeof(int64_t) * tableSize); //The indices of the patterns, or -1.
+    for (int64_t i = 0; i < tableSize; i++) {
+        table[i] = -1;
+    }
+    int64_t *columnPatterns = st_malloc(sizeof(int64_t) * blockLength);
+    *patternColumns = st_malloc(sizeof(int64_t) * blockLength);
+    *patternNumber = 0;
+    for (int64_t j = 0; j < blockLength; j++) {
+        int64_t k = (hashes[j] ^ (hashes[j] >> 32)) & (tableSize - 1);
+        while (table[k] != -1) {
+            int64_t column = (*patternColumns)[table[k]];
+            if (hashes[column] == hashes[j] && columnsAreEqual(strings, column, j)) {
+                break;
+            }
+            k = (k + 1) & (tableSize - 1);
+        }
+        if (table[k] == -1) {
+            table[k] = (*patternNumber)++;
+            (*patternColumns)[table[k]] = j;
+        }
+        columnPatterns[j] = table[k];
+    }
+    free(hashes);
+    free(table);
+    return columnPatterns;
+}
+
+static double *computeBaseProbsByPattern(MLTree *mlTree, stHash *eventsToStrings, int64_t blockLength, int64_t *patternNumber) {
+    /*
+     * As computeBaseProbsInOnePass, but computing the base probs of each pattern of the columns of the leaf strings once.
+     * As the base probs of a column only depend on its pattern, the result is the same. Returns a new array.
+     */
+    stList *strings = stList_construct();
+    for (int64_t i = 0; i < mlTree->nodeNumber; i++) {
+        stList *leafStrings = mlTree->childNumbers[i] == 0 ? stHash_search(eventsToStrings, mlTree->events[i]) : NULL;
+        if (leafStrings != NULL) {
+            stList_appendAll(strings, leafStrings);
+        }
+    }
+    int64_t *patternColumns;
+    int64_t *columnPatterns = getColumnPatterns(strings, blockLength, &patternColumns, patternNumber);
+    stList_destruct(strings);
+    double *baseProbs = st_malloc(sizeof(double) * 4 * (blockLength > 0 ? blockLength : 1));
+    if (*patternNumber > blockLength / 2) {
+        //Too few columns are shared for making the strings of the patterns to pay.
+        memcpy(baseProbs, computeBaseProbsInOnePass(mlTree, eventsToStrings, blockLength), sizeof(double) * 4 * blockLength);
+        free(columnPatterns);
+        free(patternColumns);
+        return baseProbs;
+    }
+
+    //Make the strings of the block of the patterns, of one column per pattern.
+    stHash *eventsToPatternStrings = stHash_construct2(NULL, (void (*)(void *)) stList_destruct);
+    for (int64_t i = 0; i < mlTree->nodeNumber; i++) {
+        stList *leafStrings = mlTree->childNumbers[i] == 0 ? stHash_search(eventsToStrings, mlTree->events[i]) : NULL;
+        if (leafStrings != NULL) {
+            stList *patternStrings = stList_construct3(0, free);
+            for (int64_t j = 0; j < stList_length(leafStrings); j++) {
+                char *string = stList_get(leafStrings, j);
+                char *patternString = st_malloc(sizeof(char) * (*patternNumber + 1));
+                for (int64_t k = 0; k < *patternNumber; k++) {
+                    patternString[k] = string[patternColumns[k]];
+                }
+                patternString[*patternNumber] = '\0';
+                stList_append(patternStrings, patternString);
+            }
+            stHash_insert(eventsToPatternStrings, mlTree->events[i], patternStrings);
+        }
+    }
+    double *patternBaseProbs = computeBaseProbsInOnePass(mlTree, eventsToPatternStrings, *patternNumber);
+    stHash_destruct(eventsToPatternStrings);
+
+    for (int64_t j = 0; j < blockLength; j++) {
+        memcpy(&baseProbs[j * 4], &patternBaseProbs[columnPatterns[j] * 4], sizeof(double) * 4);
+    }
+    free(columnPatterns);
+    free(patternColumns);
+    return baseProbs;
+}
+
+double *getBlockBaseProbsByPattern(stTree *tree, stHash *eventsToStrings, int64_t blockLength, int64_t *patternNumber) {
+    return computeBaseProbsByPattern(getMLTree(tree), eventsToStrings, blockLength, patternNumber);
+}
+
 ////
 // The following is used to soft-mask (make lower case) bases deemed to be repetitive in the source genomes.
 ////
 
-void maskAncestralRepeatBases(Block *block, char *mlString) {
+static void maskAncestralRepeatBasesP(Block *block, char *mlString, SegmentStrings *segmentStrings) {
     /*
      * Soft masks the positions in the mlString that are deemed to be repetitive. A position is repetitive
      * if greater than 50% of the bases from which it is derived are not upper case.
@@ -260,13 +613,12 @@ void maskAncestralRepeatBases(Block *block, char *mlString) {
     while ((segment = block_getNext(segmentIt)) != NULL) {
         if (segment_getSequence(segment) != NULL) {
             numSegmentsWithSequence++;
-            char *string = segment_getString(segment);
+            const char *string = segmentStrings_get(segmentStrings, segment);
             for (int64_t i = 0; i < block_getLength(block); i++) {
                 char uC = toupper(string[i]);
                 upperCounts[i] += uC == string[i] ? 1 : 0;
                 nCounts[i] += (uC != 'A' && uC != 'C' && uC != 'G' && uC != 'T' ? 1 : 0);
             }
-            free(string);
         }
     }
     block_destructInstanceIterator(segmentIt);
@@ -286,10 +638,16 @@ void maskAncestralRepeatBases(Block *block, char *mlString) {
     free(nCounts);
 }
 
-static stHash *hashEventsToSegmentStrings(Block *block) {
+void maskAncestralRepeatBases(Block *block, char *mlString) {
+    SegmentStrings *segmentStrings = segmentStrings_constructForBlock(block);
+    maskAncestralRepeatBasesP(block, mlString, segmentStrings);
+    segmentStrings_destruct(segmentStrings);
+}
+
+static stHash *hashEventsToSegmentStrings(Block *block, SegmentStrings *segmentStrings) {
     /*
      * Returns a hash of events to the strings of segments with a given event.
-     * The strings are stored in a list.
+     * The strings are stored in a list, and are owned by segmentStrings.
      */
     stHash *eventsToStrings = stHash_construct2(NULL, (void (*)(void *)) stList_destruct);
     Block_InstanceIterator *segmentIt = block_getInstanceIterator(block);
@@ -298,17 +656,17 @@ static stHash *hashEventsToSegmentStrings(Block *block) {
         if (segment_getSequence(segment) != NULL) {
             stList *strings = stHash_search(eventsToStrings, segment_getEvent(segment));
             if (strings == NULL) {
-                strings = stList_construct3(0, free);
+                strings = stList_construct();
                 stHash_insert(eventsToStrings, segment_getEvent(segment), strings);
             }
-            stList_append(strings, segment_getString(segment));
+            stList_append(strings, (char *) segmentStrings_get(segmentStrings, segment));
         }
     }
     block_destructInstanceIterator(segmentIt);
     return eventsToStrings;
 }
 
-char *getMaximumLikelihoodString(stTree *tree, Block *block) {
+char *getMaximumLikelihoodString2(stTree *tree, Block *block, SegmentStrings *segmentStrings) {
     /*
      * Computes a maximum likelihood (ML) string for a given block.
      */
@@ -323,14 +681,26 @@ char *getMaximumLikelihoodString(stTree *tree, Block *block) {
         memset(mlString, 'N', block_getLength(block));
         mlString[block_getLength(block)] = '\0';
     } else {
-        stHash *eventsToStrings = hashEventsToSegmentStrings(block);
-        double *baseProbs = computeBaseProbs(tree, eventsToStrings, block_getLength(block));
+        stHash *eventsToStrings = hashEventsToSegmentStrings(block, segmentStrings);
+        int64_t patternNumber;
+        double *baseProbs = computeBaseProbsByPattern(getMLTree(tree), eventsToStrings, block_getLength(block), &patternNumber);
         mlString = getMaxLikelihoodString(baseProbs, block_getLength(block));
+        if (columnPatternReportFile != NULL) {
+            fprintf(columnPatternReportFile, "Block %" PRIi64 " of length %" PRIi64 " has %" PRIi64 " column patterns, a compression ratio of %f\n",
+                    block_getName(block), block_getLength(block), patternNumber, ((double) block_getLength(block)) / patternNumber);
+        }
         //Cleanup
         free(baseProbs);
         stHash_destruct(eventsToStrings);
     }
-    maskAncestralRepeatBases(block, mlString);
+    maskAncestralRepeatBasesP(block, mlString, segmentStrings);
+    return mlString;
+}
+
+char *getMaximumLikelihoodString(stTree *tree, Block *block) {
+    SegmentStrings *segmentStrings = segmentStrings_constructForBlock(block);
+    char *mlString = getMaximumLikelihoodString2(tree, block, segmentStrings);
+    segmentStrings_destruct(segmentStrings);
     return mlString;
 }
 
@@ -5,7 +5,10 @@
 #include "stCheckEdges.h"
 #include "stMatchingAlgorithms.h"
 #include "stReferenceProblem2.h"
+#include "zScoreTable.h"
+#include "cactusReference.h"
 #include <math.h>
+#include <time.h>
 
 const char *REFERENCE_BUILDING_EXCEPTION = "REFERENCE_BUILDING_EXCEPTION";
 
@@ -67,7 +70,14 @@ static stList *getExtraAttachedStubsFromParent(Flower *flower) {
 ////////////////////////////////////
 ////////////////////////////////////
 
-static stList *calculateZP(Cap *cap, stHash *endsToNodes) {
+static inline int64_t getNode(int64_t *endIndicesToNodes, End *end) {
+    /*
+     * Get the node of the end, or 0 if it has none, see getEndIndicesToNodes.
+     */
+    return endIndicesToNodes[end_getIndex(end)];
+}
+
+static stList *calculateZP(Cap *cap, int64_t *endIndicesToNodes) {
     /*
      * Get the list of caps that represent the ends of the chains and stubs within a sequence.
      */
@@ -76,8 +86,8 @@ static stList *calculateZP(Cap *cap, stHash *endsToNodes) {
     stList *caps = stList_construct();
     bool b = 0;
     while (1) {
-        End *end = end_getPositiveOrientation(cap_getEnd(cap));
-        if (stHash_search(endsToNodes, end) != NULL) {
+        End *end = cap_getEnd(cap);
+        if (getNode(endIndicesToNodes, end) != 0) {
             assert(!cap_getSide(cap));
             if (stList_length(caps) > 0) {
                 assert(b);
@@ -87,8 +97,8 @@ static stList *calculateZP(Cap *cap, stHash *endsToNodes) {
         }
         cap = cap_getAdjacency(cap);
         assert(cap != NULL);
-        end = end_getPositiveOrientation(cap_getEnd(cap));
-        if (stHash_search(endsToNodes, end) != NULL) {
+        end = cap_getEnd(cap);
+        if (getNode(endIndicesToNodes, end) != 0) {
             assert(cap_getSide(cap));
             if (stList_length(caps) > 0) {
                 assert(!b);
@@ -106,21 +116,21 @@ static stList *calculateZP(Cap *cap, stHash *endsToNodes) {
     return NULL;
 }
 
-static Cap *calculateZP4(Cap *cap, stHash *endsToNodes) {
+static Cap *calculateZP4(Cap *cap, int64_t *endIndicesToNodes) {
     if (cap_getOtherSegmentCap(cap) == NULL) {
         return NULL;
     }
     while (1) {
         cap = cap_getOtherSegmentCap(cap);
         assert(cap != NULL);
-        End *end = end_getPositiveOrientation(cap_getEnd(cap));
-        if (stHash_search(endsToNodes, end) != NULL) {
+        End *end = cap_getEnd(cap);
+        if (getNode(endIndicesToNodes, end) != 0) {
             return cap;
         }
         cap = cap_getAdjacency(cap);
         assert(cap != NULL);
-        end = end_getPositiveOrientation(cap_getEnd(cap));
-        assert(stHash_search(endsToNodes, end) == NULL);
+        end = cap_getEnd(cap);
+        assert(getNode(endIndicesToNodes, end) == 0);
         if (end_isStubEnd(end)) {
             //if(!end_isFree(end)) { //Not true is normalisation is disabled
             //    assert(!flower_hasParentGroup(end_getFlower(end)));
@@ -131,16 +141,15 @@ static Cap *calculateZP4(Cap *cap, stHash *endsToNodes) {
     return NULL;
 }
 
-static int64_t calculateZP2(Cap *cap, stHash *endsToNodes) {
+static int64_t calculateZP2(Cap *cap, int64_t *endIndicesToNodes) {
     /*
      * Calculate the length of a segment that can be traversed from a cap,
-     * before hitting the end of the sequence of one of the other ends in the set
-     * endsToNodes.
+     * before hitting the end of the sequence of one of the other ends with a node.
      */
     assert(cap_getStrand(cap));
     Sequence *sequence = cap_getSequence(cap);
     assert(sequence != NULL);
-    Cap *otherCap = calculateZP4(cap, endsToNodes);
+    Cap *otherCap = calculateZP4(cap, endIndicesToNodes);
     int64_t capLength;
     if (otherCap == NULL) {
         //capLength = 1000000000; //make the length really long if attached, so that we don't bias toward one or the other end.
@@ -284,26 +293,91 @@ static stSet *getEventsWithSequences(Flower *flower) {
     return seqSet;
 }
 
+//The largest relative error allowed in the z-scores looked up in a ZScoreTable.
+static const double maxZScoreTableRelativeError = 0.000001;
+
+struct _referenceZScoreTables {
+    ZScoreTable *zScoreTable;
+    ZScoreTable *directZScoreTable; //For theta = 0, used to score the direct adjacencies.
+};
+
+ReferenceZScoreTables *referenceZScoreTables_construct(double theta) {
+    ReferenceZScoreTables *zScoreTables = st_malloc(sizeof(ReferenceZScoreTables));
+    zScoreTables->zScoreTable = zScoreTable_construct(theta, maxZScoreTableRelativeError);
+    zScoreTables->directZScoreTable = zScoreTable_construct(0.0, maxZScoreTableRelativeError);
+    return zScoreTables;
+}
+
+void referenceZScoreTables_destruct(ReferenceZScoreTables *zScoreTables) {
+    zScoreTable_destruct(zScoreTables->zScoreTable);
+    zScoreTable_destruct(zScoreTables->directZScoreTable);
+    free(zScoreTables);
+}
+
 static double calculateZScoreWeightedAdapterFn(Cap *_5Cap, int64_t length5Segment, int64_t length3Segment, int64_t gap, void *extraArgs) {
-    double theta = *((double *)((void **) extraArgs)[0]);
-    assert(theta >= 0.0);
+    ZScoreTable *zScoreTable = ((void **) extraArgs)[0];
     assert(cap_getEvent(_5Cap) != NULL);
     assert(stHash_search(((void **) extraArgs)[1], cap_getEvent(_5Cap)) != NULL);
     assert(stDoubleTuple_length(stHash_search(((void **) extraArgs)[1], cap_getEvent(_5Cap))) == 1);
     double weight = stDoubleTuple_getPosition(stHash_search(((void **) extraArgs)[1], cap_getEvent(_5Cap)), 0);
-    return calculateZScore(length5Segment, length3Segment, gap, theta) * weight;
+    return zScoreTable_get(zScoreTable, length5Segment, length3Segment, gap) * weight;
 }
 
 static double countAdapterFn(Cap *_5Cap, int64_t length5Segment, int64_t length3Segment, int64_t gap, void *extraArgs) {
     return 1;
 }
 
-refAdjList *calculateZ(Flower *flower, stHash *endsToNodes, int64_t nodeNumber, int64_t maxWalkForCalculatingZ,
-bool ignoreUnalignedGaps, double (*zScoreFn)(Cap *, int64_t, int64_t, int64_t, void *), void *zScoreExtraArgs) {
+/*
+ * One set of adjacency scores computed by calculateZs, with its own walk length and score function.
+ */
+typedef struct _zCalculation {
+    int64_t maxWalkForCalculatingZ;
+    bool ignoreUnalignedGaps;
+    double (*zScoreFn)(Cap *, int64_t, int64_t, int64_t, void *);
+    void *zScoreExtraArgs;
+    refAdjList *aL; //The scores, made by calculateZs.
+    stSet *pairs; //If not NULL, calculateZs adds the pairs of nodes it scores, as ordered stIntTuples.
+} ZCalculation;
+
+static void addNodePair(stSet *pairs, int64_t node1, int64_t node2) {
+    stIntTuple *pair = node1 < node2 ? stIntTuple_construct2(node1, node2) : stIntTuple_construct2(node2, node1);
+    if (stSet_search(pairs, pair) == NULL) {
+        stSet_insert(pairs, pair);
+    } else {
+        stIntTuple_destruct(pair);
+    }
+}
+
+static int64_t *getEndIndicesToNodes(Flower *flower, stHash *endsToNodes) {
     /*
-     * Calculate the zScores between all ends.
+     * Get an array of the nodes of the ends of the flower, indexed by end_getIndex, in which the ends
+     * without a node have node 0 (which is never a node). This lets the nodes of the caps visited by
+     * calculateZs be found without searching endsToNodes.
      */
-    refAdjList *aL = refAdjList_construct(nodeNumber);
+    int64_t *endIndicesToNodes = st_calloc(flower_getEndIndexBound(flower), sizeof(int64_t));
+    stHashIterator *endIt = stHash_getIterator(endsToNodes);
+    End *end;
+    while ((end = stHash_getNext(endIt)) != NULL) {
+        assert(end_getFlower(end) == flower);
+        int64_t node = stIntTuple_get(stHash_search(endsToNodes, end), 0);
+        assert(node != 0);
+        endIndicesToNodes[end_getIndex(end)] = node;
+    }
+    stHash_destructIterator(endIt);
+    return endIndicesToNodes;
+}
+
+static void calculateZs(Flower *flower, int64_t *endIndicesToNodes, int64_t nodeNumber, ZCalculation *calculations,
+        int64_t calculationNumber) {
+    /*
+     * Calculate the zScores between all ends for each of the calculations, walking the threads once.
+     * The scores are added to each list in the order calculateZ would add them, so are the same.
+     */
+    for (int64_t c = 0; c < calculationNumber; c++) {
+        calculations[c].aL = refAdjList_construct(nodeNumber);
+    }
+    int64_t *unaligned = st_malloc(sizeof(int64_t) * calculationNumber);
+    bool *walking = st_malloc(sizeof(bool) * calculationNumber);
     Flower_EndIterator *endIt = flower_getEndIterator(flower);
     End *end;
     while ((end = flower_getNextEnd(endIt)) != NULL) {
@@ -313,67 +387,106 @@ bool ignoreUnalignedGaps, double (*zScoreFn)(Cap *, int64_t, int64_t, int64_t, v
             while ((cap = end_getNext(capIt)) != NULL) {
                 cap = cap_getStrand(cap) ? cap : cap_getReverse(cap);
                 if (!cap_getSide(cap) && cap_getSequence(cap) != NULL) {
-                    stList *caps = calculateZP(cap, endsToNodes);
+                    stList *caps = calculateZP(cap, endIndicesToNodes);
+                    int64_t capNumber = stList_length(caps);
 
                     /*
-                     * Calculate the lengths of the sequences following the 3 caps, for efficiency.
+                     * Calculate the lengths of the sequences following the caps, their nodes and the
+                     * unaligned bases before each 5 cap once, for efficiency.
                      */
-                    int64_t *capSizes = st_malloc(sizeof(int64_t) * stList_length(caps));
-                    for (int64_t i = 0; i < stList_length(caps); i++) {
+                    int64_t *capSizes = st_malloc(sizeof(int64_t) * capNumber);
+                    int64_t *capNodes = st_malloc(sizeof(int64_t) * capNumber);
+                    int64_t *capGaps = st_malloc(sizeof(int64_t) * capNumber);
+                    for (int64_t i = 0; i < capNumber; i++) {
                         Cap *cap = stList_get(caps, i);
-                        capSizes[i] = calculateZP2(cap, endsToNodes);
+                        capSizes[i] = calculateZP2(cap, endIndicesToNodes);
+                        capNodes[i] = getNode(endIndicesToNodes, cap_getEnd(cap));
+                        if (cap_getSide(cap)) {
+                            assert(cap_getAdjacency(cap) != NULL);
+                            capGaps[i] = cap_getCoordinate(cap) - cap_getCoordinate(cap_getAdjacency(cap)) - 1;
+                        }
                     }
 
                     /*
                      * Iterate through all pairs of 5' and 3' caps to calculate additions to scores.
                      */
-                    for (int64_t i = (stList_length(caps) > 0 && cap_getSide(stList_get(caps, 0))) ? 1 : 0; i < stList_length(caps); i += 2) {
+                    for (int64_t i = (capNumber > 0 && cap_getSide(stList_get(caps, 0))) ? 1 : 0; i < capNumber; i += 2) {
                         Cap *_3Cap = stList_get(caps, i);
                         assert(!cap_getSide(_3Cap));
-                        int64_t _3CapSize = capSizes[i];
-                        int64_t _3Node = stIntTuple_get(stHash_search(endsToNodes, end_getPositiveOrientation(cap_getEnd(_3Cap))), 0);
-                        int64_t unaligned = 0;
-                        for (int64_t k = 0; k < maxWalkForCalculatingZ; k++) {
+                        int64_t walkingNumber = 0;
+                        for (int64_t c = 0; c < calculationNumber; c++) {
+                            unaligned[c] = 0;
+                            walking[c] = calculations[c].maxWalkForCalculatingZ > 0;
+                            walkingNumber += walking[c];
+                        }
+                        for (int64_t k = 0; walkingNumber > 0; k++) {
                             int64_t j = k * 2 + i + 1;
-                            if (j >= stList_length(caps)) {
+                            if (j >= capNumber) {
                                 break;
                             }
                             Cap *_5Cap = stList_get(caps, j);
                             assert(cap_getSide(_5Cap));
-                            assert(cap_getAdjacency(_5Cap) != NULL);
-                            if (ignoreUnalignedGaps) {
-                                assert(cap_getCoordinate(_5Cap) - cap_getCoordinate(cap_getAdjacency(_5Cap)) - 1 >= 0);
-                                unaligned += cap_getCoordinate(_5Cap) - cap_getCoordinate(cap_getAdjacency(_5Cap)) - 1;
-                            }
-                            int64_t _5Node = stIntTuple_get(stHash_search(endsToNodes, end_getPositiveOrientation(cap_getEnd(_5Cap))), 0);
-                            int64_t _5CapSize = capSizes[j];
                             assert(cap_getCoordinate(_5Cap) - cap_getCoordinate(_3Cap) > 0);
-                            int64_t diff = cap_getCoordinate(_5Cap) - cap_getCoordinate(_3Cap) - unaligned;
-                            assert(diff >= 1);
-                            if (zScoreFn(_5Cap, 1, 1, diff, zScoreExtraArgs) < 0.0000000001) { //no point walking when score gets too small, should be effective for theta >= 0.000001
-                                break;
+                            for (int64_t c = 0; c < calculationNumber; c++) {
+                                ZCalculation *calculation = &calculations[c];
+                                if (!walking[c]) {
+                                    continue;
+                                }
+                                if (k >= calculation->maxWalkForCalculatingZ) {
+                                    walking[c] = 0;
+                                    walkingNumber--;
+                                    continue;
+                                }
+                                if (calculation->ignoreUnalignedGaps) {
+                                    assert(capGaps[j] >= 0);
+                                    unaligned[c] += capGaps[j];
+                                }
+                                int64_t diff = cap_getCoordinate(_5Cap) - cap_getCoordinate(_3Cap) - unaligned[c];
+                                assert(diff >= 1);
+                                if (calculation->zScoreFn(_5Cap, 1, 1, diff, calculation->zScoreExtraArgs) < 0.0000000001) { //no point walking when score gets too small, should be effective for theta >= 0.000001
+                                    walking[c] = 0;
+                                    walkingNumber--;
+                                    continue;
+                                }
+                                double score = calculation->zScoreFn(_5Cap, capSizes[j], capSizes[i], diff, calculation->zScoreExtraArgs);
+                                assert(score >= -0.0001);
+                                if (score <= 0.0) {
+                                    score = 1e-10; //Make slightly non-zero.
+                                }
+                                assert(score > 0.0);
+                                refAdjList_addToWeight(calculation->aL, capNodes[i], capNodes[j], score);
+                                if (calculation->pairs != NULL) {
+                                    addNodePair(calculation->pairs, capNodes[i], capNodes[j]);
+                                }
+                                assert(refAdjList_getWeight(calculation->aL, capNodes[i], capNodes[j]) == refAdjList_getWeight(calculation->aL, capNodes[j], capNodes[i]));
+                                assert(refAdjList_getWeight(calculation->aL, capNodes[i], capNodes[j]) >= 0.0);
                             }
-                            double score = zScoreFn(_5Cap, _5CapSize, _3CapSize, diff, zScoreExtraArgs);
-                            assert(score >= -0.0001);
-                            if (score <= 0.0) {
-                                score = 1e-10; //Make slightly non-zero.
-                            }
-                            assert(score > 0.0);
-                            refAdjList_addToWeight(aL, _3Node, _5Node, score);
-                            assert(refAdjList_getWeight(aL, _3Node, _5Node) == refAdjList_getWeight(aL, _5Node, _3Node));
-                            assert(refAdjList_getWeight(aL, _3Node, _5Node) >= 0.0);
                         }
                     }
                     stList_destruct(caps);
                     free(capSizes);
+                    free(capNodes);
+                    free(capGaps);
                 }
             }
             end_destructInstanceIterator(capIt);
         }
     }
     flower_destructEndIterator(endIt);
+    free(unaligned);
+    free(walking);
+}
 
-    return aL;
+refAdjList *calculateZ(Flower *flower, stHash *endsToNodes, int64_t nodeNumber, int64_t maxWalkForCalculatingZ,
+bool ignoreUnalignedGaps, double (*zScoreFn)(Cap *, int64_t, int64_t, int64_t, void *), void *zScoreExtraArgs) {
+    /*
+     * Calculate the zScores between all ends.
+     */
+    ZCalculation calculation = { maxWalkForCalculatingZ, ignoreUnalignedGaps, zScoreFn, zScoreExtraArgs, NULL, NULL };
+    int64_t *endIndicesToNodes = getEndIndicesToNodes(flower, endsToNodes);
+    calculateZs(flower, endIndicesToNodes, nodeNumber, &calculation, 1);
+    free(endIndicesToNodes);
+    return calculation.aL;
 }
 
 ////////////////////////////////////
@@ -382,15 +495,38 @@ bool ignoreUnalignedGaps, double (*zScoreFn)(Cap *, int64_t, int64_t, int64_t, v
 ////////////////////////////////////
 ////////////////////////////////////
 
-static End *getEndFromNode(stHash *nodesToEnds, int64_t node) {
+static End **getNodesToEndsArray(stHash *nodesToEnds, int64_t *nodeBound) {
     /*
-     * Get the end for the given node.
+     * Get an array of the ends of the nodes, indexed by node + nodeBound, where nodeBound
+     * is set to one more than the largest absolute value of a node.
      */
-    stIntTuple *i = stIntTuple_construct1(node);
-    End *end = stHash_search(nodesToEnds, i);
+    *nodeBound = 1;
+    stHashIterator *nodeIt = stHash_getIterator(nodesToEnds);
+    stIntTuple *node;
+    while ((node = stHash_getNext(nodeIt)) != NULL) {
+        int64_t n = llabs(stIntTuple_get(node, 0));
+        if (n >= *nodeBound) {
+            *nodeBound = n + 1;
+        }
+    }
+    stHash_destructIterator(nodeIt);
+    End **nodesToEndsArray = st_calloc(2 * *nodeBound, sizeof(End *));
+    nodeIt = stHash_getIterator(nodesToEnds);
+    while ((node = stHash_getNext(nodeIt)) != NULL) {
+        nodesToEndsArray[stIntTuple_get(node, 0) + *nodeBound] = stHash_search(nodesToEnds, node);
+    }
+    stHash_destructIterator(nodeIt);
+    return nodesToEndsArray;
+}
+
+static End *getEndFromNode(End **nodesToEnds, int64_t nodeBound, int64_t node) {
+    /*
+     * Get the end for the given node, from an array made by getNodesToEndsArray.
+     */
+    assert(node > -nodeBound && node < nodeBound);
+    End *end = nodesToEnds[node + nodeBound];
     assert(end != NULL);
     assert(end_getOrientation(end));
-    stIntTuple_destruct(i);
     return end;
 }
 
@@ -588,16 +724,16 @@ stHash *makeStubEdgesToNodesHash(stList *stubEnds, stHash *endsToNodes) {
 }
 
 static void getStubEdgesInTopLevelFlower(reference *ref, Flower *flower, stHash *endsToNodes, int64_t nodeNumber, Event *referenceEvent,
-        stList *(*matchingAlgorithm)(stList *edges, int64_t nodeNumber), stList *stubEnds, double phi) {
+        stList *(*matchingAlgorithm)(stList *edges, int64_t nodeNumber), stList *stubEnds, ReferenceZScoreTables *zScoreTables,
+        double phi) {
     /*
      * Create a matching for the parent stub edges.
      */
     stHash *stubEndsToNodes = makeStubEdgesToNodesHash(stubEnds, endsToNodes);
-    double theta = 0.0;
     stSet *chosenEvents = getEventsWithSequences(flower);
     stHash *eventWeighting = getEventWeighting(referenceEvent, phi, chosenEvents);
     stSet_destruct(chosenEvents);
-    void *zArgs[2] = { &theta, eventWeighting };
+    void *zArgs[2] = { zScoreTables->directZScoreTable, eventWeighting };
     refAdjList *stubAL = calculateZ(flower, stubEndsToNodes, nodeNumber,
     INT64_MAX, 1, calculateZScoreWeightedAdapterFn, zArgs);
     stHash_destruct(eventWeighting);
@@ -639,12 +775,14 @@ static void getStubEdgesInTopLevelFlower(reference *ref, Flower *flower, stHash
 }
 
 static reference *getEmptyReference(Flower *flower, stHash *endsToNodes, int64_t nodeNumber, Event *referenceEvent,
-        stList *(*matchingAlgorithm)(stList *edges, int64_t nodeNumber), stList *stubEnds, double phi) {
+        stList *(*matchingAlgorithm)(stList *edges, int64_t nodeNumber), stList *stubEnds, ReferenceZScoreTables *zScoreTables,
+        double phi) {
     reference *ref = reference_construct(nodeNumber);
     if (flower_getParentGroup(flower) != NULL) {
         getStubEdgesFromParent(ref, flower, referenceEvent, endsToNodes, stubEnds);
     } else {
-        getStubEdgesInTopLevelFlower(ref, flower, endsToNodes, nodeNumber, referenceEvent, matchingAlgorithm, stubEnds, phi);
+        getStubEdgesInTopLevelFlower(ref, flower, endsToNodes, nodeNumber, referenceEvent, matchingAlgorithm, stubEnds,
+                zScoreTables, phi);
     }
     return ref;
 }
@@ -799,10 +937,12 @@ static stHash *getEndsToEnds(Flower *flower, stList *chosenAdjacencyEdges, stHas
      * Get a hash of matched ends.
      */
     stHash *endsToEnds = stHash_construct();
+    int64_t nodeBound;
+    End **nodesToEndsArray = getNodesToEndsArray(nodesToEnds, &nodeBound);
     for (int64_t i = 0; i < stList_length(chosenAdjacencyEdges); i++) {
         stIntTuple *edge = stList_get(chosenAdjacencyEdges, i);
-        End *end1 = getEndFromNode(nodesToEnds, stIntTuple_get(edge, 0));
-        End *end2 = getEndFromNode(nodesToEnds, stIntTuple_get(edge, 1));
+        End *end1 = getEndFromNode(nodesToEndsArray, nodeBound, stIntTuple_get(edge, 0));
+        End *end2 = getEndFromNode(nodesToEndsArray, nodeBound, stIntTuple_get(edge, 1));
         assert(end1 != NULL);
         assert(end2 != NULL);
         assert(end1 != end2);
@@ -829,6 +969,7 @@ static stHash *getEndsToEnds(Flower *flower, stList *chosenAdjacencyEdges, stHas
             mapEnds(endsToEnds, end1, end2);
         }
     }
+    free(nodesToEndsArray);
     Flower_GroupIterator *groupIt = flower_getGroupIterator(flower);
     Group *group;
     while ((group = flower_getNextGroup(groupIt)) != NULL) {
@@ -932,18 +1073,13 @@ bool referenceSplitFn(int64_t pNode, reference *ref, void *extraArgs) {
      * If this does not also have a group
      * then both ends must be from "N" blocks, and we allow them to be joined.
      */
-    //void *extraArgs[4] = { nodesToEnds, dAL, &onlyDirectAdjacencies, aL };
-    stHash *nodesToEnds = ((void **) extraArgs)[0];
-    stIntTuple *i = stIntTuple_construct1(-pNode);
-    End *end = stHash_search(nodesToEnds, i);
-    stIntTuple_destruct(i);
-    assert(end != NULL);
+    //void *extraArgs[4] = { nodesToEndsArray, countDAL, &minNumberOfSequencesToSupportAdjacency, &nodeBound };
+    End **nodesToEnds = ((void **) extraArgs)[0];
+    int64_t nodeBound = *((int64_t *) ((void **) extraArgs)[3]);
+    End *end = getEndFromNode(nodesToEnds, nodeBound, -pNode);
     Group *group = end_getGroup(end);
     if (group == NULL) {
-        i = stIntTuple_construct1(reference_getNext(ref, pNode));
-        End *adjacentEnd = stHash_search(nodesToEnds, i);
-        stIntTuple_destruct(i);
-        assert(adjacentEnd != NULL);
+        End *adjacentEnd = getEndFromNode(nodesToEnds, nodeBound, reference_getNext(ref, pNode));
         group = end_getGroup(adjacentEnd);
     }
     refAdjList *dAL = ((void **) extraArgs)[1];
@@ -983,37 +1119,80 @@ stList *getReferenceIntervalsToPreserve(reference *ref, refAdjList *dAL, int64_t
 ////////////////////////////////////
 ////////////////////////////////////
 
-void buildReferenceTopDown(Flower *flower, const char *referenceEventHeader, int64_t permutations,
+struct _referenceBuilder {
+    Flower *flower;
+    Event *referenceEvent;
+    int64_t permutations;
+    ReferenceZScoreTables *zScoreTables;
+    int64_t maxWalkForCalculatingZ;
+    bool ignoreUnalignedGaps;
+    double wiggle;
+    int64_t numberOfNsForScaffoldGap;
+    int64_t minNumberOfSequencesToSupportAdjacency;
+    bool makeScaffolds;
+    double maxOptimisationTime;
+    double minRoundImprovement;
+    stList *newEnds;
+    stHash *endsToNodes;
+    int64_t *endIndicesToNodes;
+    int64_t chainNumber;
+    int64_t nodeNumber;
+    stList *stubTangleEnds;
+    reference *ref;
+    stHash *nodesToEnds;
+    stList *referenceIntervalsToPreserve;
+    stHash *eventWeighting;
+    refAdjList *aL; //These three are made by referenceBuilder_calculateZs.
+    refAdjList *dAL;
+    refAdjList *countDAL;
+    double zTime; //The seconds taken by referenceBuilder_calculateZs.
+};
+
+ReferenceBuilder *referenceBuilder_construct(Flower *flower, const char *referenceEventHeader, int64_t permutations,
         stList *(*matchingAlgorithm)(stList *edges, int64_t nodeNumber), double (*temperature)(double),
-        double theta, double phi, int64_t maxWalkForCalculatingZ,
-        bool ignoreUnalignedGaps, double wiggle, int64_t numberOfNsForScaffoldGap, int64_t minNumberOfSequencesToSupportAdjacency, bool makeScaffolds) {
-    /*
-     * Implements a greedy algorithm and greedy update sampler to find a solution to the adjacency problem for a net.
-     */
+        ReferenceZScoreTables *zScoreTables, double phi, int64_t maxWalkForCalculatingZ,
+        bool ignoreUnalignedGaps, double wiggle, int64_t numberOfNsForScaffoldGap, int64_t minNumberOfSequencesToSupportAdjacency, bool makeScaffolds,
+        double maxOptimisationTime, double minRoundImprovement) {
+    ReferenceBuilder *builder = st_calloc(1, sizeof(ReferenceBuilder));
+    builder->flower = flower;
+    builder->permutations = permutations;
+    builder->zScoreTables = zScoreTables;
+    builder->maxWalkForCalculatingZ = maxWalkForCalculatingZ;
+    builder->ignoreUnalignedGaps = ignoreUnalignedGaps;
+    builder->wiggle = wiggle;
+    builder->numberOfNsForScaffoldGap = numberOfNsForScaffoldGap;
+    builder->minNumberOfSequencesToSupportAdjacency = minNumberOfSequencesToSupportAdjacency;
+    builder->makeScaffolds = makeScaffolds;
+    builder->maxOptimisationTime = maxOptimisationTime;
+    builder->minRoundImprovement = minRoundImprovement;
 
     /*
      * Get the reference event
      */
     Event *referenceEvent = getReferenceEvent(flower, referenceEventHeader);
+    builder->referenceEvent = referenceEvent;
     fprintf(stderr, "Chose reference event %" PRIi64 ": %s\n", event_getName(referenceEvent), event_getHeader(referenceEvent));
 
     /*
      * Get any extra ends to balance the group from the parent problem.
      */
-    stList *newEnds = getExtraAttachedStubsFromParent(flower);
+    builder->newEnds = getExtraAttachedStubsFromParent(flower);
 
     /*
      * Get the chain edges.
      */
     stHash *endsToNodes = getChainNodes(flower);
+    builder->endsToNodes = endsToNodes;
     assert(stHash_size(endsToNodes) % 2 == 0);
-    int64_t chainNumber = stHash_size(endsToNodes) / 2;
+    builder->chainNumber = stHash_size(endsToNodes) / 2;
 
     /*
      * Create the stub nodes.
      */
     stList *stubTangleEnds = getTangleStubEnds(flower, endsToNodes);
-    int64_t nodeNumber = chainNumber + stList_length(stubTangleEnds);
+    builder->stubTangleEnds = stubTangleEnds;
+    int64_t nodeNumber = builder->chainNumber + stList_length(stubTangleEnds);
+    builder->nodeNumber = nodeNumber;
     st_logInfo(
             "For flower: %" PRIi64 " we have %" PRIi64 " nodes for: %" PRIi64 " ends, %" PRIi64 " chains, %" PRIi64 " stubs and %" PRIi64 " blocks\n",
             flower_getName(flower), nodeNumber, flower_getEndNumber(flower), flower_getChainNumber(flower), stList_length(stubTangleEnds),
@@ -1023,61 +1202,158 @@ void buildReferenceTopDown(Flower *flower, const char *referenceEventHeader, int
     /*
      * Get the reference with chosen stub matched intervals
      */
-    reference *ref = getEmptyReference(flower, endsToNodes, nodeNumber, referenceEvent, matchingAlgorithm, stubTangleEnds, phi);
-    assert(reference_getIntervalNumber(ref) == stList_length(stubTangleEnds) / 2);
+    builder->ref = getEmptyReference(flower, endsToNodes, nodeNumber, referenceEvent, matchingAlgorithm, stubTangleEnds,
+            zScoreTables, phi);
+    assert(reference_getIntervalNumber(builder->ref) == stList_length(stubTangleEnds) / 2);
 
     /*
      * Invert the hash from ends to nodes to nodes to ends.
      */
-    stHash *nodesToEnds = stHash_invert(endsToNodes, (uint64_t (*)(const void *)) stIntTuple_hashKey,
+    builder->nodesToEnds = stHash_invert(endsToNodes, (uint64_t (*)(const void *)) stIntTuple_hashKey,
             (int (*)(const void *, const void *)) stIntTuple_equalsFn, (void (*)(void *)) stIntTuple_destruct, NULL);
 
     /*
      * Determine which adjacencies between stubs must be preserved (i.e. scaffolded if necessary)
      */
-    stList *referenceIntervalsToPreserve = NULL;
     if (makeScaffolds) {
         stHash *stubEndsToNodes = makeStubEdgesToNodesHash(stubTangleEnds, endsToNodes);
         refAdjList *stubDAL = calculateZ(flower, stubEndsToNodes, nodeNumber, 1, 1, countAdapterFn, NULL); //Gets set of adjacencies between stub ends.
         stHash_destruct(stubEndsToNodes);
-        referenceIntervalsToPreserve = getReferenceIntervalsToPreserve(ref, stubDAL, minNumberOfSequencesToSupportAdjacency); //List of int-tuple pairs identifying the matchings between ends that should be preserved.
+        builder->referenceIntervalsToPreserve = getReferenceIntervalsToPreserve(builder->ref, stubDAL, minNumberOfSequencesToSupportAdjacency); //List of int-tuple pairs identifying the matchings between ends that should be preserved.
         refAdjList_destruct(stubDAL);
     }
 
     /*
-     * Calculate z functions, using phylogenetic weighting.
+     * Get the phylogenetic weighting and the nodes of the ends, used to calculate the z functions.
      */
     stSet *chosenEvents = getEventsWithSequences(flower);
-    stHash *eventWeighting = getEventWeighting(referenceEvent, phi, chosenEvents);
+    builder->eventWeighting = getEventWeighting(referenceEvent, phi, chosenEvents);
     stSet_destruct(chosenEvents);
-    void *zArgs[2] = { &theta, eventWeighting };
-    refAdjList *aL = calculateZ(flower, endsToNodes, nodeNumber, maxWalkForCalculatingZ, ignoreUnalignedGaps, calculateZScoreWeightedAdapterFn, zArgs);
-    int64_t directTheta = 0.0;
-    zArgs[0] = &directTheta;
-    refAdjList *dAL = calculateZ(flower, endsToNodes, nodeNumber, 1, ignoreUnalignedGaps, calculateZScoreWeightedAdapterFn, zArgs); //Gets set of direct of direct adjacencies
-    stHash_destruct(eventWeighting);
+    builder->endIndicesToNodes = getEndIndicesToNodes(flower, endsToNodes);
+    return builder;
+}
+
+static double getTime(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1.0e9;
+}
+
+static char *optimiseReferenceInRounds(ReferenceBuilder *builder, refAdjList *aL, refAdjList *dAL, bool nudge,
+        int64_t rounds, int64_t maxNudge, double startTime, double maxPossibleScore) {
+    /*
+     * Runs the given number of rounds of updateReferenceGreedily, or of nudgeGreedily, one at a time, stopping early
+     * once a round improves the score by less than minRoundImprovement of the max possible score, or once
+     * maxOptimisationTime seconds have passed since startTime. Returns a description of the scores after each round,
+     * for the log.
+     */
+    reference *ref = builder->ref;
+    stList *scores = stList_construct3(0, free);
+    const char *stopReason = "all rounds";
+    double score = getReferenceScore(aL, ref);
+    for (int64_t i = 0; i < rounds; i++) {
+        if (builder->maxOptimisationTime > 0.0 && getTime() - startTime >= builder->maxOptimisationTime) {
+            stopReason = "out of time";
+            break;
+        }
+        if (nudge) {
+            nudgeGreedily(dAL, aL, ref, 1, maxNudge);
+        } else {
+            updateReferenceGreedily(aL, dAL, ref, 1);
+        }
+        double newScore = getReferenceScore(aL, ref);
+        stList_append(scores, stString_print("%f", newScore));
+        if (builder->minRoundImprovement > 0.0 && newScore - score < builder->minRoundImprovement * maxPossibleScore) {
+            stopReason = "converged";
+            break;
+        }
+        score = newScore;
+    }
+    char *scoresString = stString_join2(",", scores);
+    char *description = stString_print("%" PRIi64 " rounds (%s): %s", stList_length(scores), stopReason, scoresString);
+    free(scoresString);
+    stList_destruct(scores);
+    return description;
+}
+
+void referenceBuilder_calculateZs(ReferenceBuilder *builder) {
+    double startTime = getTime();
+    Flower *flower = builder->flower;
+    int64_t nodeNumber = builder->nodeNumber;
+
+    /*
+     * Calculate z functions, using phylogenetic weighting, in one pass over the threads. This gets the
+     * scored adjacencies, the direct adjacencies and the counts of direct adjacencies between the ends,
+     * the last used to split the reference below.
+     */
+    void *zArgs[2] = { builder->zScoreTables->zScoreTable, builder->eventWeighting };
+    void *directZArgs[2] = { builder->zScoreTables->directZScoreTable, builder->eventWeighting };
+    ZCalculation zCalculations[3] = {
+            { builder->maxWalkForCalculatingZ, builder->ignoreUnalignedGaps, calculateZScoreWeightedAdapterFn, zArgs, NULL, NULL },
+            { 1, builder->ignoreUnalignedGaps, calculateZScoreWeightedAdapterFn, directZArgs, NULL, NULL },
+            { 1, 1, countAdapterFn, NULL, NULL, NULL } };
+    calculateZs(flower, builder->endIndicesToNodes, nodeNumber, zCalculations, 3);
+    builder->aL = zCalculations[0].aL;
+    builder->dAL = zCalculations[1].aL; //Gets set of direct of direct adjacencies
+    builder->countDAL = zCalculations[2].aL; //Gets set of adjacencies between stub ends.
+    stHash_destruct(builder->eventWeighting);
+    builder->eventWeighting = NULL;
+    builder->zTime = getTime() - startTime;
+}
+
+void referenceBuilder_orderNodes(ReferenceBuilder *builder) {
+    //The time budget of the anytime mode includes the time taken to calculate the z-scores.
+    double startTime = getTime() - builder->zTime;
+    Flower *flower = builder->flower;
+    reference *ref = builder->ref;
+    int64_t nodeNumber = builder->nodeNumber;
+    refAdjList *aL = builder->aL;
+    refAdjList *dAL = builder->dAL;
+    builder->aL = NULL;
+    builder->dAL = NULL;
 
     /*
      * Check the edges and nodes before starting to calculate the matching.
      */
     st_logDebug(
             "Starting to build the reference for flower %lli, with %" PRIi64 " stubs and %" PRIi64 " chains and %" PRIi64 " nodes in the flowers tangle\n",
-            flower_getName(flower), reference_getIntervalNumber(ref), chainNumber, nodeNumber);
+            flower_getName(flower), reference_getIntervalNumber(ref), builder->chainNumber, nodeNumber);
 
     double maxPossibleScore = refAdjList_getMaxPossibleScore(aL);
-    makeReferenceGreedily2(aL, dAL, ref, wiggle);
+    makeReferenceGreedily2(aL, dAL, ref, builder->wiggle);
     int64_t badAdjacenciesAfterGreedy = getBadAdjacencyCount(dAL, ref);
     double totalScoreAfterGreedy = getReferenceScore(aL, ref);
     st_logDebug("The score of the initial solution is %f/%" PRIi64 " out of a max possible %f\n", totalScoreAfterGreedy, badAdjacenciesAfterGreedy,
             maxPossibleScore);
 
-    updateReferenceGreedily(aL, dAL, ref, permutations);
+    int64_t maxNudge = 100;
+    int64_t nudgePermutations = 100;
+    if (builder->maxOptimisationTime > 0.0 || builder->minRoundImprovement > 0.0) {
+        /*
+         * Anytime mode, in which the rounds are run one at a time until they stop improving the score or the
+         * time runs out, logging the score trajectory.
+         */
+        char *updates = optimiseReferenceInRounds(builder, aL, dAL, 0, builder->permutations, maxNudge, startTime,
+                maxPossibleScore);
+        char *nudges = optimiseReferenceInRounds(builder, aL, dAL, 1, nudgePermutations, maxNudge, startTime,
+                maxPossibleScore);
+        st_logInfo("Reference score trajectory for flower %" PRIi64 ", out of a max possible %f: greedy %f, "
+                "updates %s, nudges %s, in %f seconds\n", flower_getName(flower), maxPossibleScore, totalScoreAfterGreedy,
+                updates, nudges, getTime() - startTime);
+        free(updates);
+        free(nudges);
+        refAdjList_destruct(aL);
+        refAdjList_destruct(dAL);
+        return;
+    }
+
+    updateReferenceGreedily(aL, dAL, ref, builder->permutations);
 
     int64_t badAdjacenciesAfterGreedySampling = getBadAdjacencyCount(dAL, ref);
     double totalScoreAfterGreedySampling = getReferenceScore(aL, ref);
     st_logDebug(
             "The score of the solution after permutation sampling is %f/%" PRIi64 " after %" PRIi64 " rounds of greedy permutation out of a max possible %f\n",
-            totalScoreAfterGreedySampling, badAdjacenciesAfterGreedySampling, permutations, maxPossibleScore);
+            totalScoreAfterGreedySampling, badAdjacenciesAfterGreedySampling, builder->permutations, maxPossibleScore);
 
     //reorderReferenceToAvoidBreakpoints(dAL2, ref);
     //int64_t badAdjacenciesAfterTopologicalReordering = getBadAdjacencyCount(dAL, ref);
@@ -1086,8 +1362,6 @@ void buildReferenceTopDown(Flower *flower, const char *referenceEventHeader, int
     //        "The score of the solution after topological reordering is %f/%" PRIi64 " after %" PRIi64 " rounds of greedy permutation out of a max possible %f\n",
     //        totalScoreAfterTopologicalReordering, badAdjacenciesAfterTopologicalReordering, permutations, maxPossibleScore);
 
-    int64_t maxNudge = 100;
-    int64_t nudgePermutations = 100;
     nudgeGreedily(dAL, aL, ref, nudgePermutations, maxNudge);
     int64_t badAdjacenciesAfterNudging = getBadAdjacencyCount(dAL, ref);
     double totalScoreAfterNudging = getReferenceScore(aL, ref);
@@ -1096,6 +1370,83 @@ void buildReferenceTopDown(Flower *flower, const char *referenceEventHeader, int
     //The aL and dAL arrays are no longer valid as we've added additional nodes to the reference, let's clean up the arrays explicitly.
     refAdjList_destruct(aL);
     refAdjList_destruct(dAL);
+}
+
+void referenceBuilder_optimise(ReferenceBuilder *builder) {
+    referenceBuilder_calculateZs(builder);
+    referenceBuilder_orderNodes(builder);
+}
+
+int64_t referenceBuilder_getNodeNumber(ReferenceBuilder *builder) {
+    return builder->nodeNumber;
+}
+
+static stSet *constructNodePairs(void) {
+    return stSet_construct3((uint64_t (*)(const void *)) stIntTuple_hashKey,
+            (int (*)(const void *, const void *)) stIntTuple_equalsFn, (void (*)(void *)) stIntTuple_destruct);
+}
+
+static void writeAdjacencies(FILE *fileHandle, const char *label, ZCalculation *calculation) {
+    /*
+     * Writes the weights of the pairs of nodes scored by the calculation, in order.
+     */
+    stList *pairs = stSet_getList(calculation->pairs);
+    stList_sort(pairs, (int (*)(const void *, const void *)) stIntTuple_cmpFn);
+    fprintf(fileHandle, "%s %" PRIi64 "\n", label, stList_length(pairs));
+    for (int64_t i = 0; i < stList_length(pairs); i++) {
+        stIntTuple *pair = stList_get(pairs, i);
+        int64_t node1 = stIntTuple_get(pair, 0), node2 = stIntTuple_get(pair, 1);
+        fprintf(fileHandle, "%" PRIi64 " %" PRIi64 " %.17g\n", node1, node2, refAdjList_getWeight(calculation->aL, node1, node2));
+    }
+    stList_destruct(pairs);
+    stSet_destruct(calculation->pairs);
+    refAdjList_destruct(calculation->aL);
+}
+
+void referenceBuilder_writeProblem(ReferenceBuilder *builder, FILE *fileHandle) {
+    Flower *flower = builder->flower;
+    reference *ref = builder->ref;
+    fprintf(fileHandle, "referenceProblem %" PRIi64 " %" PRIi64 "\n", flower_getName(flower), builder->nodeNumber);
+
+    /*
+     * The stub nodes and the intervals between them, either from the parent or chosen by the matching.
+     */
+    fprintf(fileHandle, "stubNodes %" PRIi64 "\n", stList_length(builder->stubTangleEnds));
+    for (int64_t i = 0; i < stList_length(builder->stubTangleEnds); i++) {
+        fprintf(fileHandle, "%" PRIi64 "\n", stIntTuple_get(stHash_search(builder->endsToNodes, stList_get(builder->stubTangleEnds, i)), 0));
+    }
+    fprintf(fileHandle, "intervals %" PRIi64 "\n", reference_getIntervalNumber(ref));
+    for (int64_t i = 0; i < reference_getIntervalNumber(ref); i++) {
+        int64_t first = reference_getFirstOfInterval(ref, i);
+        fprintf(fileHandle, "%" PRIi64 " %" PRIi64 "\n", first, reference_getLast(ref, first));
+    }
+
+    /*
+     * The scores, as calculated by getStubEdgesInTopLevelFlower (for the matching) and referenceBuilder_optimise.
+     */
+    void *zArgs[2] = { builder->zScoreTables->zScoreTable, builder->eventWeighting };
+    void *directZArgs[2] = { builder->zScoreTables->directZScoreTable, builder->eventWeighting };
+    stHash *stubEndsToNodes = makeStubEdgesToNodesHash(builder->stubTangleEnds, builder->endsToNodes);
+    int64_t *stubEndIndicesToNodes = getEndIndicesToNodes(flower, stubEndsToNodes);
+    ZCalculation stubCalculation = { INT64_MAX, 1, calculateZScoreWeightedAdapterFn, directZArgs, NULL, constructNodePairs() };
+    calculateZs(flower, stubEndIndicesToNodes, builder->nodeNumber, &stubCalculation, 1);
+    ZCalculation zCalculations[2] = {
+            { builder->maxWalkForCalculatingZ, builder->ignoreUnalignedGaps, calculateZScoreWeightedAdapterFn, zArgs, NULL,
+                    constructNodePairs() },
+            { 1, builder->ignoreUnalignedGaps, calculateZScoreWeightedAdapterFn, directZArgs, NULL, constructNodePairs() } };
+    calculateZs(flower, builder->endIndicesToNodes, builder->nodeNumber, zCalculations, 2);
+    writeAdjacencies(fileHandle, "stubAdjacencies", &stubCalculation);
+    writeAdjacencies(fileHandle, "adjacencies", &zCalculations[0]);
+    writeAdjacencies(fileHandle, "directAdjacencies", &zCalculations[1]);
+    stHash_destruct(stubEndsToNodes);
+    free(stubEndIndicesToNodes);
+}
+
+void referenceBuilder_makeReference(ReferenceBuilder *builder) {
+    assert(builder->countDAL != NULL);
+    Flower *flower = builder->flower;
+    reference *ref = builder->ref;
+    stHash *nodesToEnds = builder->nodesToEnds;
 
     /*
      * Split reference intervals where the ordering of adjacent nodes
@@ -1105,19 +1456,22 @@ void buildReferenceTopDown(Flower *flower, const char *referenceEventHeader, int
      * The function returns a list of additional extra stub nodes, which
      * must then be turned into ends in the flower.
      */
-    refAdjList *countDAL = calculateZ(flower, endsToNodes, nodeNumber, 1, 1, countAdapterFn, NULL); //Gets set of adjacencies between stub ends.
-    void *extraArgs[3] = { nodesToEnds, countDAL, &minNumberOfSequencesToSupportAdjacency };
+    int64_t nodeBound;
+    End **nodesToEndsArray = getNodesToEndsArray(nodesToEnds, &nodeBound);
+    void *extraArgs[4] = { nodesToEndsArray, builder->countDAL, &builder->minNumberOfSequencesToSupportAdjacency, &nodeBound };
     stList *extraStubNodes = splitReferenceAtIndicatedLocations(ref, referenceSplitFn, extraArgs);
-    refAdjList_destruct(countDAL);
-    stHash_destruct(endsToNodes); //Note this does not destroy the associated memory.
+    free(nodesToEndsArray);
+    refAdjList_destruct(builder->countDAL);
+    stHash_destruct(builder->endsToNodes); //Note this does not destroy the associated memory.
+    free(builder->endIndicesToNodes);
 
     /*
      * Now re-join together pairs that need to be scaffolded together.
      */
     stList *prunedExtraStubNodes;
-    if (makeScaffolds) {
-        prunedExtraStubNodes = remakeReferenceIntervals(ref, referenceIntervalsToPreserve, extraStubNodes);
-        stList_destruct(referenceIntervalsToPreserve); //Clean this up.
+    if (builder->makeScaffolds) {
+        prunedExtraStubNodes = remakeReferenceIntervals(ref, builder->referenceIntervalsToPreserve, extraStubNodes);
+        stList_destruct(builder->referenceIntervalsToPreserve); //Clean this up.
     } else {
         prunedExtraStubNodes = stList_copy(extraStubNodes, NULL);
     }
@@ -1125,7 +1479,7 @@ void buildReferenceTopDown(Flower *flower, const char *referenceEventHeader, int
     /*
      * Convert the additional stub nodes into new stub ends, updating the endsToNodes and nodesToEnds sets.
      */
-    addAdditionalStubEnds(prunedExtraStubNodes, flower, nodesToEnds, newEnds);
+    addAdditionalStubEnds(prunedExtraStubNodes, flower, nodesToEnds, builder->newEnds);
     stList_destruct(prunedExtraStubNodes);
 
     /*
@@ -1146,20 +1500,103 @@ void buildReferenceTopDown(Flower *flower, const char *referenceEventHeader, int
     /*
      * Add the reference genome into flower
      */
-    makeReferenceThreads(flower, chosenEdges, nodesToEnds, referenceEvent, numberOfNsForScaffoldGap);
+    makeReferenceThreads(flower, chosenEdges, nodesToEnds, builder->referenceEvent, builder->numberOfNsForScaffoldGap);
 
     /*
      * Ensure the newly created ends have a group.
      */
-    assignGroups(newEnds, flower, referenceEvent);
+    assignGroups(builder->newEnds, flower, builder->referenceEvent);
 
     /*
      * Cleanup
      */
-    stList_destruct(newEnds);
+    stList_destruct(builder->newEnds);
     stHash_destruct(nodesToEnds);
     stList_destruct(chosenEdges);
     reference_destruct(ref);
-    stList_destruct(stubTangleEnds);
+    stList_destruct(builder->stubTangleEnds);
     stList_destruct(extraStubNodes);
+    free(builder);
+}
+
+void buildReferenceTopDown(Flower *flower, const char *referenceEventHeader, int64_t permutations,
+        stList *(*matchingAlgorithm)(stList *edges, int64_t nodeNumber), double (*temperature)(double),
+        ReferenceZScoreTables *zScoreTables, double phi, int64_t maxWalkForCalculatingZ,
+        bool ignoreUnalignedGaps, double wiggle, int64_t numberOfNsForScaffoldGap, int64_t minNumberOfSequencesToSupportAdjacency, bool makeScaffolds,
+        double maxOptimisationTime, double minRoundImprovement) {
+    /*
+     * Implements a greedy algorithm and greedy update sampler to find a solution to the adjacency problem for a net.
+     */
+    ReferenceBuilder *builder = referenceBuilder_construct(flower, referenceEventHeader, permutations, matchingAlgorithm,
+            temperature, zScoreTables, phi, maxWalkForCalculatingZ, ignoreUnalignedGaps, wiggle, numberOfNsForScaffoldGap,
+            minNumberOfSequencesToSupportAdjacency, makeScaffolds, maxOptimisationTime, minRoundImprovement);
+    referenceBuilder_optimise(builder);
+    referenceBuilder_makeReference(builder);
+}
+
+/*
+ * With a scheduler the builders of at most this many nested flowers per thread are held at once.
+ */
+static const int64_t buildersPerThread = 4;
+
+static void *calculateZsFn(void *builder) {
+    referenceBuilder_calculateZs(builder);
+    return NULL;
+}
+
+stCaf_Scheduler *referenceBuilder_constructScheduler(int64_t threads) {
+    return stCaf_Scheduler_construct(threads, calculateZsFn, NULL);
+}
+
+void buildReferencesOfNestedFlowers(Flower *flower, stCaf_Scheduler *scheduler, void (*finishFn)(Flower *nestedFlower),
+        const char *referenceEventHeader, int64_t permutations,
+        stList *(*matchingAlgorithm)(stList *edges, int64_t nodeNumber), double (*temperature)(double),
+        ReferenceZScoreTables *zScoreTables, double phi, int64_t maxWalkForCalculatingZ,
+        bool ignoreUnalignedGaps, double wiggle, int64_t numberOfNsForScaffoldGap, int64_t minNumberOfSequencesToSupportAdjacency, bool makeScaffolds,
+        double maxOptimisationTime, double minRoundImprovement) {
+    /*
+     * The nested flowers are taken in batches, in group order. The z-scores of the flowers of a batch, which are
+     * deterministic and only read the flowers, are calculated on the scheduler's threads. Everything else, including
+     * the randomised ordering passes, which draw from the process wide random number generator, is done by this
+     * thread, one flower at a time in group order, so the random numbers drawn for each flower, and the unique IDs
+     * used, are those of the serial loop.
+     */
+    int64_t maxBatchSize = scheduler == NULL ? 1 : buildersPerThread * stCaf_Scheduler_getNumThreads(scheduler);
+    Flower_GroupIterator *groupIt = flower_getGroupIterator(flower);
+    Group *group = flower_getNextGroup(groupIt);
+    while (group != NULL) {
+        stList *nestedFlowers = stList_construct();
+        stList *builders = stList_construct();
+        for (; group != NULL && stList_length(builders) < maxBatchSize; group = flower_getNextGroup(groupIt)) {
+            Flower *nestedFlower = group_getNestedFlower(group);
+            if (nestedFlower != NULL) {
+                ReferenceBuilder *builder = referenceBuilder_construct(nestedFlower, referenceEventHeader, permutations,
+                        matchingAlgorithm, temperature, zScoreTables, phi, maxWalkForCalculatingZ, ignoreUnalignedGaps, wiggle,
+                        numberOfNsForScaffoldGap, minNumberOfSequencesToSupportAdjacency, makeScaffolds,
+                        maxOptimisationTime, minRoundImprovement);
+                stList_append(nestedFlowers, nestedFlower);
+                stList_append(builders, builder);
+                if (scheduler != NULL) {
+                    stCaf_Scheduler_push(scheduler, builder, referenceBuilder_getNodeNumber(builder));
+                }
+            }
+        }
+        if (scheduler != NULL) {
+            stCaf_Scheduler_wait(scheduler);
+        }
+        for (int64_t i = 0; i < stList_length(builders); i++) {
+            ReferenceBuilder *builder = stList_get(builders, i);
+            if (scheduler == NULL) {
+                referenceBuilder_calculateZs(builder);
+            }
+            referenceBuilder_orderNodes(builder);
+            referenceBuilder_makeReference(builder);
+            if (finishFn != NULL) {
+                finishFn(stList_get(nestedFlowers, i));
+            }
+        }
+        stList_destruct(nestedFlowers);
+        stList_destruct(builders);
+    }
+    flower_destructGroupIterator(groupIt);
 }
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <stdlib.h>
+
+#include "cactus.h"
+#include "sonLib.h"
+#include "segmentStrings.h"
+
+/*
+ * Segments of a sequence separated by at most this many bases are got in one range. It is the distance
+ * within which cactusDisk_preCacheSegmentStrings merges the segments it caches, so each range is
+ * within one record of the string cache.
+ */
+static const int64_t maxGap = 500;
+
+typedef struct _sequenceRange {
+    MetaSequence *metaSequence;
+    int64_t start;
+    int64_t length;
+    char *string;
+    char *reverseString; //The reverse complement of string, made when first needed.
+} SequenceRange;
+
+typedef struct _segmentCoordinates {
+    Segment *segment; //The positive orientation of the segment.
+    MetaSequence *metaSequence;
+    int64_t start; //The start and length on the positive strand of the sequence.
+    int64_t length;
+    SequenceRange *range;
+} SegmentCoordinates;
+
+struct _segmentStrings {
+    SegmentCoordinates *segments;
+    int64_t segmentNumber;
+    SequenceRange *ranges;
+    int64_t rangeNumber;
+    stHash *segmentsToCoordinates;
+};
+
+static int compareSegmentCoordinates(const void *a, const void *b) {
+    const SegmentCoordinates *coordinates1 = a, *coordinates2 = b;
+    int i = cactusMisc_nameCompare(metaSequence_getName(coordinates1->metaSequence),
+            metaSequence_getName(coordinates2->metaSequence));
+    if (i != 0) {
+        return i;
+    }
+    return coordinates1->start < coordinates2->start ? -1 : (coordinates1->start > coordinates2->start ? 1 : 0);
+}
+
+static SegmentStrings *segmentStrings_constructForBlocks(stList *blocks) {
+    SegmentStrings *segmentStrings = st_calloc(1, sizeof(SegmentStrings));
+    int64_t maxSegmentNumber = 0;
+    for (int64_t i = 0; i < stList_length(blocks); i++) {
+        maxSegmentNumber += block_getInstanceNumber(stList_get(blocks, i));
+    }
+    segmentStrings->segments = st_malloc(sizeof(SegmentCoordinates) * (maxSegmentNumber > 0 ? maxSegmentNumber : 1));
+
+    //Gather the coordinates of the segments with sequences.
+    for (int64_t i = 0; i < stList_length(blocks); i++) {
+        Block_InstanceIterator *segmentIt = block_getInstanceIterator(stList_get(blocks, i));
+        Segment *segment;
+        while ((segment = block_getNext(segmentIt)) != NULL) {
+            Sequence *sequence = segment_getSequence(segment);
+            if (sequence != NULL) {
+                SegmentCoordinates *coordinates = &segmentStrings->segments[segmentStrings->segmentNumber++];
+                coordinates->segment = segment_getPositiveOrientation(segment);
+                coordinates->metaSequence = sequence_getMetaSequence(sequence);
+                coordinates->start = segment_getStart(segment_getStrand(segment) ? segment : segment_getReverse(segment));
+                coordinates->length = segment_getLength(segment);
+            }
+        }
+        block_destructInstanceIterator(segmentIt);
+    }
+
+    //Merge the coordinates into ranges of each sequence.
+    qsort(segmentStrings->segments, segmentStrings->segmentNumber, sizeof(SegmentCoordinates), compareSegmentCoordinates);
+    segmentStrings->ranges = st_malloc(sizeof(SequenceRange) * (segmentStrings->segmentNumber > 0 ? segmentStrings->segmentNumber : 1));
+    SequenceRange *range = NULL;
+    for (int64_t i = 0; i < segmentStrings->segmentNumber; i++) {
+        SegmentCoordinates *coordinates = &segmentStrings->segments[i];
+        if (range != NULL && range->metaSequence == coordinates->metaSequence
+                && range->start + range->length + maxGap >= coordinates->start) {
+            if (range->start + range->length < coordinates->start + coordinates->length) {
+                range->length = coordinates->start + coordinates->length - range->start;
+            }
+        } else {
+            range = &segmentStrings->ranges[segmentStrings->rangeNumber++];
+            range->metaSequence = coordinates->metaSequence;
+            range->start = coordinates->start;
+            range->length = coordinates->length;
+            range->reverseString = NULL;
+        }
+    }
+
+    //Get the string of each range, then hash the segments to their coordinates, which point into the ranges.
+    for (int64_t i = 0; i < segmentStrings->rangeNumber; i++) {
+        range = &segmentStrings->ranges[i];
+        range->string = metaSequence_getString(range->metaSequence, range->start, range->length, 1);
+    }
+    segmentStrings->segmentsToCoordinates = stHash_construct();
+    int64_t j = 0;
+    for (int64_t i = 0; i < segmentStrings->segmentNumber; i++) {
+        SegmentCoordinates *coordinates = &segmentStrings->segments[i];
+        while (segmentStrings->ranges[j].metaSequence != coordinates->metaSequence
+                || segmentStrings->ranges[j].start + segmentStrings->ranges[j].length < coordinates->start + coordinates->length) {
+            j++;
+            assert(j < segmentStrings->rangeNumber);
+        }
+        coordinates->range = &segmentStrings->ranges[j];
+        stHash_insert(segmentStrings->segmentsToCoordinates, coordinates->segment, coordinates);
+    }
+    return segmentStrings;
+}
+
+SegmentStrings *segmentStrings_construct(stList *flowers) {
+    stList *blocks = stList_construct();
+    for (int64_t i = 0; i < stList_length(flowers); i++) {
+        Flower_BlockIterator *blockIt = flower_getBlockIterator(stList_get(flowers, i));
+        Block *block;
+        while ((block = flower_getNextBlock(blockIt)) != NULL) {
+            stList_append(blocks, block);
+        }
+        flower_destructBlockIterator(blockIt);
+    }
+    SegmentStrings *segmentStrings = segmentStrings_constructForBlocks(blocks);
+    stList_destruct(blocks);
+    return segmentStrings;
+}
+
+SegmentStrings *segmentStrings_constructForBlock(Block *block) {
+    stList *blocks = stList_construct();
+    stList_append(blocks, block);
+    SegmentStrings *segmentStrings = segmentStrings_constructForBlocks(blocks);
+    stList_destruct(blocks);
+    return segmentStrings;
+}
+
+void segmentStrings_destruct(SegmentStrings *segmentStrings) {
+    for (int64_t i = 0; i < segmentStrings->rangeNumber; i++) {
+        free(segmentStrings->ranges[i].string);
+        free(segmentStrings->ranges[i].reverseString);
+    }
+    stHash_destruct(segmentStrings->segmentsToCoordinates);
+    free(segmentStrings->ranges);
+    free(segmentStrings->segments);
+    free(segmentStrings);
+}
+
+const char *segmentStrings_get(SegmentStrings *segmentStrings, Segment *segment) {
+    if (segment_getSequence(segment) == NULL) {
+        return NULL;
+    }
+    SegmentCoordinates *coordinates = stHash_search(segmentStrings->segmentsToCoordinates,
+            segment_getPositiveOrientation(segment));
+    assert(coordinates != NULL);
+    SequenceRange *range = coordinates->range;
+    if (segment_getStrand(segment)) {
+        return range->string + (coordinates->start - range->start);
+    }
+    if (range->reverseString == NULL) {
+        range->reverseString = stString_reverseComplementString(range->string);
+    }
+    return range->reverseString + (range->start + range->length - coordinates->start - coordinates->length);
+}
+
+int64_t segmentStrings_getRangeNumber(SegmentStrings *segmentStrings) {
+    return segmentStrings->rangeNumber;
+}
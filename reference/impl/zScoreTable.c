@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <math.h>
+#include <float.h>
+
+#include "sonLib.h"
+#include "stReferenceProblem2.h"
+#include "zScoreTable.h"
+
+/*
+ * The z-score of a 5 and 3 segment of lengths n and m separated by a gap of k is the sum of
+ * beta^(i + j + k) over i < n and j < m, where beta = 1 - theta, which is
+ * beta^k * (1 - beta^n) * (1 - beta^m) / theta^2. The powers of beta are the products of an
+ * entry of a table of the powers below 2^lowBits and one of the powers of beta^(2^lowBits).
+ */
+static const int64_t lowBits = 12;
+static const int64_t maxHighSize = 1 << 16;
+//Scores smaller than this are not added to the adjacency lists, see calculateZs.
+static const double smallestScore = 0.0000000001;
+
+struct _zScoreTable {
+    double theta;
+    double inverseThetaSquared;
+    double *lowPowers; //beta^i, for i < 2^lowBits
+    double *lowComplements; //1 - beta^i, for i < 2^lowBits, computed without cancellation
+    double *highPowers; //beta^(i * 2^lowBits), for i < highSize
+    int64_t highSize;
+    bool exact;
+    double maxRelativeError;
+};
+
+static double getPower(ZScoreTable *table, int64_t i) {
+    int64_t j = i >> lowBits;
+    if (j >= table->highSize) {
+        //Past the tables the powers are too small to matter, or only reached for tiny thetas.
+        return pow(1.0 - table->theta, i);
+    }
+    return table->lowPowers[i & ((1 << lowBits) - 1)] * table->highPowers[j];
+}
+
+static double getComplement(ZScoreTable *table, int64_t i) {
+    return i < (1 << lowBits) ? table->lowComplements[i] : 1.0 - getPower(table, i);
+}
+
+static double getTabulatedZScore(ZScoreTable *table, int64_t length5Segment, int64_t length3Segment, int64_t gap) {
+    assert(length5Segment >= 0 && length3Segment >= 0 && gap >= 0);
+    return getPower(table, gap) * getComplement(table, length5Segment) * getComplement(table, length3Segment)
+            * table->inverseThetaSquared;
+}
+
+/*
+ * Compares the tables to calculateZScore over a grid of lengths and gaps, including those either
+ * side of the boundaries of the tables, returning the largest relative error.
+ */
+static double checkTable(ZScoreTable *table) {
+    int64_t lowSize = 1 << lowBits, highBoundary = lowSize * table->highSize;
+    int64_t values[] = { 1, 2, 3, 100, lowSize - 1, lowSize, lowSize + 1, 100000, 10000000, highBoundary - 1,
+            highBoundary, highBoundary + 1 };
+    int64_t valueNumber = sizeof(values) / sizeof(int64_t);
+    double maxRelativeError = 0.0;
+    for (int64_t i = 0; i < valueNumber; i++) {
+        int64_t length5Segment = values[i];
+        for (int64_t j = 0; j < valueNumber; j++) {
+            int64_t length3Segment = values[j];
+            for (int64_t k = 0; k < valueNumber; k++) {
+                int64_t gap = values[k];
+                double exactScore = calculateZScore(length5Segment, length3Segment, gap, table->theta);
+                double score = getTabulatedZScore(table, length5Segment, length3Segment, gap);
+                double relativeError = fabs(score - exactScore) / (fabs(exactScore) > smallestScore ? fabs(exactScore) : smallestScore);
+                if (!(relativeError <= maxRelativeError)) { //Also catches NaNs.
+                    maxRelativeError = relativeError;
+                }
+            }
+        }
+    }
+    return maxRelativeError;
+}
+
+ZScoreTable *zScoreTable_construct(double theta, double maxRelativeError) {
+    assert(theta >= 0.0 && theta <= 1.0);
+    ZScoreTable *table = st_calloc(1, sizeof(ZScoreTable));
+    table->theta = theta;
+    if (theta <= 0.0 || theta >= 1.0) {
+        //The scores are just products of the lengths, or zero.
+        table->exact = 1;
+        return table;
+    }
+    table->inverseThetaSquared = 1.0 / (theta * theta);
+    int64_t lowSize = 1 << lowBits;
+    double logBeta = log1p(-theta);
+    table->lowPowers = st_malloc(sizeof(double) * lowSize);
+    table->lowComplements = st_malloc(sizeof(double) * lowSize);
+    for (int64_t i = 0; i < lowSize; i++) {
+        table->lowPowers[i] = exp(i * logBeta);
+        table->lowComplements[i] = -expm1(i * logBeta);
+    }
+    //Tabulate the high powers until they underflow, or the table gets too big.
+    double underflow = log(DBL_MIN) / logBeta / lowSize;
+    table->highSize = underflow < maxHighSize ? ((int64_t) underflow) + 2 : maxHighSize;
+    table->highPowers = st_malloc(sizeof(double) * table->highSize);
+    for (int64_t i = 0; i < table->highSize; i++) {
+        table->highPowers[i] = exp(i * lowSize * logBeta);
+    }
+    table->maxRelativeError = checkTable(table);
+    if (table->maxRelativeError > maxRelativeError) {
+        st_logInfo("The z-score tables for theta %f have a relative error of %g, using calculateZScore instead\n",
+                theta, table->maxRelativeError);
+        table->exact = 1;
+    }
+    return table;
+}
+
+void zScoreTable_destruct(ZScoreTable *table) {
+    free(table->lowPowers);
+    free(table->lowComplements);
+    free(table->highPowers);
+    free(table);
+}
+
+double zScoreTable_get(ZScoreTable *table, int64_t length5Segment, int64_t length3Segment, int64_t gap) {
+    if (table->exact) {
+        return calculateZScore(length5Segment, length3Segment, gap, table->theta);
+    }
+    return getTabulatedZScore(table, length5Segment, length3Segment, gap);
+}
+
+double zScoreTable_getMaxRelativeError(ZScoreTable *table) {
+    return table->maxRelativeError;
+}
+
+bool zScoreTable_isExact(ZScoreTable *table) {
+    return table->exact;
+}
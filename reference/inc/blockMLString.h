@@ -8,8 +8,16 @@
 #ifndef BLOCKMLSTRING_H_
 #define BLOCKMLSTRING_H_
 
+#include "segmentStrings.h"
+
 char *getMaximumLikelihoodString(stTree *tree, Block *block);
 
+/*
+ * As getMaximumLikelihoodString, but taking the strings of the segments of the block from segmentStrings,
+ * which must include the block, rather than getting them.
+ */
+char *getMaximumLikelihoodString2(stTree *tree, Block *block, SegmentStrings *segmentStrings);
+
 stMatrix *generateJukesCantorMatrix(double distance);
 
 stTree *getPhylogeneticTreeRootedAtGivenEvent(Event *event, stMatrix *(*generateSubstitutionMatrix)(double));
@@ -20,6 +28,36 @@ stMatrix *getSubMatrix(stTree *tree);
 
 void cleanupPhylogeneticTree(stTree *tree);
 
+/*
+ * Makes a node of a phylogenetic tree, as made by getPhylogeneticTreeRootedAtGivenEvent, whose parent
+ * branch has the given substitution matrix (4x4, freed with the tree by cleanupPhylogeneticTree).
+ */
+stTree *makePhylogeneticTreeNode(stMatrix *substitutionMatrix, Event *event);
+
+/*
+ * Gets the probabilities of each base (4 per position) at each position of a block of the given length at
+ * the root of the tree, by Felsenstein's algorithm, from a hash of the events of the leaves to lists of
+ * their strings. getBlockBaseProbs makes one pass over the nodes of the tree, sharing identical substitution
+ * matrices and reusing buffers kept with the tree, while getBlockBaseProbsRecursively is the recursive
+ * version getMaximumLikelihoodString used before; the results are the same.
+ */
+double *getBlockBaseProbs(stTree *tree, stHash *eventsToStrings, int64_t blockLength);
+
+double *getBlockBaseProbsRecursively(stTree *tree, stHash *eventsToStrings, int64_t blockLength);
+
+/*
+ * As getBlockBaseProbs, but computing the base probabilities of each distinct pattern of leaf bases in
+ * the columns of the block once, setting patternNumber to the number of patterns. getMaximumLikelihoodString
+ * uses this.
+ */
+double *getBlockBaseProbsByPattern(stTree *tree, stHash *eventsToStrings, int64_t blockLength, int64_t *patternNumber);
+
+/*
+ * If not NULL, getMaximumLikelihoodString writes the number of column patterns of each block, and the
+ * compression ratio (the length of the block over the number of patterns), to the given file.
+ */
+void setColumnPatternReportFile(FILE *fileHandle);
+
 void maskAncestralRepeatBases(Block *block, char *mlString);
 
 #endif /* BLOCKMLSTRING_H_ */
@@ -18,23 +18,136 @@
 
 #include "cactus.h"
 #include "stMatchingAlgorithms.h"
+#include "stReferenceProblem2.h"
+#include "stCafScheduler.h"
 
 extern const char *REFERENCE_BUILDING_EXCEPTION;
 
 /*
- * Construct a reference for the flower, top down.
+ * The z-score tables used to score the adjacencies, for the given theta and for theta = 0 (for the
+ * direct adjacencies). They depend only on theta, so are made once for a run and passed to the
+ * functions below, and are only read by them, so can be shared by threads.
+ */
+typedef struct _referenceZScoreTables ReferenceZScoreTables;
+
+ReferenceZScoreTables *referenceZScoreTables_construct(double theta);
+
+void referenceZScoreTables_destruct(ReferenceZScoreTables *zScoreTables);
+
+/*
+ * Construct a reference for the flower, top down. The adjacencies are scored with the z-score tables
+ * made by referenceZScoreTables_construct for the theta of the run.
+ *
+ * If maxOptimisationTime or minRoundImprovement is positive the rounds of updating and nudging the
+ * reference are run one at a time, stopping once maxOptimisationTime seconds have passed since the
+ * optimisation of the flower started, or once a round improves the score by less than
+ * minRoundImprovement times the max possible score, and the score after each round is logged.
+ * Otherwise all the rounds are run. With a time budget the reference depends on how fast the
+ * rounds run, so may differ from run to run.
  */
 void buildReferenceTopDown(Flower *flower, const char *referenceEventHeader,
         int64_t permutations,
         stList *(*matchingAlgorithm)(stList *edges, int64_t nodeNumber),
         double (*temperature)(double),
-        double theta,
+        ReferenceZScoreTables *zScoreTables,
+        double phi,
+        int64_t maxWalkForCalculatingZ, bool ignoreUnalignedGaps,
+        double wiggle, int64_t numberOfNsForScaffoldGap,
+        int64_t minNumberOfSequencesToSupportAdjacency, bool makeScaffolds,
+        double maxOptimisationTime, double minRoundImprovement);
+
+/*
+ * The steps of buildReferenceTopDown, split so that the z-scores of sibling flowers can be
+ * calculated concurrently. Constructing the builder and making the reference use the (non-reentrant)
+ * cactus API, and ordering the nodes draws from sonLib's process wide random number generator, so
+ * these must be called from one thread at a time, while referenceBuilder_calculateZs only reads the
+ * flower, draws no random numbers, and can be run concurrently for the builders of different flowers.
+ * Nothing is written to the flower, and no unique IDs are used, until referenceBuilder_makeReference,
+ * so ordering the nodes and making the reference of each flower in the order buildReferenceTopDown
+ * would be called gives the same result.
+ */
+typedef struct _referenceBuilder ReferenceBuilder;
+
+/*
+ * Gets the nodes and stub intervals of the reference problem for the flower. Takes the
+ * arguments of buildReferenceTopDown.
+ */
+ReferenceBuilder *referenceBuilder_construct(Flower *flower, const char *referenceEventHeader,
+        int64_t permutations,
+        stList *(*matchingAlgorithm)(stList *edges, int64_t nodeNumber),
+        double (*temperature)(double),
+        ReferenceZScoreTables *zScoreTables,
+        double phi,
+        int64_t maxWalkForCalculatingZ, bool ignoreUnalignedGaps,
+        double wiggle, int64_t numberOfNsForScaffoldGap,
+        int64_t minNumberOfSequencesToSupportAdjacency, bool makeScaffolds,
+        double maxOptimisationTime, double minRoundImprovement);
+
+/*
+ * Calculates the adjacency scores. Can be run concurrently for different builders.
+ */
+void referenceBuilder_calculateZs(ReferenceBuilder *builder);
+
+/*
+ * Finds the ordering of the nodes, by the greedy, permutation and nudging passes, after
+ * referenceBuilder_calculateZs.
+ */
+void referenceBuilder_orderNodes(ReferenceBuilder *builder);
+
+/*
+ * Calculates the adjacency scores and finds the ordering of the nodes.
+ */
+void referenceBuilder_optimise(ReferenceBuilder *builder);
+
+/*
+ * The number of nodes in the reference problem, a rough measure of the work to optimise it.
+ */
+int64_t referenceBuilder_getNodeNumber(ReferenceBuilder *builder);
+
+/*
+ * Writes the reference problem for the flower, so it can be replayed by cactus_referenceMatchingBenchmark:
+ * the node number, the stub nodes, the intervals of the empty reference and the weights of the
+ * adjacencies between the stubs (used to match them in the top level flower), of all the
+ * adjacencies and of the direct adjacencies. Must be called before referenceBuilder_optimise.
+ */
+void referenceBuilder_writeProblem(ReferenceBuilder *builder, FILE *fileHandle);
+
+/*
+ * Adds the reference threads to the flower, then destructs the builder.
+ */
+void referenceBuilder_makeReference(ReferenceBuilder *builder);
+
+/*
+ * Makes a scheduler whose threads calculate the z-scores of reference builders, to pass to
+ * buildReferencesOfNestedFlowers.
+ */
+stCaf_Scheduler *referenceBuilder_constructScheduler(int64_t threads);
+
+/*
+ * Builds the references of the nested flowers of the flower, which must have its reference, as
+ * calling buildReferenceTopDown on each in group order would, then calls finishFn (if not NULL) on
+ * each, in the same order. If scheduler is not NULL the z-scores of batches of the nested flowers are
+ * calculated on its threads; the result is the same. Takes the other arguments of buildReferenceTopDown.
+ */
+void buildReferencesOfNestedFlowers(Flower *flower, stCaf_Scheduler *scheduler, void (*finishFn)(Flower *nestedFlower),
+        const char *referenceEventHeader,
+        int64_t permutations,
+        stList *(*matchingAlgorithm)(stList *edges, int64_t nodeNumber),
+        double (*temperature)(double),
+        ReferenceZScoreTables *zScoreTables,
         double phi,
         int64_t maxWalkForCalculatingZ, bool ignoreUnalignedGaps,
         double wiggle, int64_t numberOfNsForScaffoldGap,
-        int64_t minNumberOfSequencesToSupportAdjacency, bool makeScaffolds);
+        int64_t minNumberOfSequencesToSupportAdjacency, bool makeScaffolds,
+        double maxOptimisationTime, double minRoundImprovement);
 
-double *calculateZ(Flower *flower, stHash *endsToNodes, double theta);
+/*
+ * Calculates the scores of the adjacencies between the ends in endsToNodes (a hash of ends to
+ * stIntTuple nodes), adding zScoreFn of each pair of segments of a thread within
+ * maxWalkForCalculatingZ segments of one another.
+ */
+refAdjList *calculateZ(Flower *flower, stHash *endsToNodes, int64_t nodeNumber, int64_t maxWalkForCalculatingZ,
+        bool ignoreUnalignedGaps, double (*zScoreFn)(Cap *, int64_t, int64_t, int64_t, void *), void *zScoreExtraArgs);
 
 /*
  * Weights events by how informative they are for inferring the
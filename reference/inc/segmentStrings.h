@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+/*
+ * segmentStrings.h
+ *
+ * Gets the strings of all the segments of a set of blocks at once. The coordinates of the segments
+ * are sorted and merged into ranges of each sequence, each of which is got from the cactus disk with
+ * one call, and the string of each segment is then a view into the string of its range (or into its
+ * reverse complement), rather than a copy made by segment_getString.
+ */
+
+#ifndef SEGMENTSTRINGS_H_
+#define SEGMENTSTRINGS_H_
+
+#include "cactus.h"
+#include "sonLib.h"
+
+typedef struct _segmentStrings SegmentStrings;
+
+/*
+ * Gets the strings of the segments of the blocks of the given flowers.
+ */
+SegmentStrings *segmentStrings_construct(stList *flowers);
+
+/*
+ * Gets the strings of the segments of the given block.
+ */
+SegmentStrings *segmentStrings_constructForBlock(Block *block);
+
+void segmentStrings_destruct(SegmentStrings *segmentStrings);
+
+/*
+ * Returns the string of the segment, as segment_getString, or NULL if the segment has no sequence.
+ * The string is owned by segmentStrings and is not null terminated, its length being that of the
+ * segment. The segment must be a segment, in either orientation, of one of the blocks.
+ */
+const char *segmentStrings_get(SegmentStrings *segmentStrings, Segment *segment);
+
+/*
+ * The number of ranges of sequence the strings were got in.
+ */
+int64_t segmentStrings_getRangeNumber(SegmentStrings *segmentStrings);
+
+#endif /* SEGMENTSTRINGS_H_ */
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+/*
+ * zScoreTable.h
+ *
+ * A cached version of calculateZScore for one value of theta, which looks up
+ * the powers of (1 - theta) it needs in tables rather than calling pow.
+ */
+
+#ifndef ZSCORETABLE_H_
+#define ZSCORETABLE_H_
+
+#include "sonLib.h"
+
+typedef struct _zScoreTable ZScoreTable;
+
+/*
+ * Makes the tables for the given theta, then checks them against calculateZScore over a grid of
+ * segment lengths and gaps. If any score differs by more than maxRelativeError (relative to the
+ * larger of the score and the smallest score worth adding), the tables are not used and
+ * zScoreTable_get calls calculateZScore instead.
+ */
+ZScoreTable *zScoreTable_construct(double theta, double maxRelativeError);
+
+void zScoreTable_destruct(ZScoreTable *table);
+
+/*
+ * As calculateZScore(length5Segment, length3Segment, gap, theta).
+ */
+double zScoreTable_get(ZScoreTable *table, int64_t length5Segment, int64_t length3Segment, int64_t gap);
+
+/*
+ * The largest relative error found by the check in zScoreTable_construct.
+ */
+double zScoreTable_getMaxRelativeError(ZScoreTable *table);
+
+/*
+ * Returns non-zero if the tables failed the check, or theta is 0 or 1, so zScoreTable_get calls
+ * calculateZScore.
+ */
+bool zScoreTable_isExact(ZScoreTable *table);
+
+#endif /* ZSCORETABLE_H_ */
@@ -157,10 +157,145 @@ static void testMLStringMakesScaffoldGaps(CuTest *testCase) {
     }
 }
 
+static stTree *makeRandomTree(char *events, int64_t *eventNumber, int64_t depth) {
+    /*
+     * Makes a random tree whose nodes have 0 to 3 children, and whose leaves have the given addresses as events.
+     */
+    stTree *tree = makePhylogeneticTreeNode(generateJukesCantorMatrix(st_randomInt(1, 4) * 0.05), (Event *) &events[(*eventNumber)++]);
+    int64_t childNumber = depth > 0 ? st_randomInt(0, 4) : 0;
+    for (int64_t i = 0; i < childNumber; i++) {
+        stTree_setParent(makeRandomTree(events, eventNumber, depth - 1), tree);
+    }
+    return tree;
+}
+
+static void addRandomLeafStrings(stTree *tree, stHash *eventsToStrings, char *ancestralString, double mutationRate, int64_t blockLength) {
+    if (stTree_getChildNumber(tree) == 0 && st_random() > 0.2) {
+        stList *strings = stList_construct3(0, free);
+        for (int64_t i = st_randomInt(0, 3); i >= 0; i--) {
+            char *string = st_malloc(blockLength + 1);
+            for (int64_t j = 0; j < blockLength; j++) {
+                string[j] = st_random() < mutationRate ? "ACGTNacgtn-"[st_randomInt(0, 11)] : ancestralString[j];
+            }
+            string[blockLength] = '\0';
+            stList_append(strings, string);
+        }
+        stHash_insert(eventsToStrings, getEvent(tree), strings);
+    }
+    for (int64_t i = 0; i < stTree_getChildNumber(tree); i++) {
+        addRandomLeafStrings(stTree_getChild(tree, i), eventsToStrings, ancestralString, mutationRate, blockLength);
+    }
+}
+
+static void testBlockBaseProbs(CuTest *testCase) {
+    /*
+     * Checks the one pass version of Felsenstein's algorithm, and the one computing each column pattern once, get exactly
+     * the base probabilities of the recursive one.
+     */
+    for (int64_t test = 0; test < 100; test++) {
+        char *events = st_malloc(1000);
+        int64_t eventNumber = 0;
+        stTree *tree = makeRandomTree(events, &eventNumber, 5);
+        //Blocks of different lengths, to check the buffers kept with the tree are resized.
+        for (int64_t block = 0; block < 3; block++) {
+            int64_t blockLength = st_randomInt(1, 200);
+            char *ancestralString = st_malloc(blockLength + 1);
+            for (int64_t j = 0; j < blockLength; j++) {
+                ancestralString[j] = "ACGT"[st_randomInt(0, 4)];
+            }
+            stHash *eventsToStrings = stHash_construct2(NULL, (void (*)(void *)) stList_destruct);
+            //Conserved blocks have few column patterns, random ones many.
+            addRandomLeafStrings(tree, eventsToStrings, ancestralString, st_random() > 0.5 ? 0.05 : 1.0, blockLength);
+            double *baseProbs = getBlockBaseProbsRecursively(tree, eventsToStrings, blockLength);
+            double *baseProbs2 = getBlockBaseProbs(tree, eventsToStrings, blockLength);
+            int64_t patternNumber;
+            double *baseProbs3 = getBlockBaseProbsByPattern(tree, eventsToStrings, blockLength, &patternNumber);
+            CuAssertTrue(testCase, patternNumber >= 1 && patternNumber <= blockLength);
+            for (int64_t i = 0; i < blockLength * 4; i++) {
+                CuAssertTrue(testCase, baseProbs[i] == baseProbs2[i]);
+                CuAssertTrue(testCase, baseProbs[i] == baseProbs3[i]);
+            }
+            free(baseProbs);
+            free(baseProbs2);
+            free(baseProbs3);
+            free(ancestralString);
+            stHash_destruct(eventsToStrings);
+        }
+        cleanupPhylogeneticTree(tree);
+        free(events);
+    }
+}
+
+static void testSegmentStrings(CuTest *testCase) {
+    /*
+     * Checks the strings got in bulk for the segments of a flower are those got by segment_getString.
+     */
+    for (int64_t testNum = 0; testNum < 100; testNum++) {
+        CactusDisk *cactusDisk = testCommon_getTemporaryCactusDisk(testCase->name);
+        eventTree_construct2(cactusDisk);
+        Flower *flower = flower_construct(cactusDisk);
+        Event *event = eventTree_getRootEvent(flower_getEventTree(flower));
+        //Make some random sequences
+        stList *sequences = stList_construct();
+        int64_t sequenceNumber = st_randomInt(1, 4);
+        int64_t *nextStarts = st_calloc(sequenceNumber, sizeof(int64_t));
+        for (int64_t i = 0; i < sequenceNumber; i++) {
+            MetaSequence *metaSeq = metaSequence_construct(1, 5000, stRandom_getRandomDNAString(5000, 1, 1, 1),
+                    "boo", event_getName(event), cactusDisk);
+            stList_append(sequences, sequence_construct(metaSeq, flower));
+        }
+        //Make blocks of segments at increasing, non-overlapping coordinates of the sequences, on either strand,
+        //some close enough together to be got in the same range.
+        int64_t blockNumber = st_randomInt(1, 20);
+        for (int64_t i = 0; i < blockNumber; i++) {
+            Block *block = block_construct(st_randomInt(1, 50), flower);
+            while (st_random() > 0.2) {
+                int64_t j = st_randomInt(0, sequenceNumber);
+                int64_t start = nextStarts[j] + st_randomInt(0, st_random() > 0.5 ? 10 : 1000);
+                if (start + block_getLength(block) <= 5000) {
+                    segment_construct2(block, start + 1, st_random() > 0.5, stList_get(sequences, j));
+                    nextStarts[j] = start + block_getLength(block);
+                } else {
+                    segment_construct(block, event);
+                }
+            }
+        }
+        //Check the strings of the segments, in both orientations
+        stList *flowers = stList_construct();
+        stList_append(flowers, flower);
+        SegmentStrings *segmentStrings = segmentStrings_construct(flowers);
+        CuAssertTrue(testCase, segmentStrings_getRangeNumber(segmentStrings) <= flower_getSegmentNumber(flower));
+        Flower_SegmentIterator *segmentIt = flower_getSegmentIterator(flower);
+        Segment *segment;
+        while ((segment = flower_getNextSegment(segmentIt)) != NULL) {
+            for (int64_t i = 0; i < 2; i++) {
+                segment = segment_getReverse(segment);
+                char *string = segment_getString(segment);
+                const char *string2 = segmentStrings_get(segmentStrings, segment);
+                if (string == NULL) {
+                    CuAssertTrue(testCase, string2 == NULL);
+                } else {
+                    CuAssertTrue(testCase, string2 != NULL);
+                    CuAssertTrue(testCase, strncmp(string, string2, segment_getLength(segment)) == 0);
+                }
+                free(string);
+            }
+        }
+        flower_destructSegmentIterator(segmentIt);
+        segmentStrings_destruct(segmentStrings);
+        stList_destruct(flowers);
+        stList_destruct(sequences);
+        free(nextStarts);
+        testCommon_deleteTemporaryCactusDisk(testCase->name, cactusDisk);
+    }
+}
+
 CuSuite* addReferenceCoordinatesTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, testMLStringRandom);
     SUITE_ADD_TEST(suite, testMLStringMakesScaffoldGaps);
+    SUITE_ADD_TEST(suite, testBlockBaseProbs);
+    SUITE_ADD_TEST(suite, testSegmentStrings);
 
     return suite;
 }
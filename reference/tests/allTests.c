@@ -10,6 +10,7 @@
 CuSuite *buildReferenceTestSuite(void);
 CuSuite* addReferenceCoordinatesTestSuite(void);
 CuSuite* recursiveThreadBuilderTestSuite(void);
+CuSuite* zScoreTableTestSuite(void);
 
 int referenceRunAllTests(void) {
     CuString *output = CuStringNew();
@@ -17,6 +18,7 @@ int referenceRunAllTests(void) {
     CuSuiteAddSuite(suite, buildReferenceTestSuite());
     CuSuiteAddSuite(suite, addReferenceCoordinatesTestSuite());
     CuSuiteAddSuite(suite, recursiveThreadBuilderTestSuite());
+    CuSuiteAddSuite(suite, zScoreTableTestSuite());
 
     CuSuiteRun(suite);
     CuSuiteSummary(suite, output);
@@ -7,6 +7,9 @@
 #include "CuTest.h"
 #include "sonLib.h"
 #include "cactusReference.h"
+#include "addReferenceCoordinates.h"
+#include "stCaf.h"
+#include "stPinchGraphs.h"
 
 static void constructEventTree_R(stTree *cur, EventTree *eventTree) {
     for (int64_t i = 0; i < stTree_getChildNumber(cur); i++) {
@@ -84,8 +87,137 @@ static void testEventWeighting(CuTest *testCase) {
     stSet_destruct(chosenEvents);
 }
 
+// Adds a thread with random nucleotides to the flower, and return its corresponding name in the pinch graph.
+static Name addThreadToFlower(Flower *flower, Event *event, int64_t length) {
+    char *dna = stRandom_getRandomDNAString(length, true, true, true);
+    MetaSequence *metaSequence = metaSequence_construct(2, length, dna, "", event_getName(event), flower_getCactusDisk(flower));
+    Sequence *sequence = sequence_construct(metaSequence, flower);
+
+    End *end1 = end_construct2(0, 0, flower);
+    End *end2 = end_construct2(1, 0, flower);
+    Cap *cap1 = cap_construct2(end1, 1, 1, sequence);
+    Cap *cap2 = cap_construct2(end2, length + 2, 1, sequence);
+    cap_makeAdjacent(cap1, cap2);
+
+    free(dna);
+    return cap_getName(cap1);
+}
+
+static int64_t buildReferencesRecursively(Flower *flower, stCaf_Scheduler *scheduler,
+        ReferenceZScoreTables *zScoreTables) {
+    /*
+     * Builds the references of the nested flowers of the flower, and of theirs, returning the number of them.
+     */
+    int64_t nestedFlowerNumber = 0;
+    buildReferencesOfNestedFlowers(flower, scheduler, NULL, "reference", 10, chooseMatching_greedy, constantTemperatureFn,
+            zScoreTables, 1.0, 10000, 0, 0.95, 10, 1, 0, -1.0, -1.0);
+    Flower_GroupIterator *groupIt = flower_getGroupIterator(flower);
+    Group *group;
+    while ((group = flower_getNextGroup(groupIt)) != NULL) {
+        if (group_getNestedFlower(group) != NULL) {
+            nestedFlowerNumber += 1 + buildReferencesRecursively(group_getNestedFlower(group), scheduler, zScoreTables);
+        }
+    }
+    flower_destructGroupIterator(groupIt);
+    return nestedFlowerNumber;
+}
+
+static void getReferenceAdjacencies(Flower *flower, Name referenceEventName, stList *adjacencies) {
+    /*
+     * Describes the reference adjacencies of the flower and its nested flowers by the names of the ends they join.
+     */
+    Flower_EndIterator *endIt = flower_getEndIterator(flower);
+    End *end;
+    while ((end = flower_getNextEnd(endIt)) != NULL) {
+        Cap *cap = getCapForReferenceEvent(end, referenceEventName);
+        if (cap != NULL && cap_getAdjacency(cap) != NULL) {
+            stList_append(adjacencies, stString_print("%" PRIi64 " %" PRIi64 " %" PRIi64 " %i", flower_getName(flower),
+                    end_getName(end), end_getName(cap_getEnd(cap_getAdjacency(cap))), cap_getSide(cap)));
+        }
+    }
+    flower_destructEndIterator(endIt);
+    Flower_GroupIterator *groupIt = flower_getGroupIterator(flower);
+    Group *group;
+    while ((group = flower_getNextGroup(groupIt)) != NULL) {
+        if (group_getNestedFlower(group) != NULL) {
+            getReferenceAdjacencies(group_getNestedFlower(group), referenceEventName, adjacencies);
+        }
+    }
+    flower_destructGroupIterator(groupIt);
+}
+
+static char *buildRandomReference(CuTest *testCase, int64_t seed, int64_t threads, int64_t *nestedFlowerNumber) {
+    /*
+     * Makes a cactus from random alignments between random threads, with the given seed, then builds its
+     * reference with the given number of threads, returning a description of the reference adjacencies.
+     */
+    CactusDisk *cactusDisk = testCommon_getTemporaryCactusDisk(testCase->name);
+    st_randomSeed(seed);
+    EventTree *eventTree = eventTree_construct2(cactusDisk);
+    Flower *flower = flower_construct(cactusDisk);
+    // A group must be constructed because stCaf_setup expects a leaf group.
+    group_construct2(flower);
+    Event *referenceEvent = event_construct3("reference", 0.1, eventTree_getRootEvent(eventTree), eventTree);
+    int64_t threadNumber = 6, threadLength = 1000;
+    Name *threadNames = st_malloc(sizeof(Name) * threadNumber);
+    for (int64_t i = 0; i < threadNumber; i++) {
+        char *header = stString_print("leaf%" PRIi64 "", i);
+        Event *event = event_construct3(header, 0.05 + 0.1 * st_random(), referenceEvent, eventTree);
+        free(header);
+        threadNames[i] = addThreadToFlower(flower, event, threadLength);
+    }
+    stPinchThreadSet *threadSet = stCaf_setup(flower);
+    for (int64_t i = 0; i < 200; i++) {
+        int64_t length = st_randomInt(1, 50);
+        stPinchThread *thread1 = stPinchThreadSet_getThread(threadSet, threadNames[st_randomInt(0, threadNumber)]);
+        stPinchThread *thread2 = stPinchThreadSet_getThread(threadSet, threadNames[st_randomInt(0, threadNumber)]);
+        stPinchThread_pinch(thread1, thread2, st_randomInt(2, threadLength - length + 2),
+                st_randomInt(2, threadLength - length + 2), length, st_random() > 0.5);
+    }
+    stCaf_finish(flower, threadSet, 1000000, 2, 1000000, 0.8);
+    stPinchThreadSet_destruct(threadSet);
+    free(threadNames);
+
+    stCaf_Scheduler *scheduler = threads > 1 ? referenceBuilder_constructScheduler(threads) : NULL;
+    ReferenceZScoreTables *zScoreTables = referenceZScoreTables_construct(0.001);
+    buildReferenceTopDown(flower, "reference", 10, chooseMatching_greedy, constantTemperatureFn, zScoreTables, 1.0,
+            10000, 0, 0.95, 10, 1, 0, -1.0, -1.0);
+    *nestedFlowerNumber = buildReferencesRecursively(flower, scheduler, zScoreTables);
+    if (scheduler != NULL) {
+        stCaf_Scheduler_destruct(scheduler);
+    }
+    referenceZScoreTables_destruct(zScoreTables);
+
+    stList *adjacencies = stList_construct3(0, free);
+    getReferenceAdjacencies(flower, event_getName(referenceEvent), adjacencies);
+    char *description = stString_join2("\n", adjacencies);
+    stList_destruct(adjacencies);
+    testCommon_deleteTemporaryCactusDisk(testCase->name, cactusDisk);
+    return description;
+}
+
+static void testBuildReferencesConcurrently(CuTest *testCase) {
+    /*
+     * Checks the references built with the z-scores of sibling flowers calculated concurrently are
+     * those built serially.
+     */
+    int64_t totalNestedFlowerNumber = 0;
+    for (int64_t test = 0; test < 10; test++) {
+        int64_t nestedFlowerNumber, nestedFlowerNumber2;
+        char *serialReference = buildRandomReference(testCase, test, 1, &nestedFlowerNumber);
+        char *concurrentReference = buildRandomReference(testCase, test, 4, &nestedFlowerNumber2);
+        CuAssertIntEquals(testCase, nestedFlowerNumber, nestedFlowerNumber2);
+        CuAssertStrEquals(testCase, serialReference, concurrentReference);
+        totalNestedFlowerNumber += nestedFlowerNumber;
+        free(serialReference);
+        free(concurrentReference);
+    }
+    CuAssertTrue(testCase, totalNestedFlowerNumber > 0); //Otherwise nothing was built concurrently.
+}
+
 CuSuite* buildReferenceTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, testEventWeighting);
+    SUITE_ADD_TEST(suite, testBuildReferencesConcurrently);
     return suite;
 }
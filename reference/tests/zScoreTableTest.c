@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <math.h>
+
+#include "CuTest.h"
+#include "sonLib.h"
+#include "stReferenceProblem2.h"
+#include "zScoreTable.h"
+
+static const double maxRelativeError = 0.000001;
+
+/*
+ * The z-score as a sum over every pair of positions in the two segments.
+ */
+static double calculateZScoreSlowly(int64_t length5Segment, int64_t length3Segment, int64_t gap, double theta) {
+    double score = 0.0;
+    for (int64_t i = 0; i < length5Segment; i++) {
+        for (int64_t j = 0; j < length3Segment; j++) {
+            score += pow(1.0 - theta, i + j + gap);
+        }
+    }
+    return score;
+}
+
+static void checkScore(CuTest *testCase, double expectedScore, double score) {
+    CuAssertDblEquals(testCase, expectedScore, score, maxRelativeError * (fabs(expectedScore) > 1e-10 ? fabs(expectedScore) : 1e-10));
+}
+
+static void testZScoreTable(CuTest *testCase) {
+    double thetas[] = { 0.0, 0.00001, 0.0001, 0.001, 0.01, 0.1, 0.5, 1.0 };
+    for (int64_t i = 0; i < sizeof(thetas) / sizeof(double); i++) {
+        double theta = thetas[i];
+        ZScoreTable *table = zScoreTable_construct(theta, maxRelativeError);
+        //The tables are only skipped when the scores are trivial.
+        CuAssertIntEquals(testCase, theta == 0.0 || theta == 1.0, zScoreTable_isExact(table));
+        CuAssertTrue(testCase, zScoreTable_getMaxRelativeError(table) <= maxRelativeError);
+        for (int64_t test = 0; test < 1000; test++) {
+            int64_t length5Segment = st_randomInt(1, 10), length3Segment = st_randomInt(1, 10), gap = st_randomInt(1, 100);
+            checkScore(testCase, calculateZScoreSlowly(length5Segment, length3Segment, gap, theta),
+                    zScoreTable_get(table, length5Segment, length3Segment, gap));
+            //Lengths and gaps either side of the boundaries of the tables.
+            length5Segment = st_randomInt(1, 100000000);
+            length3Segment = st_randomInt(1, 10000);
+            gap = st_random() > 0.5 ? st_randomInt(1, 10000) : st_randomInt(1, 100000000);
+            checkScore(testCase, calculateZScore(length5Segment, length3Segment, gap, theta),
+                    zScoreTable_get(table, length5Segment, length3Segment, gap));
+        }
+        zScoreTable_destruct(table);
+    }
+}
+
+static void testZScoreTableFallsBackToCalculateZScore(CuTest *testCase) {
+    //No table can meet a negative bound, so the scores are those of calculateZScore.
+    ZScoreTable *table = zScoreTable_construct(0.001, -1.0);
+    CuAssertTrue(testCase, zScoreTable_isExact(table));
+    for (int64_t test = 0; test < 1000; test++) {
+        int64_t length5Segment = st_randomInt(1, 100000), length3Segment = st_randomInt(1, 100000), gap = st_randomInt(1, 100000);
+        CuAssertTrue(testCase, calculateZScore(length5Segment, length3Segment, gap, 0.001)
+                == zScoreTable_get(table, length5Segment, length3Segment, gap));
+    }
+    zScoreTable_destruct(table);
+}
+
+CuSuite* zScoreTableTestSuite(void) {
+    CuSuite* suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testZScoreTable);
+    SUITE_ADD_TEST(suite, testZScoreTableFallsBackToCalculateZScore);
+    return suite;
+}
@@ -871,6 +871,9 @@ def runBarForJob(self, fileStore=None, features=None, calculateWhichEndsToComput
                  calculateWhichEndsToComputeSeparately=calculateWhichEndsToComputeSeparately,
                  endAlignmentsToPrecomputeOutputFile=endAlignmentsToPrecomputeOutputFile,
                  largeEndSize=self.getOptionalPhaseAttrib("largeEndSize", int),
+                 largeEndTime=self.getOptionalPhaseAttrib("largeEndTime", float),
+                 endAlignmentJobTime=self.getOptionalPhaseAttrib("endAlignmentJobTime", float),
+                 memoryBudget=self.getOptionalPhaseAttrib("endAlignmentMemoryBudget", int),
                  precomputedAlignments=precomputedAlignments,
                  ingroupCoverageFile=self.cactusWorkflowArguments.ingroupCoverageID if self.getOptionalPhaseAttrib("rescue", bool) else None,
                  minimumSizeToRescue=self.getOptionalPhaseAttrib("minimumSizeToRescue"),
@@ -900,9 +903,18 @@ class CactusBarWrapperLarge(CactusRecursionJob):
         endsToAlign = []
         endSizes = []
         precomputedAlignmentIDs = []
+        #If bar has grouped the ends into jobs by their estimated alignment times, use its groups
+        groupedEndsToAlign = {}
+        groupedEndSizes = {}
         for line in runBarForJob(self, features=self.featuresFn(),
                                  fileStore=fileStore, calculateWhichEndsToComputeSeparately=True):
-            endToAlign, sequencesInEndAlignment, basesInEndAlignment = line.split()
+            fields = line.split()
+            if len(fields) == 5:
+                endToAlign, sequencesInEndAlignment, basesInEndAlignment, timeOfEndAlignment, group = fields
+                groupedEndsToAlign.setdefault(int(group), []).append(endToAlign)
+                groupedEndSizes.setdefault(int(group), []).append(int(basesInEndAlignment))
+                continue
+            endToAlign, sequencesInEndAlignment, basesInEndAlignment = fields
             sequencesInEndAlignment = int(sequencesInEndAlignment)
             basesInEndAlignment = int(basesInEndAlignment)
 
@@ -936,6 +948,14 @@ class CactusBarWrapperLarge(CactusRecursionJob):
                 self.phaseNode, self.constantsNode, self.cactusDiskDatabaseString, self.flowerNames,
                 self.flowerSizes, False, endsToAlign, endSizes,
                 cactusWorkflowArguments=self.cactusWorkflowArguments)).rv())
+        for group in sorted(groupedEndsToAlign.keys()):
+            overlarge = max(groupedEndSizes[group]) >= veryLargeEndSize
+            precomputedAlignmentIDs.append(self.addChild(CactusBarEndAlignerWrapper(
+                self.phaseNode, self.constantsNode, self.cactusDiskDatabaseString, self.flowerNames,
+                self.flowerSizes, overlarge, groupedEndsToAlign[group], groupedEndSizes[group],
+                cactusWorkflowArguments=self.cactusWorkflowArguments)).rv())
+            logger.info("Precomputing %i end alignments with %i bases in job %i" % \
+                        (len(groupedEndsToAlign[group]), sum(groupedEndSizes[group]), group))
         self.precomputedAlignmentIDs = precomputedAlignmentIDs
         self.makeFollowOnRecursiveJobWithPromisedRequirements(CactusBarWrapperWithPrecomputedEndAlignments)
         logger.info("Breaking bar job into %i separate jobs" % \
@@ -1128,7 +1148,10 @@ class CactusReferenceWrapper(CactusRecursionJob):
                        wiggle=self.getOptionalPhaseAttrib("wiggle", float),
                        numberOfNs=self.getOptionalPhaseAttrib("numberOfNs", int),
                        minNumberOfSequencesToSupportAdjacency=self.getOptionalPhaseAttrib("minNumberOfSequencesToSupportAdjacency", int),
-                       makeScaffolds=self.getOptionalPhaseAttrib("makeScaffolds", bool))
+                       makeScaffolds=self.getOptionalPhaseAttrib("makeScaffolds", bool),
+                       threads=self.getOptionalPhaseAttrib("threads", int),
+                       maxOptimisationTime=self.getOptionalPhaseAttrib("maxOptimisationTime", float),
+                       minRoundImprovement=self.getOptionalPhaseAttrib("minRoundImprovement", float))
 
 class CactusReferenceRecursion2(CactusRecursionJob):
     memoryPoly = [2e+09]
@@ -467,6 +467,9 @@ def runCactusBar(cactusDiskDatabaseString, flowerNames, logLevel=None,
                  useProgressiveMerging=False,
                  calculateWhichEndsToComputeSeparately=False,
                  largeEndSize=None,
+                 largeEndTime=None,
+                 endAlignmentJobTime=None,
+                 memoryBudget=None,
                  endAlignmentsToPrecomputeOutputFile=None,
                  precomputedAlignments=None,
                  ingroupCoverageFile=None,
@@ -513,6 +516,12 @@ def runCactusBar(cactusDiskDatabaseString, flowerNames, logLevel=None,
         args += ["--calculateWhichEndsToComputeSeparately"]
     if largeEndSize is not None:
         args += ["--largeEndSize", str(largeEndSize)]
+    if largeEndTime is not None:
+        args += ["--largeEndTime", str(largeEndTime)]
+    if endAlignmentJobTime is not None:
+        args += ["--endAlignmentJobTime", str(endAlignmentJobTime)]
+    if memoryBudget is not None:
+        args += ["--memoryBudget", str(memoryBudget)]
     if endAlignmentsToPrecomputeOutputFile is not None:
         endAlignmentsToPrecomputeOutputFile = os.path.basename(endAlignmentsToPrecomputeOutputFile)
         args += ["--endAlignmentsToPrecomputeOutputFile", endAlignmentsToPrecomputeOutputFile]
@@ -553,7 +562,10 @@ def runCactusReference(cactusDiskDatabaseString, flowerNames, logLevel=None,
                        wiggle=None,
                        numberOfNs=None,
                        minNumberOfSequencesToSupportAdjacency=None,
-                       makeScaffolds=False):
+                       makeScaffolds=False,
+                       threads=None,
+                       maxOptimisationTime=None,
+                       minRoundImprovement=None):
     """Runs cactus reference."""
     logLevel = getLogLevelString2(logLevel)
     args = ["--logLevel", logLevel, "--cactusDisk", cactusDiskDatabaseString]
@@ -581,6 +593,12 @@ def runCactusReference(cactusDiskDatabaseString, flowerNames, logLevel=None,
         args += ["--minNumberOfSequencesToSupportAdjacency", str(minNumberOfSequencesToSupportAdjacency)]
     if makeScaffolds:
         args += ["--makeScaffolds"]
+    if threads is not None:
+        args += ["--threads", str(threads)]
+    if maxOptimisationTime is not None:
+        args += ["--maxOptimisationTime", str(maxOptimisationTime)]
+    if minRoundImprovement is not None:
+        args += ["--minRoundImprovement", str(minRoundImprovement)]
 
     masterMessages = cactus_call(stdin_string=flowerNames, check_output=True,
                                  parameters=["cactus_reference"] + args,